@@ -19,11 +19,18 @@ limitations under the License.
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/un.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
 #include <cstring>
 
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
 namespace apib {
 
 static const int kNumericAddressLen = 64;
@@ -32,6 +39,34 @@ Address::Address() { address_.ss_family = AF_UNSPEC; }
 
 Address::Address(const struct sockaddr* addr, socklen_t len) {
   memcpy(&address_, addr, len);
+  if (addr->sa_family == AF_UNIX) {
+    unixLength_ = len;
+  }
+}
+
+StatusOr<Address> Address::unixSocket(absl::string_view path) {
+  struct sockaddr_un sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  // Abstract names have no terminating null, and file names do
+  const bool abstract = absl::StartsWith(path, "@");
+  if (path.empty() || (path.size() >= sizeof(sa.sun_path))) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Invalid Unix socket path: ", path));
+  }
+#ifndef __linux__
+  if (abstract) {
+    return Status(Status::INVALID_ARGUMENT,
+                  "Abstract Unix sockets are only supported on Linux");
+  }
+#endif
+  memcpy(sa.sun_path, path.data(), path.size());
+  if (abstract) {
+    sa.sun_path[0] = 0;
+  }
+  const socklen_t len =
+      offsetof(struct sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1);
+  return Address((struct sockaddr*)&sa, len);
 }
 
 Address::Address(const struct sockaddr* addr, socklen_t len, uint16_t port) {
@@ -52,6 +87,8 @@ socklen_t Address::length() const {
       return sizeof(struct sockaddr_in);
     case AF_INET6:
       return sizeof(struct sockaddr_in6);
+    case AF_UNIX:
+      return unixLength_;
     case AF_UNSPEC:
       return 0;
     default:
@@ -67,6 +104,7 @@ uint16_t Address::port() const {
     case AF_INET6:
       return ntohs(((struct sockaddr_in6*)&address_)->sin6_port);
       break;
+    case AF_UNIX:
     case AF_UNSPEC:
       return 0;
     default:
@@ -83,6 +121,9 @@ void Address::setPort(uint16_t port) {
     case AF_INET6:
       ((struct sockaddr_in6*)&address_)->sin6_port = htons(port);
       break;
+    case AF_UNIX:
+      // No ports here
+      break;
     default:
       assert(0);
       break;
@@ -90,13 +131,24 @@ void Address::setPort(uint16_t port) {
 }
 
 bool operator==(const Address& a1, const Address& a2) {
-  if (a1.address_.ss_family != a2.address_.ss_family) {
+  if ((a1.address_.ss_family != a2.address_.ss_family) ||
+      (a1.length() != a2.length())) {
     return false;
   }
   return !memcmp(&a1.address_, &a2.address_, a1.length());
 }
 
 std::string Address::str() const {
+  if (address_.ss_family == AF_UNIX) {
+    const struct sockaddr_un* sa = (const struct sockaddr_un*)&address_;
+    const size_t len =
+        unixLength_ - std::min<size_t>(unixLength_,
+                                       offsetof(struct sockaddr_un, sun_path));
+    if ((len > 0) && (sa->sun_path[0] == 0)) {
+      return absl::StrCat("@", absl::string_view(sa->sun_path + 1, len - 1));
+    }
+    return std::string(sa->sun_path, strnlen(sa->sun_path, len));
+  }
   char nameBuf[kNumericAddressLen];
   const int s =
       ::getnameinfo((const struct sockaddr*)&address_, length(), nameBuf,
@@ -149,4 +201,78 @@ Address Addresses::get(uint16_t port, int sequence) const {
   return ret;
 }
 
+static bool parsePort(absl::string_view s, uint16_t* port) {
+  int p;
+  if (!absl::SimpleAtoi(s, &p) || (p <= 0) || (p > 65535)) {
+    return false;
+  }
+  *port = p;
+  return true;
+}
+
+StatusOr<SourceAddress> SourceAddress::parse(absl::string_view s) {
+  absl::string_view host = s;
+  absl::string_view ports;
+
+  if (!s.empty() && (s[0] == '[')) {
+    const auto close = s.find(']');
+    if (close == absl::string_view::npos) {
+      return Status(Status::INVALID_ARGUMENT, s);
+    }
+    host = s.substr(1, close - 1);
+    const auto rest = s.substr(close + 1);
+    if (!rest.empty()) {
+      if ((rest[0] != ':') || (rest.size() == 1)) {
+        return Status(Status::INVALID_ARGUMENT, s);
+      }
+      ports = rest.substr(1);
+    }
+  } else if (s.find(':') == s.rfind(':')) {
+    // More than one colon is an IPv6 address with no port
+    const auto colon = s.find(':');
+    if (colon != absl::string_view::npos) {
+      host = s.substr(0, colon);
+      ports = s.substr(colon + 1);
+      if (ports.empty()) {
+        return Status(Status::INVALID_ARGUMENT, s);
+      }
+    }
+  }
+
+  SourceAddress ret;
+  if (!ports.empty()) {
+    const auto dash = ports.find('-');
+    if (dash == absl::string_view::npos) {
+      if (!parsePort(ports, &ret.firstPort_)) {
+        return Status(Status::INVALID_ARGUMENT, s);
+      }
+      ret.lastPort_ = ret.firstPort_;
+    } else if (!parsePort(ports.substr(0, dash), &ret.firstPort_) ||
+               !parsePort(ports.substr(dash + 1), &ret.lastPort_) ||
+               (ret.lastPort_ < ret.firstPort_)) {
+      return Status(Status::INVALID_ARGUMENT, s);
+    }
+  }
+
+  auto ls = Addresses::lookup(host);
+  if (!ls.ok()) {
+    return ls.status();
+  }
+  ret.address_ = ls.valueref()->get(0);
+  if (!ret.address_.valid()) {
+    return Status(Status::DNS_ERROR, host);
+  }
+  return ret;
+}
+
+Address SourceAddress::get(unsigned int sequence) const {
+  if (!hasPorts()) {
+    return address_;
+  }
+  const unsigned int rangeSize = lastPort_ - firstPort_ + 1;
+  Address ret = address_;
+  ret.setPort(firstPort_ + (sequence % rangeSize));
+  return ret;
+}
+
 }  // namespace apib
@@ -44,11 +44,16 @@ class Address {
   Address(const Address&) = default;
   Address& operator=(const Address&) = default;
 
+  // Create a Unix domain socket address for "path." On Linux, a path that
+  // starts with "@" is a name in the abstract namespace instead of a file.
+  static StatusOr<Address> unixSocket(absl::string_view path);
+
   // Return the length of the address and copy it to "addr"
   socklen_t get(struct sockaddr_storage* addr) const;
 
   bool valid() const { return (address_.ss_family != AF_UNSPEC); }
   int family() const { return address_.ss_family; }
+  bool isUnix() const { return (address_.ss_family == AF_UNIX); }
   socklen_t length() const;
   uint16_t port() const;
   void setPort(uint16_t port);
@@ -63,6 +68,8 @@ class Address {
 
  private:
   struct sockaddr_storage address_;
+  // Unix socket addresses don't all have the same length
+  socklen_t unixLength_ = 0;
 };
 
 class Addresses;
@@ -95,6 +102,34 @@ class Addresses {
   std::vector<Address> addresses_;
 };
 
+/*
+ * A local address that outgoing sockets are bound to before they connect,
+ * with an optional range of local ports. With no range, the kernel picks
+ * the port.
+ */
+class SourceAddress {
+ public:
+  SourceAddress() {}
+
+  // Parse "address", "address:port", or "address:first-last". IPv6
+  // addresses that include a port must be in square brackets.
+  static StatusOr<SourceAddress> parse(absl::string_view s);
+
+  const Address& address() const { return address_; }
+  bool hasPorts() const { return firstPort_ != 0; }
+  uint16_t firstPort() const { return firstPort_; }
+  uint16_t lastPort() const { return lastPort_; }
+
+  // Get the address stamped with a port from the range. "sequence" may
+  // be any number -- it wraps around the range.
+  Address get(unsigned int sequence) const;
+
+ private:
+  Address address_;
+  uint16_t firstPort_ = 0;
+  uint16_t lastPort_ = 0;
+};
+
 }  // namespace apib
 
 #endif
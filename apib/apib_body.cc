@@ -0,0 +1,212 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_body.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "apib/apib_rand.h"
+
+namespace apib {
+
+static const char kLastChunk[] = "0\r\n\r\n";
+// Keep generated units small enough that every connection can share one
+static const size_t kMaxChunkSize = 64 * 1024 * 1024;
+
+// Parse a byte count with an optional K, M, or G suffix. It must fit in
+// an int64_t, so that it's a valid Content-Length.
+static bool parseSize(absl::string_view s, uint64_t* size) {
+  uint64_t mult = 1;
+  if (!s.empty()) {
+    switch (absl::ascii_toupper(s.back())) {
+      case 'K':
+        mult = 1024;
+        break;
+      case 'M':
+        mult = 1024 * 1024;
+        break;
+      case 'G':
+        mult = 1024 * 1024 * 1024;
+        break;
+    }
+  }
+  if (mult > 1) {
+    s.remove_suffix(1);
+  }
+  uint64_t n;
+  if (!absl::SimpleAtoi(s, &n) ||
+      (n > static_cast<uint64_t>(INT64_MAX) / mult)) {
+    return false;
+  }
+  *size = n * mult;
+  return true;
+}
+
+// Fill "block" with "len" bytes of the kind of data in "data"
+static bool generate(absl::string_view data, size_t len, std::string* block) {
+  block->reserve(len);
+  if (data == "random") {
+    RandomGenerator rand;
+    while (block->size() < len) {
+      // Three good bytes out of each random number
+      uint32_t r = rand.bits();
+      for (int i = 0; (i < 3) && (block->size() < len); i++, r >>= 8) {
+        block->push_back(r & 0xff);
+      }
+    }
+  } else if (data == "zeros") {
+    block->assign(len, '\0');
+  } else if (absl::StartsWith(data, "text:") && (data.size() > 5)) {
+    const absl::string_view text = data.substr(5);
+    while (block->size() < len) {
+      block->append(text.data(), std::min(text.size(), len - block->size()));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void BodySource::frame(absl::string_view data, std::string* out) const {
+  if (chunked_) {
+    absl::StrAppend(out, absl::Hex(data.size()), "\r\n", data, "\r\n");
+  } else {
+    out->append(data.data(), data.size());
+  }
+}
+
+Status BodySource::Parse(absl::string_view spec, absl::string_view fileData,
+                         std::unique_ptr<BodySource>* source) {
+  std::unique_ptr<BodySource> b(new BodySource());
+  absl::string_view data;
+  bool haveSize = false;
+
+  const std::vector<absl::string_view> parts =
+      absl::StrSplit(spec, ',', absl::SkipEmpty());
+  for (auto it = parts.cbegin(); it != parts.cend(); it++) {
+    const std::pair<absl::string_view, absl::string_view> nv =
+        absl::StrSplit(*it, absl::MaxSplits('=', 1));
+    uint64_t n;
+    if ((nv.first == "chunked") && (it->find('=') == absl::string_view::npos)) {
+      b->chunked_ = true;
+    } else if (nv.first == "size") {
+      if (!parseSize(nv.second, &b->size_)) {
+        return Status(Status::INVALID_ARGUMENT,
+                      absl::StrCat("Invalid body size: ", nv.second));
+      }
+      haveSize = true;
+    } else if (nv.first == "chunk") {
+      if (!parseSize(nv.second, &n) || (n == 0) || (n > kMaxChunkSize)) {
+        return Status(Status::INVALID_ARGUMENT,
+                      absl::StrCat("Invalid chunk size: ", nv.second));
+      }
+      b->chunkSize_ = n;
+    } else if (nv.first == "delay") {
+      if (!absl::SimpleAtoi(nv.second, &b->delay_)) {
+        return Status(Status::INVALID_ARGUMENT,
+                      absl::StrCat("Invalid delay: ", nv.second));
+      }
+    } else if (nv.first == "data") {
+      data = nv.second;
+    } else {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid stream option: ", *it));
+    }
+  }
+
+  if (!fileData.empty()) {
+    if (haveSize || !data.empty()) {
+      return Status(Status::INVALID_ARGUMENT,
+                    "A body from a file can't have \"size\" or \"data\"");
+    }
+    b->size_ = fileData.size();
+  } else if (!haveSize) {
+    return Status(Status::INVALID_ARGUMENT, "The body needs a \"size\"");
+  }
+
+  const uint64_t fullUnits = b->size_ / b->chunkSize_;
+  const size_t lastLen = b->size_ % b->chunkSize_;
+  b->unitCount_ = fullUnits + (lastLen > 0 ? 1 : 0);
+  if (b->chunked_ && (lastLen == 0)) {
+    // The last chunk is followed by the empty one, so if there is no
+    // short last chunk, then the last unit is a whole one.
+    b->unitCount_ = std::max<uint64_t>(b->unitCount_, 1);
+  }
+
+  if (!fileData.empty()) {
+    for (uint64_t i = 0; i < (fullUnits + (lastLen > 0 ? 1 : 0)); i++) {
+      b->frame(fileData.substr(i * b->chunkSize_, b->chunkSize_), &b->whole_);
+    }
+    if (b->chunked_) {
+      b->whole_.append(kLastChunk);
+    }
+    // Every unit but the last is a whole chunk
+    b->unitLen_ = b->chunkSize_;
+    if (b->chunked_) {
+      b->unitLen_ += absl::StrCat(absl::Hex(b->chunkSize_)).size() + 4;
+    }
+    source->reset(b.release());
+    return Status::kOk;
+  }
+
+  std::string block;
+  if (!generate(data.empty() ? "random" : data,
+                std::min<uint64_t>(b->size_, b->chunkSize_), &block)) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Invalid body data: ", data));
+  }
+  if (fullUnits > 0) {
+    b->frame(block, &b->repeated_);
+  }
+  if (lastLen > 0) {
+    b->frame(absl::string_view(block).substr(0, lastLen), &b->last_);
+  } else {
+    b->last_ = b->repeated_;
+  }
+  if (b->chunked_) {
+    b->last_.append(kLastChunk);
+  }
+  source->reset(b.release());
+  return Status::kOk;
+}
+
+absl::string_view BodySource::unit(size_t i) const {
+  const bool last = ((i + 1) >= unitCount_);
+  if (!whole_.empty()) {
+    const absl::string_view w(whole_);
+    return last ? w.substr(i * unitLen_) : w.substr(i * unitLen_, unitLen_);
+  }
+  return last ? last_ : repeated_;
+}
+
+bool BodyStream::advance(size_t n) {
+  pos_ += n;
+  if (pos_ < source_->unit(unit_).size()) {
+    return false;
+  }
+  unit_++;
+  pos_ = 0;
+  return !done();
+}
+
+}  // namespace apib
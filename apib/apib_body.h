@@ -0,0 +1,106 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_BODY_H
+#define APIB_BODY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "apib/status.h"
+
+namespace apib {
+
+/*
+ * A request body that is sent a piece at a time rather than being built
+ * into each request, so that it may be much bigger than memory. The body
+ * is divided into units of "chunk" bytes. With chunked encoding, each unit
+ * is one HTTP chunk, and either way, the client may pause between units.
+ *
+ * Everything that is sent is built here ahead of time and shared by all the
+ * connections. For generated data, every unit but the last is the same,
+ * so only one of them is kept, already framed as a chunk if need be.
+ */
+class BodySource {
+ public:
+  static constexpr size_t kDefaultChunkSize = 65536;
+
+  // Create a body from a "--stream" argument, which is a list of
+  // comma-separated options:
+  //   size=SIZE                  Generate SIZE bytes, with a K, M, or G suffix
+  //   data=random|zeros|text:STRING   What to generate (default random)
+  //   chunked                    Use chunked transfer encoding
+  //   chunk=SIZE                 The size of each unit (default 64K)
+  //   delay=MS                   Wait this long between units
+  // If "fileData" is not empty, then it is the body, and "size" and "data"
+  // may not be used.
+  static Status Parse(absl::string_view spec, absl::string_view fileData,
+                      std::unique_ptr<BodySource>* source);
+
+  bool chunked() const { return chunked_; }
+  // The length of the body, not counting chunk framing
+  uint64_t size() const { return size_; }
+  // How long to wait between units, in milliseconds
+  unsigned int delay() const { return delay_; }
+  size_t unitCount() const { return unitCount_; }
+  // The bytes to send for unit "i," including any chunk framing, and the
+  // final empty chunk for the last unit.
+  absl::string_view unit(size_t i) const;
+
+ private:
+  void frame(absl::string_view data, std::string* out) const;
+
+  bool chunked_ = false;
+  uint64_t size_ = 0;
+  size_t chunkSize_ = kDefaultChunkSize;
+  unsigned int delay_ = 0;
+  size_t unitCount_ = 0;
+  // Either "whole_" holds every unit in order, each "unitLen_" long but the
+  // last, or every unit is "repeated_" but the last, which is "last_."
+  std::string whole_;
+  size_t unitLen_ = 0;
+  std::string repeated_;
+  std::string last_;
+};
+
+// Where one connection is in sending a BodySource.
+class BodyStream {
+ public:
+  void start(const BodySource* source) {
+    source_ = source;
+    unit_ = 0;
+    pos_ = 0;
+  }
+  bool done() const { return unit_ >= source_->unitCount(); }
+  // The next bytes to send. Does not change until "advance" is called.
+  absl::string_view peek() const {
+    return source_->unit(unit_).substr(pos_);
+  }
+  // Record that "n" bytes from "peek" were sent. Returns true if that
+  // finished a unit and there are more to send.
+  bool advance(size_t n);
+
+ private:
+  const BodySource* source_ = nullptr;
+  size_t unit_ = 0;
+  size_t pos_ = 0;
+};
+
+}  // namespace apib
+
+#endif  // APIB_BODY_H
@@ -0,0 +1,459 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_compare.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include "absl/strings/str_format.h"
+#include "apib/apib_histogram.h"
+#include "apib/apib_json.h"
+
+namespace apib {
+
+static const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+StatusOr<RunResults> RunResults::Parse(absl::string_view json) {
+  const auto parsed = JsonValue::Parse(json);
+  if (!parsed.ok()) {
+    return parsed.status();
+  }
+  const JsonValue& root = parsed.valueref();
+  const JsonValue* results = root.get("results");
+  const JsonValue* histogram = root.get("histogram");
+  if (results == nullptr || histogram == nullptr) {
+    return Status(Status::PARSE_ERROR,
+                  "Not a result file written by \"apib --json\"");
+  }
+
+  RunResults r;
+  r.name = root.getString("name", "");
+  r.throughput = results->getNumber("throughput", 0.0);
+  r.completedRequests = results->getNumber("completedRequests", 0.0);
+  r.unsuccessfulRequests = results->getNumber("unsuccessfulRequests", 0.0);
+  r.socketErrors = results->getNumber("socketErrors", 0.0);
+
+  const JsonValue* intervals = root.get("intervals");
+  if (intervals != nullptr) {
+    for (size_t i = 0; i < intervals->size(); i++) {
+      r.intervals.push_back(intervals->at(i).getNumber("throughput", 0.0));
+    }
+  }
+
+  r.buckets.resize(Histogram::kNumBuckets);
+  const JsonValue* buckets = histogram->get("buckets");
+  if (buckets != nullptr) {
+    for (size_t i = 0; i < buckets->size(); i++) {
+      const JsonValue& b = buckets->at(i);
+      const double min = b.getNumber("min", -1.0);
+      if (min < 0.0) {
+        return Status(Status::PARSE_ERROR, "Invalid histogram bucket");
+      }
+      r.buckets[Histogram::bucketFor(min)] += b.getNumber("count", 0.0);
+    }
+  }
+  return std::move(r);
+}
+
+StatusOr<RunResults> RunResults::Load(const std::string& fileName) {
+  std::ifstream in(fileName);
+  if (!in) {
+    return Status(Status::IO_ERROR, "Can't open \"" + fileName + '\"');
+  }
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  auto r = Parse(buf.str());
+  if (!r.ok()) {
+    return Status(r.status().code(), fileName + ": " + r.status().message());
+  }
+  r.valueptr()->fileName = fileName;
+  return r;
+}
+
+static double mean(const std::vector<double>& v) {
+  double sum = 0.0;
+  for (auto it = v.cbegin(); it != v.cend(); it++) {
+    sum += *it;
+  }
+  return sum / v.size();
+}
+
+static double variance(const std::vector<double>& v, double m) {
+  double sum = 0.0;
+  for (auto it = v.cbegin(); it != v.cend(); it++) {
+    sum += (*it - m) * (*it - m);
+  }
+  return sum / (v.size() - 1);
+}
+
+// Continued fraction for the incomplete beta function, using the
+// modified Lentz method.
+static double betaFraction(double x, double a, double b) {
+  const double tiny = 1e-300;
+  const double qab = a + b;
+  const double qap = a + 1.0;
+  const double qam = a - 1.0;
+  double c = 1.0;
+  double d = 1.0 - qab * x / qap;
+  if (fabs(d) < tiny) {
+    d = tiny;
+  }
+  d = 1.0 / d;
+  double h = d;
+  for (int m = 1; m <= 300; m++) {
+    const int m2 = 2 * m;
+    double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+    d = 1.0 + aa * d;
+    if (fabs(d) < tiny) {
+      d = tiny;
+    }
+    c = 1.0 + aa / c;
+    if (fabs(c) < tiny) {
+      c = tiny;
+    }
+    d = 1.0 / d;
+    h *= d * c;
+    aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+    d = 1.0 + aa * d;
+    if (fabs(d) < tiny) {
+      d = tiny;
+    }
+    c = 1.0 + aa / c;
+    if (fabs(c) < tiny) {
+      c = tiny;
+    }
+    d = 1.0 / d;
+    const double del = d * c;
+    h *= del;
+    if (fabs(del - 1.0) < 1e-12) {
+      break;
+    }
+  }
+  return h;
+}
+
+// The regularized incomplete beta function I_x(a, b)
+static double incompleteBeta(double x, double a, double b) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  if (x >= 1.0) {
+    return 1.0;
+  }
+  const double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+                           a * log(x) + b * log(1.0 - x));
+  if (x < (a + 1.0) / (a + b + 2.0)) {
+    return front * betaFraction(x, a, b) / a;
+  }
+  return 1.0 - front * betaFraction(1.0 - x, b, a) / b;
+}
+
+double WelchTTest(const std::vector<double>& a, const std::vector<double>& b) {
+  if (a.size() < 2 || b.size() < 2) {
+    return kNaN;
+  }
+  const double ma = mean(a);
+  const double mb = mean(b);
+  const double va = variance(a, ma) / a.size();
+  const double vb = variance(b, mb) / b.size();
+  if (va + vb == 0.0) {
+    return ma == mb ? 1.0 : 0.0;
+  }
+  const double t = (ma - mb) / sqrt(va + vb);
+  const double df = (va + vb) * (va + vb) /
+                    (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+  // The two-sided tail of Student's t distribution
+  return incompleteBeta(df / (df + t * t), df / 2.0, 0.5);
+}
+
+double MannWhitney(const std::vector<int64_t>& a, const std::vector<int64_t>& b,
+                   double* probability) {
+  assert(a.size() == b.size());
+  double na = 0.0;
+  double nb = 0.0;
+  // Pairs where the value from "b" is larger, with ties counting half
+  double u = 0.0;
+  double tieSum = 0.0;
+  for (size_t i = 0; i < a.size(); i++) {
+    u += b[i] * (na + a[i] / 2.0);
+    na += a[i];
+    nb += b[i];
+    const double t = a[i] + b[i];
+    tieSum += t * t * t - t;
+  }
+  if (na == 0.0 || nb == 0.0) {
+    *probability = kNaN;
+    return kNaN;
+  }
+  *probability = u / (na * nb);
+  const double n = na + nb;
+  const double var =
+      na * nb / 12.0 * ((n + 1.0) - tieSum / (n * (n - 1.0)));
+  if (var <= 0.0) {
+    return 1.0;
+  }
+  const double z = (u - na * nb / 2.0) / sqrt(var);
+  return erfc(fabs(z) / sqrt(2.0));
+}
+
+double HistogramPercentile(const std::vector<int64_t>& buckets,
+                           double percent) {
+  int64_t total = 0;
+  for (auto it = buckets.cbegin(); it != buckets.cend(); it++) {
+    total += *it;
+  }
+  if (total == 0) {
+    return kNaN;
+  }
+  const double target = total * percent / 100.0;
+  double below = 0.0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    if (below + buckets[i] >= target) {
+      const double frac = (target - below) / buckets[i];
+      const double lower = Histogram::bucketLowerBound(i);
+      const double upper = Histogram::bucketUpperBound(i) + 1.0;
+      return lower + frac * (upper - lower);
+    }
+    below += buckets[i];
+  }
+  return Histogram::bucketUpperBound(buckets.size() - 1);
+}
+
+static double histogramMean(const std::vector<int64_t>& buckets) {
+  double count = 0.0;
+  double sum = 0.0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    if (buckets[i] > 0) {
+      const double mid = (Histogram::bucketLowerBound(i) +
+                          Histogram::bucketUpperBound(i)) /
+                         2.0;
+      count += buckets[i];
+      sum += mid * buckets[i];
+    }
+  }
+  return count > 0.0 ? sum / count : kNaN;
+}
+
+// Negative means the mean of the histogram rather than a percentile
+static double latencyStat(const std::vector<int64_t>& buckets,
+                          double percent) {
+  return percent < 0.0 ? histogramMean(buckets)
+                       : HistogramPercentile(buckets, percent);
+}
+
+static double percentChange(double from, double to) {
+  if (from == 0.0) {
+    return kNaN;
+  }
+  return (to - from) / from * 100.0;
+}
+
+// Set the confidence interval from a set of bootstrap samples of the
+// percent change
+static void setInterval(std::vector<double>* samples, double alpha,
+                        MetricDelta* d) {
+  if (samples->size() < 2) {
+    d->changeLow = kNaN;
+    d->changeHigh = kNaN;
+    return;
+  }
+  std::sort(samples->begin(), samples->end());
+  const size_t last = samples->size() - 1;
+  d->changeLow = (*samples)[(size_t)(last * alpha / 2.0)];
+  d->changeHigh = (*samples)[(size_t)ceil(last * (1.0 - alpha / 2.0))];
+}
+
+// A "Poisson bootstrap": instead of drawing N samples with replacement,
+// draw each bucket's count from a Poisson distribution with the original
+// count as its mean. This approximates the usual bootstrap closely for
+// large N, and costs one draw per bucket rather than one per request.
+static void resample(const std::vector<int64_t>& in,
+                     std::vector<int64_t>* out, std::mt19937_64* rand) {
+  out->resize(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    if (in[i] == 0) {
+      (*out)[i] = 0;
+    } else {
+      std::poisson_distribution<int64_t> dist(in[i]);
+      (*out)[i] = dist(*rand);
+    }
+  }
+}
+
+static void resample(const std::vector<double>& in, std::vector<double>* out,
+                     std::mt19937_64* rand) {
+  std::uniform_int_distribution<size_t> dist(0, in.size() - 1);
+  out->resize(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    (*out)[i] = in[dist(*rand)];
+  }
+}
+
+static MetricDelta compareThroughput(const RunResults& base,
+                                     const RunResults& cand,
+                                     const CompareOptions& opts,
+                                     std::mt19937_64* rand) {
+  MetricDelta d;
+  d.name = "Throughput";
+  d.baseline = base.throughput;
+  d.candidate = cand.throughput;
+  d.change = percentChange(base.throughput, cand.throughput);
+  d.pValue = WelchTTest(base.intervals, cand.intervals);
+
+  std::vector<double> samples;
+  if (base.intervals.size() >= 2 && cand.intervals.size() >= 2) {
+    std::vector<double> rb;
+    std::vector<double> rc;
+    for (int i = 0; i < opts.iterations; i++) {
+      resample(base.intervals, &rb, rand);
+      resample(cand.intervals, &rc, rand);
+      const double c = percentChange(mean(rb), mean(rc));
+      if (!std::isnan(c)) {
+        samples.push_back(c);
+      }
+    }
+  }
+  setInterval(&samples, opts.alpha, &d);
+
+  d.significant = d.pValue < opts.alpha;
+  // With too few intervals to test, the threshold alone decides
+  d.regression = d.change < -opts.threshold &&
+                 (d.significant || std::isnan(d.pValue));
+  return d;
+}
+
+static MetricDelta compareLatency(const std::string& name, double percent,
+                                  const RunResults& base,
+                                  const RunResults& cand,
+                                  const CompareOptions& opts,
+                                  std::mt19937_64* rand) {
+  MetricDelta d;
+  d.name = name;
+  d.baseline = latencyStat(base.buckets, percent) / 1000000.0;
+  d.candidate = latencyStat(cand.buckets, percent) / 1000000.0;
+  d.change = percentChange(d.baseline, d.candidate);
+
+  std::vector<double> samples;
+  if (!std::isnan(d.change)) {
+    std::vector<int64_t> rb;
+    std::vector<int64_t> rc;
+    for (int i = 0; i < opts.iterations; i++) {
+      resample(base.buckets, &rb, rand);
+      resample(cand.buckets, &rc, rand);
+      const double c =
+          percentChange(latencyStat(rb, percent), latencyStat(rc, percent));
+      if (!std::isnan(c)) {
+        samples.push_back(c);
+      }
+    }
+  }
+  setInterval(&samples, opts.alpha, &d);
+
+  d.significant = d.changeLow > 0.0 || d.changeHigh < 0.0;
+  d.regression = d.significant && d.change > opts.threshold;
+  return d;
+}
+
+Comparison CompareRuns(const RunResults& baseline,
+                       const RunResults& candidate,
+                       const CompareOptions& opts) {
+  std::mt19937_64 rand(opts.seed);
+  Comparison c;
+  c.alpha = opts.alpha;
+  c.metrics.push_back(compareThroughput(baseline, candidate, opts, &rand));
+  c.metrics.push_back(compareLatency("Average latency", -1.0, baseline,
+                                     candidate, opts, &rand));
+  c.metrics.push_back(
+      compareLatency("50% latency", 50.0, baseline, candidate, opts, &rand));
+  c.metrics.push_back(
+      compareLatency("90% latency", 90.0, baseline, candidate, opts, &rand));
+  c.metrics.push_back(
+      compareLatency("99% latency", 99.0, baseline, candidate, opts, &rand));
+  c.metrics.push_back(compareLatency("99.9% latency", 99.9, baseline,
+                                     candidate, opts, &rand));
+  c.latencyPValue =
+      MannWhitney(baseline.buckets, candidate.buckets, &c.slowerProbability);
+  for (auto it = c.metrics.cbegin(); it != c.metrics.cend(); it++) {
+    if (it->regression) {
+      c.regression = true;
+    }
+  }
+  return c;
+}
+
+static std::string formatRun(const RunResults& r) {
+  if (r.name.empty()) {
+    return r.fileName;
+  }
+  return absl::StrFormat("%s (%s)", r.fileName, r.name);
+}
+
+static std::string formatChange(double c) {
+  if (std::isnan(c)) {
+    return "n/a";
+  }
+  return absl::StrFormat("%+.2f%%", c);
+}
+
+void PrintComparison(std::ostream& out, const RunResults& baseline,
+                     const RunResults& candidate, const Comparison& c) {
+  out << "Baseline:  " << formatRun(baseline) << std::endl;
+  out << "Candidate: " << formatRun(candidate) << std::endl;
+  out << std::endl;
+  const std::string confidence =
+      absl::StrFormat("%g%% interval", (1.0 - c.alpha) * 100.0);
+  out << absl::StrFormat("%-16s %12s %12s %9s  %-22s %-8s\n", "", "Baseline",
+                         "Candidate", "Change", confidence, "p-value");
+  for (auto it = c.metrics.cbegin(); it != c.metrics.cend(); it++) {
+    const std::string interval =
+        std::isnan(it->changeLow)
+            ? "n/a"
+            : absl::StrFormat("[%s, %s]", formatChange(it->changeLow),
+                              formatChange(it->changeHigh));
+    const std::string p =
+        std::isnan(it->pValue) ? "" : absl::StrFormat("%.4f", it->pValue);
+    const char* flag = "";
+    if (it->regression) {
+      flag = "REGRESSION";
+    } else if (it->significant) {
+      flag = "significant";
+    }
+    out << absl::StrFormat("%-16s %12.3f %12.3f %9s  %-22s %-8s %s\n",
+                           it->name, it->baseline, it->candidate,
+                           formatChange(it->change), interval, p, flag);
+  }
+  out << std::endl;
+  out << "Throughput is in requests per second, and latency in milliseconds."
+      << std::endl;
+  if (!std::isnan(c.slowerProbability)) {
+    out << absl::StrFormat(
+               "A candidate request is slower than a baseline request %.1f%% "
+               "of the time (Mann-Whitney p-value %.4f)",
+               c.slowerProbability * 100.0, c.latencyPValue)
+        << std::endl;
+  }
+}
+
+}  // namespace apib
@@ -0,0 +1,119 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_COMPARE_H
+#define APIB_COMPARE_H
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// The parts of a file written by "apib --json" that we need to compare
+// two runs.
+class RunResults {
+ public:
+  std::string fileName;
+  std::string name;
+  double throughput = 0.0;
+  int64_t completedRequests = 0;
+  int64_t unsuccessfulRequests = 0;
+  int64_t socketErrors = 0;
+  // Throughput of each reporting interval, in requests per second
+  std::vector<double> intervals;
+  // Latency histogram counts, indexed like apib::Histogram
+  std::vector<int64_t> buckets;
+
+  static StatusOr<RunResults> Parse(absl::string_view json);
+  static StatusOr<RunResults> Load(const std::string& fileName);
+};
+
+class CompareOptions {
+ public:
+  // Significance level for the tests and the confidence intervals
+  double alpha = 0.05;
+  // Changes smaller than this percentage are never regressions, even if
+  // they are statistically significant.
+  double threshold = 5.0;
+  // Number of bootstrap resamples
+  int iterations = 1000;
+  uint32_t seed = 1;
+};
+
+// The comparison of one metric, such as throughput or a latency
+// percentile
+class MetricDelta {
+ public:
+  std::string name;
+  double baseline = 0.0;
+  double candidate = 0.0;
+  // Percent change from the baseline to the candidate
+  double change = 0.0;
+  // Confidence interval of "change," or NaN if it could not be computed
+  double changeLow = std::numeric_limits<double>::quiet_NaN();
+  double changeHigh = std::numeric_limits<double>::quiet_NaN();
+  // For throughput, the p-value of Welch's t-test on the intervals.
+  // NaN otherwise.
+  double pValue = std::numeric_limits<double>::quiet_NaN();
+  bool significant = false;
+  bool regression = false;
+};
+
+class Comparison {
+ public:
+  std::vector<MetricDelta> metrics;
+  // Mann-Whitney U test on the latency histograms: the probability that
+  // a random candidate request is slower than a random baseline request,
+  // and the p-value of the difference from 0.5.
+  double slowerProbability = std::numeric_limits<double>::quiet_NaN();
+  double latencyPValue = std::numeric_limits<double>::quiet_NaN();
+  bool regression = false;
+  // The significance level that was used
+  double alpha = 0.0;
+};
+
+extern Comparison CompareRuns(const RunResults& baseline,
+                              const RunResults& candidate,
+                              const CompareOptions& opts);
+extern void PrintComparison(std::ostream& out, const RunResults& baseline,
+                            const RunResults& candidate,
+                            const Comparison& c);
+
+// Statistical building blocks, exposed for testing.
+
+// Two-sided p-value of Welch's t-test. Both sets need at least two
+// samples, otherwise the result is NaN.
+extern double WelchTTest(const std::vector<double>& a,
+                         const std::vector<double>& b);
+// Mann-Whitney U test on two histograms with the same buckets. Sets
+// "probability" to P(b > a) + P(b == a) / 2 and returns the two-sided
+// p-value using the normal approximation with a correction for ties.
+extern double MannWhitney(const std::vector<int64_t>& a,
+                          const std::vector<int64_t>& b, double* probability);
+// Estimate a percentile of a latency histogram, in nanoseconds,
+// assuming that values are spread evenly within each bucket.
+extern double HistogramPercentile(const std::vector<int64_t>& buckets,
+                                  double percent);
+
+}  // namespace apib
+
+#endif  // APIB_COMPARE_H
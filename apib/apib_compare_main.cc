@@ -0,0 +1,125 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <getopt.h>
+
+#include <cstdlib>
+#include <iostream>
+
+#include "apib/apib_compare.h"
+
+using apib::CompareOptions;
+using apib::Comparison;
+using apib::RunResults;
+
+static const char* const OPTIONS = "a:hi:s:t:";
+
+static const struct option Options[] = {
+    {"alpha", required_argument, NULL, 'a'},
+    {"help", no_argument, NULL, 'h'},
+    {"iterations", required_argument, NULL, 'i'},
+    {"seed", required_argument, NULL, 's'},
+    {"threshold", required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}};
+
+static const char* const USAGE_DOCS =
+    "-a --alpha          Significance level for the tests and confidence\n"
+    "                    intervals (default 0.05)\n"
+    "-h --help           Print this help\n"
+    "-i --iterations     Number of bootstrap resamples (default 1000)\n"
+    "-s --seed           Random seed for the bootstrap (default 1)\n"
+    "-t --threshold      Smallest change, in percent, that counts as a\n"
+    "                    regression (default 5)\n"
+    "\n"
+    "Each file must be written by \"apib --json\". Every candidate is\n"
+    "compared to the baseline. The exit code is 0 if there were no\n"
+    "regressions, 1 if there were, and 2 on errors.\n";
+
+static void printUsage(const char* name) {
+  std::cerr << "Usage: " << name
+            << " [options] <baseline> <candidate> [<candidate> ...]"
+            << std::endl;
+  std::cerr << USAGE_DOCS;
+}
+
+int main(int argc, char** argv) {
+  CompareOptions opts;
+  int arg;
+
+  do {
+    arg = getopt_long(argc, argv, OPTIONS, Options, NULL);
+    switch (arg) {
+      case 'a':
+        opts.alpha = atof(optarg);
+        break;
+      case 'h':
+        printUsage(argv[0]);
+        return 0;
+      case 'i':
+        opts.iterations = atoi(optarg);
+        break;
+      case 's':
+        opts.seed = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        opts.threshold = atof(optarg);
+        break;
+      case '?':
+        printUsage(argv[0]);
+        return 2;
+      case -1:
+        break;
+      default:
+        return 2;
+    }
+  } while (arg >= 0);
+
+  if ((argc - optind) < 2) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  if (opts.alpha <= 0.0 || opts.alpha >= 1.0 || opts.iterations < 0 ||
+      opts.threshold < 0.0) {
+    std::cerr << "Invalid option value" << std::endl;
+    return 2;
+  }
+
+  const auto baseline = RunResults::Load(argv[optind]);
+  if (!baseline.ok()) {
+    std::cerr << baseline << std::endl;
+    return 2;
+  }
+
+  bool regression = false;
+  for (int i = optind + 1; i < argc; i++) {
+    const auto candidate = RunResults::Load(argv[i]);
+    if (!candidate.ok()) {
+      std::cerr << candidate << std::endl;
+      return 2;
+    }
+    const Comparison c = apib::CompareRuns(baseline.valueref(),
+                                           candidate.valueref(), opts);
+    if (i > optind + 1) {
+      std::cout << std::endl;
+    }
+    apib::PrintComparison(std::cout, baseline.valueref(), candidate.valueref(),
+                          c);
+    if (c.regression) {
+      regression = true;
+    }
+  }
+  return regression ? 1 : 0;
+}
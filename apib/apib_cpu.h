@@ -18,6 +18,8 @@ limitations under the License.
 #define APIB_CPU_H
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
 namespace apib {
 
@@ -52,6 +54,18 @@ extern double cpu_GetInterval(CPUUsage* usage);
 /* Return the percent of free RAM, or a negative number if we don't know */
 extern double cpu_GetMemoryUsage();
 
+/* Return the CPUs that this process may run on, grouped by NUMA node.
+   If we can't tell which CPUs are on which nodes, return a single node. */
+extern std::vector<std::vector<int>> cpu_GetNodes();
+
+/* Return the CPUs that handle interrupts for the named network interface,
+   or an empty list if we can't tell. */
+extern std::vector<int> cpu_GetInterfaceCpus(const std::string& iface);
+
+/* Restrict the calling thread to run only on the given CPUs.
+   Returns 0 on success, or an errno value. */
+extern int cpu_SetAffinity(const std::vector<int>& cpus);
+
 }  // namespace apib
 
 #endif  // APIB_CPU_H
\ No newline at end of file
@@ -16,12 +16,15 @@ limitations under the License.
 
 /* clang-format off */
 /* Won't compile if sorted. */
+#include <sys/param.h>
 #include <sys/types.h>
+#include <sys/cpuset.h>
 #include <sys/sysctl.h>
 #include <sys/times.h>
 #include <unistd.h>
 /* clang-format on */
 
+#include <cerrno>
 #include <cstring>
 
 #include "apib/apib_cpu.h"
@@ -101,4 +104,34 @@ double cpu_GetInterval(CPUUsage* oldCpu) {
   return ((double)usageTicks / (double)allUsageTicks);
 }
 
+// We don't look at NUMA domains on BSD, so all CPUs are in one node.
+std::vector<std::vector<int>> cpu_GetNodes() {
+  std::vector<int> cpus;
+  for (int i = 0; i < cpu_Count(); i++) {
+    cpus.push_back(i);
+  }
+  return std::vector<std::vector<int>>(1, cpus);
+}
+
+std::vector<int> cpu_GetInterfaceCpus(const std::string& iface) {
+  return std::vector<int>();
+}
+
+int cpu_SetAffinity(const std::vector<int>& cpus) {
+  cpuset_t set;
+  CPU_ZERO(&set);
+  for (auto it = cpus.cbegin(); it != cpus.cend(); it++) {
+    if ((*it < 0) || (*it >= CPU_SETSIZE)) {
+      return EINVAL;
+    }
+    CPU_SET(*it, &set);
+  }
+  // -1 means the current thread
+  if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(set),
+                         &set) != 0) {
+    return errno;
+  }
+  return 0;
+}
+
 }  // namespace apib
@@ -16,6 +16,8 @@ limitations under the License.
 
 #include <unistd.h>
 
+#include <cerrno>
+
 #include "apib/apib_cpu.h"
 
 namespace apib {
@@ -34,4 +36,18 @@ double cpu_GetInterval(CPUUsage* usage) { return 0.0; }
 
 double cpu_GetMemoryUsage() { return 0.0; }
 
+std::vector<std::vector<int>> cpu_GetNodes() {
+  std::vector<int> cpus;
+  for (int i = 0; i < cpu_Count(); i++) {
+    cpus.push_back(i);
+  }
+  return std::vector<std::vector<int>>(1, cpus);
+}
+
+std::vector<int> cpu_GetInterfaceCpus(const std::string& iface) {
+  return std::vector<int>();
+}
+
+int cpu_SetAffinity(const std::vector<int>& cpus) { return ENOTSUP; }
+
 }  // namespace apib
\ No newline at end of file
@@ -14,18 +14,28 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "apib/apib_cpu.h"
 #include "apib/apib_lines.h"
 #include "apib/apib_time.h"
+#include "apib/apib_util.h"
 
 #define PROC_BUF_LEN 8192
 
@@ -224,4 +234,145 @@ double cpu_GetInterval(CPUUsage* oldCpu) {
   return ((double)usageTicks / (double)allUsageTicks);
 }
 
-}  // namespace apib
\ No newline at end of file
+// Read the first line of a small file, such as one from sysfs.
+static bool readFirstLine(const std::string& path, std::string* line) {
+  std::ifstream in(path);
+  if (in.fail()) {
+    return false;
+  }
+  std::getline(in, *line);
+  return !in.fail();
+}
+
+static bool readCpuList(const std::string& path, std::vector<int>* cpus) {
+  std::string line;
+  return readFirstLine(path, &line) && parseCpuList(line, cpus);
+}
+
+static std::vector<int> getAllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    for (int i = 0; i < cpu_Count(); i++) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> cpu_GetNodes() {
+  const std::vector<int> allowed = getAllowedCpus();
+  std::vector<std::vector<int>> nodes;
+
+  std::vector<int> nodeIds;
+  if (readCpuList("/sys/devices/system/node/online", &nodeIds)) {
+    for (auto it = nodeIds.cbegin(); it != nodeIds.cend(); it++) {
+      std::vector<int> nodeCpus;
+      if (!readCpuList(
+              absl::StrCat("/sys/devices/system/node/node", *it, "/cpulist"),
+              &nodeCpus)) {
+        continue;
+      }
+      // Leave out CPUs that we aren't allowed to use, as with "taskset"
+      std::vector<int> usable;
+      std::set_intersection(nodeCpus.cbegin(), nodeCpus.cend(),
+                            allowed.cbegin(), allowed.cend(),
+                            std::back_inserter(usable));
+      if (!usable.empty()) {
+        nodes.push_back(usable);
+      }
+    }
+  }
+
+  if (nodes.empty()) {
+    nodes.push_back(allowed);
+  }
+  return nodes;
+}
+
+// Find the IRQs for a network interface. PCI devices list them in sysfs.
+// Otherwise, look for the interface name in /proc/interrupts, which works
+// for some virtual devices.
+static std::vector<int> getInterfaceIrqs(const std::string& iface) {
+  std::vector<int> irqs;
+
+  const std::string irqDir =
+      absl::StrCat("/sys/class/net/", iface, "/device/msi_irqs");
+  DIR* dir = opendir(irqDir.c_str());
+  if (dir != nullptr) {
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+      int irq;
+      if (absl::SimpleAtoi(ent->d_name, &irq)) {
+        irqs.push_back(irq);
+      }
+    }
+    closedir(dir);
+  }
+  if (!irqs.empty()) {
+    return irqs;
+  }
+
+  std::ifstream in("/proc/interrupts");
+  std::string line;
+  while (std::getline(in, line)) {
+    const std::vector<absl::string_view> fields =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    if (fields.size() < 2) {
+      continue;
+    }
+    // The last field is the name, like "eth0" or "eth0-TxRx-3"
+    const absl::string_view name = fields.back();
+    if ((name != iface) && !absl::StartsWith(name, iface + "-")) {
+      continue;
+    }
+    const absl::string_view num = fields[0].substr(0, fields[0].find(':'));
+    int irq;
+    if (absl::SimpleAtoi(num, &irq)) {
+      irqs.push_back(irq);
+    }
+  }
+  return irqs;
+}
+
+std::vector<int> cpu_GetInterfaceCpus(const std::string& iface) {
+  std::vector<int> result;
+  const std::vector<int> irqs = getInterfaceIrqs(iface);
+  for (auto it = irqs.cbegin(); it != irqs.cend(); it++) {
+    std::vector<int> cpus;
+    // The "effective" list is where the interrupt actually goes, but not
+    // every kernel has it.
+    if (readCpuList(
+            absl::StrCat("/proc/irq/", *it, "/effective_affinity_list"),
+            &cpus) ||
+        readCpuList(absl::StrCat("/proc/irq/", *it, "/smp_affinity_list"),
+                    &cpus)) {
+      result.insert(result.end(), cpus.cbegin(), cpus.cend());
+    }
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+int cpu_SetAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto it = cpus.cbegin(); it != cpus.cend(); it++) {
+    if ((*it < 0) || (*it >= CPU_SETSIZE)) {
+      return EINVAL;
+    }
+    CPU_SET(*it, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+}  // namespace apib
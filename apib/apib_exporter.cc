@@ -0,0 +1,396 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_exporter.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "apib/apib_reporting.h"
+
+using absl::StrAppend;
+using absl::StrAppendFormat;
+
+namespace apib {
+
+#define LISTEN_BACKLOG 32
+#define READ_BUF_LEN 512
+// Requests with more headers than this are rejected
+#define MAX_REQUEST_LEN 8192
+// Attempts to get a consistent copy of the page before giving up
+#define MAX_READ_TRIES 1000
+
+static const char* const kContentType =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// The histogram buckets that we expose. The page has hundreds, which is
+// too many to scrape, so we expose one per power of two, which lines up
+// exactly with the buckets of the page. This range is about a
+// microsecond to 34 seconds.
+static const int kFirstBucketPower = 10;
+static const int kLastBucketPower = 35;
+
+// One scrape request. It lives until the response is written.
+class MetricsConnection {
+ public:
+  MetricsConnection(MetricsServer* server, struct ev_loop* loop, int fd)
+      : server_(server), loop_(loop), fd_(fd) {}
+  ~MetricsConnection();
+  void start();
+  void readReady();
+  void writeReady();
+
+ private:
+  void respond(absl::string_view status, absl::string_view contentType,
+               absl::string_view body);
+  void finish();
+
+  MetricsServer* server_;
+  struct ev_loop* loop_;
+  int fd_;
+  ev_io io_;
+  std::string request_;
+  std::string response_;
+  size_t written_ = 0;
+};
+
+static void handleConnectionIo(struct ev_loop* loop, ev_io* io, int revents) {
+  auto c = reinterpret_cast<MetricsConnection*>(io->data);
+  if (revents & EV_READ) {
+    c->readReady();
+  } else if (revents & EV_WRITE) {
+    c->writeReady();
+  }
+}
+
+void MetricsConnection::start() {
+  ev_io_init(&io_, handleConnectionIo, fd_, EV_READ);
+  io_.data = this;
+  ev_io_start(loop_, &io_);
+}
+
+void MetricsConnection::readReady() {
+  char buf[READ_BUF_LEN];
+  const ssize_t rc = read(fd_, buf, READ_BUF_LEN);
+  if (rc < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+      return;
+    }
+    finish();
+    return;
+  }
+  if (rc == 0) {
+    finish();
+    return;
+  }
+  request_.append(buf, rc);
+  if (request_.find("\r\n\r\n") == std::string::npos) {
+    if (request_.size() > MAX_REQUEST_LEN) {
+      finish();
+    }
+    return;
+  }
+
+  // We only need the request line
+  absl::string_view line(request_);
+  line = line.substr(0, line.find("\r\n"));
+  const auto methodEnd = line.find(' ');
+  const absl::string_view method = line.substr(0, methodEnd);
+  absl::string_view path;
+  if (methodEnd != absl::string_view::npos) {
+    path = line.substr(methodEnd + 1);
+    path = path.substr(0, path.find(' '));
+    path = path.substr(0, path.find('?'));
+  }
+
+  if ((method != "GET") && (method != "HEAD")) {
+    respond("405 Method Not Allowed", "text/plain", "Method not allowed\n");
+  } else if ((path == "/metrics") || (path == "/")) {
+    const std::string body = server_->scrape();
+    respond("200 OK", kContentType, method == "HEAD" ? "" : body);
+  } else {
+    respond("404 Not Found", "text/plain", "Not found\n");
+  }
+}
+
+void MetricsConnection::respond(absl::string_view status,
+                                absl::string_view contentType,
+                                absl::string_view body) {
+  response_ = absl::StrCat("HTTP/1.1 ", status, "\r\nContent-Type: ",
+                           contentType, "\r\nContent-Length: ", body.size(),
+                           "\r\nConnection: close\r\n\r\n", body);
+  ev_io_stop(loop_, &io_);
+  ev_io_set(&io_, fd_, EV_WRITE);
+  ev_io_start(loop_, &io_);
+  writeReady();
+}
+
+void MetricsConnection::writeReady() {
+  while (written_ < response_.size()) {
+    const ssize_t rc = write(fd_, response_.data() + written_,
+                             response_.size() - written_);
+    if (rc < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        return;
+      }
+      break;
+    }
+    written_ += rc;
+  }
+  finish();
+}
+
+void MetricsConnection::finish() {
+  ev_io_stop(loop_, &io_);
+  server_->connectionDone(this);
+}
+
+MetricsConnection::~MetricsConnection() { close(fd_); }
+
+std::string MetricsServer::format(const MetricsPage& p, double cpu,
+                                  double mem) {
+  std::string out;
+
+  out.append("# TYPE apib_requests counter\n");
+  out.append("# HELP apib_requests HTTP requests completed.\n");
+  StrAppend(&out, "apib_requests_total{result=\"success\"} ",
+            p.successfulRequests, "\n");
+  StrAppend(&out, "apib_requests_total{result=\"failure\"} ",
+            p.unsuccessfulRequests, "\n");
+
+  out.append("# TYPE apib_socket_errors counter\n");
+  out.append("# HELP apib_socket_errors Connection and I/O errors.\n");
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    StrAppend(&out, "apib_socket_errors_total{class=\"",
+              ErrorTypeLabel((ErrorType)i),
+              "\"} ", p.errorCounts[i], "\n");
+  }
+
+  out.append("# TYPE apib_connections_opened counter\n");
+  out.append("# HELP apib_connections_opened Connections opened.\n");
+  StrAppend(&out, "apib_connections_opened_total ", p.connectionsOpened,
+            "\n");
+
+  out.append("# TYPE apib_sent_bytes counter\n");
+  out.append("# UNIT apib_sent_bytes bytes\n");
+  out.append("# HELP apib_sent_bytes Bytes sent.\n");
+  StrAppend(&out, "apib_sent_bytes_total ", p.bytesSent, "\n");
+  out.append("# TYPE apib_received_bytes counter\n");
+  out.append("# UNIT apib_received_bytes bytes\n");
+  out.append("# HELP apib_received_bytes Bytes received.\n");
+  StrAppend(&out, "apib_received_bytes_total ", p.bytesReceived, "\n");
+
+  out.append("# TYPE apib_request_duration_seconds histogram\n");
+  out.append("# UNIT apib_request_duration_seconds seconds\n");
+  out.append("# HELP apib_request_duration_seconds Request latency.\n");
+  int64_t cumulative = 0;
+  int bucket = 0;
+  for (int power = kFirstBucketPower; power <= kLastBucketPower; power++) {
+    const int64_t bound = (1LL << power) - 1;
+    const int last = Histogram::bucketFor(bound);
+    for (; bucket <= last; bucket++) {
+      cumulative += p.buckets[bucket];
+    }
+    StrAppendFormat(&out,
+                    "apib_request_duration_seconds_bucket{le=\"%.9g\"} %d\n",
+                    bound / 1000000000.0, cumulative);
+  }
+  StrAppend(&out, "apib_request_duration_seconds_bucket{le=\"+Inf\"} ",
+            p.latencyCount, "\n");
+  StrAppend(&out, "apib_request_duration_seconds_count ", p.latencyCount,
+            "\n");
+  StrAppendFormat(&out, "apib_request_duration_seconds_sum %.9f\n",
+                  p.latencySum / 1000000000.0);
+
+  out.append("# TYPE apib_throughput gauge\n");
+  out.append(
+      "# HELP apib_throughput Successful requests per second in the "
+      "latest interval.\n");
+  StrAppendFormat(&out, "apib_throughput %.3f\n", p.intervalThroughput);
+
+  if (cpu >= 0.0) {
+    out.append("# TYPE apib_client_cpu_ratio gauge\n");
+    out.append(
+        "# HELP apib_client_cpu_ratio CPU used on the client host since the "
+        "last scrape.\n");
+    StrAppendFormat(&out, "apib_client_cpu_ratio %.4f\n", cpu);
+  }
+  if (mem >= 0.0) {
+    out.append("# TYPE apib_client_memory_ratio gauge\n");
+    out.append(
+        "# HELP apib_client_memory_ratio Memory in use on the client "
+        "host.\n");
+    StrAppendFormat(&out, "apib_client_memory_ratio %.4f\n", mem);
+  }
+
+  out.append("# TYPE apib_running gauge\n");
+  out.append(
+      "# HELP apib_running Whether the test is running, after any "
+      "warm-up.\n");
+  StrAppend(&out, "apib_running ", p.state == METRICS_RUNNING ? 1 : 0, "\n");
+  out.append("# EOF\n");
+  return out;
+}
+
+std::string MetricsServer::scrape() {
+  MetricsPage copy;
+  bool ok = false;
+  for (int i = 0; !ok && (i < MAX_READ_TRIES); i++) {
+    ok = MetricsFile::read(page_, &copy);
+  }
+  if (!ok) {
+    // The page is being updated constantly, so just report nothing
+    return "# EOF\n";
+  }
+  const double cpu = (cpuAvailable_ ? cpu_GetInterval(&cpuUsage_) : -1.0);
+  return format(copy, cpu, cpu_GetMemoryUsage());
+}
+
+void MetricsServer::acceptLoop() { ev_run(loop_, 0); }
+
+void MetricsServer::acceptOne() {
+  const int fd = accept(listenfd_, nullptr, nullptr);
+  if (fd < 0) {
+    return;
+  }
+  const int err = fcntl(fd, F_SETFL, O_NONBLOCK);
+  if (err != 0) {
+    close(fd);
+    return;
+  }
+  MetricsConnection* c = new MetricsConnection(this, loop_, fd);
+  connections_.insert(c);
+  c->start();
+}
+
+void MetricsServer::connectionDone(MetricsConnection* c) {
+  connections_.erase(c);
+  delete c;
+}
+
+// Called by libev when there is something to accept()
+static void handleMetricsAccept(struct ev_loop* loop, ev_io* io,
+                                int revents) {
+  auto s = reinterpret_cast<MetricsServer*>(io->data);
+  s->acceptOne();
+}
+
+// Called by libev when it's time to stop
+static void handleMetricsShutdown(struct ev_loop* loop, ev_async* a,
+                                  int revents) {
+  ev_break(loop, EVBREAK_ALL);
+}
+
+Status MetricsServer::start(const std::string& address, int port,
+                            const MetricsPage* page, bool cpuAvailable) {
+  page_ = page;
+  cpuAvailable_ = cpuAvailable;
+  if (cpuAvailable_) {
+    cpu_GetUsage(&cpuUsage_);
+  }
+
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  memset(&addr, 0, sizeof(addr));
+  struct sockaddr_in* addr4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+  struct sockaddr_in6* addr6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+  if (inet_pton(AF_INET, address.c_str(), &addr4->sin_addr) == 1) {
+    addr4->sin_family = AF_INET;
+    addr4->sin_port = htons(port);
+    addrLen = sizeof(struct sockaddr_in);
+  } else if (inet_pton(AF_INET6, address.c_str(), &addr6->sin6_addr) == 1) {
+    addr6->sin6_family = AF_INET6;
+    addr6->sin6_port = htons(port);
+    addrLen = sizeof(struct sockaddr_in6);
+  } else {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Invalid listen address ", address));
+  }
+
+  listenfd_ = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (listenfd_ < 0) {
+    return Status(Status::SOCKET_ERROR, errno);
+  }
+  int one = 1;
+  setsockopt(listenfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  int err = fcntl(listenfd_, F_SETFL, O_NONBLOCK);
+  if (err == 0) {
+    err = bind(listenfd_, reinterpret_cast<struct sockaddr*>(&addr), addrLen);
+  }
+  if (err == 0) {
+    err = listen(listenfd_, LISTEN_BACKLOG);
+  }
+  if (err != 0) {
+    const Status s(Status::SOCKET_ERROR, errno);
+    close(listenfd_);
+    listenfd_ = -1;
+    return s;
+  }
+
+  loop_ = ev_loop_new(EVFLAG_AUTO);
+  ev_async_init(&shutdownev_, handleMetricsShutdown);
+  ev_async_start(loop_, &shutdownev_);
+  ev_io_init(&listenev_, handleMetricsAccept, listenfd_, EV_READ);
+  listenev_.data = this;
+  ev_io_start(loop_, &listenev_);
+
+  acceptThread_.reset(
+      new std::thread(std::bind(&MetricsServer::acceptLoop, this)));
+  return Status::kOk;
+}
+
+MetricsServer::~MetricsServer() {
+  if (loop_ != nullptr) {
+    ev_loop_destroy(loop_);
+  }
+}
+
+int MetricsServer::port() const {
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+
+  getsockname(listenfd_, (struct sockaddr*)&addr, &addrlen);
+  if (addr.ss_family == AF_INET6) {
+    return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+  }
+  return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
+void MetricsServer::stop() {
+  ev_async_send(loop_, &shutdownev_);
+  acceptThread_->join();
+  close(listenfd_);
+  // Scrapes that were still in progress
+  for (auto it = connections_.begin(); it != connections_.end(); it++) {
+    delete *it;
+  }
+  connections_.clear();
+}
+
+void MetricsServer::join() { acceptThread_->join(); }
+
+}  // namespace apib
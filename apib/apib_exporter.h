@@ -0,0 +1,77 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_EXPORTER_H
+#define APIB_EXPORTER_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "apib/apib_cpu.h"
+#include "apib/apib_metrics.h"
+#include "apib/status.h"
+#include "ev.h"
+
+namespace apib {
+
+class MetricsConnection;
+
+// An HTTP server that exposes the live results in the OpenMetrics text
+// format, so that Prometheus and similar systems can scrape them. It runs
+// its own event loop on its own thread, like MonServer, and only reads
+// the MetricsPage that the reporting code publishes, so a scrape never
+// touches the I/O threads.
+class MetricsServer {
+ public:
+  ~MetricsServer();
+  // Listen on "address" and "port," which may be zero to pick one.
+  // "cpuAvailable" is whether "cpu_Init" succeeded. The caller must call it
+  // before starting this or any other thread.
+  Status start(const std::string& address, int port, const MetricsPage* page,
+               bool cpuAvailable);
+  int port() const;
+  void stop();
+  void join();
+  // Called by the event loop
+  void acceptOne();
+  void connectionDone(MetricsConnection* c);
+  // Return the response to a scrape
+  std::string scrape();
+
+  // Render a snapshot of the results. "cpu" is the client CPU usage since
+  // the last scrape, as a ratio, or negative if unknown, and so is "mem."
+  static std::string format(const MetricsPage& p, double cpu, double mem);
+
+ private:
+  void acceptLoop();
+
+  const MetricsPage* page_ = nullptr;
+  CPUUsage cpuUsage_;
+  bool cpuAvailable_ = false;
+  int listenfd_ = -1;
+  std::unique_ptr<std::thread> acceptThread_;
+  struct ev_loop* loop_ = nullptr;
+  ev_io listenev_;
+  ev_async shutdownev_;
+  // Only touched by the event loop, or once it has stopped
+  std::set<MetricsConnection*> connections_;
+};
+
+}  // namespace apib
+
+#endif  // APIB_EXPORTER_H
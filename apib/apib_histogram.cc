@@ -0,0 +1,124 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_histogram.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace apib {
+
+// Values below kSubBuckets have a bucket to themselves, and each larger
+// power of two is split into kSubBuckets buckets.
+static const int kSubBucketBits = 4;
+static_assert((1 << kSubBucketBits) == Histogram::kSubBuckets,
+              "kSubBuckets must match kSubBucketBits");
+
+// "v" must not be zero
+static int highestBit(uint64_t v) { return 63 - __builtin_clzll(v); }
+
+const int Histogram::kSubBuckets;
+const int Histogram::kMaxExponent;
+const int Histogram::kNumBuckets;
+const int64_t Histogram::kMaxValue;
+
+Histogram::Histogram() { clear(); }
+
+void Histogram::clear() {
+  memset(counts_, 0, sizeof(counts_));
+  count_ = 0;
+  sum_ = 0;
+  min_ = 0;
+  max_ = 0;
+}
+
+int Histogram::bucketFor(int64_t value) {
+  if (value < kSubBuckets) {
+    return (value < 0 ? 0 : value);
+  }
+  if (value > kMaxValue) {
+    return kNumBuckets - 1;
+  }
+  const int exp = highestBit(value);
+  const int sub = (value >> (exp - kSubBucketBits)) & (kSubBuckets - 1);
+  return ((exp - kSubBucketBits + 1) * kSubBuckets) + sub;
+}
+
+int64_t Histogram::bucketLowerBound(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  const int exp = (bucket / kSubBuckets) + kSubBucketBits - 1;
+  const int64_t sub = bucket % kSubBuckets;
+  return (kSubBuckets + sub) << (exp - kSubBucketBits);
+}
+
+int64_t Histogram::bucketUpperBound(int bucket) {
+  return bucketLowerBound(bucket + 1) - 1;
+}
+
+void Histogram::record(int64_t value) {
+  if (value < 0) {
+    value = 0;
+  }
+  counts_[bucketFor(value)]++;
+  if ((count_ == 0) || (value < min_)) {
+    min_ = value;
+  }
+  if (value > max_) {
+    max_ = value;
+  }
+  count_++;
+  sum_ += value;
+}
+
+void Histogram::add(const Histogram& h) {
+  if (h.count_ == 0) {
+    return;
+  }
+  for (int i = 0; i < kNumBuckets; i++) {
+    counts_[i] += h.counts_[i];
+  }
+  if ((count_ == 0) || (h.min_ < min_)) {
+    min_ = h.min_;
+  }
+  if (h.max_ > max_) {
+    max_ = h.max_;
+  }
+  count_ += h.count_;
+  sum_ += h.sum_;
+}
+
+int64_t Histogram::percentile(double percent) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  int64_t target = (int64_t)ceil((count_ * percent) / 100.0);
+  if (target < 1) {
+    target = 1;
+  }
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    seen += counts_[i];
+    if (seen >= target) {
+      const int64_t upper = bucketUpperBound(i);
+      return (upper < max_ ? upper : max_);
+    }
+  }
+  return max_;
+}
+
+}  // namespace apib
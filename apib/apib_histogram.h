@@ -0,0 +1,71 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_HISTOGRAM_H
+#define APIB_HISTOGRAM_H
+
+#include <cstdint>
+
+namespace apib {
+
+// A fixed-size histogram of non-negative values, such as latencies in
+// nanoseconds. Each power of two is divided into kSubBuckets linear
+// buckets, so a value is always placed in a bucket whose width is at most
+// 1/kSubBuckets of its lower bound. Values above kMaxValue are counted in
+// the last bucket. Recording a value never allocates memory.
+class Histogram {
+ public:
+  static const int kSubBuckets = 16;
+  static const int kMaxExponent = 40;
+  static const int kNumBuckets = (kMaxExponent - 2) * kSubBuckets;
+  static const int64_t kMaxValue = (1LL << (kMaxExponent + 1)) - 1;
+
+  Histogram();
+
+  void record(int64_t value);
+  // Add all the counts from another histogram to this one
+  void add(const Histogram& h);
+  void clear();
+
+  int64_t count() const { return count_; }
+  // The total of all the values recorded
+  int64_t sum() const { return sum_; }
+  // The smallest and largest values recorded, exactly. Both are zero
+  // if nothing was recorded.
+  int64_t min() const { return min_; }
+  int64_t max() const { return max_; }
+  // The value below which "percent" percent of the recorded values
+  // fall. This is the upper bound of the bucket that contains it, but no
+  // larger than the largest value recorded.
+  int64_t percentile(double percent) const;
+  int64_t bucketCount(int bucket) const { return counts_[bucket]; }
+
+  static int bucketFor(int64_t value);
+  // The range of values, inclusive, that fall into a bucket
+  static int64_t bucketLowerBound(int bucket);
+  static int64_t bucketUpperBound(int bucket);
+
+ private:
+  int64_t counts_[kNumBuckets];
+  int64_t count_;
+  int64_t sum_;
+  int64_t min_;
+  int64_t max_;
+};
+
+}  // namespace apib
+
+#endif  // APIB_HISTOGRAM_H
@@ -0,0 +1,228 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_host.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+namespace apib {
+
+// Format a numeric address the same way that "Address::str" does, so that
+// weights can be matched to addresses by name.
+static bool normalizeAddress(absl::string_view s, std::string* out) {
+  const std::string str(s);
+  struct sockaddr_storage ss;
+  memset(&ss, 0, sizeof(ss));
+  struct sockaddr_in* sa4 = reinterpret_cast<struct sockaddr_in*>(&ss);
+  struct sockaddr_in6* sa6 = reinterpret_cast<struct sockaddr_in6*>(&ss);
+  if (inet_pton(AF_INET, str.c_str(), &sa4->sin_addr) == 1) {
+    sa4->sin_family = AF_INET;
+    *out = Address((struct sockaddr*)sa4, sizeof(*sa4)).str();
+    return true;
+  }
+  if (inet_pton(AF_INET6, str.c_str(), &sa6->sin6_addr) == 1) {
+    sa6->sin6_family = AF_INET6;
+    *out = Address((struct sockaddr*)sa6, sizeof(*sa6)).str();
+    return true;
+  }
+  return false;
+}
+
+Status Balance::Parse(absl::string_view spec, Balance* balance) {
+  balance->weights_.clear();
+  if (spec == "thread") {
+    balance->mode_ = BY_THREAD;
+    return Status::kOk;
+  }
+  if (spec == "round-robin") {
+    balance->mode_ = ROUND_ROBIN;
+    return Status::kOk;
+  }
+  if (spec == "least-conn") {
+    balance->mode_ = LEAST_CONNECTIONS;
+    return Status::kOk;
+  }
+  if ((spec != "weighted") && !absl::StartsWith(spec, "weighted:")) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Invalid balance mode: ", spec));
+  }
+
+  balance->mode_ = WEIGHTED;
+  spec.remove_prefix(std::min<size_t>(spec.size(), 9));
+  const std::vector<absl::string_view> parts =
+      absl::StrSplit(spec, ',', absl::SkipEmpty());
+  for (auto it = parts.cbegin(); it != parts.cend(); it++) {
+    // IPv6 addresses have colons but never equals signs
+    const size_t eq = it->rfind('=');
+    std::string addr;
+    unsigned int weight;
+    if ((eq == absl::string_view::npos) ||
+        !normalizeAddress(it->substr(0, eq), &addr) ||
+        !absl::SimpleAtoi(it->substr(eq + 1), &weight)) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid address weight: ", *it));
+    }
+    balance->weights_.push_back(std::make_pair(addr, weight));
+  }
+  return Status::kOk;
+}
+
+unsigned int Balance::weight(const Address& addr) const {
+  if (weights_.empty()) {
+    return 1;
+  }
+  const std::string name = addr.str();
+  for (auto it = weights_.cbegin(); it != weights_.cend(); it++) {
+    if (it->first == name) {
+      return it->second;
+    }
+  }
+  return 1;
+}
+
+Host::Host(absl::string_view name) : name_(name) {
+  sets_.push_back(std::unique_ptr<AddressSet>(new AddressSet()));
+  current_.store(sets_.back().get());
+}
+
+Host::Host(absl::string_view name, const Address& fixed)
+    : Host(name) {
+  update(std::vector<Address>(1, fixed), Balance());
+  fixed_ = true;
+}
+
+Status Host::lookup(const Balance& balance) {
+  if (fixed_) {
+    return Status::kOk;
+  }
+  auto ls = Addresses::lookup(name_);
+  if (!ls.ok()) {
+    return ls.status();
+  }
+  const Addresses& addrs = *(ls.valueref());
+  std::vector<Address> found;
+  for (int i = 0; i < addrs.size(); i++) {
+    found.push_back(addrs.get(0, i));
+  }
+  update(found, balance);
+  return Status::kOk;
+}
+
+void Host::update(const std::vector<Address>& found, const Balance& balance) {
+  std::vector<bool> present(all_.size());
+  for (auto it = found.cbegin(); it != found.cend(); it++) {
+    const Address& a = *it;
+    size_t j = 0;
+    while ((j < all_.size()) && !(all_[j]->address == a)) {
+      j++;
+    }
+    if (j == all_.size()) {
+      all_.push_back(std::unique_ptr<HostAddress>(new HostAddress(a)));
+      all_.back()->weight = balance.weight(a);
+      present.push_back(true);
+    } else {
+      present[j] = true;
+    }
+  }
+
+  // Keep the set in the order the addresses were first seen, rather than
+  // the order DNS returned them in, which may rotate on every lookup.
+  std::unique_ptr<AddressSet> set(new AddressSet());
+  for (size_t j = 0; j < all_.size(); j++) {
+    if (present[j]) {
+      set->push_back(all_[j].get());
+    }
+  }
+  if (*set == *(current_.load())) {
+    return;
+  }
+
+  for (size_t j = 0; j < all_.size(); j++) {
+    all_[j]->current = present[j];
+  }
+  current_.store(set.get());
+  sets_.push_back(std::move(set));
+}
+
+HostAddress* Host::pick(const Balance& balance, int sequence,
+                        RandomGenerator* rand) {
+  const AddressSet& set = *(current_.load());
+  const size_t n = set.size();
+  if (n == 0) {
+    return nullptr;
+  }
+  if (n == 1) {
+    return set[0];
+  }
+
+  switch (balance.mode()) {
+    case Balance::ROUND_ROBIN:
+      return set[next_++ % n];
+
+    case Balance::LEAST_CONNECTIONS: {
+      // Start at a different place for each thread so that ties spread out
+      HostAddress* best = nullptr;
+      for (size_t i = 0; i < n; i++) {
+        HostAddress* a = set[(sequence + i) % n];
+        if ((best == nullptr) || (a->active < best->active)) {
+          best = a;
+        }
+      }
+      return best;
+    }
+
+    case Balance::WEIGHTED: {
+      unsigned int total = 0;
+      for (auto it = set.cbegin(); it != set.cend(); it++) {
+        total += (*it)->weight;
+      }
+      if (total == 0) {
+        break;
+      }
+      unsigned int r = rand->get(0, total - 1);
+      for (auto it = set.cbegin(); it != set.cend(); it++) {
+        if (r < (*it)->weight) {
+          return *it;
+        }
+        r -= (*it)->weight;
+      }
+      break;
+    }
+
+    case Balance::BY_THREAD:
+      break;
+  }
+  return set[sequence % n];
+}
+
+const HostAddress* Host::get(int sequence) const {
+  const AddressSet& set = *(current_.load());
+  if (set.empty()) {
+    return nullptr;
+  }
+  return set[sequence % set.size()];
+}
+
+}  // namespace apib
@@ -0,0 +1,142 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_HOST_H
+#define APIB_HOST_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "apib/addresses.h"
+#include "apib/apib_rand.h"
+#include "apib/status.h"
+
+namespace apib {
+
+/*
+ * How a new connection chooses among the addresses of a host.
+ */
+class Balance {
+ public:
+  typedef enum {
+    // Each thread always uses the same address
+    BY_THREAD,
+    // Each new connection uses the next address
+    ROUND_ROBIN,
+    // Each new connection uses the address with the fewest active
+    // connections from this process
+    LEAST_CONNECTIONS,
+    // Each new connection picks an address at random, in proportion
+    // to its weight
+    WEIGHTED
+  } Mode;
+
+  // Parse a "--balance" argument: "thread," "round-robin," "least-conn," or
+  // "weighted:ADDRESS=WEIGHT,...". Addresses without a weight get 1.
+  static Status Parse(absl::string_view spec, Balance* balance);
+
+  Mode mode() const { return mode_; }
+  unsigned int weight(const Address& addr) const;
+
+ private:
+  Mode mode_ = BY_THREAD;
+  // Numeric addresses, formatted like "Address::str," and their weights
+  std::vector<std::pair<std::string, unsigned int>> weights_;
+};
+
+/*
+ * One address of a host, along with what's known about connections to it.
+ * An address is never forgotten once DNS returns it, so that connections
+ * may keep pointers to it, and so that its statistics last for the
+ * whole run.
+ */
+struct HostAddress {
+  explicit HostAddress(const Address& a) : address(a) {}
+  HostAddress(const HostAddress&) = delete;
+  HostAddress& operator=(const HostAddress&) = delete;
+
+  // With no port
+  const Address address;
+  unsigned int weight = 1;
+  // Whether the last lookup returned this address. Connections to
+  // addresses that are no longer current are closed once they are idle.
+  std::atomic<bool> current{true};
+  // Connections from this process that are sending requests to it now
+  std::atomic<int> active{0};
+  // Totals for the run
+  std::atomic<int64_t> connections{0};
+  std::atomic<int64_t> requests{0};
+};
+
+/*
+ * A host name and the set of addresses that DNS last returned for it.
+ * When a lookup returns a different set, the new set replaces the old
+ * one in a single atomic store, so that I/O threads can choose addresses
+ * without locking while the lookup runs on another thread. Old sets are
+ * kept until the host is destroyed, since a thread may still be reading
+ * one. Sets only change when DNS does, so there are few of them.
+ */
+class Host {
+ public:
+  explicit Host(absl::string_view name);
+  // A host with just this address, which is never looked up
+  Host(absl::string_view name, const Address& fixed);
+  Host(const Host&) = delete;
+  Host& operator=(const Host&) = delete;
+
+  const std::string& name() const { return name_; }
+
+  // Look up the name, and switch to the new set of addresses if it changed.
+  // If the lookup fails, keep using the last set. Only one thread may call
+  // this at a time. Does nothing for a host with a fixed address.
+  Status lookup(const Balance& balance);
+  // Switch to this set of addresses, with no ports, if it's different.
+  void update(const std::vector<Address>& found, const Balance& balance);
+
+  // Choose the address for a new connection from thread "sequence," or
+  // return null if there are no addresses.
+  HostAddress* pick(const Balance& balance, int sequence,
+                    RandomGenerator* rand);
+  // The current address at position "sequence" in the set, which wraps
+  // around, or null if there are none.
+  const HostAddress* get(int sequence) const;
+  size_t size() const { return current_.load()->size(); }
+
+  // Every address ever returned, in the order they were first seen. It's not
+  // safe to call this while a lookup may be running.
+  const std::vector<std::unique_ptr<HostAddress>>& all() const {
+    return all_;
+  }
+
+ private:
+  typedef std::vector<HostAddress*> AddressSet;
+
+  const std::string name_;
+  bool fixed_ = false;
+  std::vector<std::unique_ptr<HostAddress>> all_;
+  std::vector<std::unique_ptr<AddressSet>> sets_;
+  std::atomic<const AddressSet*> current_;
+  std::atomic<unsigned int> next_{0};
+};
+
+}  // namespace apib
+
+#endif  // APIB_HOST_H
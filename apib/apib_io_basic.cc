@@ -24,9 +24,11 @@ limitations under the License.
 #include <unistd.h>
 
 #include <cassert>
+#include <cerrno>
 #include <iostream>
 
 #include "apib/apib_iothread.h"
+#include "apib/apib_probes.h"
 
 #if EV_VERSION_MAJOR > 4 || EV_VERSION_MINOR > 32
 #define HAS_IO_MODIFY 1
@@ -34,36 +36,84 @@ limitations under the License.
 
 namespace apib {
 
-int ConnectionState::Connect() {
-  const Address addr = url_->address(t_->threadIndex());
-  if (!addr.valid()) {
+Status ConnectionState::Connect() {
+  HostAddress* target = url_->pickAddress(t_->threadIndex(), t_->rand());
+  if (target == nullptr) {
     io_Verbose(this, "No addresses to look up\n");
-    return -1;
+    return Status(Status::DNS_ERROR, "No addresses to look up");
   }
+  Address addr = target->address;
+  addr.setPort(url_->port());
 
   if (t_->verbose) {
     io_Verbose(this, "Connecting to %s. (TLS = %i)\n", addr.str().c_str(),
                url_->isSsl());
   }
 
+  Status s;
+  if ((t_->sourceAddresses == nullptr) || t_->sourceAddresses->empty()) {
+    s = connectFrom(addr, Address());
+  } else {
+    // Spread connections across the source addresses round-robin
+    const auto& sources = *(t_->sourceAddresses);
+    const SourceAddress& src = sources[(index_ + t_->index) % sources.size()];
+    if (!src.hasPorts()) {
+      s = connectFrom(addr, src.address());
+    } else {
+      // Walk through the port range, skipping ports that are still in use.
+      for (int i = 0; i < kMaxBindAttempts; i++) {
+        s = connectFrom(addr, src.get(sourcePort_++));
+        if (s.ok() ||
+            ((s.errnum() != EADDRINUSE) && (s.errnum() != EADDRNOTAVAIL))) {
+          break;
+        }
+      }
+    }
+  }
+
+  if (s.ok()) {
+    target->connections++;
+    setActive(target);
+    t_->trace(TRACE_CONNECT, index_);
+    if (APIB_PROBE_ENABLED(connect)) {
+      APIB_PROBE3(connect, t_->index, index_, url_->index());
+    }
+    inHandshake_ = url_->isSsl();
+  }
+  return s;
+}
+
+Status ConnectionState::connectFrom(const Address& addr,
+                                    const Address& source) {
   std::unique_ptr<Socket> newSock;
   Status connectStatus;
   if (url_->isSsl()) {
     TLSSocket* ts = new TLSSocket();
+    ts->setSource(source);
+    ts->setOptions(t_->socketOptions);
+    ts->setFastOpen(t_->fastOpen);
+    if ((tlsSession_ != nullptr) &&
+        URLInfo::IsSameServer(*tlsSessionUrl_, *url_)) {
+      ts->setSession(tlsSession_, t_->tlsEarlyData);
+    }
     connectStatus = ts->connectTLS(addr, url_->hostName(), t_->sslCtx);
     newSock.reset(ts);
   } else {
     newSock.reset(new Socket());
+    newSock->setSource(source);
+    newSock->setOptions(t_->socketOptions);
+    newSock->setFastOpen(t_->fastOpen);
     connectStatus = newSock->connect(addr);
   }
 
   if (!connectStatus.ok()) {
     io_Verbose(this, "Error on connect: %s\n", connectStatus.str().c_str());
-    return -1;
+    return connectStatus;
   }
 
   socket_.swap(newSock);
-  return 0;
+  responseReceived_ = false;
+  return Status::kOk;
 }
 
 void ConnectionState::completeShutdown(struct ev_loop* loop, ev_io* w,
@@ -122,6 +172,10 @@ void ConnectionState::completeShutdown(struct ev_loop* loop, ev_io* w,
 }
 
 void ConnectionState::Close() {
+  t_->trace(TRACE_CLOSE, index_);
+  if (APIB_PROBE_ENABLED(close)) {
+    APIB_PROBE3(close, t_->index, index_, url_->index());
+  }
   const auto cs = socket_->close();
   if (!cs.ok()) {
     io_Verbose(this, "Close finished with error: %s\n", cs.str().c_str());
@@ -155,6 +209,21 @@ void ConnectionState::Close() {
   }
 }
 
+// With TLS, the handshake finishes inside some read or write, so check
+// after each one until it's done. The first request on a connection starts
+// when the connection does.
+void ConnectionState::checkHandshake() {
+  const TLSSocket* ts = static_cast<const TLSSocket*>(socket_.get());
+  if (ts->handshakeDone()) {
+    inHandshake_ = false;
+    t_->trace(TRACE_HANDSHAKE, index_);
+    if (APIB_PROBE_ENABLED(handshake)) {
+      APIB_PROBE4(handshake, t_->index, index_, url_->index(),
+                  TicksToNanos(t_->requestTicks() - startTime_));
+    }
+  }
+}
+
 // Called by libev whenever the socket is ready for writing.
 // -1 means write is done.
 // 0 means write would block
@@ -162,28 +231,46 @@ void ConnectionState::Close() {
 int ConnectionState::singleWrite(struct ev_loop* loop, ev_io* w, int revents) {
   io_Verbose(this, "I/O ready on write path: %i\n", revents);
 
-  const size_t len = fullWrite_.size() - fullWritePos_;
-  assert(len > 0);
+  // Write the headers, and then any streamed body
+  const bool inHeaders = (fullWritePos_ < fullWrite_.size());
+  const absl::string_view out =
+      inHeaders ? absl::string_view(fullWrite_).substr(fullWritePos_)
+                : bodyStream_.peek();
+  assert(!out.empty());
   size_t wrote;
-  const auto writeStatus =
-      socket_->write(fullWrite_.data() + fullWritePos_, len, &wrote);
+  const auto writeStatus = socket_->write(out.data(), out.size(), &wrote);
 
   if (!writeStatus.ok()) {
     io_Verbose(this, "Error on write: %s\n", writeStatus.str().c_str());
     ev_io_stop(loop, &io_);
-    WriteDone(-1);
+    WriteDone(writeStatus.status());
     return -1;
   }
 
   switch (writeStatus.value()) {
     case OK:
       io_Verbose(this, "Successfully wrote %zu bytes\n", wrote);
-      fullWritePos_ += wrote;
       t_->recordWrite(wrote);
-      if (fullWritePos_ == fullWrite_.size()) {
+      requestWritten_ += wrote;
+      if (inHandshake_) {
+        checkHandshake();
+      }
+      if (inHeaders) {
+        fullWritePos_ += wrote;
+      } else if (bodyStream_.advance(wrote) && (t_->stream->delay() > 0)) {
+        // Pause between the units of the body
+        ev_io_stop(loop, &io_);
+        ev_timer_init(&pauseTimer_, pauseDone, t_->stream->delay() / 1000.0,
+                      0);
+        pauseTimer_.data = this;
+        ev_timer_start(loop, &pauseTimer_);
+        return 0;
+      }
+      if ((fullWritePos_ == fullWrite_.size()) &&
+          ((t_->stream == nullptr) || bodyStream_.done())) {
         // Whole message body has been written, so stop writing
         ev_io_stop(loop, &io_);
-        WriteDone(0);
+        WriteDone(Status::kOk);
         return 0;
       }
       return 1;
@@ -223,6 +310,13 @@ void ConnectionState::writeReady(struct ev_loop* loop, ev_io* w, int revents) {
     ;
 }
 
+void ConnectionState::pauseDone(struct ev_loop* loop, ev_timer* t,
+                                int revents) {
+  ConnectionState* c = (ConnectionState*)t->data;
+  io_Verbose(c, "Pause over\n");
+  c->SendWrite();
+}
+
 // Set up libev to asychronously write from writeBuf
 void ConnectionState::SendWrite() {
   ev_io_init(&io_, writeReady, socket_->fd(), EV_WRITE);
@@ -231,6 +325,29 @@ void ConnectionState::SendWrite() {
   ev_io_start(t_->loop(), &io_);
 }
 
+bool ConnectionState::parseResponse(size_t readCount) {
+  // Parse the data we just read plus whatever was left from before
+  const size_t parsedLen = readCount + readBufPos_;
+  const size_t parsed = http_parser_execute(&parser_, t_->parserSettings(),
+                                            readBuf_, parsedLen);
+  io_Verbose(this, "Parsed %zu\n", parsed);
+  if (parser_.http_errno != 0) {
+    return false;
+  }
+
+  if (parsed < parsedLen) {
+    // http_parser didn't have enough data, and only parsed part of it.
+    // Move the unparsed data down to the start of the buffer so that
+    // we can put new data after it
+    const size_t unparsedLen = parsedLen - parsed;
+    memmove(readBuf_, readBuf_ + parsed, unparsedLen);
+    readBufPos_ = unparsedLen;
+  } else {
+    readBufPos_ = 0;
+  }
+  return true;
+}
+
 int ConnectionState::singleRead(struct ev_loop* loop, ev_io* w, int revents) {
   io_Verbose(this, "I/O ready on read path: %i\n", revents);
   const size_t len = kReadBufSize - readBufPos_;
@@ -245,48 +362,43 @@ int ConnectionState::singleRead(struct ev_loop* loop, ev_io* w, int revents) {
     io_Verbose(this, "Error reading from socket: %s\n",
                readStatus.str().c_str());
     ev_io_stop(loop, &io_);
-    ReadDone(-3);
+    ReadDone(readStatus.status());
     return -1;
   }
 
   if (readStatus.value() == OK) {
     io_Verbose(this, "Successfully read %zu bytes\n", readCount);
     t_->recordRead(readCount);
-    // Parse the data we just read plus whatever was left from before
-    const size_t parsedLen = readCount + readBufPos_;
-
+    requestRead_ += readCount;
+    if (awaitingResponse_) {
+      awaitingResponse_ = false;
+      if (inHandshake_) {
+        checkHandshake();
+      }
+      t_->trace(TRACE_FIRST_BYTE, index_);
+      if (APIB_PROBE_ENABLED(first_byte)) {
+        APIB_PROBE4(first_byte, t_->index, index_, url_->index(),
+                    TicksToNanos(t_->requestTicks() - startTime_));
+      }
+    }
     if (t_->verbose) {
-      fwrite(readBuf_, parsedLen, 1, stdout);
+      fwrite(readBuf_, readCount + readBufPos_, 1, stdout);
     }
-
-    const size_t parsed = http_parser_execute(&parser_, t_->parserSettings(),
-                                              readBuf_, parsedLen);
-    io_Verbose(this, "Parsed %zu\n", parsed);
-    if (parser_.http_errno != 0) {
+    if (!parseResponse(readCount)) {
       // Invalid HTTP response. Complete with an error.
       io_Verbose(this, "Parsing error %i\n", parser_.http_errno);
       ev_io_stop(t_->loop(), &io_);
-      ReadDone(-1);
+      ReadDone(Status(Status::PARSE_ERROR,
+                      http_errno_description((http_errno)parser_.http_errno)));
       return -1;
     }
 
-    if (parsed < parsedLen) {
-      // http_parser didn't have enough data, and only parsed part of it.
-      // Move the unparsed data down to the start of the buffer so that
-      // we can put new data after it
-      const size_t unparsedLen = parsedLen - parsed;
-      memmove(readBuf_, readBuf_ + parsed, unparsedLen);
-      readBufPos_ = unparsedLen;
-    } else {
-      readBufPos_ = 0;
-    }
-
     // "readDone" set by an http_parser callback that's set up on
     // apib_iothread.c
     if (readDone_) {
       // Parser parsed all the content, so we're done for now.
       ev_io_stop(loop, &io_);
-      ReadDone(0);
+      ReadDone(Status::kOk);
       return 0;
     }
     return 1;
@@ -295,7 +407,12 @@ int ConnectionState::singleRead(struct ev_loop* loop, ev_io* w, int revents) {
   if (readStatus.value() == FEOF) {
     io_Verbose(this, "EOF. Done = %i\n", readDone_);
     ev_io_stop(loop, &io_);
-    ReadDone(readDone_ ? 0 : -2);
+    if (readDone_) {
+      ReadDone(Status::kOk);
+    } else {
+      ReadDone(Status(Status::SOCKET_ERROR,
+                      "Connection closed before response was complete"));
+    }
     return 0;
   }
 
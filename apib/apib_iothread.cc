@@ -16,13 +16,23 @@ limitations under the License.
 
 #include "apib/apib_iothread.h"
 
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <thread>
 
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "apib/apib_cpu.h"
 #include "apib/apib_lines.h"
+#include "apib/apib_probes.h"
 #include "apib/apib_rand.h"
 #include "apib/apib_reporting.h"
 #include "apib/apib_time.h"
@@ -39,11 +49,19 @@ ConnectionState::ConnectionState(int index, IOThread* t) : index_(index) {
   keepRunning_ = 1;
   t_ = t;
   readBuf_ = new char[kReadBufSize];
+  // Start each connection at a different place in the source port range
+  sourcePort_ = t->rand()->get();
 }
 
 // TODO memory leak -- COnnectionStates are freed when threads exit but not
 // when they just close. Think of a way to handle this...
-ConnectionState::~ConnectionState() { delete[] readBuf_; }
+ConnectionState::~ConnectionState() {
+  setActive(nullptr);
+  delete[] readBuf_;
+  if (tlsSession_ != nullptr) {
+    SSL_SESSION_free(tlsSession_);
+  }
+}
 
 int ConnectionState::httpComplete(http_parser* p) {
   ConnectionState* c = (ConnectionState*)p->data;
@@ -52,73 +70,104 @@ int ConnectionState::httpComplete(http_parser* p) {
 }
 
 void ConnectionState::writeRequest() {
-  if (!writeDirty_ && (t_->oauth == nullptr)) {
+  const RequestTemplates* tmpl = t_->templates;
+  if (t_->stream != nullptr) {
+    bodyStream_.start(t_->stream);
+  }
+  if (!writeDirty_ && (t_->signer == nullptr) && (tmpl == nullptr)) {
     // If we're reusing the same connection with the same URL,
     // then we can re-use the write buffer
     fullWritePos_ = 0;
     return;
   }
 
-  // Reset read buffer so that we can avoid re-allocation on every re-write
-  writeBuf_.rdbuf()->pubseekpos(0, std::ios_base::in);
-  writeBuf_.rdbuf()->pubseekpos(0, std::ios_base::out);
-  writeBuf_ << t_->httpVerb << " " << url_->path() << " HTTP/1.1\r\n";
+  absl::string_view path = url_->path();
+  absl::string_view body = t_->sendData;
+  TemplateContext ctx;
+  if (tmpl != nullptr) {
+    t_->templateContext(index_, &ctx);
+    templatePath_.clear();
+    tmpl->paths[url_->index()].fill(ctx, &templatePath_);
+    path = templatePath_;
+    templateBody_.clear();
+    tmpl->body.fill(ctx, &templateBody_);
+    body = templateBody_;
+  }
+
+  // Clearing the buffer keeps its capacity, so this does not allocate
+  // unless the request is bigger than any before it
+  fullWrite_.clear();
+  absl::StrAppend(&fullWrite_, t_->httpVerb, " ", path, " HTTP/1.1\r\n");
   if (!(t_->headersSet & IOThread::kUserAgentSet)) {
-    writeBuf_ << "User-Agent: apib\r\n";
+    fullWrite_.append("User-Agent: apib\r\n");
   }
   if (!(t_->headersSet & IOThread::kHostSet)) {
-    writeBuf_ << "Host: " << url_->hostHeader() << "\r\n";
+    absl::StrAppend(&fullWrite_, "Host: ", url_->hostHeader(), "\r\n");
   }
-  if (!t_->sendData.empty()) {
+  if (t_->stream != nullptr) {
+    if (!(t_->headersSet & IOThread::kContentTypeSet)) {
+      fullWrite_.append("Content-Type: application/octet-stream\r\n");
+    }
+    if (t_->stream->chunked()) {
+      fullWrite_.append("Transfer-Encoding: chunked\r\n");
+    } else if (!(t_->headersSet & IOThread::kContentLengthSet)) {
+      absl::StrAppend(&fullWrite_, "Content-Length: ", t_->stream->size(),
+                      "\r\n");
+    }
+  } else if (!body.empty()) {
     if (!(t_->headersSet & IOThread::kContentTypeSet)) {
-      writeBuf_ << "Content-Type: text/plain\r\n";
+      fullWrite_.append("Content-Type: text/plain\r\n");
     }
     if (!(t_->headersSet & IOThread::kContentLengthSet)) {
-      writeBuf_ << "Content-Length: " << t_->sendData.size() << "\r\n";
+      absl::StrAppend(&fullWrite_, "Content-Length: ", body.size(), "\r\n");
     }
   }
-  if (t_->oauth != NULL) {
-    const auto authHdr = oauth_MakeHeader(
-        t_->rand(), *url_, "", t_->httpVerb.c_str(), NULL, 0, *(t_->oauth));
-    writeBuf_ << authHdr << "\r\n";
+  if (t_->signer != nullptr) {
+    signature_.clear();
+    t_->requestSigner()->sign(t_->rand(), *url_, t_->httpVerb, body,
+                              GetWallTime() / 1000000000LL, &signature_);
+    fullWrite_.append(signature_);
   }
   if (t_->noKeepAlive && !(t_->headersSet & IOThread::kConnectionSet)) {
-    writeBuf_ << "Connection: close\r\n";
+    fullWrite_.append("Connection: close\r\n");
   }
-  if (t_->headers != nullptr) {
+  if (tmpl != nullptr) {
+    tmpl->headers.fill(ctx, &fullWrite_);
+  } else if (t_->headers != nullptr) {
     for (auto it = t_->headers->begin(); it != t_->headers->end(); it++) {
-      writeBuf_ << *it << "\r\n";
+      absl::StrAppend(&fullWrite_, *it, "\r\n");
     }
   }
   if (t_->verbose) {
-    io_Verbose(this, "%s\n", writeBuf_.str().c_str());
+    io_Verbose(this, "%s\n", fullWrite_.c_str());
   }
 
-  writeBuf_ << "\r\n";
-  if (!t_->sendData.empty()) {
-    writeBuf_ << t_->sendData;
+  fullWrite_.append("\r\n");
+  if (t_->stream == nullptr) {
+    fullWrite_.append(body.data(), body.size());
   }
   if (t_->verbose) {
-    io_Verbose(this, "Total send is %zi bytes\n", writeBuf_.str().size());
+    io_Verbose(this, "Total send is %zi bytes\n", fullWrite_.size());
   }
-  fullWrite_ = writeBuf_.str();
   fullWritePos_ = 0;
   writeDirty_ = false;
 }
 
 void ConnectionState::ConnectAndSend() {
-  startTime_ = GetTime();
+  startTime_ = t_->requestTicks();
   if (needsOpen_) {
-    const int err = Connect();
-    if (err == 0) {
+    const Status s = Connect();
+    if (s.ok()) {
       RecordConnectionOpen();
     } else {
-      std::cerr << "Error opening TCP connection: " << err << std::endl;
-      RecordSocketError();
-      sendAfterDelay(kConnectFailureDelay);
+      std::cerr << "Error opening TCP connection: " << s << std::endl;
+      recordError(s);
+      sendAfterDelay(t_->backoffDelay(connectFailures_));
       return;
     }
   }
+  t_->trace(TRACE_WRITE_START, index_);
+  requestWritten_ = 0;
   writeRequest();
   SendWrite();
 }
@@ -142,6 +191,17 @@ void ConnectionState::sendAfterDelay(double seconds) {
   ev_timer_start(t_->loop(), &thinkTimer_);
 }
 
+void ConnectionState::recordError(const Status& s) {
+  t_->trace(TRACE_ERROR, index_);
+  RecordSocketError(ClassifyError(s));
+  // An error on a connection that has never worked probably means that the
+  // server is in trouble, so the next attempt will back off. Other errors,
+  // such as a keep-alive connection that the server closed, retry right away.
+  if (!responseReceived_) {
+    connectFailures_++;
+  }
+}
+
 void ConnectionState::recycle(bool closeConn) {
   if (closeConn || t_->noKeepAlive || !t_->shouldKeepRunning()) {
     needsOpen_ = true;
@@ -151,7 +211,7 @@ void ConnectionState::recycle(bool closeConn) {
     return;
   }
 
-  needsOpen_ = false;
+  needsOpen_ = (socket_ == nullptr);
   if (t_->thinkTime > 0) {
     addThinkTime();
   } else {
@@ -159,6 +219,65 @@ void ConnectionState::recycle(bool closeConn) {
   }
 }
 
+// Called when the keep-alive connection to the server of "oldUrl" is done
+// and the next request goes to a different server. Rather than close it,
+// keep it idle for a later request to that server, and reuse an idle
+// connection to the new server if there is one.
+void ConnectionState::switchServer(const URLInfo& oldUrl) {
+  if ((t_->hostPoolSize <= 0) || t_->noKeepAlive ||
+      !t_->shouldKeepRunning()) {
+    recycle(true);
+    return;
+  }
+
+  IdleSocket reused;
+  for (auto it = idleSockets_.begin(); it != idleSockets_.end(); it++) {
+    if (URLInfo::IsSameServer(*(it->url), *url_)) {
+      reused = std::move(*it);
+      idleSockets_.erase(it);
+      break;
+    }
+  }
+
+  if (static_cast<int>(idleSockets_.size()) >= t_->hostPoolSize) {
+    io_Verbose(this, "Closing the oldest idle connection\n");
+    idleSockets_.erase(idleSockets_.begin());
+  }
+  IdleSocket idle;
+  idle.url = &oldUrl;
+  idle.address = active_;
+  idle.socket.swap(socket_);
+  idleSockets_.push_back(std::move(idle));
+  setActive(nullptr);
+
+  // The server may have closed the idle connection in the meantime, or DNS
+  // may no longer return its address. If so, it's dropped without a
+  // shutdown, since there is nobody to send it to.
+  if ((reused.socket != nullptr) && reused.address->current &&
+      reused.socket->stillOpen()) {
+    io_Verbose(this, "Reusing an idle connection to %s\n",
+               reused.address->address.str().c_str());
+    socket_.swap(reused.socket);
+    setActive(reused.address);
+    responseReceived_ = true;
+  }
+  recycle(false);
+}
+
+// Move the count of requests for the last address to it, and count this
+// connection as active on the new one.
+void ConnectionState::setActive(HostAddress* addr) {
+  if (active_ != nullptr) {
+    active_->active--;
+    active_->requests += activeRequests_;
+    activeRequests_ = 0;
+  }
+  active_ = addr;
+  if (active_ != nullptr) {
+    active_->active++;
+  }
+}
+
 int ConnectionState::StartConnect() {
   url_ = URLInfo::GetNext(t_->rand());
   needsOpen_ = true;
@@ -167,25 +286,35 @@ int ConnectionState::StartConnect() {
 }
 
 void ConnectionState::CloseDone() {
+  setActive(nullptr);
   if (!keepRunning_ || !t_->shouldKeepRunning()) {
     io_Verbose(this, "Connection %i closed and done\n", index_);
     return;
   }
 
-  if (t_->thinkTime > 0) {
+  if (connectFailures_ > 0) {
+    sendAfterDelay(t_->backoffDelay(connectFailures_));
+  } else if (t_->thinkTime > 0) {
     addThinkTime();
   } else {
     ConnectAndSend();
   }
 }
 
-void ConnectionState::WriteDone(int err) {
-  if (err != 0) {
-    RecordSocketError();
-    io_Verbose(this, "Error on write: %i\n", err);
+void ConnectionState::WriteDone(const Status& s) {
+  if (!s.ok()) {
+    io_Verbose(this, "Error on write: %s\n", s.str().c_str());
+    recordError(s);
     recycle(true);
   } else {
     io_Verbose(this, "Write complete. Starting to read\n");
+    t_->trace(TRACE_WRITE_END, index_);
+    if (APIB_PROBE_ENABLED(write_done)) {
+      APIB_PROBE4(write_done, t_->index, index_, url_->index(),
+                  requestWritten_);
+    }
+    awaitingResponse_ = true;
+    requestRead_ = 0;
     // Prepare to read.
     // do NOT adjust readBufPos because it may have been left over from another
     // transaction.
@@ -196,25 +325,43 @@ void ConnectionState::WriteDone(int err) {
   }
 }
 
-void ConnectionState::ReadDone(int err) {
-  if (err != 0) {
-    io_Verbose(this, "Error on read: %i\n", err);
-    RecordSocketError();
+void ConnectionState::ReadDone(const Status& s) {
+  // The status is -1 if the response failed
+  if (APIB_PROBE_ENABLED(read_done)) {
+    APIB_PROBE6(read_done, t_->index, index_, url_->index(),
+                s.ok() ? parser_.status_code : -1, requestRead_,
+                TicksToNanos(t_->requestTicks() - startTime_));
+  }
+  if (!s.ok()) {
+    io_Verbose(this, "Error on read: %s\n", s.str().c_str());
+    recordError(s);
     recycle(true);
     return;
   }
 
-  t_->recordResult(parser_.status_code, GetTime() - startTime_);
+  t_->trace(TRACE_COMPLETE, index_);
+  t_->recordResult(parser_.status_code, t_->requestTicks() - startTime_,
+                   url_->index());
+  if (!responseReceived_) {
+    connectionEstablished();
+  }
+  responseReceived_ = true;
+  connectFailures_ = 0;
+  activeRequests_++;
   if (!http_should_keep_alive(&(parser_))) {
     io_Verbose(this, "Server does not want keep-alive\n");
     recycle(true);
+  } else if (!active_->current) {
+    // Reconnect so that the next connection goes to a current address
+    io_Verbose(this, "Address is no longer in DNS\n");
+    recycle(true);
   } else {
     const URLInfo* oldUrl = url_;
     url_ = URLInfo::GetNext(t_->rand());
-    if (!URLInfo::IsSameServer(*oldUrl, *url_, t_->index)) {
+    if (!URLInfo::IsSameServer(*oldUrl, *url_)) {
       io_Verbose(this, "Switching to a different server\n");
       writeDirty_ = true;
-      recycle(true);
+      switchServer(*oldUrl);
     } else {
       // URLs are static throughout the run, so we can just compare pointer here
       if (url_ != oldUrl) {
@@ -225,14 +372,89 @@ void ConnectionState::ReadDone(int err) {
   }
 }
 
-void IOThread::recordResult(int statusCode, int_fast64_t latency) {
+// Called after the first successful response on a new connection, when we
+// can tell what the server made of our attempts to connect faster.
+void ConnectionState::connectionEstablished() {
+  if (t_->fastOpen && socket_->fastOpened()) {
+    RecordConnectFeature(TCP_FAST_OPEN);
+  }
+  if (!url_->isSsl()) {
+    return;
+  }
+  const TLSSocket* ts = static_cast<const TLSSocket*>(socket_.get());
+  if (ts->sessionReused()) {
+    RecordConnectFeature(TLS_RESUMED);
+  }
+  if (ts->earlyDataAccepted()) {
+    RecordConnectFeature(TLS_EARLY_DATA_ACCEPTED);
+  } else if (ts->earlyDataRejected()) {
+    RecordConnectFeature(TLS_EARLY_DATA_REJECTED);
+  }
+  if (t_->tlsResume) {
+    SSL_SESSION* session = ts->getSession();
+    if (session != nullptr) {
+      if (tlsSession_ != nullptr) {
+        SSL_SESSION_free(tlsSession_);
+      }
+      tlsSession_ = session;
+      tlsSessionUrl_ = url_;
+    }
+  }
+}
+
+void IOThread::recordResult(int statusCode, int_fast64_t latency,
+                            size_t urlIndex) {
   Counters* c = getCounters();
+  if (c->urls.size() <= urlIndex) {
+    c->urls.resize(urlIndex + 1);
+  }
+  UrlCounters* u = &(c->urls[urlIndex]);
   if ((statusCode >= 200) && (statusCode < 300)) {
     c->successfulRequests++;
+    u->successfulRequests++;
   } else {
     c->failedRequests++;
+    u->failedRequests++;
   }
   c->latencies.push_back(latency);
+  u->latencySum += latency;
+  if (latency > u->latencyMax) {
+    u->latencyMax = latency;
+  }
+}
+
+double IOThread::backoffDelay(int failures) {
+  // Double in 64 bits, so that nothing wraps before we clamp to "max"
+  const uint64_t max = std::min<uint64_t>(backoffMax, INT32_MAX);
+  uint64_t delay = std::min<uint64_t>(backoffMin, max);
+  for (int i = 1; (i < failures) && (delay < max); i++) {
+    delay *= 2;
+  }
+  if (delay > max) {
+    delay = max;
+  }
+  // Always wait at least half the delay, and randomize the rest
+  const int32_t half = static_cast<int32_t>(delay / 2);
+  const int32_t jittered =
+      half + rand_.get(0, static_cast<int32_t>(delay) - half);
+  return (double)jittered / 1000.0;
+}
+
+RequestSigner* IOThread::requestSigner() {
+  if (!signer_) {
+    signer_ = signer->clone();
+  }
+  return signer_.get();
+}
+
+void IOThread::templateContext(int conn, TemplateContext* ctx) {
+  ctx->rand = &rand_;
+  ctx->counter = templateCounter_++;
+  ctx->thread = index;
+  ctx->connection = conn;
+  if (!templates->csv.empty()) {
+    ctx->row = &(templates->csv.row(rand_.get(0, templates->csv.size() - 1)));
+  }
 }
 
 void IOThread::recordRead(size_t c) { getCounters()->bytesRead += c; }
@@ -271,6 +493,12 @@ void IOThread::hardShutdown(struct ev_loop* loop, ev_timer* timer,
   ev_break(loop, EVBREAK_ALL);
 }
 
+void IOThread::updateLoopTime(struct ev_loop* loop, ev_check* c,
+                              int revents) {
+  IOThread* t = (IOThread*)c->data;
+  t->loopTicks_ = GetTicks();
+}
+
 void IOThread::processCommands(struct ev_loop* loop, ev_async* a, int revents) {
   IOThread* t = (IOThread*)a->data;
   Command cmd;
@@ -315,6 +543,17 @@ void IOThread::threadLoopBody() {
   ev_async_start(loop_, &async_);
   ev_unref(loop_);
 
+  if (loopTime) {
+    // Check watchers run after each poll, and at the highest priority
+    // this one runs before any of the I/O callbacks.
+    loopTicks_ = GetTicks();
+    ev_check_init(&loopTimeWatcher_, updateLoopTime);
+    ev_set_priority(&loopTimeWatcher_, EV_MAXPRI);
+    loopTimeWatcher_.data = this;
+    ev_check_start(loop_, &loopTimeWatcher_);
+    ev_unref(loop_);
+  }
+
   for (int i = 0; i < numConnections; i++) {
     // First-time initialization of new connection
     ConnectionState* c = new ConnectionState(i, this);
@@ -338,12 +577,23 @@ void IOThread::threadLoop() {
   iothread_Verbose(this, "Starting new event loop %i for %i connection\n",
                    index, numConnections);
 
+  if (!cpus.empty()) {
+    // Do this before the event loop and connections are allocated, so that
+    // on a NUMA system their memory comes from this CPU's node.
+    const int err = cpu_SetAffinity(cpus);
+    if (err != 0) {
+      std::cerr << "Can't set CPU affinity for thread " << index << ": "
+                << strerror(err) << std::endl;
+    }
+  }
+
   threadLoopBody();
 
   ev_loop_destroy(loop_);
 }
 
 IOThread::IOThread() {
+  std::call_once(parserInitalized, initializeParser);
   Counters* c = new Counters();
   counterPtr_.store(reinterpret_cast<uintptr_t>(c));
 }
@@ -368,25 +618,51 @@ Counters* IOThread::exchangeCounters() {
       counterPtr_.exchange(reinterpret_cast<uintptr_t>(newCounters)));
 }
 
+int64_t IOThread::cpuTime() {
+#if defined(_POSIX_THREAD_CPUTIME) && (_POSIX_THREAD_CPUTIME >= 0)
+  if ((thread_ == nullptr) || !thread_->joinable()) {
+    return -1;
+  }
+  clockid_t clock;
+  struct timespec tp;
+  if ((pthread_getcpuclockid(thread_->native_handle(), &clock) != 0) ||
+      (clock_gettime(clock, &tp) != 0)) {
+    return -1;
+  }
+  return ((int64_t)tp.tv_sec * 1000000000LL) + tp.tv_nsec;
+#else
+  return -1;
+#endif
+}
+
 void IOThread::initializeParser() {
   http_parser_settings_init(&parserSettings_);
   parserSettings_.on_message_complete = ConnectionState::httpComplete;
 }
 
 void IOThread::Start() {
-  std::call_once(parserInitalized, initializeParser);
-
   // Special handling to signal thread to process only one request
   if (keepRunning < 0) {
     keepRunning = 0;
   } else {
     keepRunning = 1;
   }
+  if (traceEvents > 0) {
+    trace_.reset(new TraceBuffer(traceEvents));
+  }
 
   auto loopFunc = std::bind(&IOThread::threadLoop, this);
   thread_ = new std::thread(loopFunc);
 }
 
+void IOThread::traceSnapshot(std::vector<TraceEvent>* events) const {
+  if (trace_ == nullptr) {
+    events->clear();
+  } else {
+    trace_->snapshot(events);
+  }
+}
+
 void IOThread::RequestStop(int timeoutSecs) {
   iothread_Verbose(
       this, "Signalling to threads to stop running in less than %i seconds\n",
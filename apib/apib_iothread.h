@@ -21,15 +21,18 @@ limitations under the License.
 
 #include <atomic>
 #include <memory>
-#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "apib/apib_body.h"
 #include "apib/apib_commandqueue.h"
 #include "apib/apib_lines.h"
-#include "apib/apib_oauth.h"
 #include "apib/apib_rand.h"
+#include "apib/apib_signer.h"
+#include "apib/apib_template.h"
+#include "apib/apib_time.h"
+#include "apib/apib_trace.h"
 #include "apib/apib_url.h"
 #include "apib/socket.h"
 #include "apib/tlssocket.h"
@@ -56,12 +59,43 @@ class IOThread {
   std::string sslCipher;
   std::string sendData;
   SSL_CTX* sslCtx = nullptr;
-  OAuthInfo* oauth = nullptr;
+  // Adds headers to sign each request. Each thread signs with its own copy.
+  const RequestSigner* signer = nullptr;
+  // If set, fill in the placeholders in the path, headers, and body for
+  // every request
+  const RequestTemplates* templates = nullptr;
+  // If set, send this body a piece at a time instead of "sendData"
+  const BodySource* stream = nullptr;
   std::vector<std::string>* headers = nullptr;
+  std::vector<SourceAddress>* sourceAddresses = nullptr;
+  const SocketOptions* socketOptions = nullptr;
   int headersSet = 0;
   unsigned int thinkTime = 0;
   int noKeepAlive = 0;
   int keepRunning = 0;
+  // Use TCP Fast Open for new connections
+  bool fastOpen = false;
+  // Resume the previous TLS session when reconnecting to the same server,
+  // and optionally send the request as TLS 1.3 early data.
+  bool tlsResume = false;
+  bool tlsEarlyData = false;
+  // If not empty, run the thread only on these CPUs
+  std::vector<int> cpus;
+  // When a new connection fails, wait this many milliseconds before trying
+  // again, doubling the delay for each consecutive failure up to the max.
+  // Delays above INT32_MAX milliseconds are treated as INT32_MAX.
+  unsigned int backoffMin = kDefaultBackoffMin;
+  unsigned int backoffMax = kDefaultBackoffMax;
+  // Read the clock once per pass through the event loop, rather than
+  // twice for every request, and use that time for every request in
+  // the pass.
+  bool loopTime = false;
+  // When the next URL is on a different server, keep up to this many
+  // keep-alive connections to other servers for later requests, rather
+  // than closing the connection. Zero closes it every time.
+  int hostPoolSize = kDefaultHostPoolSize;
+  // If not zero, keep a trace of the last this many connection events
+  int traceEvents = 0;
   // Everything ABOVE must be initialized.
 
   // Constants for "headersSet"
@@ -72,6 +106,10 @@ class IOThread {
   static constexpr int kConnectionSet = (1 << 4);
   static constexpr int kUserAgentSet = (1 << 5);
 
+  static constexpr unsigned int kDefaultBackoffMin = 250;
+  static constexpr unsigned int kDefaultBackoffMax = 5000;
+  static constexpr int kDefaultHostPoolSize = 4;
+
   IOThread();
   ~IOThread();
 
@@ -102,15 +140,43 @@ class IOThread {
   http_parser_settings* parserSettings() { return &parserSettings_; }
   bool shouldKeepRunning() { return keepRunning; }
   RandomGenerator* rand() { return &rand_; }
+  // This thread's copy of "signer," which must be set
+  RequestSigner* requestSigner();
+  // Set up "ctx" for the next templated request on connection "conn"
+  void templateContext(int conn, TemplateContext* ctx);
+  // The current time, from GetTicks, or the time at the start of this pass
+  // through the event loop if "loopTime" is set
+  int64_t requestTicks() { return loopTime ? loopTicks_ : GetTicks(); }
+  // Add an event for connection "conn" to the trace, if there is one.
+  // This always reads the clock, regardless of "loopTime."
+  void trace(TraceType type, int conn) {
+    if (trace_ != nullptr) {
+      trace_->record(GetTicks(), type, conn);
+    }
+  }
+  bool tracing() const { return trace_ != nullptr; }
+  // Copy the events in the trace. This may be called from any thread at
+  // any time after "Start."
+  void traceSnapshot(std::vector<TraceEvent>* events) const;
 
   void recordRead(size_t c);
   void recordWrite(size_t c);
-  void recordResult(int statusCode, int64_t latency);
+  // "urlIndex" is the URLInfo::index of the URL that was requested
+  void recordResult(int statusCode, int64_t latency, size_t urlIndex = 0);
+
+  // Return how long to wait, in seconds, before reconnecting after
+  // "failures" consecutive connection failures. The result is randomized so
+  // that many failing connections don't all retry at the same moment.
+  double backoffDelay(int failures);
 
   // Swap the current set of performance counters and start new ones.
   // The caller must free the result.
   Counters* exchangeCounters();
 
+  // The CPU time that the thread has used so far, in nanoseconds, or -1
+  // if the platform can't tell us. Only call it while the thread runs.
+  int64_t cpuTime();
+
   // A utility function to print out the back ends for Libev
   static std::string GetEvBackends(int mask);
 
@@ -124,6 +190,7 @@ class IOThread {
   static void initializeParser();
   static void processCommands(struct ev_loop* loop, ev_async* a, int revents);
   static void hardShutdown(struct ev_loop* loop, ev_timer* timer, int revents);
+  static void updateLoopTime(struct ev_loop* loop, ev_check* c, int revents);
   void setNumConnections(size_t newVal);
   Counters* getCounters() {
     return reinterpret_cast<Counters*>(counterPtr_.load());
@@ -134,11 +201,16 @@ class IOThread {
   std::vector<ConnectionState*> connections_;
   std::thread* thread_ = nullptr;
   RandomGenerator rand_;
+  std::unique_ptr<RequestSigner> signer_;
+  uint64_t templateCounter_ = 0;
   struct ev_loop* loop_ = nullptr;
   ev_async async_;
   CommandQueue commands_;
   ev_timer shutdownTimer_;
+  ev_check loopTimeWatcher_;
+  int64_t loopTicks_ = 0;
   std::atomic_uintptr_t counterPtr_;
+  std::unique_ptr<TraceBuffer> trace_;
 };
 
 // This is an internal class used per connection.
@@ -148,12 +220,12 @@ class ConnectionState {
   ~ConnectionState();
 
   // Called when asynchronous I/O completes
-  void WriteDone(int err);
-  void ReadDone(int err);
+  void WriteDone(const Status& s);
+  void ReadDone(const Status& s);
   void CloseDone();
 
-  // Connect in a non-blocking way, and return non-zero on error.
-  int Connect();
+  // Connect in a non-blocking way.
+  Status Connect();
   void ConnectAndSend();
   int StartConnect();
 
@@ -174,20 +246,31 @@ class ConnectionState {
   static int httpComplete(http_parser* p);
 
  private:
+  // The micro-benchmarks in "test/io_benchmark.cc" call "writeRequest" and
+  // "parseResponse" directly.
+  friend class ConnectionBenchmark;
+
   // The size of the buffer to read from when calling read()
   // or SSL_read()
   static constexpr int kReadBufSize = 8192;
-  // In the event that connecting a socket fails, we will wait
-  // for this time, in seconds, before trying again.
-  // Nevertheless, if this ever gets used then the benchmark
-  // is pretty much ruined anyway...
-  static constexpr double kConnectFailureDelay = 0.25;
+  // How many ports to try from a source port range before giving up
+  static constexpr int kMaxBindAttempts = 16;
 
   void addThinkTime();
   void sendAfterDelay(double seconds);
+  void recordError(const Status& s);
+  Status connectFrom(const Address& addr, const Address& source);
+  void connectionEstablished();
+  void checkHandshake();
   void recycle(bool closeConn);
+  void switchServer(const URLInfo& oldUrl);
+  void setActive(HostAddress* addr);
   void writeRequest();
 
+  // Parse "readCount" new bytes in "readBuf_" along with any that were left
+  // over from the last read, and keep whatever is left over this time.
+  // Returns false if the response is invalid.
+  bool parseResponse(size_t readCount);
   int singleRead(struct ev_loop* loop, ev_io* w, int revents);
   int singleWrite(struct ev_loop* loop, ev_io* w, int revents);
 
@@ -195,24 +278,61 @@ class ConnectionState {
   static void readReady(struct ev_loop* loop, ev_io* w, int revents);
   static void writeReady(struct ev_loop* loop, ev_io* w, int revents);
   static void thinkingDone(struct ev_loop* loop, ev_timer* t, int revents);
+  static void pauseDone(struct ev_loop* loop, ev_timer* t, int revents);
 
   const int index_ = 0;
   bool keepRunning_ = 0;
   std::unique_ptr<Socket> socket_;
+  // The address that "socket_" is connected to, and how many requests
+  // it has completed that aren't counted there yet
+  HostAddress* active_ = nullptr;
+  int64_t activeRequests_ = 0;
   IOThread* t_ = nullptr;
   bool backwardsIo_ = false;
   ev_io io_;
   ev_timer thinkTimer_;
+  // Waits between the units of a streamed body
+  ev_timer pauseTimer_;
   URLInfo* url_ = nullptr;
   bool writeDirty_ = true;
-  std::ostringstream writeBuf_;
+  // Each request is built here, and the buffers are kept from one request
+  // to the next so that building a request does not usually allocate.
   std::string fullWrite_;
+  std::string signature_;
+  std::string templatePath_;
+  std::string templateBody_;
   size_t fullWritePos_ = 0;
+  // Sent after "fullWrite_" if "stream" is set
+  BodyStream bodyStream_;
   char* readBuf_ = nullptr;
   size_t readBufPos_ = 0;
   http_parser parser_;
   bool readDone_ = false;
   bool needsOpen_ = false;
+  // For the trace and probes: whether nothing has been read since the
+  // request was written, and whether the TLS handshake is still going on
+  bool awaitingResponse_ = false;
+  bool inHandshake_ = false;
+  // Bytes written and read for the current request, for the probes
+  size_t requestWritten_ = 0;
+  size_t requestRead_ = 0;
+  // Whether the current socket has ever returned a complete response.
+  // Errors on new sockets count towards "connectFailures_".
+  bool responseReceived_ = false;
+  int connectFailures_ = 0;
+  unsigned int sourcePort_ = 0;
+  // Idle keep-alive connections to servers other than the current one,
+  // at most one per server, oldest first
+  struct IdleSocket {
+    const URLInfo* url = nullptr;
+    HostAddress* address = nullptr;
+    std::unique_ptr<Socket> socket;
+  };
+  std::vector<IdleSocket> idleSockets_;
+  // The last TLS session, and the URL that it was for, for "tlsResume"
+  SSL_SESSION* tlsSession_ = nullptr;
+  const URLInfo* tlsSessionUrl_ = nullptr;
+  // When the request started, from GetTicks
   long long startTime_ = 0LL;
 };
 
@@ -0,0 +1,453 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_json.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace apib {
+
+std::string JsonWriter::quote(absl::string_view s) {
+  std::string r;
+  r.reserve(s.size() + 2);
+  r.push_back('"');
+  for (const char c : s) {
+    switch (c) {
+      case '"':
+        r.append("\\\"");
+        break;
+      case '\\':
+        r.append("\\\\");
+        break;
+      case '\n':
+        r.append("\\n");
+        break;
+      case '\r':
+        r.append("\\r");
+        break;
+      case '\t':
+        r.append("\\t");
+        break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          r.append(absl::StrFormat("\\u%04x", (unsigned char)c));
+        } else {
+          r.push_back(c);
+        }
+    }
+  }
+  r.push_back('"');
+  return r;
+}
+
+void JsonWriter::newLine() {
+  out_ << '\n';
+  for (size_t i = 0; i < nonEmpty_.size(); i++) {
+    out_ << "  ";
+  }
+}
+
+void JsonWriter::beforeValue() {
+  if (afterKey_) {
+    afterKey_ = false;
+    return;
+  }
+  if (!nonEmpty_.empty()) {
+    if (nonEmpty_.back()) {
+      out_ << ',';
+    }
+    nonEmpty_.back() = true;
+    newLine();
+  }
+}
+
+void JsonWriter::writeRaw(absl::string_view s) {
+  beforeValue();
+  out_ << s;
+}
+
+void JsonWriter::key(absl::string_view k) {
+  beforeValue();
+  out_ << quote(k) << ": ";
+  afterKey_ = true;
+}
+
+void JsonWriter::beginObject() {
+  beforeValue();
+  out_ << '{';
+  nonEmpty_.push_back(false);
+}
+
+void JsonWriter::endObject() {
+  const bool wasEmpty = !nonEmpty_.back();
+  nonEmpty_.pop_back();
+  if (!wasEmpty) {
+    newLine();
+  }
+  out_ << '}';
+  if (nonEmpty_.empty()) {
+    out_ << '\n';
+  }
+}
+
+void JsonWriter::beginArray() {
+  beforeValue();
+  out_ << '[';
+  nonEmpty_.push_back(false);
+}
+
+void JsonWriter::endArray() {
+  const bool wasEmpty = !nonEmpty_.back();
+  nonEmpty_.pop_back();
+  if (!wasEmpty) {
+    newLine();
+  }
+  out_ << ']';
+  if (nonEmpty_.empty()) {
+    out_ << '\n';
+  }
+}
+
+void JsonWriter::value(absl::string_view s) { writeRaw(quote(s)); }
+
+void JsonWriter::value(bool b) { writeRaw(b ? "true" : "false"); }
+
+void JsonWriter::value(double d) {
+  if (!std::isfinite(d)) {
+    writeRaw("null");
+    return;
+  }
+  // Use the shortest form that reads back as the same number
+  std::string s = absl::StrFormat("%.15g", d);
+  if (strtod(s.c_str(), nullptr) != d) {
+    s = absl::StrFormat("%.17g", d);
+  }
+  writeRaw(s);
+}
+
+// A recursive-descent parser for JsonValue
+class JsonParser {
+ public:
+  explicit JsonParser(absl::string_view text) : text_(text) {}
+
+  Status parseDocument(JsonValue* v) {
+    Status s = parseValue(v, 0);
+    if (!s.ok()) {
+      return s;
+    }
+    skipSpace();
+    if (pos_ < text_.size()) {
+      return error("unexpected data after the end");
+    }
+    return Status::kOk;
+  }
+
+ private:
+  // Deeper than this is surely not something that we wrote
+  static const int kMaxDepth = 64;
+
+  Status error(absl::string_view msg) const {
+    return Status(Status::PARSE_ERROR,
+                  absl::StrCat("Invalid JSON at offset ", pos_, ": ", msg));
+  }
+
+  void skipSpace() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' ||
+            text_[pos_] == '\n' || text_[pos_] == '\r')) {
+      pos_++;
+    }
+  }
+
+  bool consume(absl::string_view word) {
+    if (text_.substr(pos_, word.size()) == word) {
+      pos_ += word.size();
+      return true;
+    }
+    return false;
+  }
+
+  Status parseValue(JsonValue* v, int depth) {
+    if (depth > kMaxDepth) {
+      return error("too deeply nested");
+    }
+    skipSpace();
+    if (pos_ >= text_.size()) {
+      return error("unexpected end");
+    }
+    switch (text_[pos_]) {
+      case '{':
+        return parseObject(v, depth);
+      case '[':
+        return parseArray(v, depth);
+      case '"':
+        v->type_ = JsonValue::STRING;
+        return parseString(&v->string_);
+      case 't':
+      case 'f':
+      case 'n':
+        if (consume("true")) {
+          v->type_ = JsonValue::BOOLEAN;
+          v->bool_ = true;
+        } else if (consume("false")) {
+          v->type_ = JsonValue::BOOLEAN;
+          v->bool_ = false;
+        } else if (consume("null")) {
+          v->type_ = JsonValue::NUL;
+        } else {
+          return error("unknown literal");
+        }
+        return Status::kOk;
+      default:
+        return parseNumber(v);
+    }
+  }
+
+  Status parseObject(JsonValue* v, int depth) {
+    v->type_ = JsonValue::OBJECT;
+    pos_++;
+    skipSpace();
+    if (consume("}")) {
+      return Status::kOk;
+    }
+    for (;;) {
+      skipSpace();
+      if (pos_ >= text_.size() || text_[pos_] != '"') {
+        return error("expected a member name");
+      }
+      std::string key;
+      Status s = parseString(&key);
+      if (!s.ok()) {
+        return s;
+      }
+      skipSpace();
+      if (!consume(":")) {
+        return error("expected ':'");
+      }
+      v->keys_.push_back(std::move(key));
+      v->children_.push_back(JsonValue());
+      s = parseValue(&(v->children_.back()), depth + 1);
+      if (!s.ok()) {
+        return s;
+      }
+      skipSpace();
+      if (consume("}")) {
+        return Status::kOk;
+      }
+      if (!consume(",")) {
+        return error("expected ',' or '}'");
+      }
+    }
+  }
+
+  Status parseArray(JsonValue* v, int depth) {
+    v->type_ = JsonValue::ARRAY;
+    pos_++;
+    skipSpace();
+    if (consume("]")) {
+      return Status::kOk;
+    }
+    for (;;) {
+      v->children_.push_back(JsonValue());
+      Status s = parseValue(&(v->children_.back()), depth + 1);
+      if (!s.ok()) {
+        return s;
+      }
+      skipSpace();
+      if (consume("]")) {
+        return Status::kOk;
+      }
+      if (!consume(",")) {
+        return error("expected ',' or ']'");
+      }
+    }
+  }
+
+  bool parseHex4(uint32_t* cp) {
+    if (pos_ + 4 > text_.size()) {
+      return false;
+    }
+    uint32_t r = 0;
+    for (int i = 0; i < 4; i++) {
+      const char c = text_[pos_++];
+      r <<= 4;
+      if (c >= '0' && c <= '9') {
+        r |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        r |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        r |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    *cp = r;
+    return true;
+  }
+
+  static void appendUtf8(uint32_t cp, std::string* out) {
+    if (cp < 0x80) {
+      out->push_back(cp);
+    } else if (cp < 0x800) {
+      out->push_back(0xc0 | (cp >> 6));
+      out->push_back(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+      out->push_back(0xe0 | (cp >> 12));
+      out->push_back(0x80 | ((cp >> 6) & 0x3f));
+      out->push_back(0x80 | (cp & 0x3f));
+    } else {
+      out->push_back(0xf0 | (cp >> 18));
+      out->push_back(0x80 | ((cp >> 12) & 0x3f));
+      out->push_back(0x80 | ((cp >> 6) & 0x3f));
+      out->push_back(0x80 | (cp & 0x3f));
+    }
+  }
+
+  Status parseString(std::string* out) {
+    // Skip the opening quote
+    pos_++;
+    while (pos_ < text_.size()) {
+      const char c = text_[pos_++];
+      if (c == '"') {
+        return Status::kOk;
+      }
+      if ((unsigned char)c < 0x20) {
+        return error("control character in string");
+      }
+      if (c != '\\') {
+        out->push_back(c);
+        continue;
+      }
+      if (pos_ >= text_.size()) {
+        break;
+      }
+      const char e = text_[pos_++];
+      switch (e) {
+        case '"':
+        case '\\':
+        case '/':
+          out->push_back(e);
+          break;
+        case 'b':
+          out->push_back('\b');
+          break;
+        case 'f':
+          out->push_back('\f');
+          break;
+        case 'n':
+          out->push_back('\n');
+          break;
+        case 'r':
+          out->push_back('\r');
+          break;
+        case 't':
+          out->push_back('\t');
+          break;
+        case 'u': {
+          uint32_t cp;
+          if (!parseHex4(&cp)) {
+            return error("invalid unicode escape");
+          }
+          if (cp >= 0xd800 && cp < 0xdc00) {
+            // The first half of a surrogate pair
+            uint32_t low;
+            if (!consume("\\u") || !parseHex4(&low) || low < 0xdc00 ||
+                low > 0xdfff) {
+              return error("invalid surrogate pair");
+            }
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          }
+          appendUtf8(cp, out);
+          break;
+        }
+        default:
+          return error("invalid escape");
+      }
+    }
+    return error("unterminated string");
+  }
+
+  Status parseNumber(JsonValue* v) {
+    const size_t start = pos_;
+    if (pos_ < text_.size() && text_[pos_] == '-') {
+      pos_++;
+    }
+    while (pos_ < text_.size() &&
+           ((text_[pos_] >= '0' && text_[pos_] <= '9') || text_[pos_] == '.' ||
+            text_[pos_] == 'e' || text_[pos_] == 'E' || text_[pos_] == '+' ||
+            text_[pos_] == '-')) {
+      pos_++;
+    }
+    const std::string num(text_.substr(start, pos_ - start));
+    char* end;
+    const double d = strtod(num.c_str(), &end);
+    if (num.empty() || *end != 0 || !std::isfinite(d)) {
+      pos_ = start;
+      return error("invalid number");
+    }
+    v->type_ = JsonValue::NUMBER;
+    v->number_ = d;
+    return Status::kOk;
+  }
+
+  const absl::string_view text_;
+  size_t pos_ = 0;
+};
+
+StatusOr<JsonValue> JsonValue::Parse(absl::string_view text) {
+  JsonValue v;
+  JsonParser p(text);
+  Status s = p.parseDocument(&v);
+  if (!s.ok()) {
+    return s;
+  }
+  return std::move(v);
+}
+
+const JsonValue* JsonValue::get(absl::string_view key) const {
+  if (type_ != OBJECT) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < keys_.size(); i++) {
+    if (keys_[i] == key) {
+      return &(children_[i]);
+    }
+  }
+  return nullptr;
+}
+
+double JsonValue::getNumber(absl::string_view key, double dflt) const {
+  const JsonValue* v = get(key);
+  if (v == nullptr || v->type_ != NUMBER) {
+    return dflt;
+  }
+  return v->number_;
+}
+
+std::string JsonValue::getString(absl::string_view key,
+                                 const std::string& dflt) const {
+  const JsonValue* v = get(key);
+  if (v == nullptr || v->type_ != STRING) {
+    return dflt;
+  }
+  return v->string_;
+}
+
+}  // namespace apib
@@ -0,0 +1,118 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_JSON_H
+#define APIB_JSON_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// A minimal streaming JSON writer. The caller is responsible for
+// balancing objects and arrays and for calling "key" before each value
+// inside an object. Output is indented for readability.
+class JsonWriter {
+ public:
+  explicit JsonWriter(std::ostream& out) : out_(out) {}
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(absl::string_view k);
+
+  void value(absl::string_view s);
+  void value(const char* s) { value(absl::string_view(s)); }
+  void value(const std::string& s) { value(absl::string_view(s)); }
+  void value(bool b);
+  // Doubles are written with enough precision to read back exactly.
+  // Infinities and NaN become null.
+  void value(double d);
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          !std::is_same<T, bool>::value>::type
+  value(T v) {
+    writeRaw(std::to_string(v));
+  }
+
+  template <typename T>
+  void field(absl::string_view k, T v) {
+    key(k);
+    value(v);
+  }
+
+  // Escape a string and surround it with quotes
+  static std::string quote(absl::string_view s);
+
+ private:
+  void beforeValue();
+  void writeRaw(absl::string_view s);
+  void newLine();
+
+  std::ostream& out_;
+  // For each open object or array, whether anything has been written to it
+  std::vector<bool> nonEmpty_;
+  bool afterKey_ = false;
+};
+
+// A parsed JSON document. This is meant for reading back the files that
+// apib writes, so it favors simplicity over speed. Numbers are stored as
+// doubles, and the members of an object keep the order of the input.
+class JsonValue {
+ public:
+  enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+  static StatusOr<JsonValue> Parse(absl::string_view text);
+
+  Type type() const { return type_; }
+  bool isNull() const { return type_ == NUL; }
+  bool boolValue() const { return bool_; }
+  double number() const { return number_; }
+  const std::string& string() const { return string_; }
+
+  // The number of elements in an array or members of an object
+  size_t size() const { return children_.size(); }
+  const JsonValue& at(size_t i) const { return children_[i]; }
+  // The member of an object called "key," or nullptr
+  const JsonValue* get(absl::string_view key) const;
+  // Shortcuts for members that hold numbers or strings. They return
+  // "dflt" if there is no such member or if it has the wrong type.
+  double getNumber(absl::string_view key, double dflt) const;
+  std::string getString(absl::string_view key,
+                        const std::string& dflt) const;
+
+ private:
+  friend class JsonParser;
+
+  Type type_ = NUL;
+  bool bool_ = false;
+  double number_ = 0.0;
+  std::string string_;
+  // Array elements, or object values with the names in "keys_"
+  std::vector<JsonValue> children_;
+  std::vector<std::string> keys_;
+};
+
+}  // namespace apib
+
+#endif  // APIB_JSON_H
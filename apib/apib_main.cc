@@ -15,9 +15,14 @@ limitations under the License.
 */
 
 #include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <ctime>
 #include <fstream>
@@ -26,13 +31,20 @@ limitations under the License.
 #include <string>
 #include <vector>
 
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "apib/apib_body.h"
 #include "apib/apib_cpu.h"
+#include "apib/apib_exporter.h"
 #include "apib/apib_iothread.h"
 #include "apib/apib_oauth.h"
 #include "apib/apib_reporting.h"
+#include "apib/apib_responder.h"
+#include "apib/apib_template.h"
+#include "apib/apib_time.h"
+#include "apib/apib_trace.h"
 #include "apib/apib_url.h"
 #include "apib/apib_util.h"
 #include "third_party/base64/base64.h"
@@ -42,6 +54,7 @@ static const std::string kApibVersion = "1.2.1";
 using apib::eqcase;
 using apib::IOThread;
 using apib::OAuthInfo;
+using apib::RequestSigner;
 using apib::RecordInit;
 using apib::RecordStart;
 using apib::RecordStop;
@@ -54,8 +67,12 @@ using std::endl;
 static const int KeepAliveAlways = -1;
 static const int DefaultNumConnections = 1;
 static const int DefaultDuration = 60;
+static const int DefaultCalibrateDuration = 10;
 static const int DefaultWarmup = 0;
 static const int ReportSleepTime = 5;
+static const int DefaultTraceEvents = 65536;
+// Each event takes 16 bytes on each I/O thread, so this is 64 MB per thread
+static const int MaxTraceEvents = 4194304;
 
 static int ShortOutput = 0;
 static std::string RunName;
@@ -73,11 +90,77 @@ static bool Verbose = false;
 static int ThinkTime = 0;
 static std::vector<std::string> Headers;
 static int SetHeaders = 0;
+static std::vector<apib::SourceAddress> SourceAddresses;
+static apib::SocketOptions SocketOptions;
+static bool FastOpen = false;
+static bool TlsResume = false;
+static bool TlsEarlyData = false;
+static std::string CpuAffinity;
+// The sets of CPUs that I/O threads are pinned to, round-robin
+static std::vector<std::vector<int>> CpuSlots;
+static int NumProcesses = 1;
+// In a worker process, the index of its first thread across all processes
+static int ThreadIndexBase = 0;
+static std::string MetricsFile;
+static int MetricsInterval = 1000;
+static std::string MetricsAddress = "0.0.0.0";
+static int MetricsPort = -1;
+static apib::MetricsServer *MetricsExporter = nullptr;
+static std::string JsonFile;
+static bool UseTsc = false;
+static bool LoopTime = false;
+static bool Calibrate = false;
+static apib::Responder *CalibrateServer = nullptr;
+static unsigned int BackoffMin = IOThread::kDefaultBackoffMin;
+static unsigned int BackoffMax = IOThread::kDefaultBackoffMax;
+static int HostPoolSize = IOThread::kDefaultHostPoolSize;
+static apib::Balance AddressBalance;
+static int DnsRefresh = 0;
+static std::string TraceFile;
+static int TraceEvents = DefaultTraceEvents;
+// Set by SIGUSR1 to write the trace so far
+static volatile sig_atomic_t TraceRequested = 0;
+static int TraceDumps = 0;
 
-static OAuthInfo *OAuth = nullptr;
+static std::unique_ptr<RequestSigner> Signer;
+static bool UseTemplates = false;
+static std::string CsvFile;
+static apib::RequestTemplates Templates;
+static bool TemplatesActive = false;
+static std::string StreamSpec;
+static std::unique_ptr<apib::BodySource> Stream;
 
 static const char *const OPTIONS = "c:d:f:hk:t:u:vw:x:C:F:H:O:K:M:X:N:STVW:Z1";
 
+// Values for options that only have a long form. They start above the
+// range of characters used by the short options.
+enum {
+  BackoffOption = 256,
+  SourceOption,
+  SockOptOption,
+  FastOpenOption,
+  TlsResumeOption,
+  TlsEarlyDataOption,
+  CpuAffinityOption,
+  ProcessesOption,
+  MetricsFileOption,
+  MetricsIntervalOption,
+  MetricsPortOption,
+  JsonOption,
+  TscOption,
+  LoopTimeOption,
+  CalibrateOption,
+  SignOption,
+  TemplateOption,
+  CsvOption,
+  StreamOption,
+  HostPoolOption,
+  BalanceOption,
+  DnsRefreshOption,
+  TraceOption,
+  TraceEventsOption
+};
+
 static const struct option Options[] = {
     {"concurrency", required_argument, NULL, 'c'},
     {"duration", required_argument, NULL, 'd'},
@@ -102,7 +185,32 @@ static const struct option Options[] = {
     {"header-line", no_argument, NULL, 'T'},
     {"verify", no_argument, NULL, 'V'},
     {"one", no_argument, NULL, '1'},
-    {"think-time", required_argument, NULL, 'W'}};
+    {"think-time", required_argument, NULL, 'W'},
+    {"backoff", required_argument, NULL, BackoffOption},
+    {"source", required_argument, NULL, SourceOption},
+    {"sockopt", required_argument, NULL, SockOptOption},
+    {"tcp-fastopen", no_argument, NULL, FastOpenOption},
+    {"tls-resume", no_argument, NULL, TlsResumeOption},
+    {"tls-early-data", no_argument, NULL, TlsEarlyDataOption},
+    {"cpu-affinity", required_argument, NULL, CpuAffinityOption},
+    {"processes", required_argument, NULL, ProcessesOption},
+    {"metrics-file", required_argument, NULL, MetricsFileOption},
+    {"metrics-interval", required_argument, NULL, MetricsIntervalOption},
+    {"metrics-port", required_argument, NULL, MetricsPortOption},
+    {"json", required_argument, NULL, JsonOption},
+    {"tsc", no_argument, NULL, TscOption},
+    {"loop-time", no_argument, NULL, LoopTimeOption},
+    {"calibrate", no_argument, NULL, CalibrateOption},
+    {"sign", required_argument, NULL, SignOption},
+    {"template", no_argument, NULL, TemplateOption},
+    {"csv", required_argument, NULL, CsvOption},
+    {"stream", required_argument, NULL, StreamOption},
+    {"host-pool", required_argument, NULL, HostPoolOption},
+    {"balance", required_argument, NULL, BalanceOption},
+    {"dns-refresh", required_argument, NULL, DnsRefreshOption},
+    {"trace", required_argument, NULL, TraceOption},
+    {"trace-events", required_argument, NULL, TraceEventsOption},
+    {NULL, 0, NULL, 0}};
 
 static const char *const USAGE_DOCS =
     "-1 --one                Send just one request and exit\n"
@@ -134,10 +242,75 @@ static const char *const USAGE_DOCS =
     "        in milliseconds\n"
     "-M --monitor            Host name and port number of apibmon\n"
     "-X --monitor2           Second host name and port number of apibmon\n"
+    "   --backoff            Delay before reconnecting after a failed\n"
+    "       connection, in milliseconds, as min[:max] (default 250:5000)\n"
+    "   --source             Local address for outgoing connections, with\n"
+    "       an optional port range, as address[:first-last]. May be a\n"
+    "       comma-separated list or repeated\n"
+    "   --sockopt            Socket option to set on every connection, as\n"
+    "       name=value. May be repeated. Options are sndbuf, rcvbuf,\n"
+    "       busy_poll, quickack, congestion, fastopen_connect, and tos\n"
+    "   --tcp-fastopen       Send requests on new connections with the SYN\n"
+    "       using TCP Fast Open\n"
+    "   --tls-resume         Resume the last TLS session when reconnecting\n"
+    "   --tls-early-data     Also send requests as TLS 1.3 early data on\n"
+    "       resumed sessions\n"
+    "   --cpu-affinity       Pin I/O threads to CPUs. One of \"cores\",\n"
+    "       \"nodes\", a list of CPUs like \"0-3,8\", or \"irq:IFACE\" to\n"
+    "       use the CPUs that handle a network interface's interrupts\n"
+    "   --processes          Number of worker processes to fork. Threads\n"
+    "       and connections are divided among them (default 1)\n"
+    "   --metrics-file       Publish live results to a memory-mapped file\n"
+    "       that other programs may read while the test runs\n"
+    "   --metrics-interval   How often to update the metrics file, in\n"
+    "       milliseconds (default 1000)\n"
+    "   --metrics-port       Serve live results to Prometheus and other\n"
+    "       OpenMetrics scrapers at /metrics, as [address:]port\n"
+    "   --json               Write complete results as JSON to a file,\n"
+    "       or to standard output instead of the usual report if \"-\"\n"
+    "   --tsc                Time requests with the CPU's time stamp\n"
+    "       counter instead of the system clock, if it is reliable\n"
+    "   --loop-time          Read the clock once per event loop pass instead\n"
+    "       of twice per request, at some cost in latency accuracy\n"
+    "   --calibrate          Instead of testing a URL, test a built-in\n"
+    "       server that does almost nothing, to measure the CPU cost of\n"
+    "       each request and the most that this client can do (default\n"
+    "       one I/O thread for 10 seconds)\n"
+    "   --sign               Sign each request, as type,name=value,...\n"
+    "       \"hmac-sha256,key=ID,secret=SECRET\"\n"
+    "       \"jwt,alg=RS256|ES256,key=PEM-FILE\" with optional iss, sub,\n"
+    "       aud, kid, ttl (default 300), and reuse (default ttl/2)\n"
+    "       \"sigv4,access=KEY,secret=SECRET,region=REGION,service=NAME\"\n"
+    "       with an optional session token\n"
+    "   --template           Fill in placeholders in the URL path, headers,\n"
+    "       and body on every request: ${counter}, ${rand:MIN:MAX},\n"
+    "       ${randstr:LEN}, ${uuid}, ${csv:COLUMN}, ${conn}, ${thread}\n"
+    "   --csv                Read values for ${csv:COLUMN} from a CSV file,\n"
+    "       using a random row for each request\n"
+    "   --stream             Send the body a piece at a time, as a list of\n"
+    "       size=SIZE, data=random|zeros|text:STRING, chunked, chunk=SIZE,\n"
+    "       and delay=MS between chunks. Sizes may end in K, M, or G.\n"
+    "       With -f, the file is the body instead of size and data\n"
+    "   --host-pool          With URLs on more than one server, how many\n"
+    "       idle keep-alive connections to other servers each connection\n"
+    "       keeps for later requests (default 4, 0 to close them)\n"
+    "   --balance            How new connections choose among the addresses\n"
+    "       of a host: thread (default), round-robin, least-conn, or\n"
+    "       weighted:ADDRESS=WEIGHT,... where unlisted addresses get 1\n"
+    "   --dns-refresh        Look up host names again this often, in\n"
+    "       seconds, and move connections off addresses that are gone\n"
+    "   --trace              Record when each connection connects, writes,\n"
+    "       waits, reads, and closes, and write the events to a file in\n"
+    "       Chrome trace format at the end, or to FILE.1, FILE.2, and so\n"
+    "       on when apib gets SIGUSR1\n"
+    "   --trace-events       How many of the latest events each I/O thread\n"
+    "       keeps for --trace (default 65536, at most 4194304)\n"
     "\n"
     "The last argument may be an http or https URL, or an \"@\" symbol\n"
     "followed by a file name. If a file name, then apib will read the file\n"
     "as a list of URLs, one per line, and randomly test each one.\n"
+    "A URL of the form unix://SOCKET:PATH sends requests for PATH to the\n"
+    "Unix socket SOCKET, which may start with \"@\" for an abstract name.\n"
     "\n"
     "  if -S is used then output is CSV-separated on one line:\n"
     "  name,throughput,avg. "
@@ -234,7 +407,7 @@ static int createSslContext(IOThread *t) {
   return 0;
 }
 
-static int readFile(const std::string &name, IOThread *t) {
+static int readFile(const std::string &name, std::string *data) {
   // Open and seek to the end
   std::ifstream in(name, std::ios::binary | std::ios::ate);
   if (!in) {
@@ -246,48 +419,328 @@ static int readFile(const std::string &name, IOThread *t) {
   std::string buf(size, '\0');
   in.seekg(0);
   in.read(&buf[0], size);
-  t->sendData = std::move(buf);
+  *data = std::move(buf);
   return 0;
 }
 
-static void waitAndReport(const apib::ThreadList &threads, int duration,
-                          bool warmup) {
-  int durationLeft = duration;
-  int toSleep;
+// Whether to keep interval reports off of standard output
+static bool quietOutput() { return ShortOutput || (JsonFile == "-"); }
+
+static bool metricsEnabled() {
+  return !MetricsFile.empty() || (MetricsPort >= 0);
+}
+
+// Sum the progress of all the worker processes
+static int64_t workerSuccesses(const apib::WorkerCounters *counters) {
+  int64_t total = 0;
+  for (int i = 0; i < NumProcesses; i++) {
+    total += counters[i].successfulRequests;
+  }
+  return total;
+}
+
+static void waitForWorkers(const apib::WorkerCounters *counters,
+                           int duration, bool warmup) {
+  const int reportTime = ReportSleepTime * 1000;
+  const int tick = (metricsEnabled() ? MetricsInterval : reportTime);
+  int durationLeft = duration * 1000;
+  int sinceReport = 0;
 
   while (durationLeft > 0) {
-    if (durationLeft < ReportSleepTime) {
-      toSleep = durationLeft;
-    } else {
-      toSleep = ReportSleepTime;
+    const int toSleep = std::min(std::min(durationLeft, tick),
+                                 reportTime - sinceReport);
+    usleep(toSleep * 1000);
+    durationLeft -= toSleep;
+    sinceReport += toSleep;
+
+    const int64_t successes = workerSuccesses(counters);
+    if ((sinceReport >= reportTime) || (durationLeft <= 0)) {
+      if (quietOutput()) {
+        apib::RecordInterval(successes);
+      } else {
+        ReportInterval(std::cout, successes, duration, warmup);
+      }
+      sinceReport = 0;
     }
+    apib::PublishMetrics(successes, warmup);
+  }
+}
 
-    sleep(toSleep);
-    if (ShortOutput) {
-      apib::SampleCPU();
-    } else {
-      ReportInterval(std::cout, threads, duration, warmup);
+static void requestTrace(int sig) { TraceRequested = 1; }
+
+// With --trace, SIGUSR1 asks for the trace so far instead of killing us
+static void installTraceHandler() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = requestTrace;
+  sigaction(SIGUSR1, &sa, nullptr);
+}
+
+// Write the events that the threads have kept so far
+static void writeTrace(const apib::ThreadList &threads,
+                       const std::string &fileName) {
+  std::vector<std::vector<apib::TraceEvent>> events(threads.size());
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->traceSnapshot(&(events[i]));
+  }
+  std::ofstream out(fileName);
+  apib::WriteChromeTrace(out, events);
+  out.close();
+  if (out.fail()) {
+    cerr << "Error writing " << fileName << endl;
+  } else if (!quietOutput()) {
+    cout << "Wrote trace to " << fileName << endl;
+  }
+}
+
+// Sleep for "ms" milliseconds, writing the trace right away if SIGUSR1
+// arrives in the meantime
+static void sleepAndTrace(const apib::ThreadList &threads, int ms) {
+  const int64_t end = apib::GetTime() + (ms * 1000000LL);
+  for (;;) {
+    if (TraceRequested) {
+      TraceRequested = 0;
+      writeTrace(threads, absl::StrCat(TraceFile, ".", ++TraceDumps));
     }
+    const int64_t left = end - apib::GetTime();
+    if (left <= 0) {
+      return;
+    }
+    // The signal cuts this short
+    usleep(left / 1000);
+  }
+}
+
+// Report progress every ReportSleepTime seconds, and update the metrics
+// file, if any, more often than that.
+static void waitAndReport(const apib::ThreadList &threads, int duration,
+                          bool warmup) {
+  const int reportTime = ReportSleepTime * 1000;
+  const int tick = (metricsEnabled() ? MetricsInterval : reportTime);
+  int durationLeft = duration * 1000;
+  int sinceReport = 0;
+
+  while (durationLeft > 0) {
+    const int toSleep = std::min(std::min(durationLeft, tick),
+                                 reportTime - sinceReport);
+    sleepAndTrace(threads, toSleep);
     durationLeft -= toSleep;
+    sinceReport += toSleep;
+
+    if ((sinceReport >= reportTime) || (durationLeft <= 0)) {
+      if (quietOutput()) {
+        apib::RecordInterval(threads);
+      } else {
+        ReportInterval(std::cout, threads, duration, warmup);
+      }
+      sinceReport = 0;
+    }
+    apib::PublishMetrics(threads, warmup);
   }
 }
 
-static void processOAuth(const absl::string_view arg) {
+static bool processOAuth(const absl::string_view arg) {
+  if (Signer) {
+    cerr << "Only one of -O and --sign may be used" << endl;
+    return false;
+  }
   const std::vector<std::string> parts = absl::StrSplit(arg, ':');
-  OAuth = new OAuthInfo();
+  OAuthInfo oauth;
   if (parts.size() > 0) {
-    OAuth->consumerKey = parts[0];
+    oauth.consumerKey = parts[0];
   }
   if (parts.size() > 1) {
-    OAuth->consumerSecret = parts[1];
+    oauth.consumerSecret = parts[1];
   }
   if (parts.size() > 2) {
-    OAuth->accessToken = parts[2];
+    oauth.accessToken = parts[2];
   }
   if (parts.size() > 3) {
-    OAuth->tokenSecret = parts[3];
+    oauth.tokenSecret = parts[3];
   }
+  Signer.reset(new apib::OAuthSigner(oauth));
   SetHeaders |= IOThread::kAuthorizationSet;
+  return true;
+}
+
+static bool processSign(const absl::string_view arg) {
+  if (Signer) {
+    cerr << "Only one of -O and --sign may be used" << endl;
+    return false;
+  }
+  const auto s = RequestSigner::Parse(arg, &Signer);
+  if (!s.ok()) {
+    cerr << s << endl;
+    return false;
+  }
+  SetHeaders |= IOThread::kAuthorizationSet;
+  return true;
+}
+
+// Compile the templates for every URL plus the headers and body, once
+// for all the threads.
+static bool compileTemplates() {
+  std::string body;
+  if (!FileName.empty() && (readFile(FileName, &body) != 0)) {
+    return false;
+  }
+  auto s = Templates.compile(Headers, body);
+  if (!s.ok()) {
+    cerr << s << endl;
+    return false;
+  }
+  if (Templates.usesCsv() && CsvFile.empty()) {
+    cerr << "${csv} placeholders need --csv" << endl;
+    return false;
+  }
+  if (!CsvFile.empty()) {
+    s = Templates.csv.load(CsvFile);
+    if (!s.ok()) {
+      cerr << "Error reading CSV file: " << s << endl;
+      return false;
+    }
+  }
+  if (Signer && !Templates.pathsAreLiteral()) {
+    // Signers cache what they can for each URL
+    cerr << "URLs with placeholders can't be signed" << endl;
+    return false;
+  }
+  // Without any placeholders, every request is the same, and the I/O
+  // threads can re-use them as usual.
+  TemplatesActive = !Templates.isLiteral();
+  return true;
+}
+
+// Prepare the streamed body, which all the threads share
+static bool makeStream() {
+  std::string fileData;
+  if (!FileName.empty() && (readFile(FileName, &fileData) != 0)) {
+    return false;
+  }
+  const auto s = apib::BodySource::Parse(StreamSpec, fileData, &Stream);
+  if (!s.ok()) {
+    cerr << s << endl;
+    return false;
+  }
+  if (Signer) {
+    cerr << "Streamed bodies can't be signed" << endl;
+    return false;
+  }
+  if (TemplatesActive && !Templates.body.isLiteral()) {
+    cerr << "Streamed bodies can't have placeholders" << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool processBackoff(const absl::string_view arg) {
+  const std::vector<absl::string_view> parts = absl::StrSplit(arg, ':');
+  if (!absl::SimpleAtoi(parts[0], &BackoffMin)) {
+    return false;
+  }
+  if (parts.size() > 1) {
+    if (!absl::SimpleAtoi(parts[1], &BackoffMax)) {
+      return false;
+    }
+  } else {
+    BackoffMax = BackoffMin;
+  }
+  // The delay is a 32-bit count of milliseconds, which is almost 25 days
+  return (parts.size() <= 2) && (BackoffMax >= BackoffMin) &&
+         (BackoffMax <= INT32_MAX);
+}
+
+static bool processSource(const absl::string_view arg) {
+  const std::vector<absl::string_view> addrs = absl::StrSplit(arg, ',');
+  for (auto it = addrs.cbegin(); it != addrs.cend(); it++) {
+    const auto s = apib::SourceAddress::parse(*it);
+    if (!s.ok()) {
+      cerr << "Invalid source address: " << s << endl;
+      return false;
+    }
+    SourceAddresses.push_back(s.value());
+  }
+  return true;
+}
+
+static bool processBalance(const absl::string_view arg) {
+  const auto s = apib::Balance::Parse(arg, &AddressBalance);
+  if (!s.ok()) {
+    cerr << s << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool processSockOpt(const absl::string_view arg) {
+  const auto s = SocketOptions.add(arg);
+  if (!s.ok()) {
+    cerr << s << endl;
+    cerr << "Supported socket options: " << apib::SocketOptions::names()
+         << endl;
+    return false;
+  }
+  return true;
+}
+
+// Parse "--metrics-port" as [address:]port.
+static bool processMetricsPort(absl::string_view arg) {
+  const auto colon = arg.rfind(':');
+  if (colon != absl::string_view::npos) {
+    absl::string_view addr = arg.substr(0, colon);
+    if ((addr.size() > 1) && (addr.front() == '[') && (addr.back() == ']')) {
+      addr = addr.substr(1, addr.size() - 2);
+    }
+    MetricsAddress = std::string(addr);
+    arg = arg.substr(colon + 1);
+  }
+  return absl::SimpleAtoi(arg, &MetricsPort) && (MetricsPort >= 0) &&
+         (MetricsPort <= 65535);
+}
+
+// Work out the sets of CPUs to pin threads to, based on "--cpu-affinity."
+static bool assignCpuSlots() {
+  if (CpuAffinity.empty()) {
+    return true;
+  }
+
+  const std::vector<std::vector<int>> nodes = apib::cpu_GetNodes();
+  std::vector<int> cpus;
+  if (CpuAffinity == "nodes") {
+    // Threads may float among the CPUs in a node
+    CpuSlots = nodes;
+    return true;
+  } else if (CpuAffinity == "cores") {
+    // Take one CPU from each node in turn so that threads are spread
+    // evenly across the nodes.
+    for (size_t i = 0;; i++) {
+      bool found = false;
+      for (auto it = nodes.cbegin(); it != nodes.cend(); it++) {
+        if (i < it->size()) {
+          cpus.push_back((*it)[i]);
+          found = true;
+        }
+      }
+      if (!found) {
+        break;
+      }
+    }
+  } else if (absl::StartsWith(CpuAffinity, "irq:")) {
+    const std::string iface = CpuAffinity.substr(4);
+    cpus = apib::cpu_GetInterfaceCpus(iface);
+    if (cpus.empty()) {
+      cerr << "Can't find which CPUs handle interrupts for " << iface << endl;
+      return false;
+    }
+  } else if (!apib::parseCpuList(CpuAffinity, &cpus) || cpus.empty()) {
+    cerr << "Invalid CPU list: " << CpuAffinity << endl;
+    return false;
+  }
+
+  for (auto it = cpus.cbegin(); it != cpus.cend(); it++) {
+    CpuSlots.push_back(std::vector<int>(1, *it));
+  }
+  return true;
 }
 
 static void addHeader(const absl::string_view val) {
@@ -330,14 +783,14 @@ static int initializeThread(int ix, IOThread *t) {
     numConn++;
   }
 
-  if (!FileName.empty()) {
-    if (readFile(FileName, t) != 0) {
+  if (!FileName.empty() && !Stream) {
+    if (readFile(FileName, &t->sendData) != 0) {
       return 3;
     }
   }
 
   if (Verb.empty()) {
-    if (FileName.empty()) {
+    if (FileName.empty() && !Stream) {
       t->httpVerb = "GET";
     } else {
       t->httpVerb = "POST";
@@ -346,23 +799,374 @@ static int initializeThread(int ix, IOThread *t) {
     t->httpVerb = Verb;
   }
 
-  t->index = ix;
+  t->index = ThreadIndexBase + ix;
   t->keepRunning = (JustOnce ? -1 : 1);
   t->numConnections = numConn;
   t->verbose = Verbose;
   t->sslCipher = SslCipher;
   t->headers = &Headers;
   t->headersSet = SetHeaders;
+  t->sourceAddresses = &SourceAddresses;
+  t->socketOptions = &SocketOptions;
+  t->fastOpen = FastOpen;
+  t->tlsResume = TlsResume;
+  t->tlsEarlyData = TlsEarlyData;
+  if (!CpuSlots.empty()) {
+    t->cpus = CpuSlots[t->index % CpuSlots.size()];
+  }
   t->thinkTime = ThinkTime;
   t->noKeepAlive = (KeepAlive != KeepAliveAlways);
-  t->oauth = OAuth;
+  t->signer = Signer.get();
+  t->templates = (TemplatesActive ? &Templates : nullptr);
+  t->stream = Stream.get();
+  t->backoffMin = BackoffMin;
+  t->backoffMax = BackoffMax;
+  t->hostPoolSize = HostPoolSize;
+  t->loopTime = LoopTime;
+  t->traceEvents = (TraceFile.empty() ? 0 : TraceEvents);
 
   return createSslContext(t);
 }
 
+// In a worker process, publish progress to the parent every second instead
+// of printing it.
+static void waitAndPublish(const apib::ThreadList &threads, int duration,
+                           apib::WorkerCounters *counters) {
+  for (int left = duration; left > 0; left--) {
+    sleep(1);
+    const auto r = apib::ReportIntervalResults(threads);
+    counters->successfulRequests += r.successfulRequests;
+  }
+}
+
+// Run the benchmark on NumThreads threads in this process. A worker
+// process passes "counters" to report its progress to the parent.
+static int runThreads(int duration, int warmupTime,
+                      apib::WorkerCounters *counters) {
+  if (DnsRefresh > 0) {
+    URLInfo::StartRefresh(DnsRefresh);
+  }
+  if (!TraceFile.empty() && (counters == nullptr)) {
+    installTraceHandler();
+  }
+  apib::ThreadList threads;
+  for (int i = 0; i < NumThreads; i++) {
+    threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
+    int err = initializeThread(i, threads[i].get());
+    if (err != 0) {
+      return err;
+    }
+    threads[i]->Start();
+  }
+
+  if (warmupTime > 0) {
+    RecordStart(true, threads);
+    if (counters == nullptr) {
+      waitAndReport(threads, warmupTime, true);
+    } else {
+      waitAndPublish(threads, warmupTime, counters);
+    }
+  }
+  RecordStart(true, threads);
+  if (counters == nullptr) {
+    waitAndReport(threads, duration, false);
+  } else {
+    waitAndPublish(threads, duration, counters);
+  }
+  RecordStop(threads);
+
+  for (auto it = threads.begin(); it != threads.end(); it++) {
+    (*it)->RequestStop(2);
+  }
+  for (auto it = threads.begin(); it != threads.end(); it++) {
+    (*it)->Join();
+  }
+  URLInfo::StopRefresh();
+  if (!TraceFile.empty()) {
+    writeTrace(threads, TraceFile);
+  }
+  return 0;
+}
+
+// Print how the connections and requests were spread across the addresses
+// of each host, if any host had more than one.
+static void printAddressStats() {
+  const auto &hosts = URLInfo::Hosts();
+  bool several = false;
+  for (auto h = hosts.cbegin(); h != hosts.cend(); h++) {
+    several |= ((*h)->all().size() > 1);
+  }
+  if (!several) {
+    return;
+  }
+  cout << "Addresses:" << endl;
+  for (auto h = hosts.cbegin(); h != hosts.cend(); h++) {
+    const auto &all = (*h)->all();
+    for (auto a = all.cbegin(); a != all.cend(); a++) {
+      cout << "  " << (*h)->name() << ' ' << (*a)->address.str() << ": "
+           << (*a)->connections << " connections, " << (*a)->requests
+           << " requests" << ((*a)->current ? "" : " (no longer in DNS)")
+           << endl;
+    }
+  }
+}
+
+static bool writeAll(int fd, const std::string &data) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    const ssize_t w = write(fd, data.data() + pos, data.size() - pos);
+    if (w <= 0) {
+      return false;
+    }
+    pos += w;
+  }
+  return true;
+}
+
+static std::string readAll(int fd) {
+  std::string data;
+  char buf[8192];
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof(buf))) > 0) {
+    data.append(buf, r);
+  }
+  return data;
+}
+
+// Create the metrics file, and start serving it if requested. The
+// exporter needs the page even if there is no file.
+static bool startMetrics() {
+  if (!metricsEnabled()) {
+    return true;
+  }
+  const auto s = apib::RecordMetricsFile(MetricsFile);
+  if (!s.ok()) {
+    cerr << "Can't create metrics file " << MetricsFile << ": " << s << endl;
+    return false;
+  }
+  if (MetricsPort >= 0) {
+    // Set up CPU measurement here, before the exporter thread starts
+    const bool cpuAvailable = (apib::cpu_Init() == 0);
+    MetricsExporter = new apib::MetricsServer();
+    const auto ss =
+        MetricsExporter->start(MetricsAddress, MetricsPort,
+                               apib::GetMetricsPage(), cpuAvailable);
+    if (!ss.ok()) {
+      cerr << "Can't serve metrics on port " << MetricsPort << ": " << ss
+           << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void stopMetrics() {
+  if (MetricsExporter != nullptr) {
+    MetricsExporter->stop();
+    delete MetricsExporter;
+    MetricsExporter = nullptr;
+  }
+}
+
+// Kill and reap the workers that have started, when something goes wrong
+// before they finish.
+static void stopWorkers(const std::vector<pid_t> &pids,
+                        const std::vector<int> &pipes) {
+  for (auto it = pids.cbegin(); it != pids.cend(); it++) {
+    kill(*it, SIGKILL);
+  }
+  for (auto it = pids.cbegin(); it != pids.cend(); it++) {
+    waitpid(*it, nullptr, 0);
+  }
+  for (auto it = pipes.cbegin(); it != pipes.cend(); it++) {
+    close(*it);
+  }
+}
+
+// Fork NumProcesses worker processes, each of which runs a share of the
+// threads and connections with its own heap, TLS contexts, and event loops.
+// Workers publish progress in shared memory so that this process can print
+// interval reports, and send their full results back over a pipe at the
+// end to be merged.
+static int runProcesses(int duration, int warmupTime) {
+  const size_t sharedSize = sizeof(apib::WorkerCounters) * NumProcesses;
+  void *shared = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("Can't allocate shared memory");
+    return -1;
+  }
+  apib::WorkerCounters *counters =
+      static_cast<apib::WorkerCounters *>(shared);
+  for (int i = 0; i < NumProcesses; i++) {
+    new (&counters[i]) apib::WorkerCounters();
+    counters[i].successfulRequests = 0;
+  }
+
+  const int totalThreads = NumThreads;
+  const int totalConnections = NumConnections;
+  std::vector<pid_t> pids;
+  std::vector<int> pipes;
+  int threadBase = 0;
+  // Don't let the workers print anything that's still buffered.
+  cout.flush();
+
+  for (int i = 0; i < NumProcesses; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      perror("Can't create pipe");
+      stopWorkers(pids, pipes);
+      munmap(shared, sharedSize);
+      return -1;
+    }
+    int numThreads = totalThreads / NumProcesses;
+    if (i < (totalThreads % NumProcesses)) {
+      numThreads++;
+    }
+    int numConnections = totalConnections / NumProcesses;
+    if (i < (totalConnections % NumProcesses)) {
+      numConnections++;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+      perror("Can't fork worker process");
+      close(fds[0]);
+      close(fds[1]);
+      stopWorkers(pids, pipes);
+      munmap(shared, sharedSize);
+      return -1;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      for (auto it = pipes.cbegin(); it != pipes.cend(); it++) {
+        close(*it);
+      }
+      NumThreads = numThreads;
+      NumConnections = numConnections;
+      ThreadIndexBase = threadBase;
+      // Only the parent talks to the remote monitors.
+      RecordInit("", "");
+      int err = runThreads(duration, warmupTime, &counters[i]);
+      if ((err == 0) && !writeAll(fds[1], apib::SerializeResults())) {
+        err = -1;
+      }
+      // Skip exit handlers that belong to the parent
+      _exit(err == 0 ? 0 : 1);
+    }
+
+    close(fds[1]);
+    pids.push_back(pid);
+    pipes.push_back(fds[0]);
+    threadBase += numThreads;
+  }
+
+  // Workers don't need the metrics file, so open it only after they start
+  if (!startMetrics()) {
+    stopWorkers(pids, pipes);
+    munmap(shared, sharedSize);
+    return -1;
+  }
+  const apib::ThreadList noThreads;
+  if (warmupTime > 0) {
+    RecordStart(true, noThreads);
+    waitForWorkers(counters, warmupTime, true);
+  }
+  RecordStart(true, noThreads);
+  waitForWorkers(counters, duration, false);
+  RecordStop(noThreads);
+
+  int result = 0;
+  for (int i = 0; i < NumProcesses; i++) {
+    const std::string data = readAll(pipes[i]);
+    close(pipes[i]);
+    int status = 0;
+    if (waitpid(pids[i], &status, 0) < 0) {
+      perror("Can't wait for worker process");
+      result = -1;
+      continue;
+    }
+    if (WIFSIGNALED(status)) {
+      cerr << "Worker process " << i << " crashed with signal "
+           << WTERMSIG(status) << endl;
+      result = -1;
+      continue;
+    }
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+      cerr << "Worker process " << i << " failed" << endl;
+      result = -1;
+      continue;
+    }
+    const auto ms = apib::MergeResults(data);
+    if (!ms.ok()) {
+      cerr << "Can't merge the results of worker process " << i << ": " << ms
+           << endl;
+      result = -1;
+    }
+  }
+  munmap(shared, sharedSize);
+  return result;
+}
+
+// For --calibrate, start the built-in server with as many threads as the
+// client, and point the client at it.
+static bool startCalibrateServer(std::string *url) {
+  if (NumThreads < 1) {
+    NumThreads = 1;
+  }
+  CalibrateServer = new apib::Responder();
+  const auto s = CalibrateServer->start(NumThreads);
+  if (!s.ok()) {
+    cerr << "Can't start the calibration server: " << s << endl;
+    return false;
+  }
+  *url = absl::StrCat("http://127.0.0.1:", CalibrateServer->port(), "/");
+  if (!quietOutput()) {
+    cout << "Calibrating against a built-in server at " << *url << endl;
+  }
+  return true;
+}
+
+static void stopCalibrateServer() {
+  if (CalibrateServer != nullptr) {
+    CalibrateServer->stop();
+    delete CalibrateServer;
+    CalibrateServer = nullptr;
+  }
+}
+
+static apib::RunInfo makeRunInfo(int argc, char *const *argv,
+                                 const std::string &url, int duration,
+                                 int warmupTime) {
+  apib::RunInfo info;
+  info.name = RunName;
+  for (int i = 0; i < argc; i++) {
+    if (i > 0) {
+      info.commandLine += ' ';
+    }
+    info.commandLine += argv[i];
+  }
+  info.url = url;
+  if (!Verb.empty()) {
+    info.method = Verb;
+  } else {
+    info.method = (FileName.empty() ? "GET" : "POST");
+  }
+  info.threads = NumThreads;
+  info.connections = NumConnections;
+  info.processes = NumProcesses;
+  info.duration = (JustOnce ? 0 : duration);
+  info.warmup = (JustOnce ? 0 : warmupTime);
+  info.keepAlive = KeepAlive;
+  info.thinkTime = ThinkTime;
+  info.clock = (apib::TscEnabled() ? "tsc" : "monotonic");
+  info.loopTime = LoopTime;
+  return info;
+}
+
 int main(int argc, char *const *argv) {
   /* Arguments */
-  int duration = DefaultDuration;
+  int duration = -1;
   int warmupTime = DefaultWarmup;
   bool doHelp = false;
   bool doVersion = false;
@@ -440,7 +1244,9 @@ int main(int argc, char *const *argv) {
         RunName = optarg;
         break;
       case 'O':
-        processOAuth(optarg);
+        if (!processOAuth(optarg)) {
+          failed = true;
+        }
         break;
       case 'S':
         ShortOutput = true;
@@ -460,6 +1266,108 @@ int main(int argc, char *const *argv) {
       case '1':
         JustOnce = true;
         break;
+      case BackoffOption:
+        if (!processBackoff(optarg)) {
+          failed = true;
+        }
+        break;
+      case SourceOption:
+        if (!processSource(optarg)) {
+          failed = true;
+        }
+        break;
+      case SockOptOption:
+        if (!processSockOpt(optarg)) {
+          failed = true;
+        }
+        break;
+      case FastOpenOption:
+        if (apib::Socket::fastOpenSupported()) {
+          FastOpen = true;
+        } else {
+          cerr << "TCP Fast Open is not supported on this platform" << endl;
+          failed = true;
+        }
+        break;
+      case TlsResumeOption:
+        TlsResume = true;
+        break;
+      case TlsEarlyDataOption:
+        TlsResume = true;
+        TlsEarlyData = true;
+        break;
+      case CpuAffinityOption:
+        CpuAffinity = optarg;
+        break;
+      case ProcessesOption:
+        if (!absl::SimpleAtoi(optarg, &NumProcesses) || (NumProcesses < 1)) {
+          failed = true;
+        }
+        break;
+      case MetricsFileOption:
+        MetricsFile = optarg;
+        break;
+      case MetricsIntervalOption:
+        if (!absl::SimpleAtoi(optarg, &MetricsInterval) ||
+            (MetricsInterval < 1)) {
+          failed = true;
+        }
+        break;
+      case JsonOption:
+        JsonFile = optarg;
+        break;
+      case TscOption:
+        UseTsc = true;
+        break;
+      case LoopTimeOption:
+        LoopTime = true;
+        break;
+      case CalibrateOption:
+        Calibrate = true;
+        break;
+      case SignOption:
+        if (!processSign(optarg)) {
+          failed = true;
+        }
+        break;
+      case TemplateOption:
+        UseTemplates = true;
+        break;
+      case CsvOption:
+        CsvFile = optarg;
+        break;
+      case StreamOption:
+        StreamSpec = optarg;
+        break;
+      case BalanceOption:
+        if (!processBalance(optarg)) {
+          failed = true;
+        }
+        break;
+      case DnsRefreshOption:
+        if (!absl::SimpleAtoi(optarg, &DnsRefresh) || (DnsRefresh <= 0)) {
+          failed = true;
+        }
+        break;
+      case TraceOption:
+        TraceFile = optarg;
+        break;
+      case TraceEventsOption:
+        if (!absl::SimpleAtoi(optarg, &TraceEvents) || (TraceEvents <= 0) ||
+            (TraceEvents > MaxTraceEvents)) {
+          failed = true;
+        }
+        break;
+      case HostPoolOption:
+        if (!absl::SimpleAtoi(optarg, &HostPoolSize) || (HostPoolSize < 0)) {
+          failed = true;
+        }
+        break;
+      case MetricsPortOption:
+        if (!processMetricsPort(optarg)) {
+          failed = true;
+        }
+        break;
       case '?':
       case ':':
         // Unknown. Error was printed.
@@ -483,7 +1391,17 @@ int main(int argc, char *const *argv) {
     return 0;
   }
 
-  if (!failed && (optind == (argc - 1))) {
+  if (duration < 0) {
+    duration = (Calibrate ? DefaultCalibrateDuration : DefaultDuration);
+  }
+
+  if (Calibrate) {
+    // The built-in server takes the place of the URL
+    if (optind != argc) {
+      cerr << "--calibrate does not take a URL" << endl;
+      failed = true;
+    }
+  } else if (!failed && (optind == (argc - 1))) {
     url = argv[optind];
   } else {
     // No URL
@@ -501,6 +1419,11 @@ int main(int argc, char *const *argv) {
     addHeader(hdr.str());
   }
 
+  if (Calibrate && !startCalibrateServer(&url)) {
+    goto finished;
+  }
+
+  URLInfo::SetBalance(AddressBalance);
   if (!url.empty()) {
     if (url[0] == '@') {
       const auto s = URLInfo::InitFile(url.substr(1));
@@ -516,23 +1439,75 @@ int main(int argc, char *const *argv) {
       }
     }
 
-    if (setProcessLimits(NumConnections) != 0) {
+    if (!TraceFile.empty() && (NumProcesses > 1)) {
+      cerr << "--trace can't be used with --processes" << endl;
+      goto finished;
+    }
+    if (!CsvFile.empty() && !UseTemplates) {
+      cerr << "--csv needs --template" << endl;
+      goto finished;
+    }
+    if (UseTemplates && !compileTemplates()) {
+      goto finished;
+    }
+    if (!StreamSpec.empty() && !makeStream()) {
+      goto finished;
+    }
+
+    // Each connection may also keep idle connections to other servers
+    const int pooled = std::min<int>(
+        HostPoolSize, std::max<int>(URLInfo::Count(), 1) - 1);
+    if (setProcessLimits(NumConnections * (1 + pooled)) != 0) {
+      goto finished;
+    }
+
+    if (!assignCpuSlots()) {
       goto finished;
     }
 
     if (NumThreads < 1) {
-      NumThreads = apib::cpu_Count();
+      if (CpuSlots.empty()) {
+        NumThreads = apib::cpu_Count();
+      } else {
+        // One thread for each CPU that we're pinning to
+        NumThreads = 0;
+        for (auto it = CpuSlots.cbegin(); it != CpuSlots.cend(); it++) {
+          NumThreads += it->size();
+        }
+      }
     }
     if (NumThreads > NumConnections) {
       NumThreads = NumConnections;
     }
+    // Every process needs at least one thread and one connection
+    if (NumProcesses > NumConnections) {
+      NumProcesses = NumConnections;
+    }
+    if (NumThreads < NumProcesses) {
+      NumThreads = NumProcesses;
+    }
 
     if (Verbose) {
       printLibraryInfo();
     }
 
+    if (UseTsc) {
+      // Calibrate before any threads or processes start
+      const auto s = apib::EnableTsc();
+      if (!s.ok()) {
+        cerr << "Not using the TSC: " << s << endl;
+      } else if (Verbose) {
+        cout << "Using the TSC at " << apib::TickFrequency() / 1000000.0
+             << " MHz" << endl;
+      }
+    }
+
     RecordInit(monitorHost, monitor2Host);
 
+    if ((NumProcesses == 1) && !startMetrics()) {
+      goto finished;
+    }
+
     apib::ThreadList threads;
     if (JustOnce) {
       threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
@@ -540,34 +1515,26 @@ int main(int argc, char *const *argv) {
       if (err != 0) {
         goto finished;
       }
+      // Nothing waits for SIGUSR1 here, so the trace is only written at
+      // the end
+      if (!TraceFile.empty()) {
+        installTraceHandler();
+      }
       RecordStart(true, threads);
       threads[0]->Start();
       threads[0]->Join();
       RecordStop(threads);
-
-    } else {
-      for (int i = 0; i < NumThreads; i++) {
-        threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
-        int err = initializeThread(i, threads[i].get());
-        if (err != 0) {
-          goto finished;
-        }
-        threads[i]->Start();
+      if (!TraceFile.empty()) {
+        writeTrace(threads, TraceFile);
       }
 
-      if (warmupTime > 0) {
-        RecordStart(true, threads);
-        waitAndReport(threads, warmupTime, true);
-      }
-      RecordStart(true, threads);
-      waitAndReport(threads, duration, false);
-      RecordStop(threads);
-
-      for (auto it = threads.begin(); it != threads.end(); it++) {
-        (*it)->RequestStop(2);
+    } else if (NumProcesses > 1) {
+      if (runProcesses(duration, warmupTime) != 0) {
+        goto finished;
       }
-      for (auto it = threads.begin(); it != threads.end(); it++) {
-        (*it)->Join();
+    } else {
+      if (runThreads(duration, warmupTime, nullptr) != 0) {
+        goto finished;
       }
     }
   } else {
@@ -575,11 +1542,43 @@ int main(int argc, char *const *argv) {
     return 0;
   }
 
-  if (ShortOutput) {
+  apib::PublishFinalMetrics();
+  if (!JsonFile.empty()) {
+    const apib::RunInfo info =
+        makeRunInfo(argc, argv, url, duration, warmupTime);
+    if (JsonFile == "-") {
+      apib::PrintJsonResults(std::cout, info);
+    } else {
+      std::ofstream jsonOut(JsonFile);
+      apib::PrintJsonResults(jsonOut, info);
+      if (jsonOut.fail()) {
+        cerr << "Error writing " << JsonFile << endl;
+      }
+    }
+  }
+  if (JsonFile == "-") {
+    // Already printed
+    if (!Calibrate) {
+      apib::PrintSaturationWarning(cerr, apib::ClientCpuSaturated());
+    }
+  } else if (ShortOutput) {
     apib::PrintShortResults(std::cout, RunName, NumThreads, NumConnections);
+    if (!Calibrate) {
+      apib::PrintSaturationWarning(cerr, apib::ClientCpuSaturated());
+    }
+  } else if (Calibrate) {
+    apib::PrintCalibrationResults(std::cout);
   } else {
     apib::PrintFullResults(std::cout);
+    if (!SocketOptions.empty()) {
+      cout << "Socket options:       " << SocketOptions.str() << endl;
+    }
+    if (NumProcesses == 1) {
+      printAddressStats();
+    }
   }
+  stopMetrics();
+  stopCalibrateServer();
   apib::EndReporting();
 
 finished:
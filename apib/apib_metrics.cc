@@ -0,0 +1,132 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_metrics.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#include "apib/apib_time.h"
+
+namespace apib {
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+              "Sequence must be a plain 64-bit word");
+// The layout is documented in doc/METRICS.md. Change kMetricsVersion
+// and the documentation if these change.
+static_assert(offsetof(MetricsPage, updateTime) == 48,
+              "Metrics layout changed");
+static_assert(offsetof(MetricsPage, intervalTime) == 176,
+              "Metrics layout changed");
+static_assert(offsetof(MetricsPage, buckets) == 304, "Metrics layout changed");
+static_assert(offsetof(MetricsPage, latencySum) == 5168,
+              "Metrics layout changed");
+static_assert(sizeof(MetricsPage) == 5176, "Metrics layout changed");
+
+MetricsFile::~MetricsFile() { close(); }
+
+Status MetricsFile::open(const std::string& path) {
+  close();
+  void* m;
+  if (path.empty()) {
+    m = mmap(nullptr, sizeof(MetricsPage), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+      return Status(Status::IO_ERROR, errno);
+    }
+  } else {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return Status(Status::IO_ERROR, errno);
+    }
+    if (ftruncate(fd, sizeof(MetricsPage)) != 0) {
+      const int err = errno;
+      ::close(fd);
+      return Status(Status::IO_ERROR, err);
+    }
+    m = mmap(nullptr, sizeof(MetricsPage), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    const int err = errno;
+    // The mapping keeps the file open
+    ::close(fd);
+    if (m == MAP_FAILED) {
+      return Status(Status::IO_ERROR, err);
+    }
+  }
+
+  // The page is all zeroes, so it's safe to construct the sequence
+  // counter in place.
+  page_ = static_cast<MetricsPage*>(m);
+  new (&page_->sequence) std::atomic<uint64_t>(0);
+  page_->version = kMetricsVersion;
+  page_->size = sizeof(MetricsPage);
+  page_->pid = getpid();
+  page_->state = METRICS_STARTING;
+  page_->numBuckets = Histogram::kNumBuckets;
+  page_->subBuckets = Histogram::kSubBuckets;
+  page_->numErrorTypes = kMetricsErrorTypes;
+  // Readers check this last
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(page_->magic, kMetricsMagic, sizeof(kMetricsMagic));
+  return Status::kOk;
+}
+
+void MetricsFile::close() {
+  if (page_ != nullptr) {
+    munmap(page_, sizeof(MetricsPage));
+    page_ = nullptr;
+  }
+}
+
+MetricsPage* MetricsFile::beginUpdate() {
+  const uint64_t seq = page_->sequence.load(std::memory_order_relaxed);
+  page_->sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  page_->updateTime = GetWallTime();
+  return page_;
+}
+
+void MetricsFile::endUpdate() {
+  const uint64_t seq = page_->sequence.load(std::memory_order_relaxed);
+  page_->sequence.store(seq + 1, std::memory_order_release);
+}
+
+bool MetricsFile::read(const MetricsPage* page, MetricsPage* copy) {
+  const uint64_t before = page->sequence.load(std::memory_order_acquire);
+  if ((before & 1) != 0) {
+    return false;
+  }
+  // Skip the sequence itself, which can't be copied
+  const size_t seqEnd = offsetof(MetricsPage, sequence) + sizeof(uint64_t);
+  memcpy(copy->magic, page->magic, offsetof(MetricsPage, sequence));
+  memcpy(reinterpret_cast<char*>(copy) + seqEnd,
+         reinterpret_cast<const char*>(page) + seqEnd,
+         sizeof(MetricsPage) - seqEnd);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = page->sequence.load(std::memory_order_relaxed);
+  copy->sequence.store(after, std::memory_order_relaxed);
+  return (before == after);
+}
+
+}  // namespace apib
@@ -0,0 +1,125 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_METRICS_H
+#define APIB_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "apib/apib_histogram.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// The live metrics file is a single MetricsPage, mapped into memory and
+// updated in place while a test runs, so that other programs can map it
+// too and read it as often as they like. doc/METRICS.md describes the
+// layout for readers that are not written in C++.
+
+static const char kMetricsMagic[8] = {'A', 'P', 'I', 'B', 'M', 'E', 'T', 'R'};
+static const uint32_t kMetricsVersion = 1;
+// Room for more error types than there are today, so that adding one
+// does not change the layout.
+static const int kMetricsErrorTypes = 8;
+// The latency percentiles in "intervalLatency" and "latency"
+static const int kMetricsNumPercentiles = 5;
+static const double kMetricsPercentiles[kMetricsNumPercentiles] = {
+    50.0, 90.0, 99.0, 99.9, 100.0};
+
+typedef enum {
+  METRICS_STARTING = 0,
+  METRICS_WARMUP = 1,
+  METRICS_RUNNING = 2,
+  METRICS_DONE = 3,
+} MetricsState;
+
+// All times are in nanoseconds, and all counts except the interval
+// counts are totals since the start of the warm-up or the test. Fields
+// are all 64 bits wide except where noted, in host byte order.
+struct MetricsPage {
+  char magic[8];
+  uint32_t version;
+  // The size of this structure
+  uint32_t size;
+  // A sequence lock. Odd while the page is being updated.
+  std::atomic<uint64_t> sequence;
+  int64_t pid;
+  // A MetricsState
+  int32_t state;
+  int32_t numBuckets;
+  int32_t subBuckets;
+  int32_t numErrorTypes;
+  // Wall-clock time of the last update since the Unix epoch
+  int64_t updateTime;
+  int64_t elapsedTime;
+
+  int64_t successfulRequests;
+  int64_t unsuccessfulRequests;
+  int64_t socketErrors;
+  // "socketErrors" by type, in the order of ErrorType
+  int64_t errorCounts[kMetricsErrorTypes];
+  int64_t connectionsOpened;
+  int64_t bytesSent;
+  int64_t bytesReceived;
+
+  // Results since the previous update
+  int64_t intervalTime;
+  int64_t intervalSuccesses;
+  int64_t intervalFailures;
+  double intervalThroughput;
+  int64_t intervalLatency[kMetricsNumPercentiles];
+
+  // Latency since the start of the test
+  int64_t latencyCount;
+  int64_t latencyMin;
+  int64_t latency[kMetricsNumPercentiles];
+  // Counts for each bucket of a Histogram
+  int64_t buckets[Histogram::kNumBuckets];
+  // The total of all latencies since the start
+  int64_t latencySum;
+};
+
+// Create and update the metrics file. Only one thread may update it.
+class MetricsFile {
+ public:
+  ~MetricsFile();
+
+  // Create the file, or replace it if it exists, and map it. If "path"
+  // is empty, keep the page in memory for readers in this process.
+  Status open(const std::string& path);
+  bool isOpen() const { return page_ != nullptr; }
+  const MetricsPage* page() const { return page_; }
+  void close();
+
+  // Start an update and return the page to modify. Readers will discard
+  // anything they read until "endUpdate" is called.
+  MetricsPage* beginUpdate();
+  void endUpdate();
+
+  // Copy a consistent snapshot of a page that another thread or process
+  // may be updating. Returns false if the copy was not consistent, in
+  // which case the caller should try again.
+  static bool read(const MetricsPage* page, MetricsPage* copy);
+
+ private:
+  MetricsPage* page_ = nullptr;
+};
+
+}  // namespace apib
+
+#endif  // APIB_METRICS_H
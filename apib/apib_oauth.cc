@@ -17,13 +17,12 @@ limitations under the License.
 #include "apib/apib_oauth.h"
 
 #include <assert.h>
-#include <openssl/bio.h>
-#include <openssl/hmac.h>
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 
 #include <algorithm>
 #include <cmath>
-#include <sstream>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 
 #include "absl/strings/str_split.h"
@@ -33,77 +32,102 @@ limitations under the License.
 #include "apib/apib_url.h"
 #include "third_party/base64/base64.h"
 
-#define MAX_NUM_SIZE 256
-
 namespace apib {
 
 typedef std::pair<std::string, std::string> Param;
 typedef std::vector<Param> ParamList;
 
+static const char kHexDigits[] = "0123456789ABCDEF";
+
+static int64_t wallSeconds() { return (int64_t)floor(Seconds(GetWallTime())); }
+
+static bool isUnreserved(char c) {
+  return isalnum(c) || (c == '-') || (c == '.') || (c == '_') || (c == '~');
+}
+
 /* Encode a string as described by the OAuth 1.0a spec, specifically
  * RFC5849. */
-static void appendEncoded(std::ostream& o, const absl::string_view str) {
-  size_t p = 0;
-  while (p < str.size()) {
-    if (isalnum(str[p]) || (str[p] == '-') || (str[p] == '.') ||
-        (str[p] == '_') || (str[p] == '~')) {
-      o << str[p];
+static void appendEncoded(std::string* o, const absl::string_view str) {
+  for (auto it = str.begin(); it != str.end(); it++) {
+    if (isUnreserved(*it)) {
+      o->push_back(*it);
+    } else {
+      const unsigned char ch = *it;
+      o->push_back('%');
+      o->push_back(kHexDigits[ch >> 4]);
+      o->push_back(kHexDigits[ch & 0xf]);
+    }
+  }
+}
 
+// Encode a string that will be encoded again in the base string, in
+// one pass.
+static void appendEncodedTwice(std::string* o, const absl::string_view str) {
+  for (auto it = str.begin(); it != str.end(); it++) {
+    if (isUnreserved(*it)) {
+      o->push_back(*it);
     } else {
-      // Encode string to hexadecimal upper case!
-      const int ch = str[p];
-      o << '%' << std::hex << std::uppercase << ch << std::dec;
+      const unsigned char ch = *it;
+      o->append("%25");
+      o->push_back(kHexDigits[ch >> 4]);
+      o->push_back(kHexDigits[ch & 0xf]);
     }
-    p++;
   }
 }
 
 static std::string reEncode(const absl::string_view str) {
-  std::ostringstream s;
-  appendEncoded(s, str);
-  return s.str();
+  std::string s;
+  appendEncoded(&s, str);
+  return s;
+}
+
+static int hexValue(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+  if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+  return 0;
 }
 
 /*
  * Decode a string as described by the HTML spec and as commonly implemented. */
 static std::string decode(const absl::string_view str) {
-  std::ostringstream decoded;
-  char tmp[3];
-
+  std::string decoded;
   for (size_t ip = 0; ip < str.size(); ip++) {
     const char c = str[ip];
     if (c == '+') {
-      decoded << ' ';
+      decoded.push_back(' ');
     } else if (c == '%') {
       if ((ip + 2) >= str.size()) {
         // Bad input.
         break;
       }
-      tmp[0] = str[ip + 1];
-      tmp[1] = str[ip + 2];
-      tmp[2] = 0;
+      decoded.push_back(
+          (char)((hexValue(str[ip + 1]) << 4) | hexValue(str[ip + 2])));
       ip += 2;
-      const int ch = std::stoi(tmp, nullptr, 16);
-      decoded << (char)ch;
     } else {
-      decoded << str[ip];
+      decoded.push_back(c);
     }
   }
-  return decoded.str();
+  return decoded;
 }
 
 static void readParams(ParamList& paramSrc, const absl::string_view str) {
-  const std::vector<std::string> params = absl::StrSplit(str, '&');
+  const std::vector<absl::string_view> params =
+      absl::StrSplit(str, '&', absl::SkipEmpty());
   for (auto it = params.cbegin(); it != params.cend(); it++) {
-    const std::vector<std::string> nv = absl::StrSplit(*it, '=');
-    if (nv.size() > 0) {
-      const std::string name = decode(nv[0]);
-      std::string val;
-      if (nv.size() > 1) {
-        val = decode(nv[1]);
-      }
-      paramSrc.push_back(std::make_pair(name, val));
+    const std::vector<absl::string_view> nv = absl::StrSplit(*it, '=');
+    const std::string name = decode(nv[0]);
+    std::string val;
+    if (nv.size() > 1) {
+      val = decode(nv[1]);
     }
+    paramSrc.push_back(std::make_pair(name, val));
   }
 }
 
@@ -112,104 +136,219 @@ static void addParam(ParamList& params, const std::string& name,
   params.push_back(std::make_pair(name, val));
 }
 
-static bool compareParam(const Param& p1, const Param& p2) {
-  if (p1.first < p2.first) {
-    return true;
-  }
-  if (p1.first > p2.first) {
-    return false;
-  }
-  return (p1.second < p2.second);
+static void appendParam(std::string* o, const Param& p) {
+  appendEncoded(o, p.first);
+  o->append("%3D");
+  appendEncoded(o, p.second);
 }
 
-std::string oauth_generateHmac(const std::string& base,
-                               const OAuthInfo& oauth) {
-  std::ostringstream key;
-  appendEncoded(key, oauth.consumerSecret);
-  key << '&';
-  if (!oauth.tokenSecret.empty()) {
-    key << oauth.tokenSecret;
+// The base string for one URL, method, and body. The nonce goes between
+// "head" and "middle," and the timestamp between "middle" and "tail,"
+// which puts them in sorted order among the other parameters.
+struct OAuthSigner::Canonical {
+  const URLInfo* url;
+  std::string method;
+  std::string sendData;
+  std::string head;
+  std::string middle;
+  std::string tail;
+};
+
+OAuthSigner::OAuthSigner(const OAuthInfo& oauth) : oauth_(oauth) {
+  std::string key;
+  appendEncoded(&key, oauth.consumerSecret);
+  key.push_back('&');
+  key.append(oauth.tokenSecret);
+  key_.reset(new HmacKey(EVP_sha1(), key));
+
+  headerKeys_ = "\", oauth_consumer_key=\"";
+  appendEncoded(&headerKeys_, oauth.consumerKey);
+  if (!oauth.accessToken.empty()) {
+    headerKeys_.append("\", oauth_token=\"");
+    appendEncoded(&headerKeys_, oauth.accessToken);
   }
-
-  char hmac[EVP_MAX_MD_SIZE];
-  unsigned int hmacLen;
-  HMAC(EVP_sha1(), key.str().c_str(), key.str().size(),
-       (unsigned char*)base.data(), base.size(), (unsigned char*)hmac,
-       &hmacLen);
-
-  char* ret = (char*)malloc(Base64encode_len(hmacLen));
-  Base64encode(ret, hmac, hmacLen);
-  return std::string(ret);
+  headerKeys_.append(
+      "\", oauth_signature_method=\"HMAC-SHA1\", oauth_signature=\"");
 }
 
-static std::string makeNonce(RandomGenerator* rand) {
-  std::ostringstream nonce;
-  nonce << std::hex << std::uppercase << rand->get() << rand->get() << std::dec;
-  return nonce.str();
-}
+OAuthSigner::~OAuthSigner() {}
 
-std::string oauth_buildBaseString(RandomGenerator* rand, const URLInfo& url,
-                                  const std::string& method, long timestamp,
-                                  const std::string& nonce,
-                                  const char* sendData, size_t sendDataSize,
-                                  const OAuthInfo& oauth) {
-  std::ostringstream base;
-  ParamList params;
+std::unique_ptr<RequestSigner> OAuthSigner::clone() const {
+  return std::unique_ptr<RequestSigner>(new OAuthSigner(oauth_));
+}
 
-  base << method << '&';
+const OAuthSigner::Canonical& OAuthSigner::canonical(
+    const URLInfo& url, absl::string_view method, absl::string_view sendData) {
+  if (canonical_.size() <= url.index()) {
+    canonical_.resize(url.index() + 1);
+  }
+  std::unique_ptr<Canonical>& cp = canonical_[url.index()];
+  if (cp && (cp->url == &url) && (cp->method == method) &&
+      (cp->sendData == sendData)) {
+    return *cp;
+  }
 
-  /* Encoded and normalized URL */
-  appendEncoded(base, (url.isSsl() ? URLInfo::kHttps : URLInfo::kHttp));
-  appendEncoded(base, "://");
-  appendEncoded(base, url.hostHeader());
-  appendEncoded(base, url.pathOnly());
+  cp.reset(new Canonical());
+  cp->url = &url;
+  cp->method = std::string(method);
+  cp->sendData = std::string(sendData);
 
-  /* Parse query */
+  ParamList params;
   readParams(params, url.query());
-
-  /* Parse form body */
-  if (sendData != nullptr) {
-    std::string tmpSend(sendData, sendDataSize);
-    readParams(params, tmpSend);
+  readParams(params, sendData);
+  if (!oauth_.consumerKey.empty()) {
+    addParam(params, "oauth_consumer_key", oauth_.consumerKey);
   }
-
-  /* Add additional OAuth params */
-  if (!oauth.consumerKey.empty()) {
-    addParam(params, "oauth_consumer_key", oauth.consumerKey);
-  }
-  if (!oauth.accessToken.empty()) {
-    addParam(params, "oauth_token", oauth.accessToken);
+  if (!oauth_.accessToken.empty()) {
+    addParam(params, "oauth_token", oauth_.accessToken);
   }
   addParam(params, "oauth_signature_method", "HMAC-SHA1");
-  addParam(params, "oauth_nonce", nonce);
-  addParam(params, "oauth_timestamp", std::to_string(timestamp));
 
   /* Re-encode each string! */
-  for (size_t i = 0; i < params.size(); i++) {
-    std::string newName = reEncode(params[i].first);
-    std::string newVal = reEncode(params[i].second);
-    params[i] = std::make_pair(newName, newVal);
+  for (auto it = params.begin(); it != params.end(); it++) {
+    *it = std::make_pair(reEncode(it->first), reEncode(it->second));
   }
-
   /* Sort by name, then by value */
-  std::sort(params.begin(), params.end(), compareParam);
+  std::sort(params.begin(), params.end());
 
-  // Build the final list of params
-  std::ostringstream finalParams;
-  bool first = true;
-  for (auto it = params.begin(); it != params.end(); it++) {
-    if (first) {
-      first = false;
-    } else {
-      finalParams << '&';
-    }
-    finalParams << it->first << '=' << it->second;
+  std::string* h = &(cp->head);
+  h->append(method.data(), method.size());
+  h->push_back('&');
+  /* Encoded and normalized URL */
+  appendEncoded(h, (url.isSsl() ? URLInfo::kHttps : URLInfo::kHttp));
+  appendEncoded(h, "://");
+  appendEncoded(h, url.hostHeader());
+  appendEncoded(h, url.pathOnly());
+  h->push_back('&');
+
+  /* Attach the parameters, which encodes them again */
+  auto it = params.cbegin();
+  for (; (it != params.cend()) && (it->first <= "oauth_nonce"); it++) {
+    appendParam(h, *it);
+    h->append("%26");
+  }
+  h->append("oauth_nonce%3D");
+  for (; (it != params.cend()) && (it->first <= "oauth_timestamp"); it++) {
+    cp->middle.append("%26");
+    appendParam(&(cp->middle), *it);
+  }
+  cp->middle.append("%26oauth_timestamp%3D");
+  for (; it != params.cend(); it++) {
+    cp->tail.append("%26");
+    appendParam(&(cp->tail), *it);
+  }
+  return *cp;
+}
+
+void OAuthSigner::buildBaseString(const URLInfo& url, absl::string_view method,
+                                  absl::string_view sendData, long timestamp,
+                                  absl::string_view nonce, std::string* out) {
+  const Canonical& c = canonical(url, method, sendData);
+  snprintf(timestamp_, sizeof(timestamp_), "%ld", timestamp);
+  out->assign(c.head);
+  appendEncodedTwice(out, nonce);
+  out->append(c.middle);
+  out->append(timestamp_);
+  out->append(c.tail);
+}
+
+void OAuthSigner::sign(absl::string_view base, std::string* out) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  const unsigned int digestLen = key_->sign(base, digest);
+
+  char encoded[(EVP_MAX_MD_SIZE + 2) / 3 * 4 + 1];
+  assert(Base64encode_len(digestLen) <= (int)sizeof(encoded));
+  const int encodedLen = Base64encode(encoded, (const char*)digest, digestLen);
+  // The length includes the null terminator
+  out->assign(encoded, encodedLen - 1);
+}
+
+void OAuthSigner::signRequest(RandomGenerator* rand, const URLInfo& url,
+                              absl::string_view method,
+                              absl::string_view sendData, int64_t now) {
+  const long timestamp = (long)now;
+  snprintf(nonce_, sizeof(nonce_), "%X%X", (unsigned int)rand->get(),
+           (unsigned int)rand->get());
+  buildBaseString(url, method, sendData, timestamp, nonce_, &base_);
+  sign(base_, &signature_);
+}
+
+void OAuthSigner::makeHeader(absl::string_view realm) {
+  result_.assign("Authorization: OAuth realm=\"");
+  result_.append(realm.data(), realm.size());
+  result_.append(headerKeys_);
+  appendEncoded(&result_, signature_);
+  result_.append("\", oauth_timestamp=\"");
+  result_.append(timestamp_);
+  result_.append("\", oauth_nonce=\"");
+  result_.append(nonce_);
+  result_.push_back('\"');
+}
+
+const std::string& OAuthSigner::header(RandomGenerator* rand,
+                                       const URLInfo& url,
+                                       absl::string_view realm,
+                                       absl::string_view method,
+                                       absl::string_view sendData) {
+  signRequest(rand, url, method, sendData, wallSeconds());
+  makeHeader(realm);
+  return result_;
+}
+
+void OAuthSigner::sign(RandomGenerator* rand, const URLInfo& url,
+                       absl::string_view method, absl::string_view body,
+                       int64_t now, std::string* headers) {
+  signRequest(rand, url, method, "", now);
+  makeHeader("");
+  headers->append(result_);
+  headers->append("\r\n");
+}
+
+const std::string& OAuthSigner::queryString(RandomGenerator* rand,
+                                            const URLInfo& url,
+                                            absl::string_view method,
+                                            absl::string_view sendData) {
+  signRequest(rand, url, method, sendData, wallSeconds());
+  result_.assign("oauth_consumer_key=");
+  appendEncoded(&result_, oauth_.consumerKey);
+  if (!oauth_.accessToken.empty()) {
+    result_.append("&oauth_token=");
+    appendEncoded(&result_, oauth_.accessToken);
+  }
+  result_.append("&oauth_signature_method=HMAC-SHA1&oauth_signature=");
+  appendEncoded(&result_, signature_);
+  result_.append("&oauth_timestamp=");
+  result_.append(timestamp_);
+  result_.append("&oauth_nonce=");
+  result_.append(nonce_);
+  return result_;
+}
+
+static absl::string_view sendDataView(const char* sendData, size_t size) {
+  if (sendData == nullptr) {
+    return absl::string_view();
   }
+  return absl::string_view(sendData, size);
+}
+
+std::string oauth_generateHmac(const std::string& base,
+                               const OAuthInfo& oauth) {
+  OAuthSigner signer(oauth);
+  std::string ret;
+  signer.sign(base, &ret);
+  return ret;
+}
 
-  /* Attach them, which encodes them again */
-  base << '&';
-  appendEncoded(base, finalParams.str());
-  return base.str();
+std::string oauth_buildBaseString(RandomGenerator* rand, const URLInfo& url,
+                                  const std::string& method, long timestamp,
+                                  const std::string& nonce,
+                                  const char* sendData, size_t sendDataSize,
+                                  const OAuthInfo& oauth) {
+  OAuthSigner signer(oauth);
+  std::string base;
+  signer.buildBaseString(url, method, sendDataView(sendData, sendDataSize),
+                         timestamp, nonce, &base);
+  return base;
 }
 
 std::string oauth_MakeQueryString(RandomGenerator* rand, const URLInfo& url,
@@ -217,26 +356,9 @@ std::string oauth_MakeQueryString(RandomGenerator* rand, const URLInfo& url,
                                   const char* sendData,
                                   unsigned int sendDataSize,
                                   const OAuthInfo& oauth) {
-  const auto nonce = makeNonce(rand);
-  const long timestamp = (long)floor(Seconds(GetTime()));
-  const auto baseString = oauth_buildBaseString(
-      rand, url, method, timestamp, nonce, sendData, sendDataSize, oauth);
-  const auto hmac = oauth_generateHmac(baseString, oauth);
-
-  /* Now generate the final query string */
-  std::ostringstream query;
-  query << "oauth_consumer_key=";
-  appendEncoded(query, oauth.consumerKey);
-  if (!oauth.accessToken.empty()) {
-    query << "&oauth_token=";
-    appendEncoded(query, oauth.accessToken);
-  }
-  query << "&oauth_signature_method=HMAC-SHA1";
-  query << "&oauth_signature=";
-  appendEncoded(query, hmac);
-  query << "&oauth_timestamp=" << timestamp;
-  query << "&oauth_nonce=" << nonce;
-  return query.str();
+  OAuthSigner signer(oauth);
+  return signer.queryString(rand, url, method,
+                            sendDataView(sendData, sendDataSize));
 }
 
 std::string oauth_MakeHeader(RandomGenerator* rand, const URLInfo& url,
@@ -244,27 +366,9 @@ std::string oauth_MakeHeader(RandomGenerator* rand, const URLInfo& url,
                              const std::string& method, const char* sendData,
                              unsigned int sendDataSize,
                              const OAuthInfo& oauth) {
-  long timestamp = (long)floor(Seconds(GetTime()));
-  const auto nonce = makeNonce(rand);
-
-  const auto baseString = oauth_buildBaseString(
-      rand, url, method, timestamp, nonce, sendData, sendDataSize, oauth);
-  const auto hmac = oauth_generateHmac(baseString, oauth);
-
-  /* Now generate the final query string */
-  std::ostringstream hdr;
-  hdr << "Authorization: OAuth realm=\"" << realm
-      << "\", oauth_consumer_key=\"";
-  appendEncoded(hdr, oauth.consumerKey);
-  if (!oauth.accessToken.empty()) {
-    hdr << "\", oauth_token=\"";
-    appendEncoded(hdr, oauth.accessToken);
-  }
-  hdr << "\", oauth_signature_method=\"HMAC-SHA1\", oauth_signature=\"";
-  appendEncoded(hdr, hmac);
-  hdr << "\", oauth_timestamp=\"" << timestamp << "\", oauth_nonce=\"" << nonce
-      << '\"';
-  return hdr.str();
+  OAuthSigner signer(oauth);
+  return signer.header(rand, url, realm, method,
+                       sendDataView(sendData, sendDataSize));
 }
 
-}  // namespace apib
\ No newline at end of file
+}  // namespace apib
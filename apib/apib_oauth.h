@@ -17,9 +17,13 @@ limitations under the License.
 #ifndef APIB_OAUTH_H
 #define APIB_OAUTH_H
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "absl/strings/string_view.h"
 #include "apib/apib_rand.h"
+#include "apib/apib_signer.h"
 #include "apib/apib_url.h"
 
 namespace apib {
@@ -32,9 +36,69 @@ class OAuthInfo {
   std::string tokenSecret;
 };
 
+// Signs requests for a single thread. For each URL it keeps the parts of
+// the signature base string that are the same for every request, and it
+// keeps the HMAC key ready to use. Signing a request then only formats the
+// nonce and timestamp, hashes, and encodes, into buffers that are reused
+// from one request to the next. Not thread-safe.
+class OAuthSigner : public RequestSigner {
+ public:
+  explicit OAuthSigner(const OAuthInfo& oauth);
+  ~OAuthSigner();
+  OAuthSigner(const OAuthSigner&) = delete;
+  OAuthSigner& operator=(const OAuthSigner&) = delete;
+
+  std::unique_ptr<RequestSigner> clone() const override;
+  // Add an "Authorization" header. The body isn't signed, because it's only
+  // part of the signature when it's an HTML form.
+  void sign(RandomGenerator* rand, const URLInfo& url,
+            absl::string_view method, absl::string_view body, int64_t now,
+            std::string* headers) override;
+
+  // Return an HTTP "Authorization:" header, without the trailing CRLF, for
+  // a request with a new nonce and the current time. The result is only
+  // valid until the next call.
+  const std::string& header(RandomGenerator* rand, const URLInfo& url,
+                            absl::string_view realm, absl::string_view method,
+                            absl::string_view sendData);
+  // Do the same but return a query string.
+  const std::string& queryString(RandomGenerator* rand, const URLInfo& url,
+                                 absl::string_view method,
+                                 absl::string_view sendData);
+
+  // Replace "out" with the signature base string for a request.
+  void buildBaseString(const URLInfo& url, absl::string_view method,
+                       absl::string_view sendData, long timestamp,
+                       absl::string_view nonce, std::string* out);
+  // Replace "out" with the Base64 HMAC-SHA1 signature of "base."
+  void sign(absl::string_view base, std::string* out);
+
+ private:
+  struct Canonical;
+
+  const Canonical& canonical(const URLInfo& url, absl::string_view method,
+                             absl::string_view sendData);
+  // Set up "nonce_", "timestamp_", and "signature_" for a new request.
+  void signRequest(RandomGenerator* rand, const URLInfo& url,
+                   absl::string_view method, absl::string_view sendData,
+                   int64_t now);
+  void makeHeader(absl::string_view realm);
+
+  const OAuthInfo oauth_;
+  std::unique_ptr<HmacKey> key_;
+  // Indexed by URLInfo::index
+  std::vector<std::unique_ptr<Canonical>> canonical_;
+  // The constant part of the header after the realm
+  std::string headerKeys_;
+  char nonce_[24];
+  char timestamp_[24];
+  std::string base_;
+  std::string signature_;
+  std::string result_;
+};
+
 // Generate an OAuth 1.0a query string for the specified URL,
-// form body content, and security tokens. The result must be freed
-// using free().
+// form body content, and security tokens.
 extern std::string oauth_MakeQueryString(
     RandomGenerator* rand, const URLInfo& url, const std::string& method,
     const char* sendData, unsigned int sendDataSize, const OAuthInfo& oauth);
@@ -0,0 +1,36 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_probes.h"
+
+#ifdef APIB_HAVE_PROBES
+
+// Tracers find the semaphores in the ".probes" section, and increment
+// them while they are attached.
+#define APIB_SEMAPHORE(name)                                     \
+  unsigned short apib_##name##_semaphore __attribute__((unused)) \
+      __attribute__((section(".probes"))) = 0
+
+extern "C" {
+APIB_SEMAPHORE(connect);
+APIB_SEMAPHORE(handshake);
+APIB_SEMAPHORE(write_done);
+APIB_SEMAPHORE(first_byte);
+APIB_SEMAPHORE(read_done);
+APIB_SEMAPHORE(close);
+}
+
+#endif  // APIB_HAVE_PROBES
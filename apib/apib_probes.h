@@ -0,0 +1,76 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_PROBES_H
+#define APIB_PROBES_H
+
+/*
+ * Static probes for bpftrace, SystemTap, perf, and other tools that
+ * understand USDT, in the provider "apib." They need the <sys/sdt.h> header
+ * from SystemTap, which on most Linux distributions is in a package called
+ * "systemtap-sdt-dev" or "systemtap-sdt-devel." Without it, or with
+ * APIB_NO_PROBES defined, the probes compile to nothing.
+ *
+ * Each probe has a semaphore that a tracer sets while it is attached, and
+ * callers check "APIB_PROBE_ENABLED" before working out the arguments.
+ * When nothing is attached, a probe costs a load and a branch.
+ */
+
+#if defined(__linux__) && !defined(APIB_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define APIB_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef APIB_HAVE_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// The tracer finds these by name, so they may not be mangled
+extern "C" {
+extern unsigned short apib_connect_semaphore;
+extern unsigned short apib_handshake_semaphore;
+extern unsigned short apib_write_done_semaphore;
+extern unsigned short apib_first_byte_semaphore;
+extern unsigned short apib_read_done_semaphore;
+extern unsigned short apib_close_semaphore;
+}
+
+#define APIB_PROBE_ENABLED(name) \
+  __builtin_expect(*(volatile unsigned short*)&apib_##name##_semaphore, 0)
+#define APIB_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(apib, name, a1, a2, a3)
+#define APIB_PROBE4(name, a1, a2, a3, a4) \
+  DTRACE_PROBE4(apib, name, a1, a2, a3, a4)
+#define APIB_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+  DTRACE_PROBE6(apib, name, a1, a2, a3, a4, a5, a6)
+
+#else
+
+#define APIB_PROBE_ENABLED(name) false
+#define APIB_PROBE3(name, a1, a2, a3) \
+  do {                                \
+  } while (0)
+#define APIB_PROBE4(name, a1, a2, a3, a4) \
+  do {                                    \
+  } while (0)
+#define APIB_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+  do {                                            \
+  } while (0)
+
+#endif  // APIB_HAVE_PROBES
+
+#endif  // APIB_PROBES_H
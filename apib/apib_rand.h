@@ -30,6 +30,9 @@ class RandomGenerator {
   RandomGenerator();
   int32_t get() { return dist_(engine_); }
   int32_t get(int32_t min, int32_t max);
+  // The raw output of the generator, which is much faster than "get" when
+  // the caller just needs random bits. Only the low 30 bits are useful.
+  uint32_t bits() { return engine_(); }
 
  private:
   std::minstd_rand engine_;
@@ -21,12 +21,16 @@ limitations under the License.
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
@@ -37,7 +41,11 @@ limitations under the License.
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_format.h"
 #include "apib/apib_cpu.h"
+#include "apib/apib_histogram.h"
+#include "apib/apib_json.h"
+#include "apib/apib_metrics.h"
 #include "apib/apib_time.h"
+#include "apib/apib_url.h"
 
 using absl::StrFormat;
 using std::cerr;
@@ -52,7 +60,9 @@ static std::mutex latch;
 static volatile bool reporting = 0;
 static bool cpuAvailable = false;
 static std::atomic_int_fast32_t socketErrors;
+static std::atomic_int_fast32_t errorCounts[NUM_ERROR_TYPES];
 static std::atomic_int_fast32_t connectionsOpened;
+static std::atomic_int_fast32_t featureCounts[NUM_CONNECT_FEATURES];
 
 static int_fast32_t successfulRequests;
 static int_fast32_t unsuccessfulRequests;
@@ -60,6 +70,7 @@ static int_fast32_t unsuccessfulRequests;
 static int64_t startTime;
 static int64_t stopTime;
 static int64_t intervalStartTime;
+static int64_t lastWorkerSuccesses = 0LL;
 
 static std::vector<std::unique_ptr<Counters>> accumulatedResults;
 
@@ -80,6 +91,48 @@ static std::string remote2MonitorHost;
 static int64_t totalBytesSent = 0LL;
 static int64_t totalBytesReceived = 0LL;
 
+// CPU time of each I/O thread at the start of the test, and how much
+// they used by the end, in nanoseconds
+static std::vector<int64_t> threadCpuStart;
+static int64_t threadCpuTime = 0LL;
+static int64_t maxThreadCpuTime = 0LL;
+
+// A client that spends more of its time on the CPU than this is the
+// bottleneck, or close enough to it to distort the results
+static const double kSaturatedCpu = 0.9;
+
+// Results for each URL, by URLInfo::index
+static std::vector<UrlCounters> urlTotals;
+
+// Progress of the test, kept for the JSON output
+class IntervalSample {
+ public:
+  double elapsedTime;
+  double intervalTime;
+  int32_t successfulRequests;
+  double throughput;
+  double clientCpu;
+};
+static std::vector<IntervalSample> intervalHistory;
+// Wall-clock time when the test started, in seconds since the epoch
+static double startWallTime;
+
+// Counts collected from the threads since the last ReportIntervalResults
+static int_fast32_t pendingSuccesses;
+static int_fast32_t pendingFailures;
+
+static_assert(NUM_ERROR_TYPES <= kMetricsErrorTypes,
+              "Metrics file has no room for all error types");
+static MetricsFile metricsFile;
+// Latencies since the start of the test and since the last update of
+// the metrics file. Only maintained when there is a metrics file.
+static Histogram runLatencies;
+static Histogram metricsLatencies;
+static int64_t metricsIntervalStart;
+static int64_t metricsSuccesses;
+static int64_t metricsFailures;
+static int64_t lastMetricsWorkerSuccesses = 0LL;
+
 static void connectMonitor(absl::string_view hn, int* fd) {
   assert(fd != NULL);
 
@@ -158,11 +211,53 @@ failure:
   return 0.0;
 }
 
-void RecordSocketError(void) {
+ErrorType ClassifyError(const Status& s) {
+  switch (s.code()) {
+    case Status::TLS_ERROR:
+      return TLS_FAILURE;
+    case Status::PARSE_ERROR:
+      return PARSE_FAILURE;
+    case Status::SOCKET_ERROR:
+      switch (s.errnum()) {
+        case ECONNREFUSED:
+          return CONNECTION_REFUSED;
+        case ETIMEDOUT:
+          return CONNECTION_TIMEOUT;
+        case EADDRNOTAVAIL:
+          // Usually this means that we ran out of ephemeral ports
+          return ADDRESS_UNAVAILABLE;
+        default:
+          return OTHER_ERROR;
+      }
+    default:
+      return OTHER_ERROR;
+  }
+}
+
+std::string ErrorTypeName(ErrorType t) {
+  switch (t) {
+    case CONNECTION_REFUSED:
+      return "Refused";
+    case CONNECTION_TIMEOUT:
+      return "Timed out";
+    case ADDRESS_UNAVAILABLE:
+      return "Addr. unavailable";
+    case TLS_FAILURE:
+      return "TLS";
+    case PARSE_FAILURE:
+      return "HTTP parsing";
+    default:
+      return "Other";
+  }
+}
+
+void RecordSocketError(ErrorType t) {
   if (!reporting) {
     return;
   }
+  assert(t < NUM_ERROR_TYPES);
   socketErrors++;
+  errorCounts[t]++;
 }
 
 void RecordConnectionOpen(void) {
@@ -172,6 +267,79 @@ void RecordConnectionOpen(void) {
   connectionsOpened++;
 }
 
+void RecordConnectFeature(ConnectFeature f) {
+  if (!reporting) {
+    return;
+  }
+  assert(f < NUM_CONNECT_FEATURES);
+  featureCounts[f]++;
+}
+
+std::string ErrorTypeLabel(ErrorType t) {
+  switch (t) {
+    case CONNECTION_REFUSED:
+      return "refused";
+    case CONNECTION_TIMEOUT:
+      return "timeout";
+    case ADDRESS_UNAVAILABLE:
+      return "address_unavailable";
+    case TLS_FAILURE:
+      return "tls";
+    case PARSE_FAILURE:
+      return "parse";
+    default:
+      return "other";
+  }
+}
+
+std::string ConnectFeatureName(ConnectFeature f) {
+  switch (f) {
+    case TCP_FAST_OPEN:
+      return "TCP Fast Open";
+    case TLS_RESUMED:
+      return "TLS resumed";
+    case TLS_EARLY_DATA_ACCEPTED:
+      return "Early data accepted";
+    case TLS_EARLY_DATA_REJECTED:
+      return "Early data rejected";
+    default:
+      return "Unknown";
+  }
+}
+
+std::string ConnectFeatureLabel(ConnectFeature f) {
+  switch (f) {
+    case TCP_FAST_OPEN:
+      return "tcp_fast_open";
+    case TLS_RESUMED:
+      return "tls_resumed";
+    case TLS_EARLY_DATA_ACCEPTED:
+      return "early_data_accepted";
+    case TLS_EARLY_DATA_REJECTED:
+      return "early_data_rejected";
+    default:
+      return "unknown";
+  }
+}
+
+void UrlCounters::add(const UrlCounters& c) {
+  successfulRequests += c.successfulRequests;
+  failedRequests += c.failedRequests;
+  latencySum += c.latencySum;
+  if (c.latencyMax > latencyMax) {
+    latencyMax = c.latencyMax;
+  }
+}
+
+static void addUrlCounters(const std::vector<UrlCounters>& urls) {
+  if (urlTotals.size() < urls.size()) {
+    urlTotals.resize(urls.size());
+  }
+  for (size_t i = 0; i < urls.size(); i++) {
+    urlTotals[i].add(urls[i]);
+  }
+}
+
 void RecordByteCounts(int64_t sent, int64_t received) {
   totalBytesSent += sent;
   totalBytesReceived += received;
@@ -184,16 +352,72 @@ void RecordInit(const std::string& monitorHost, const std::string& host2) {
   remote2MonitorHost = host2;
 }
 
+// The I/O threads record latency in ticks, so that they do as little
+// as possible for each request. Convert them once they are ours.
+static void convertTicks(Counters* c) {
+  if (!TscEnabled()) {
+    return;
+  }
+  for (auto it = c->latencies.begin(); it != c->latencies.end(); it++) {
+    *it = TicksToNanos(*it);
+  }
+  for (auto it = c->urls.begin(); it != c->urls.end(); it++) {
+    it->latencySum = TicksToNanos(it->latencySum);
+    it->latencyMax = TicksToNanos(it->latencyMax);
+  }
+}
+
+// Move the counters from each thread to the totals
+static void collectCounters(const ThreadList& threads) {
+  for (auto it = threads.cbegin(); it != threads.cend(); it++) {
+    Counters* c = (*it)->exchangeCounters();
+    convertTicks(c);
+    totalBytesReceived += c->bytesRead;
+    totalBytesSent += c->bytesWritten;
+    successfulRequests += c->successfulRequests;
+    unsuccessfulRequests += c->failedRequests;
+    pendingSuccesses += c->successfulRequests;
+    pendingFailures += c->failedRequests;
+    addUrlCounters(c->urls);
+    if (metricsFile.isOpen()) {
+      metricsSuccesses += c->successfulRequests;
+      metricsFailures += c->failedRequests;
+      for (auto lit = c->latencies.cbegin(); lit != c->latencies.cend();
+           lit++) {
+        runLatencies.record(*lit);
+        metricsLatencies.record(*lit);
+      }
+    }
+    accumulatedResults.push_back(std::unique_ptr<Counters>(c));
+  }
+}
+
 void RecordStart(bool startReporting, const ThreadList& threads) {
   /* When we warm up we want to zero these out before continuing */
   std::lock_guard<std::mutex> lock(latch);
   successfulRequests = 0;
   unsuccessfulRequests = 0;
   socketErrors = 0;
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    errorCounts[i] = 0;
+  }
   connectionsOpened = 0;
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    featureCounts[i] = 0;
+  }
   totalBytesSent = 0;
   totalBytesReceived = 0;
   accumulatedResults.clear();
+  pendingSuccesses = 0;
+  pendingFailures = 0;
+  urlTotals.clear();
+  intervalHistory.clear();
+  runLatencies.clear();
+  metricsLatencies.clear();
+  metricsSuccesses = 0;
+  metricsFailures = 0;
+  threadCpuTime = 0;
+  maxThreadCpuTime = 0;
 
   // We also want to zero out each thread's counters
   // since they may have started already!
@@ -222,8 +446,17 @@ void RecordStart(bool startReporting, const ThreadList& threads) {
     }
   }
 
+  threadCpuStart.clear();
+  for (auto it = threads.cbegin(); it != threads.cend(); it++) {
+    threadCpuStart.push_back((*it)->cpuTime());
+  }
+
   startTime = GetTime();
   intervalStartTime = startTime;
+  metricsIntervalStart = startTime;
+  startWallTime = std::chrono::duration<double>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
 
   clientSamples.clear();
   remoteSamples.clear();
@@ -241,38 +474,29 @@ void RecordStop(const ThreadList& threads) {
   }
 
   reporting = false;
-  for (auto it = threads.cbegin(); it != threads.cend(); it++) {
-    Counters* c = (*it)->exchangeCounters();
-    totalBytesReceived += c->bytesRead;
-    totalBytesSent += c->bytesWritten;
-    successfulRequests += c->successfulRequests;
-    unsuccessfulRequests += c->failedRequests;
-    accumulatedResults.push_back(std::unique_ptr<Counters>(c));
+  for (size_t i = 0; (i < threads.size()) && (i < threadCpuStart.size());
+       i++) {
+    const int64_t now = threads[i]->cpuTime();
+    if ((now >= 0) && (threadCpuStart[i] >= 0)) {
+      const int64_t used = now - threadCpuStart[i];
+      threadCpuTime += used;
+      maxThreadCpuTime = std::max(maxThreadCpuTime, used);
+    }
   }
+  collectCounters(threads);
   stopTime = GetTime();
 }
 
 BenchmarkIntervalResults ReportIntervalResults(const ThreadList& threads) {
-  int_fast32_t intervalSuccesses = 0LL;
-  int_fast32_t intervalFailures = 0LL;
   const int64_t now = GetTime();
-
-  for (auto it = threads.cbegin(); it != threads.cend(); it++) {
-    Counters* c = (*it)->exchangeCounters();
-    totalBytesReceived += c->bytesRead;
-    totalBytesSent += c->bytesWritten;
-    intervalSuccesses += c->successfulRequests;
-    intervalFailures += c->failedRequests;
-    accumulatedResults.push_back(std::unique_ptr<Counters>(c));
-  }
-
   // "exchangeCounters" clears thread-specific counters. Transfer new totals
   // to the grand total for an accurate result.
-  successfulRequests += intervalSuccesses;
-  unsuccessfulRequests += intervalFailures;
+  collectCounters(threads);
 
   BenchmarkIntervalResults r;
-  r.successfulRequests = intervalSuccesses;
+  r.successfulRequests = pendingSuccesses;
+  pendingSuccesses = 0;
+  pendingFailures = 0;
   r.intervalTime = Seconds(now - intervalStartTime);
   r.elapsedTime = Seconds(now - startTime);
   r.averageThroughput = (double)r.successfulRequests / r.intervalTime;
@@ -280,6 +504,111 @@ BenchmarkIntervalResults ReportIntervalResults(const ThreadList& threads) {
   return r;
 }
 
+BenchmarkIntervalResults ReportIntervalResults(int64_t workerSuccesses) {
+  const int64_t now = GetTime();
+
+  // The total counts up for the whole run, including the warm-up, so
+  // only the difference matters. Totals are collected by "MergeResults."
+  BenchmarkIntervalResults r;
+  r.successfulRequests = workerSuccesses - lastWorkerSuccesses;
+  r.intervalTime = Seconds(now - intervalStartTime);
+  r.elapsedTime = Seconds(now - startTime);
+  r.averageThroughput = (double)r.successfulRequests / r.intervalTime;
+  intervalStartTime = now;
+  lastWorkerSuccesses = workerSuccesses;
+  return r;
+}
+
+Status RecordMetricsFile(const std::string& path) {
+  return metricsFile.open(path);
+}
+
+const MetricsPage* GetMetricsPage() { return metricsFile.page(); }
+
+// Fill in the metrics page from the totals and the latest interval
+static void updateMetrics(MetricsState state, int64_t now,
+                          int64_t intervalTime, int64_t intervalSuccesses,
+                          int64_t intervalFailures,
+                          const Histogram& intervalLatencies) {
+  MetricsPage* p = metricsFile.beginUpdate();
+  p->state = state;
+  p->elapsedTime = now - startTime;
+  p->successfulRequests = successfulRequests;
+  p->unsuccessfulRequests = unsuccessfulRequests;
+  p->socketErrors = socketErrors;
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    p->errorCounts[i] = errorCounts[i];
+  }
+  p->connectionsOpened = connectionsOpened;
+  p->bytesSent = totalBytesSent;
+  p->bytesReceived = totalBytesReceived;
+
+  p->intervalTime = intervalTime;
+  p->intervalSuccesses = intervalSuccesses;
+  p->intervalFailures = intervalFailures;
+  p->intervalThroughput =
+      (intervalTime > 0 ? intervalSuccesses / Seconds(intervalTime) : 0.0);
+  for (int i = 0; i < kMetricsNumPercentiles; i++) {
+    p->intervalLatency[i] =
+        intervalLatencies.percentile(kMetricsPercentiles[i]);
+    p->latency[i] = runLatencies.percentile(kMetricsPercentiles[i]);
+  }
+  p->latencyCount = runLatencies.count();
+  p->latencyMin = runLatencies.min();
+  p->latencySum = runLatencies.sum();
+  for (int i = 0; i < Histogram::kNumBuckets; i++) {
+    p->buckets[i] = runLatencies.bucketCount(i);
+  }
+  metricsFile.endUpdate();
+}
+
+void PublishMetrics(const ThreadList& threads, bool warmup) {
+  if (!metricsFile.isOpen()) {
+    return;
+  }
+  const int64_t now = GetTime();
+  collectCounters(threads);
+  updateMetrics(warmup ? METRICS_WARMUP : METRICS_RUNNING, now,
+                now - metricsIntervalStart, metricsSuccesses, metricsFailures,
+                metricsLatencies);
+  metricsIntervalStart = now;
+  metricsSuccesses = 0;
+  metricsFailures = 0;
+  metricsLatencies.clear();
+}
+
+void PublishMetrics(int64_t workerSuccesses, bool warmup) {
+  if (!metricsFile.isOpen()) {
+    return;
+  }
+  // Worker processes only share their successful requests while they
+  // run. Everything else arrives with "MergeResults."
+  const int64_t now = GetTime();
+  updateMetrics(warmup ? METRICS_WARMUP : METRICS_RUNNING, now,
+                now - metricsIntervalStart,
+                workerSuccesses - lastMetricsWorkerSuccesses, 0,
+                metricsLatencies);
+  metricsIntervalStart = now;
+  lastMetricsWorkerSuccesses = workerSuccesses;
+}
+
+void PublishFinalMetrics() {
+  if (!metricsFile.isOpen()) {
+    return;
+  }
+  // Start over so that results from "MergeResults" are included
+  runLatencies.clear();
+  for (auto it = accumulatedResults.cbegin(); it != accumulatedResults.cend();
+       it++) {
+    for (auto lit = (*it)->latencies.cbegin(); lit != (*it)->latencies.cend();
+         lit++) {
+      runLatencies.record(*lit);
+    }
+  }
+  updateMetrics(METRICS_DONE, stopTime, stopTime - startTime,
+                successfulRequests, unsuccessfulRequests, runLatencies);
+}
+
 void SampleCPU() {
   if (remoteCpuSocket != 0) {
     const double remoteCpu = getRemoteStat(kCPUCmd, &remoteCpuSocket);
@@ -293,24 +622,26 @@ void SampleCPU() {
   clientSamples.push_back(cpu);
 }
 
-void ReportInterval(std::ostream& out, const ThreadList& threads,
-                    int totalDuration, bool warmup) {
-  double cpu = 0.0;
-  double remoteCpu = 0.0;
-  double remote2Cpu = 0.0;
-
+// Sample local and remote CPU usage for an interval report. The remote
+// figure is zero when no monitor is in use.
+static double sampleIntervalCpu(double* remoteCpu) {
+  *remoteCpu = 0.0;
   if (remoteCpuSocket != 0) {
-    remoteCpu = getRemoteStat(kCPUCmd, &remoteCpuSocket);
-    remoteSamples.push_back(remoteCpu);
+    *remoteCpu = getRemoteStat(kCPUCmd, &remoteCpuSocket);
+    remoteSamples.push_back(*remoteCpu);
   }
   if (remote2CpuSocket != 0) {
-    remote2Cpu = getRemoteStat(kCPUCmd, &remote2CpuSocket);
+    const double remote2Cpu = getRemoteStat(kCPUCmd, &remote2CpuSocket);
     remote2Samples.push_back(remote2Cpu);
   }
-  cpu = cpu_GetInterval(&cpuUsage);
+  const double cpu = cpu_GetInterval(&cpuUsage);
   clientSamples.push_back(cpu);
+  return cpu;
+}
 
-  const BenchmarkIntervalResults r = ReportIntervalResults(threads);
+static void printInterval(std::ostream& out,
+                          const BenchmarkIntervalResults& r, double cpu,
+                          double remoteCpu, int totalDuration, bool warmup) {
   const std::string warm = (warmup ? "Warming up: " : "");
 
   out << StrFormat("%s(%.0f / %i) %.3f", warm, r.elapsedTime, totalDuration,
@@ -324,6 +655,46 @@ void ReportInterval(std::ostream& out, const ThreadList& threads,
   out << endl;
 }
 
+static void addInterval(const BenchmarkIntervalResults& r, double cpu) {
+  IntervalSample i;
+  i.elapsedTime = r.elapsedTime;
+  i.intervalTime = r.intervalTime;
+  i.successfulRequests = r.successfulRequests;
+  i.throughput = r.averageThroughput;
+  i.clientCpu = cpu;
+  intervalHistory.push_back(i);
+}
+
+void ReportInterval(std::ostream& out, const ThreadList& threads,
+                    int totalDuration, bool warmup) {
+  double remoteCpu;
+  const double cpu = sampleIntervalCpu(&remoteCpu);
+  const BenchmarkIntervalResults r = ReportIntervalResults(threads);
+  addInterval(r, cpu);
+  printInterval(out, r, cpu, remoteCpu, totalDuration, warmup);
+}
+
+void ReportInterval(std::ostream& out, int64_t workerSuccesses,
+                    int totalDuration, bool warmup) {
+  double remoteCpu;
+  const double cpu = sampleIntervalCpu(&remoteCpu);
+  const BenchmarkIntervalResults r = ReportIntervalResults(workerSuccesses);
+  addInterval(r, cpu);
+  printInterval(out, r, cpu, remoteCpu, totalDuration, warmup);
+}
+
+void RecordInterval(const ThreadList& threads) {
+  double remoteCpu;
+  const double cpu = sampleIntervalCpu(&remoteCpu);
+  addInterval(ReportIntervalResults(threads), cpu);
+}
+
+void RecordInterval(int64_t workerSuccesses) {
+  double remoteCpu;
+  const double cpu = sampleIntervalCpu(&remoteCpu);
+  addInterval(ReportIntervalResults(workerSuccesses), cpu);
+}
+
 static int64_t getLatencyPercent(const std::vector<int_fast64_t>& latencies,
                                  int percent) {
   if (latencies.empty()) {
@@ -393,7 +764,13 @@ BenchmarkResults ReportResults() {
   r.successfulRequests = successfulRequests;
   r.unsuccessfulRequests = unsuccessfulRequests;
   r.socketErrors = socketErrors;
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    r.errorCounts[i] = errorCounts[i];
+  }
   r.connectionsOpened = connectionsOpened;
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    r.featureCounts[i] = featureCounts[i];
+  }
   r.totalBytesSent = totalBytesSent;
   r.totalBytesReceived = totalBytesReceived;
 
@@ -408,9 +785,146 @@ BenchmarkResults ReportResults() {
   r.averageSendBandwidth = (totalBytesSent * 8.0 / 1048576.0) / r.elapsedTime;
   r.averageReceiveBandwidth =
       (totalBytesReceived * 8.0 / 1048576.0) / r.elapsedTime;
+  r.threadCpuTime = Seconds(threadCpuTime);
+  r.maxThreadBusy =
+      (rawElapsed > 0) ? ((double)maxThreadCpuTime / (double)rawElapsed) : 0.0;
   return r;
 }
 
+static bool isSaturated(const BenchmarkResults& r) {
+  return (getAverageCpu(clientSamples) >= kSaturatedCpu) ||
+         (r.maxThreadBusy >= kSaturatedCpu);
+}
+
+bool ClientCpuSaturated() { return isSaturated(ReportResults()); }
+
+void PrintSaturationWarning(std::ostream& out, bool saturated) {
+  if (!saturated) {
+    return;
+  }
+  out << "Warning: The client was nearly out of CPU, so these results may\n"
+         "  measure apib and not the server. Try more I/O threads with -K,\n"
+         "  more processes with --processes, or another client host, and\n"
+         "  use --calibrate to see how much one client can do.\n";
+}
+
+// The serialized format is a sequence of native 64-bit integers, since
+// it is only ever read by a copy of the same program.
+static void putInt(std::string* out, int64_t v) {
+  out->append(reinterpret_cast<const char*>(&v), sizeof(int64_t));
+}
+
+static bool getInt(absl::string_view* in, int64_t* v) {
+  if (in->size() < sizeof(int64_t)) {
+    return false;
+  }
+  memcpy(v, in->data(), sizeof(int64_t));
+  in->remove_prefix(sizeof(int64_t));
+  return true;
+}
+
+std::string SerializeResults() {
+  std::lock_guard<std::mutex> lock(latch);
+  std::string out;
+  putInt(&out, successfulRequests);
+  putInt(&out, unsuccessfulRequests);
+  putInt(&out, socketErrors);
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    putInt(&out, errorCounts[i]);
+  }
+  putInt(&out, connectionsOpened);
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    putInt(&out, featureCounts[i]);
+  }
+  putInt(&out, totalBytesSent);
+  putInt(&out, totalBytesReceived);
+  putInt(&out, threadCpuTime);
+  putInt(&out, maxThreadCpuTime);
+  putInt(&out, urlTotals.size());
+  for (auto it = urlTotals.cbegin(); it != urlTotals.cend(); it++) {
+    putInt(&out, it->successfulRequests);
+    putInt(&out, it->failedRequests);
+    putInt(&out, it->latencySum);
+    putInt(&out, it->latencyMax);
+  }
+
+  size_t numLatencies = 0;
+  for (auto it = accumulatedResults.cbegin(); it != accumulatedResults.cend();
+       it++) {
+    numLatencies += (*it)->latencies.size();
+  }
+  putInt(&out, numLatencies);
+  for (auto it = accumulatedResults.cbegin(); it != accumulatedResults.cend();
+       it++) {
+    for (auto lit = (*it)->latencies.cbegin(); lit != (*it)->latencies.cend();
+         lit++) {
+      putInt(&out, *lit);
+    }
+  }
+  return out;
+}
+
+Status MergeResults(absl::string_view data) {
+  const Status invalid(Status::PARSE_ERROR, "Invalid worker results");
+  // Decode everything before touching the totals so that a truncated
+  // result is ignored entirely.
+  const int numCounts = 3 + NUM_ERROR_TYPES + 1 + NUM_CONNECT_FEATURES + 4;
+  int64_t counts[numCounts];
+  for (int i = 0; i < numCounts; i++) {
+    if (!getInt(&data, &counts[i])) {
+      return invalid;
+    }
+  }
+  int64_t numUrls;
+  if (!getInt(&data, &numUrls) || (numUrls < 0) ||
+      (data.size() < (size_t)numUrls * 4 * sizeof(int64_t))) {
+    return invalid;
+  }
+  std::vector<UrlCounters> urls(numUrls);
+  for (auto it = urls.begin(); it != urls.end(); it++) {
+    int64_t v;
+    getInt(&data, &v);
+    it->successfulRequests = v;
+    getInt(&data, &v);
+    it->failedRequests = v;
+    getInt(&data, &v);
+    it->latencySum = v;
+    getInt(&data, &v);
+    it->latencyMax = v;
+  }
+  int64_t numLatencies;
+  if (!getInt(&data, &numLatencies) || (numLatencies < 0) ||
+      (data.size() != ((size_t)numLatencies * sizeof(int64_t)))) {
+    return invalid;
+  }
+  std::unique_ptr<Counters> c(new Counters());
+  c->latencies.reserve(numLatencies);
+  int64_t latency;
+  while (getInt(&data, &latency)) {
+    c->latencies.push_back(latency);
+  }
+
+  std::lock_guard<std::mutex> lock(latch);
+  const int64_t* v = counts;
+  successfulRequests += *(v++);
+  unsuccessfulRequests += *(v++);
+  socketErrors += *(v++);
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    errorCounts[i] += *(v++);
+  }
+  connectionsOpened += *(v++);
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    featureCounts[i] += *(v++);
+  }
+  totalBytesSent += *(v++);
+  totalBytesReceived += *(v++);
+  threadCpuTime += *(v++);
+  maxThreadCpuTime = std::max(maxThreadCpuTime, *(v++));
+  addUrlCounters(urls);
+  accumulatedResults.push_back(std::move(c));
+  return Status::kOk;
+}
+
 void PrintFullResults(std::ostream& out) {
   const BenchmarkResults r = ReportResults();
 
@@ -419,7 +933,19 @@ void PrintFullResults(std::ostream& out) {
   out << StrFormat("Successful requests:  %i\n", r.successfulRequests);
   out << StrFormat("Non-200 results:      %i\n", r.unsuccessfulRequests);
   out << StrFormat("Connections opened:   %i\n", r.connectionsOpened);
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    if (r.featureCounts[i] > 0) {
+      const std::string label = ConnectFeatureName((ConnectFeature)i) + ':';
+      out << StrFormat("  %-20s%i\n", label, r.featureCounts[i]);
+    }
+  }
   out << StrFormat("Socket errors:        %i\n", r.socketErrors);
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    if (r.errorCounts[i] > 0) {
+      const std::string label = ErrorTypeName((ErrorType)i) + ':';
+      out << StrFormat("  %-20s%i\n", label, r.errorCounts[i]);
+    }
+  }
   out << '\n';
   out << StrFormat("Throughput:           %.3f requests/second\n",
                    r.averageThroughput);
@@ -445,6 +971,9 @@ void PrintFullResults(std::ostream& out) {
     out << StrFormat("Client CPU max:       %.0f%%\n",
                      getMaxCpu(clientSamples) * 100.0);
   }
+  if (r.threadCpuTime > 0.0) {
+    out << StrFormat("I/O thread CPU max:   %.0f%%\n", r.maxThreadBusy * 100.0);
+  }
   out << StrFormat("Client memory usage:  %.0f%%\n", clientMem * 100.0);
   if (!remoteSamples.empty()) {
     out << StrFormat("Remote CPU average:   %.0f%%\n",
@@ -469,6 +998,37 @@ void PrintFullResults(std::ostream& out) {
                    r.averageSendBandwidth);
   out << StrFormat("Receive bandwidth:    %.2f megabits / second\n",
                    r.averageReceiveBandwidth);
+  if (isSaturated(r)) {
+    out << '\n';
+    PrintSaturationWarning(out, true);
+  }
+}
+
+void PrintCalibrationResults(std::ostream& out) {
+  const BenchmarkResults r = ReportResults();
+
+  out << StrFormat("Duration:             %.3f seconds\n", r.elapsedTime);
+  out << StrFormat("Attempted requests:   %i\n", r.completedRequests);
+  out << StrFormat("Socket errors:        %i\n", r.socketErrors);
+  out << '\n';
+  out << StrFormat("Throughput:           %.3f requests/second\n",
+                   r.averageThroughput);
+  if ((r.threadCpuTime > 0.0) && (r.completedRequests > 0)) {
+    // Only the I/O threads count, since the server shares the host
+    const double perRequest = r.threadCpuTime / r.completedRequests;
+    out << StrFormat("CPU per request:      %.3f microseconds\n",
+                     perRequest * 1000000.0);
+    out << StrFormat("Max. per core:        %.0f requests/second\n",
+                     1.0 / perRequest);
+    out << StrFormat("I/O thread CPU max:   %.0f%%\n", r.maxThreadBusy * 100.0);
+  } else {
+    out << "CPU per request:      unknown on this platform\n";
+  }
+  out << StrFormat("Minimum latency:      %.3f milliseconds\n", r.latencies[0]);
+  out << StrFormat("50%% latency:          %.3f milliseconds\n",
+                   r.latencies[50]);
+  out << StrFormat("99%% latency:          %.3f milliseconds\n",
+                   r.latencies[99]);
 }
 
 void PrintShortResults(std::ostream& out, const std::string& runName,
@@ -490,6 +1050,188 @@ void PrintShortResults(std::ostream& out, const std::string& runName,
       r.averageReceiveBandwidth);
 }
 
+static std::string formatWallTime(double t) {
+  const time_t secs = (time_t)t;
+  struct tm tm;
+  gmtime_r(&secs, &tm);
+  char buf[32];
+  strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+  return StrFormat("%s.%03dZ", buf, (int)((t - secs) * 1000.0));
+}
+
+static void printJsonHost(JsonWriter* w) {
+  w->beginObject();
+  char hostName[256];
+  if (gethostname(hostName, sizeof(hostName)) == 0) {
+    hostName[sizeof(hostName) - 1] = 0;
+    w->field("hostName", hostName);
+  }
+  struct utsname u;
+  if (uname(&u) == 0) {
+    w->field("os", u.sysname);
+    w->field("release", u.release);
+    w->field("machine", u.machine);
+  }
+  w->field("cpus", cpu_Count());
+  w->endObject();
+}
+
+static void printJsonCpu(JsonWriter* w, const std::vector<double>& samples,
+                         double mem) {
+  w->beginObject();
+  w->field("average", getAverageCpu(samples));
+  w->field("max", getMaxCpu(samples));
+  w->field("memory", mem);
+  w->endObject();
+}
+
+void PrintJsonResults(std::ostream& out, const RunInfo& info) {
+  const BenchmarkResults r = ReportResults();
+  JsonWriter w(out);
+
+  w.beginObject();
+  w.field("name", info.name);
+  w.field("startTime", formatWallTime(startWallTime));
+
+  w.key("config");
+  w.beginObject();
+  w.field("commandLine", info.commandLine);
+  w.field("url", info.url);
+  w.field("method", info.method);
+  w.field("threads", info.threads);
+  w.field("connections", info.connections);
+  w.field("processes", info.processes);
+  w.field("duration", info.duration);
+  w.field("warmup", info.warmup);
+  w.field("keepAlive", info.keepAlive);
+  w.field("thinkTime", info.thinkTime);
+  w.field("clock", info.clock);
+  w.field("loopTime", info.loopTime);
+  w.endObject();
+
+  w.key("host");
+  printJsonHost(&w);
+
+  // Times are in seconds, latencies in milliseconds, and bandwidth in
+  // megabits per second, as in the other output formats.
+  w.key("results");
+  w.beginObject();
+  w.field("duration", r.elapsedTime);
+  w.field("completedRequests", r.completedRequests);
+  w.field("successfulRequests", r.successfulRequests);
+  w.field("unsuccessfulRequests", r.unsuccessfulRequests);
+  w.field("socketErrors", r.socketErrors);
+  w.key("errors");
+  w.beginObject();
+  for (int i = 0; i < NUM_ERROR_TYPES; i++) {
+    w.field(ErrorTypeLabel((ErrorType)i), r.errorCounts[i]);
+  }
+  w.endObject();
+  w.field("connectionsOpened", r.connectionsOpened);
+  w.key("connectFeatures");
+  w.beginObject();
+  for (int i = 0; i < NUM_CONNECT_FEATURES; i++) {
+    w.field(ConnectFeatureLabel((ConnectFeature)i), r.featureCounts[i]);
+  }
+  w.endObject();
+  w.field("bytesSent", r.totalBytesSent);
+  w.field("bytesReceived", r.totalBytesReceived);
+  w.field("throughput", r.averageThroughput);
+  w.field("sendBandwidth", r.averageSendBandwidth);
+  w.field("receiveBandwidth", r.averageReceiveBandwidth);
+  w.key("latency");
+  w.beginObject();
+  w.field("average", r.averageLatency);
+  w.field("stdDev", r.latencyStdDev);
+  w.field("min", r.latencies[0]);
+  w.field("max", r.latencies[100]);
+  // Every percentile from 0 to 100
+  w.key("percentiles");
+  w.beginArray();
+  for (int i = 0; i <= 100; i++) {
+    w.value(r.latencies[i]);
+  }
+  w.endArray();
+  w.endObject();
+  w.key("clientCpu");
+  printJsonCpu(&w, clientSamples, clientMem);
+  w.key("ioThreads");
+  w.beginObject();
+  w.field("cpuTime", r.threadCpuTime);
+  w.field("maxBusy", r.maxThreadBusy);
+  w.endObject();
+  w.field("clientSaturated", isSaturated(r));
+  if (!remoteSamples.empty()) {
+    w.key("remoteCpu");
+    printJsonCpu(&w, remoteSamples, remoteMem);
+  }
+  if (!remote2Samples.empty()) {
+    w.key("remote2Cpu");
+    printJsonCpu(&w, remote2Samples, remote2Mem);
+  }
+  w.endObject();
+
+  // The buckets are described in doc/METRICS.md. Only the buckets
+  // with something in them are included.
+  Histogram h;
+  for (auto it = accumulatedResults.cbegin(); it != accumulatedResults.cend();
+       it++) {
+    for (auto lit = (*it)->latencies.cbegin(); lit != (*it)->latencies.cend();
+         lit++) {
+      h.record(*lit);
+    }
+  }
+  w.key("histogram");
+  w.beginObject();
+  w.field("unit", "nanoseconds");
+  w.field("count", h.count());
+  w.field("sum", h.sum());
+  w.key("buckets");
+  w.beginArray();
+  for (int i = 0; i < Histogram::kNumBuckets; i++) {
+    if (h.bucketCount(i) > 0) {
+      w.beginObject();
+      w.field("min", Histogram::bucketLowerBound(i));
+      w.field("max", Histogram::bucketUpperBound(i));
+      w.field("count", h.bucketCount(i));
+      w.endObject();
+    }
+  }
+  w.endArray();
+  w.endObject();
+
+  w.key("intervals");
+  w.beginArray();
+  for (auto it = intervalHistory.cbegin(); it != intervalHistory.cend();
+       it++) {
+    w.beginObject();
+    w.field("elapsed", it->elapsedTime);
+    w.field("duration", it->intervalTime);
+    w.field("successfulRequests", it->successfulRequests);
+    w.field("throughput", it->throughput);
+    w.field("clientCpu", it->clientCpu);
+    w.endObject();
+  }
+  w.endArray();
+
+  w.key("urls");
+  w.beginArray();
+  for (size_t i = 0; i < urlTotals.size(); i++) {
+    const UrlCounters& u = urlTotals[i];
+    const int64_t count = u.successfulRequests + u.failedRequests;
+    w.beginObject();
+    w.field("url", i < URLInfo::Count() ? URLInfo::Get(i)->str() : "");
+    w.field("successfulRequests", u.successfulRequests);
+    w.field("unsuccessfulRequests", u.failedRequests);
+    w.field("averageLatency",
+            count > 0 ? Milliseconds(u.latencySum / count) : 0.0);
+    w.field("maxLatency", Milliseconds(u.latencyMax));
+    w.endObject();
+  }
+  w.endArray();
+  w.endObject();
+}
+
 void PrintReportingHeader(std::ostream& out) {
   out << "Name,Throughput,Avg. Latency,Threads,Connections,Duration,"
          "Completed,Successful,Errors,Sockets,"
@@ -507,6 +1249,7 @@ void EndReporting() {
   if (remote2CpuSocket != 0) {
     close(remote2CpuSocket);
   }
+  metricsFile.close();
 }
 
 }  // namespace apib
@@ -17,16 +17,32 @@ limitations under the License.
 #ifndef APIB_REPORTING_H
 #define APIB_REPORTING_H
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
 
+#include "absl/strings/string_view.h"
 #include "apib/apib_iothread.h"
+#include "apib/apib_metrics.h"
+#include "apib/status.h"
 
 namespace apib {
 
+// Results for one URL, so that tests with a list of URLs can tell which
+// ones were slow or failing.
+class UrlCounters {
+ public:
+  int_fast32_t successfulRequests = 0LL;
+  int_fast32_t failedRequests = 0LL;
+  int_fast64_t latencySum = 0LL;
+  int_fast64_t latencyMax = 0LL;
+
+  void add(const UrlCounters& c);
+};
+
 // Per-thread counters. We swap these in and out of IOThreads so that we can
 // efficiently count with a minimum of global synchronization
 class Counters {
@@ -36,15 +52,43 @@ class Counters {
   int_fast64_t bytesRead = 0LL;
   int_fast64_t bytesWritten = 0LL;
   std::vector<int_fast64_t> latencies;
+  // Indexed by URLInfo::index
+  std::vector<UrlCounters> urls;
 };
 
+// Socket errors are counted separately by type so that we can report
+// why a benchmark failed, and not just that it did.
+typedef enum {
+  OTHER_ERROR,
+  CONNECTION_REFUSED,
+  CONNECTION_TIMEOUT,
+  ADDRESS_UNAVAILABLE,
+  TLS_FAILURE,
+  PARSE_FAILURE,
+  NUM_ERROR_TYPES
+} ErrorType;
+
+// Ways of speeding up a new connection, counted when the server accepts them
+// so that we can tell how often they actually helped.
+typedef enum {
+  TCP_FAST_OPEN,
+  TLS_RESUMED,
+  TLS_EARLY_DATA_ACCEPTED,
+  TLS_EARLY_DATA_REJECTED,
+  NUM_CONNECT_FEATURES
+} ConnectFeature;
+
 class BenchmarkResults {
  public:
   int32_t completedRequests;
   int32_t successfulRequests;
   int32_t unsuccessfulRequests;
   int32_t socketErrors;
+  // "socketErrors" broken down by ErrorType
+  int32_t errorCounts[NUM_ERROR_TYPES];
   int32_t connectionsOpened;
+  // How many of "connectionsOpened" used each ConnectFeature
+  int32_t featureCounts[NUM_CONNECT_FEATURES];
   int64_t totalBytesSent;
   int64_t totalBytesReceived;
 
@@ -62,6 +106,12 @@ class BenchmarkResults {
   // Megabits / second
   double averageSendBandwidth;
   double averageReceiveBandwidth;
+
+  // CPU time used by all the I/O threads, in seconds, and the fraction
+  // of the test that the busiest one spent on the CPU. Both are zero if
+  // the platform can't measure the CPU time of a thread.
+  double threadCpuTime;
+  double maxThreadBusy;
 };
 
 class BenchmarkIntervalResults {
@@ -74,6 +124,34 @@ class BenchmarkIntervalResults {
   double averageThroughput;
 };
 
+// A description of the test, for the JSON output
+class RunInfo {
+ public:
+  std::string name;
+  std::string commandLine;
+  // The URL, or "@" and the name of a file of URLs
+  std::string url;
+  std::string method;
+  int threads = 0;
+  int connections = 0;
+  int processes = 1;
+  int duration = 0;
+  int warmup = 0;
+  int keepAlive = 0;
+  int thinkTime = 0;
+  // "monotonic" or "tsc"
+  std::string clock;
+  bool loopTime = false;
+};
+
+// Progress counters for a worker process. These live in memory that is
+// shared with the parent process, so that the parent can report progress
+// while the workers run.
+class WorkerCounters {
+ public:
+  std::atomic<int64_t> successfulRequests;
+};
+
 // One time initialization
 extern void RecordInit(const std::string& monitorHost,
                        const std::string& monitor2Host);
@@ -86,23 +164,80 @@ extern void RecordStop(const ThreadList& threads);
 // Get results since last interval -- may be called while running
 extern BenchmarkIntervalResults ReportIntervalResults(
     const ThreadList& threads);
+// Get results since last interval from the combined successful requests
+// of all worker processes, as published in WorkerCounters.
+extern BenchmarkIntervalResults ReportIntervalResults(
+    int64_t workerSuccesses);
 // Get total results -- must be called after stop
 extern BenchmarkResults ReportResults();
+
+// After stop, encode the raw results of a worker process so that the
+// parent can combine them with "MergeResults."
+extern std::string SerializeResults();
+// Add results from SerializeResults to the results of this process.
+// Call after stop.
+extern Status MergeResults(absl::string_view data);
 // And clean it up. Don't call before reporting.
 extern void EndReporting();
 
-// Record an error connecting
-extern void RecordSocketError();
+// Figure out which type of error a failed I/O operation represents
+extern ErrorType ClassifyError(const Status& s);
+// Return a readable name for an ErrorType
+extern std::string ErrorTypeName(ErrorType t);
+// Return a short lower-case name for an ErrorType, for machine-readable
+// output
+extern std::string ErrorTypeLabel(ErrorType t);
+
+// Record an error connecting, reading, or writing
+extern void RecordSocketError(ErrorType t = OTHER_ERROR);
 // Report any time we open a connection
 extern void RecordConnectionOpen();
+// Report that a new connection made use of a ConnectFeature
+extern void RecordConnectFeature(ConnectFeature f);
+// Return a readable name for a ConnectFeature
+extern std::string ConnectFeatureName(ConnectFeature f);
+extern std::string ConnectFeatureLabel(ConnectFeature f);
+
+// Whether the client was so busy that the results may measure the
+// limits of apib rather than of the server. Call after stop.
+extern bool ClientCpuSaturated();
+// If "saturated," as returned by ClientCpuSaturated, print a warning that
+// says what to do about it
+extern void PrintSaturationWarning(std::ostream& out, bool saturated);
 
 // Call ReportResults and print to a file
 extern void PrintShortResults(std::ostream& out, const std::string& runName,
                               size_t numThreads, int connections);
 extern void PrintFullResults(std::ostream& out);
+// Print what a run against the built-in Responder says about the
+// client's own limits
+extern void PrintCalibrationResults(std::ostream& out);
+// Print everything that we know about the test as a JSON object
+extern void PrintJsonResults(std::ostream& out, const RunInfo& info);
 // Call ReportIntervalResults and print to a file
 extern void ReportInterval(std::ostream& out, const ThreadList& threads,
                            int totalDuration, bool warmup);
+extern void ReportInterval(std::ostream& out, int64_t workerSuccesses,
+                           int totalDuration, bool warmup);
+// Publish live results to a memory-mapped file at "path," replacing it
+// if it exists, or only in memory if "path" is empty. Call before
+// RecordStart.
+extern Status RecordMetricsFile(const std::string& path);
+// The page that live results are published to, or null if none.
+// Read it with MetricsFile::read.
+extern const MetricsPage* GetMetricsPage();
+// Collect counters from the threads, like ReportIntervalResults, and
+// publish them to the metrics file, if there is one.
+extern void PublishMetrics(const ThreadList& threads, bool warmup);
+extern void PublishMetrics(int64_t workerSuccesses, bool warmup);
+// Publish the final results to the metrics file. Call after stop, and
+// after any calls to MergeResults.
+extern void PublishFinalMetrics();
+
+// Like ReportInterval, but without printing anything. The intervals
+// are included in the JSON output.
+extern void RecordInterval(const ThreadList& threads);
+extern void RecordInterval(int64_t workerSuccesses);
 // If ReportInterval is not being called, call this instead to ensure
 // that the CPU samples are happening regularly so
 // that we get a good average.
@@ -0,0 +1,297 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_responder.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace apib {
+
+#define LISTEN_BACKLOG 1024
+#define READ_BUF_LEN 4096
+
+static const char kResponse[] =
+    "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+static const size_t kResponseLen = sizeof(kResponse) - 1;
+static const char kEndOfHeaders[] = "\r\n\r\n";
+
+// One listening socket with its own event loop and thread
+class ResponderThread {
+ public:
+  ~ResponderThread();
+  Status listen(int port);
+  int port() const;
+  void start();
+  void stop();
+  void acceptReady();
+
+ private:
+  void run() { ev_run(loop_, 0); }
+
+  int listenfd_ = -1;
+  struct ev_loop* loop_ = nullptr;
+  ev_io listenev_;
+  ev_async shutdownev_;
+  std::unique_ptr<std::thread> thread_;
+};
+
+// One client connection. It lives until the client closes it.
+class ResponderConnection {
+ public:
+  ResponderConnection(struct ev_loop* loop, int fd) : loop_(loop), fd_(fd) {}
+  void start();
+  void ioReady(int revents);
+
+ private:
+  void readReady();
+  void writeReady();
+  void finish();
+
+  struct ev_loop* loop_;
+  int fd_;
+  ev_io io_;
+  // How much of "kEndOfHeaders" we have seen so far
+  int matched_ = 0;
+  std::string output_;
+  size_t written_ = 0;
+};
+
+static void handleConnectionIo(struct ev_loop* loop, ev_io* io, int revents) {
+  reinterpret_cast<ResponderConnection*>(io->data)->ioReady(revents);
+}
+
+void ResponderConnection::start() {
+  ev_io_init(&io_, handleConnectionIo, fd_, EV_READ);
+  io_.data = this;
+  ev_io_start(loop_, &io_);
+}
+
+void ResponderConnection::ioReady(int revents) {
+  if (revents & EV_WRITE) {
+    writeReady();
+  } else if (revents & EV_READ) {
+    readReady();
+  }
+}
+
+void ResponderConnection::readReady() {
+  char buf[READ_BUF_LEN];
+  const ssize_t rc = read(fd_, buf, READ_BUF_LEN);
+  if (rc < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+      return;
+    }
+    finish();
+    return;
+  }
+  if (rc == 0) {
+    finish();
+    return;
+  }
+
+  // Every blank line ends a request. Track partial matches across reads.
+  int responses = 0;
+  for (ssize_t i = 0; i < rc; i++) {
+    if (buf[i] == kEndOfHeaders[matched_]) {
+      matched_++;
+      if (matched_ == 4) {
+        responses++;
+        matched_ = 0;
+      }
+    } else {
+      matched_ = (buf[i] == '\r') ? 1 : 0;
+    }
+  }
+  if (responses == 0) {
+    return;
+  }
+  if (written_ == output_.size()) {
+    output_.clear();
+    written_ = 0;
+  }
+  for (int i = 0; i < responses; i++) {
+    output_.append(kResponse, kResponseLen);
+  }
+  writeReady();
+}
+
+void ResponderConnection::writeReady() {
+  while (written_ < output_.size()) {
+    const ssize_t rc =
+        write(fd_, output_.data() + written_, output_.size() - written_);
+    if (rc < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        // Wait until we can write the rest
+        ev_io_stop(loop_, &io_);
+        ev_io_set(&io_, fd_, EV_READ | EV_WRITE);
+        ev_io_start(loop_, &io_);
+        return;
+      }
+      finish();
+      return;
+    }
+    written_ += rc;
+  }
+  if (io_.events & EV_WRITE) {
+    ev_io_stop(loop_, &io_);
+    ev_io_set(&io_, fd_, EV_READ);
+    ev_io_start(loop_, &io_);
+  }
+}
+
+void ResponderConnection::finish() {
+  ev_io_stop(loop_, &io_);
+  close(fd_);
+  delete this;
+}
+
+static void handleAccept(struct ev_loop* loop, ev_io* io, int revents) {
+  reinterpret_cast<ResponderThread*>(io->data)->acceptReady();
+}
+
+static void handleShutdown(struct ev_loop* loop, ev_async* a, int revents) {
+  ev_break(loop, EVBREAK_ALL);
+}
+
+void ResponderThread::acceptReady() {
+  for (;;) {
+    const int fd = accept(listenfd_, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ResponderConnection* c = new ResponderConnection(loop_, fd);
+    c->start();
+  }
+}
+
+Status ResponderThread::listen(int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  listenfd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenfd_ < 0) {
+    return Status(Status::SOCKET_ERROR, errno);
+  }
+  int one = 1;
+  setsockopt(listenfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+  setsockopt(listenfd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+  int err = fcntl(listenfd_, F_SETFL, O_NONBLOCK);
+  if (err == 0) {
+    err = bind(listenfd_, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr));
+  }
+  if (err == 0) {
+    err = ::listen(listenfd_, LISTEN_BACKLOG);
+  }
+  if (err != 0) {
+    const Status s(Status::SOCKET_ERROR, errno);
+    close(listenfd_);
+    listenfd_ = -1;
+    return s;
+  }
+
+  loop_ = ev_loop_new(EVFLAG_AUTO);
+  ev_async_init(&shutdownev_, handleShutdown);
+  ev_async_start(loop_, &shutdownev_);
+  ev_io_init(&listenev_, handleAccept, listenfd_, EV_READ);
+  listenev_.data = this;
+  ev_io_start(loop_, &listenev_);
+  return Status::kOk;
+}
+
+int ResponderThread::port() const {
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+  getsockname(listenfd_, reinterpret_cast<struct sockaddr*>(&addr), &addrLen);
+  return ntohs(addr.sin_port);
+}
+
+void ResponderThread::start() {
+  thread_.reset(new std::thread(std::bind(&ResponderThread::run, this)));
+}
+
+void ResponderThread::stop() {
+  if (thread_) {
+    ev_async_send(loop_, &shutdownev_);
+    thread_->join();
+    thread_.reset();
+  }
+}
+
+ResponderThread::~ResponderThread() {
+  stop();
+  // Connections that are still open are abandoned along with the loop
+  if (loop_ != nullptr) {
+    ev_loop_destroy(loop_);
+  }
+  if (listenfd_ >= 0) {
+    close(listenfd_);
+  }
+}
+
+Responder::Responder() {}
+
+Responder::~Responder() { stop(); }
+
+Status Responder::start(int threads) {
+#ifndef SO_REUSEPORT
+  // Without it, only one socket can listen on the port
+  threads = 1;
+#endif
+  for (int i = 0; i < threads; i++) {
+    std::unique_ptr<ResponderThread> t(new ResponderThread());
+    const Status s = t->listen(port_);
+    if (!s.ok()) {
+      threads_.clear();
+      return s;
+    }
+    if (port_ == 0) {
+      port_ = t->port();
+    }
+    threads_.push_back(std::move(t));
+  }
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->start();
+  }
+  return Status::kOk;
+}
+
+void Responder::stop() {
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->stop();
+  }
+  threads_.clear();
+}
+
+}  // namespace apib
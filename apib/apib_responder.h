@@ -0,0 +1,54 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_RESPONDER_H
+#define APIB_RESPONDER_H
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "apib/status.h"
+#include "ev.h"
+
+namespace apib {
+
+class ResponderThread;
+
+// An HTTP server that does as little work as possible, for measuring the
+// limits of the client itself. It answers every request with the same
+// tiny response and keeps connections open. It does not parse requests:
+// it only looks for the blank line at the end of the headers, so it
+// only supports requests without a body.
+class Responder {
+ public:
+  Responder();
+  ~Responder();
+  // Listen on a random port on the loopback address with "threads"
+  // threads. On Linux each thread has its own listening socket, and the
+  // kernel spreads connections across them.
+  Status start(int threads);
+  int port() const { return port_; }
+  void stop();
+
+ private:
+  std::vector<std::unique_ptr<ResponderThread>> threads_;
+  int port_ = 0;
+};
+
+}  // namespace apib
+
+#endif  // APIB_RESPONDER_H
@@ -0,0 +1,748 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_signer.h"
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/pem.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "apib/apib_json.h"
+#include "third_party/base64/base64.h"
+
+namespace apib {
+
+static const char kHexDigits[] = "0123456789ABCDEF";
+static const char kLowerHexDigits[] = "0123456789abcdef";
+static const int kDefaultJwtTtl = 300;
+static const char kSigV4Algorithm[] = "AWS4-HMAC-SHA256";
+
+HmacKey::HmacKey(const EVP_MD* md, absl::string_view key) {
+  const int blockSize = EVP_MD_block_size(md);
+  std::vector<unsigned char> keyBlock(blockSize, 0);
+  if ((int)key.size() > blockSize) {
+    unsigned int len;
+    EVP_Digest(key.data(), key.size(), keyBlock.data(), &len, md, nullptr);
+  } else {
+    memcpy(keyBlock.data(), key.data(), key.size());
+  }
+
+  std::vector<unsigned char> pad(blockSize);
+  for (int i = 0; i < blockSize; i++) {
+    pad[i] = keyBlock[i] ^ 0x36;
+  }
+  inner_ = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(inner_, md, nullptr);
+  EVP_DigestUpdate(inner_, pad.data(), blockSize);
+  for (int i = 0; i < blockSize; i++) {
+    pad[i] = keyBlock[i] ^ 0x5c;
+  }
+  outer_ = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(outer_, md, nullptr);
+  EVP_DigestUpdate(outer_, pad.data(), blockSize);
+  work_ = EVP_MD_CTX_new();
+}
+
+HmacKey::~HmacKey() {
+  EVP_MD_CTX_free(inner_);
+  EVP_MD_CTX_free(outer_);
+  EVP_MD_CTX_free(work_);
+}
+
+unsigned int HmacKey::sign(absl::string_view data, unsigned char* out) {
+  unsigned int len;
+  EVP_MD_CTX_copy_ex(work_, inner_);
+  EVP_DigestUpdate(work_, data.data(), data.size());
+  EVP_DigestFinal_ex(work_, out, &len);
+  EVP_MD_CTX_copy_ex(work_, outer_);
+  EVP_DigestUpdate(work_, out, len);
+  EVP_DigestFinal_ex(work_, out, &len);
+  return len;
+}
+
+static void appendHex(std::string* out, const unsigned char* buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    out->push_back(kLowerHexDigits[buf[i] >> 4]);
+    out->push_back(kLowerHexDigits[buf[i] & 0xf]);
+  }
+}
+
+static void appendBase64(std::string* out, const unsigned char* buf,
+                         size_t len) {
+  const size_t start = out->size();
+  out->resize(start + Base64encode_len(len));
+  const int encodedLen = Base64encode(&((*out)[start]), (const char*)buf, len);
+  // The length includes the null terminator
+  out->resize(start + encodedLen - 1);
+}
+
+// The URL-safe form of Base64, without padding, as JWTs use
+static void appendBase64Url(std::string* out, absl::string_view s) {
+  const size_t start = out->size();
+  appendBase64(out, (const unsigned char*)s.data(), s.size());
+  while ((out->size() > start) && (out->back() == '=')) {
+    out->pop_back();
+  }
+  for (size_t i = start; i < out->size(); i++) {
+    if ((*out)[i] == '+') {
+      (*out)[i] = '-';
+    } else if ((*out)[i] == '/') {
+      (*out)[i] = '_';
+    }
+  }
+}
+
+static void sha256Hex(absl::string_view data, std::string* out) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int len;
+  EVP_Digest(data.data(), data.size(), digest, &len, EVP_sha256(), nullptr);
+  appendHex(out, digest, len);
+}
+
+// Percent-encode everything but the RFC 3986 unreserved characters, and
+// optionally the slash, as SigV4 requires.
+static void appendUriEncoded(std::string* out, absl::string_view s,
+                             bool keepSlash) {
+  for (auto it = s.begin(); it != s.end(); it++) {
+    const unsigned char c = *it;
+    if (isalnum(c) || (c == '-') || (c == '.') || (c == '_') || (c == '~') ||
+        (keepSlash && (c == '/'))) {
+      out->push_back(c);
+    } else {
+      out->push_back('%');
+      out->push_back(kHexDigits[c >> 4]);
+      out->push_back(kHexDigits[c & 0xf]);
+    }
+  }
+}
+
+static int hexValue(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+  if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+  return 0;
+}
+
+static std::string uriDecode(absl::string_view s) {
+  std::string d;
+  for (size_t i = 0; i < s.size(); i++) {
+    if ((s[i] == '%') && ((i + 2) < s.size())) {
+      d.push_back((char)((hexValue(s[i + 1]) << 4) | hexValue(s[i + 2])));
+      i += 2;
+    } else if (s[i] == '+') {
+      d.push_back(' ');
+    } else {
+      d.push_back(s[i]);
+    }
+  }
+  return d;
+}
+
+static void makeNonce(RandomGenerator* rand, char* buf, size_t len) {
+  snprintf(buf, len, "%08X%08X", (unsigned int)rand->get(),
+           (unsigned int)rand->get());
+}
+
+// The parts of a signature that depend only on the URL, method, and body,
+// kept for each URL by its index.
+template <class T>
+class RequestCache {
+ public:
+  // Return the entry for this request, or null if it must be built
+  // with "add."
+  T* find(const URLInfo& url, absl::string_view method,
+          absl::string_view body) {
+    if (entries_.size() <= url.index()) {
+      entries_.resize(url.index() + 1);
+    }
+    T* e = entries_[url.index()].get();
+    if ((e != nullptr) && (e->url == &url) && (e->method == method) &&
+        (e->body == body)) {
+      return e;
+    }
+    return nullptr;
+  }
+
+  T* add(const URLInfo& url, absl::string_view method,
+         absl::string_view body) {
+    T* e = new T();
+    e->url = &url;
+    e->method = std::string(method);
+    e->body = std::string(body);
+    entries_[url.index()].reset(e);
+    return e;
+  }
+
+ private:
+  std::vector<std::unique_ptr<T>> entries_;
+};
+
+// The settings from a "--sign" argument
+typedef std::map<std::string, std::string> Settings;
+
+static Status requireSettings(const Settings& s,
+                              std::initializer_list<const char*> required,
+                              std::initializer_list<const char*> optional) {
+  for (auto r = required.begin(); r != required.end(); r++) {
+    if (s.find(*r) == s.end()) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Missing signer setting \"", *r, "\""));
+    }
+  }
+  for (auto it = s.cbegin(); it != s.cend(); it++) {
+    if ((std::find(required.begin(), required.end(), it->first) ==
+         required.end()) &&
+        (std::find(optional.begin(), optional.end(), it->first) ==
+         optional.end())) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Unknown signer setting \"", it->first, "\""));
+    }
+  }
+  return Status::kOk;
+}
+
+static std::string getSetting(const Settings& s, const std::string& name) {
+  const auto it = s.find(name);
+  return (it == s.end() ? "" : it->second);
+}
+
+/*
+ * HMAC-SHA256 over the method, path and query, host, timestamp, nonce,
+ * and the SHA-256 hash of the body, one per line.
+ */
+class HmacSha256Signer : public RequestSigner {
+ public:
+  HmacSha256Signer(const std::string& keyId, const std::string& secret)
+      : keyId_(keyId), secret_(secret), key_(EVP_sha256(), secret) {}
+
+  std::unique_ptr<RequestSigner> clone() const override {
+    return std::unique_ptr<RequestSigner>(
+        new HmacSha256Signer(keyId_, secret_));
+  }
+
+  void sign(RandomGenerator* rand, const URLInfo& url,
+            absl::string_view method, absl::string_view body, int64_t now,
+            std::string* headers) override {
+    Entry* e = cache_.find(url, method, body);
+    if (e == nullptr) {
+      e = cache_.add(url, method, body);
+      absl::StrAppend(&e->prefix, method, "\n", url.path(), "\n",
+                      url.hostHeader(), "\n");
+      e->suffix.push_back('\n');
+      sha256Hex(body, &e->suffix);
+    }
+
+    char timestamp[24];
+    snprintf(timestamp, sizeof(timestamp), "%lld", (long long)now);
+    char nonce[24];
+    makeNonce(rand, nonce, sizeof(nonce));
+
+    toSign_.assign(e->prefix);
+    toSign_.append(timestamp);
+    toSign_.push_back('\n');
+    toSign_.append(nonce);
+    toSign_.append(e->suffix);
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    const unsigned int macLen = key_.sign(toSign_, mac);
+
+    headers->append("Authorization: HMAC-SHA256 keyId=\"");
+    headers->append(keyId_);
+    headers->append("\", timestamp=\"");
+    headers->append(timestamp);
+    headers->append("\", nonce=\"");
+    headers->append(nonce);
+    headers->append("\", signature=\"");
+    appendBase64(headers, mac, macLen);
+    headers->append("\"\r\n");
+  }
+
+ private:
+  struct Entry {
+    const URLInfo* url;
+    std::string method;
+    std::string body;
+    std::string prefix;
+    std::string suffix;
+  };
+
+  const std::string keyId_;
+  const std::string secret_;
+  HmacKey key_;
+  RequestCache<Entry> cache_;
+  std::string toSign_;
+};
+
+/*
+ * A JSON Web Token signed with RS256 or ES256, as an OAuth 2.0 bearer token.
+ * Signing with a private key takes far longer than the rest of a request,
+ * so each token is reused for "reuse" seconds.
+ */
+class JwtSigner : public RequestSigner {
+ public:
+  struct Config {
+    bool ecdsa = false;
+    std::shared_ptr<EVP_PKEY> key;
+    // The encoded JOSE header, and the claims that never change
+    std::string header;
+    std::string claims;
+    int ttl = kDefaultJwtTtl;
+    int reuse = kDefaultJwtTtl / 2;
+  };
+
+  explicit JwtSigner(const Config& config) : config_(config) {
+    ctx_ = EVP_MD_CTX_new();
+  }
+  ~JwtSigner() { EVP_MD_CTX_free(ctx_); }
+
+  std::unique_ptr<RequestSigner> clone() const override {
+    return std::unique_ptr<RequestSigner>(new JwtSigner(config_));
+  }
+
+  void sign(RandomGenerator* rand, const URLInfo& url,
+            absl::string_view method, absl::string_view body, int64_t now,
+            std::string* headers) override {
+    if (token_.empty() || (now >= renewAt_)) {
+      mint(rand, now);
+    }
+    headers->append(token_);
+  }
+
+ private:
+  void mint(RandomGenerator* rand, int64_t now) {
+    char nonce[24];
+    makeNonce(rand, nonce, sizeof(nonce));
+    std::string claims = config_.claims;
+    absl::StrAppend(&claims, "\"iat\":", now, ",\"exp\":", now + config_.ttl,
+                    ",\"jti\":\"", nonce, "\"}");
+
+    std::string signingInput = config_.header;
+    signingInput.push_back('.');
+    appendBase64Url(&signingInput, claims);
+
+    size_t sigLen = 0;
+    EVP_MD_CTX_reset(ctx_);
+    if ((EVP_DigestSignInit(ctx_, nullptr, EVP_sha256(), nullptr,
+                            config_.key.get()) != 1) ||
+        (EVP_DigestSignUpdate(ctx_, signingInput.data(),
+                              signingInput.size()) != 1) ||
+        (EVP_DigestSignFinal(ctx_, nullptr, &sigLen) != 1)) {
+      // The key was checked when it was loaded, so this shouldn't happen.
+      // Send an invalid token so that the requests fail visibly.
+      token_ = "Authorization: Bearer invalid\r\n";
+      renewAt_ = now + 1;
+      return;
+    }
+    std::vector<unsigned char> sig(sigLen);
+    EVP_DigestSignFinal(ctx_, sig.data(), &sigLen);
+    sig.resize(sigLen);
+    if (config_.ecdsa) {
+      sig = rawEcdsaSignature(sig);
+    }
+
+    token_ = "Authorization: Bearer ";
+    token_.append(signingInput);
+    token_.push_back('.');
+    appendBase64Url(&token_, absl::string_view((const char*)sig.data(),
+                                                sig.size()));
+    token_.append("\r\n");
+    renewAt_ = now + config_.reuse;
+  }
+
+  // JWS wants the two 32-byte numbers of a P-256 signature side by side,
+  // rather than the DER encoding that OpenSSL produces.
+  static std::vector<unsigned char> rawEcdsaSignature(
+      const std::vector<unsigned char>& der) {
+    const unsigned char* p = der.data();
+    ECDSA_SIG* es = d2i_ECDSA_SIG(nullptr, &p, der.size());
+    std::vector<unsigned char> raw(64, 0);
+    if (es == nullptr) {
+      return raw;
+    }
+    const BIGNUM* r;
+    const BIGNUM* s;
+    ECDSA_SIG_get0(es, &r, &s);
+    BN_bn2bin(r, raw.data() + 32 - BN_num_bytes(r));
+    BN_bn2bin(s, raw.data() + 64 - BN_num_bytes(s));
+    ECDSA_SIG_free(es);
+    return raw;
+  }
+
+  const Config config_;
+  EVP_MD_CTX* ctx_;
+  std::string token_;
+  int64_t renewAt_ = 0;
+};
+
+/*
+ * AWS Signature Version 4. The signing key changes once a day, and the
+ * canonical request is the same for every request to a URL except for
+ * the date, so only the date, two hashes, and an HMAC happen per request.
+ */
+class SigV4Signer : public RequestSigner {
+ public:
+  struct Config {
+    std::string access;
+    std::string secret;
+    std::string region;
+    std::string service;
+    std::string token;
+  };
+
+  explicit SigV4Signer(const Config& config) : config_(config) {
+    md_ = EVP_MD_CTX_new();
+    // S3 wants the payload hash as a header. Other services don't.
+    contentHeader_ = (config.service == "s3");
+    signedHeaders_ = "host;";
+    if (contentHeader_) {
+      signedHeaders_.append("x-amz-content-sha256;");
+    }
+    signedHeaders_.append("x-amz-date");
+    if (!config.token.empty()) {
+      signedHeaders_.append(";x-amz-security-token");
+    }
+  }
+  ~SigV4Signer() { EVP_MD_CTX_free(md_); }
+
+  std::unique_ptr<RequestSigner> clone() const override {
+    return std::unique_ptr<RequestSigner>(new SigV4Signer(config_));
+  }
+
+  void sign(RandomGenerator* rand, const URLInfo& url,
+            absl::string_view method, absl::string_view body, int64_t now,
+            std::string* headers) override {
+    Entry* e = cache_.find(url, method, body);
+    if (e == nullptr) {
+      e = buildEntry(url, method, body);
+    }
+    if (now != lastTime_) {
+      setTime(now);
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen;
+    EVP_DigestInit_ex(md_, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(md_, e->prefix.data(), e->prefix.size());
+    EVP_DigestUpdate(md_, amzDate_, strlen(amzDate_));
+    EVP_DigestUpdate(md_, e->suffix.data(), e->suffix.size());
+    EVP_DigestFinal_ex(md_, digest, &digestLen);
+
+    toSign_.assign(stringToSignPrefix_);
+    appendHex(&toSign_, digest, digestLen);
+    const unsigned int sigLen = signingKey_->sign(toSign_, digest);
+
+    headers->append("X-Amz-Date: ");
+    headers->append(amzDate_);
+    headers->append("\r\n");
+    if (contentHeader_) {
+      headers->append("X-Amz-Content-Sha256: ");
+      headers->append(e->bodyHash);
+      headers->append("\r\n");
+    }
+    if (!config_.token.empty()) {
+      headers->append("X-Amz-Security-Token: ");
+      headers->append(config_.token);
+      headers->append("\r\n");
+    }
+    headers->append(authPrefix_);
+    appendHex(headers, digest, sigLen);
+    headers->append("\r\n");
+  }
+
+ private:
+  struct Entry {
+    const URLInfo* url;
+    std::string method;
+    std::string body;
+    std::string bodyHash;
+    // The canonical request goes around the date
+    std::string prefix;
+    std::string suffix;
+  };
+
+  Entry* buildEntry(const URLInfo& url, absl::string_view method,
+                    absl::string_view body) {
+    Entry* e = cache_.add(url, method, body);
+    sha256Hex(body, &e->bodyHash);
+
+    std::string& p = e->prefix;
+    absl::StrAppend(&p, method, "\n");
+    const std::string path = url.pathOnly();
+    appendUriEncoded(&p, path.empty() ? "/" : path, true);
+    p.push_back('\n');
+
+    std::vector<std::pair<std::string, std::string>> params;
+    const std::string query = url.query();
+    const std::vector<absl::string_view> pairs =
+        absl::StrSplit(query, '&', absl::SkipEmpty());
+    for (auto it = pairs.cbegin(); it != pairs.cend(); it++) {
+      const std::vector<absl::string_view> nv =
+          absl::StrSplit(*it, absl::MaxSplits('=', 1));
+      std::string name;
+      std::string value;
+      appendUriEncoded(&name, uriDecode(nv[0]), false);
+      if (nv.size() > 1) {
+        appendUriEncoded(&value, uriDecode(nv[1]), false);
+      }
+      params.push_back(std::make_pair(name, value));
+    }
+    std::sort(params.begin(), params.end());
+    for (auto it = params.cbegin(); it != params.cend(); it++) {
+      if (it != params.cbegin()) {
+        p.push_back('&');
+      }
+      absl::StrAppend(&p, it->first, "=", it->second);
+    }
+
+    absl::StrAppend(&p, "\nhost:", url.hostHeader(), "\n");
+    if (contentHeader_) {
+      absl::StrAppend(&p, "x-amz-content-sha256:", e->bodyHash, "\n");
+    }
+    p.append("x-amz-date:");
+
+    e->suffix.push_back('\n');
+    if (!config_.token.empty()) {
+      absl::StrAppend(&e->suffix, "x-amz-security-token:", config_.token,
+                      "\n");
+    }
+    absl::StrAppend(&e->suffix, "\n", signedHeaders_, "\n", e->bodyHash);
+    return e;
+  }
+
+  void setTime(int64_t now) {
+    lastTime_ = now;
+    const time_t t = now;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(amzDate_, sizeof(amzDate_), "%Y%m%dT%H%M%SZ", &tm);
+    if (strncmp(dateStamp_, amzDate_, 8) == 0) {
+      // Only the time of day changed
+      stringToSignPrefix_.replace(kDateOffset, kAmzDateLen, amzDate_);
+      return;
+    }
+
+    // A new day, so a new scope and signing key
+    memcpy(dateStamp_, amzDate_, 8);
+    dateStamp_[8] = 0;
+    const std::string scope = absl::StrCat(dateStamp_, "/", config_.region, "/",
+                                           config_.service, "/aws4_request");
+    unsigned char k[EVP_MAX_MD_SIZE];
+    unsigned int kLen;
+    {
+      HmacKey h(EVP_sha256(), "AWS4" + config_.secret);
+      kLen = h.sign(dateStamp_, k);
+    }
+    const absl::string_view parts[] = {config_.region, config_.service,
+                                       "aws4_request"};
+    for (const auto& part : parts) {
+      HmacKey h(EVP_sha256(), absl::string_view((const char*)k, kLen));
+      kLen = h.sign(part, k);
+    }
+    signingKey_.reset(
+        new HmacKey(EVP_sha256(), absl::string_view((const char*)k, kLen)));
+
+    stringToSignPrefix_ =
+        absl::StrCat(kSigV4Algorithm, "\n", amzDate_, "\n", scope, "\n");
+    authPrefix_ = absl::StrCat("Authorization: ", kSigV4Algorithm,
+                               " Credential=", config_.access, "/", scope,
+                               ", SignedHeaders=", signedHeaders_,
+                               ", Signature=");
+  }
+
+  // Where the date goes in "stringToSignPrefix_," and how long it is
+  static const size_t kDateOffset = 17;
+  static const size_t kAmzDateLen = 16;
+
+ private:
+  const Config config_;
+  bool contentHeader_;
+  std::string signedHeaders_;
+  EVP_MD_CTX* md_;
+  RequestCache<Entry> cache_;
+  int64_t lastTime_ = -1;
+  char amzDate_[20] = {0};
+  char dateStamp_[9] = {0};
+  std::unique_ptr<HmacKey> signingKey_;
+  std::string stringToSignPrefix_;
+  std::string authPrefix_;
+  std::string toSign_;
+};
+
+static Status loadKey(const std::string& fileName, bool ecdsa,
+                      std::shared_ptr<EVP_PKEY>* key) {
+  FILE* f = fopen(fileName.c_str(), "r");
+  if (f == nullptr) {
+    return Status(Status::IO_ERROR, errno);
+  }
+  EVP_PKEY* k = PEM_read_PrivateKey(f, nullptr, nullptr, nullptr);
+  fclose(f);
+  if (k == nullptr) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Can't read private key from ", fileName));
+  }
+  key->reset(k, EVP_PKEY_free);
+  if (ecdsa) {
+    if (EVP_PKEY_id(k) != EVP_PKEY_EC) {
+      return Status(Status::INVALID_ARGUMENT, "ES256 requires an EC key");
+    }
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L) && !defined(OPENSSL_IS_BORINGSSL)
+    char group[64];
+    const bool p256 =
+        (EVP_PKEY_get_group_name(k, group, sizeof(group), nullptr) == 1) &&
+        (strcmp(group, "prime256v1") == 0);
+#else
+    const EC_KEY* ec = EVP_PKEY_get0_EC_KEY(k);
+    const bool p256 = (EC_GROUP_get_curve_name(EC_KEY_get0_group(ec)) ==
+                       NID_X9_62_prime256v1);
+#endif
+    if (!p256) {
+      return Status(Status::INVALID_ARGUMENT,
+                    "ES256 requires a P-256 key");
+    }
+  } else if (EVP_PKEY_id(k) != EVP_PKEY_RSA) {
+    return Status(Status::INVALID_ARGUMENT, "RS256 requires an RSA key");
+  }
+  return Status::kOk;
+}
+
+static Status parseSeconds(const Settings& s, const std::string& name,
+                           int* value) {
+  const auto it = s.find(name);
+  if (it == s.end()) {
+    return Status::kOk;
+  }
+  if (!absl::SimpleAtoi(it->second, value) || (*value < 0)) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Invalid value for \"", name, "\""));
+  }
+  return Status::kOk;
+}
+
+static Status makeJwtSigner(const Settings& s,
+                            std::unique_ptr<RequestSigner>* signer) {
+  Status st = requireSettings(s, {"alg", "key"},
+                              {"iss", "sub", "aud", "kid", "ttl", "reuse"});
+  if (!st.ok()) {
+    return st;
+  }
+  JwtSigner::Config c;
+  const std::string alg = getSetting(s, "alg");
+  if (alg == "ES256") {
+    c.ecdsa = true;
+  } else if (alg != "RS256") {
+    return Status(Status::INVALID_ARGUMENT,
+                  "JWT algorithm must be RS256 or ES256");
+  }
+  st = loadKey(getSetting(s, "key"), c.ecdsa, &c.key);
+  if (!st.ok()) {
+    return st;
+  }
+  st = parseSeconds(s, "ttl", &c.ttl);
+  if (!st.ok()) {
+    return st;
+  }
+  c.reuse = c.ttl / 2;
+  st = parseSeconds(s, "reuse", &c.reuse);
+  if (!st.ok()) {
+    return st;
+  }
+  if (c.reuse > c.ttl) {
+    return Status(Status::INVALID_ARGUMENT,
+                  "Tokens can't be reused after they expire");
+  }
+
+  std::string header = absl::StrCat("{\"alg\":\"", alg, "\",\"typ\":\"JWT\"");
+  if (s.count("kid") > 0) {
+    absl::StrAppend(&header, ",\"kid\":", JsonWriter::quote(s.at("kid")));
+  }
+  header.push_back('}');
+  appendBase64Url(&c.header, header);
+
+  c.claims = "{";
+  const char* names[] = {"iss", "sub", "aud"};
+  for (const char* n : names) {
+    if (s.count(n) > 0) {
+      absl::StrAppend(&c.claims, "\"", n, "\":", JsonWriter::quote(s.at(n)),
+                      ",");
+    }
+  }
+  signer->reset(new JwtSigner(c));
+  return Status::kOk;
+}
+
+Status RequestSigner::Parse(absl::string_view spec,
+                            std::unique_ptr<RequestSigner>* signer) {
+  const std::vector<absl::string_view> parts = absl::StrSplit(spec, ',');
+  const absl::string_view type = parts[0];
+  Settings s;
+  for (size_t i = 1; i < parts.size(); i++) {
+    const std::vector<std::string> nv =
+        absl::StrSplit(parts[i], absl::MaxSplits('=', 1));
+    if (nv.size() != 2) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid signer setting \"", parts[i], "\""));
+    }
+    s[nv[0]] = nv[1];
+  }
+
+  if (type == "hmac-sha256") {
+    const Status st = requireSettings(s, {"key", "secret"}, {});
+    if (!st.ok()) {
+      return st;
+    }
+    signer->reset(new HmacSha256Signer(s["key"], s["secret"]));
+    return Status::kOk;
+  }
+  if (type == "jwt") {
+    return makeJwtSigner(s, signer);
+  }
+  if (type == "sigv4") {
+    const Status st =
+        requireSettings(s, {"access", "secret", "region", "service"}, {"token"});
+    if (!st.ok()) {
+      return st;
+    }
+    SigV4Signer::Config c;
+    c.access = s["access"];
+    c.secret = s["secret"];
+    c.region = s["region"];
+    c.service = s["service"];
+    c.token = getSetting(s, "token");
+    signer->reset(new SigV4Signer(c));
+    return Status::kOk;
+  }
+  return Status(Status::INVALID_ARGUMENT,
+                absl::StrCat("Unknown signer type \"", type, "\""));
+}
+
+}  // namespace apib
@@ -0,0 +1,82 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_SIGNER_H
+#define APIB_SIGNER_H
+
+#include <openssl/evp.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "apib/apib_rand.h"
+#include "apib/apib_url.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// An HMAC key for one digest, with the inner and outer key pads already
+// hashed, so that each signature only hashes the message. Not thread-safe.
+class HmacKey {
+ public:
+  HmacKey(const EVP_MD* md, absl::string_view key);
+  ~HmacKey();
+  HmacKey(const HmacKey&) = delete;
+  HmacKey& operator=(const HmacKey&) = delete;
+
+  // Write the HMAC of "data" to "out," which must have room for
+  // EVP_MAX_MD_SIZE bytes, and return its length.
+  unsigned int sign(absl::string_view data, unsigned char* out);
+
+ private:
+  EVP_MD_CTX* inner_;
+  EVP_MD_CTX* outer_;
+  EVP_MD_CTX* work_;
+};
+
+// Adds headers that authenticate each request. The I/O threads call
+// "sign" for every request, so implementations keep whatever they can
+// from one request to the next. Each thread gets its own copy from
+// "clone," so "sign" need not be thread-safe.
+class RequestSigner {
+ public:
+  virtual ~RequestSigner() {}
+
+  // Return a new signer with the same settings for another thread.
+  virtual std::unique_ptr<RequestSigner> clone() const = 0;
+
+  // Append the signature headers for a request, each followed by CRLF.
+  // "now" is the wall-clock time in seconds since the epoch.
+  virtual void sign(RandomGenerator* rand, const URLInfo& url,
+                    absl::string_view method, absl::string_view body,
+                    int64_t now, std::string* headers) = 0;
+
+  // Create a signer from a "--sign" argument, which is the signer type
+  // followed by comma-separated "name=value" settings:
+  //   hmac-sha256,key=ID,secret=SECRET
+  //   jwt,alg=RS256|ES256,key=PEM-FILE[,iss=][,sub=][,aud=][,kid=]
+  //       [,ttl=SECONDS][,reuse=SECONDS]
+  //   sigv4,access=KEY,secret=SECRET,region=REGION,service=SERVICE
+  //       [,token=SESSION-TOKEN]
+  static Status Parse(absl::string_view spec,
+                      std::unique_ptr<RequestSigner>* signer);
+};
+
+}  // namespace apib
+
+#endif  // APIB_SIGNER_H
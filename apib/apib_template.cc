@@ -0,0 +1,336 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_template.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "apib/apib_url.h"
+
+namespace apib {
+
+// 64 characters that are safe in a URL, so each one takes six random bits
+static const char kRandChars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+static const char kHexChars[] = "0123456789abcdef";
+
+Status CsvData::load(absl::string_view fileName) {
+  std::ifstream in(std::string(fileName), std::ios::binary);
+  if (!in) {
+    return Status(Status::IO_ERROR, fileName);
+  }
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  parse(buf.str());
+  if (rows_.empty()) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("No rows in CSV file ", fileName));
+  }
+  return Status::kOk;
+}
+
+void CsvData::parse(absl::string_view data) {
+  std::vector<std::string> row;
+  std::string field;
+  bool quoted = false;
+  bool lineEmpty = true;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    const char c = data[i];
+    if (quoted) {
+      if (c != '"') {
+        field.push_back(c);
+      } else if (((i + 1) < data.size()) && (data[i + 1] == '"')) {
+        field.push_back('"');
+        i++;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+      lineEmpty = false;
+    } else if (c == ',') {
+      row.push_back(std::move(field));
+      field.clear();
+      lineEmpty = false;
+    } else if ((c == '\n') || (c == '\r')) {
+      if (!lineEmpty) {
+        row.push_back(std::move(field));
+        rows_.push_back(std::move(row));
+      }
+      field.clear();
+      row.clear();
+      lineEmpty = true;
+    } else {
+      field.push_back(c);
+      lineEmpty = false;
+    }
+  }
+  if (!lineEmpty) {
+    row.push_back(std::move(field));
+    rows_.push_back(std::move(row));
+  }
+}
+
+StatusOr<RequestTemplate> RequestTemplate::Compile(absl::string_view text) {
+  RequestTemplate t;
+  size_t pos = 0;
+
+  while (pos < text.size()) {
+    const size_t start = text.find("${", pos);
+    if (start == absl::string_view::npos) {
+      t.addLiteral(text.substr(pos));
+      break;
+    }
+    if ((start > pos) && (text[start - 1] == '$')) {
+      // "$${" is an escaped "${"
+      t.addLiteral(text.substr(pos, start - pos - 1));
+      t.addLiteral("${");
+      pos = start + 2;
+      continue;
+    }
+    t.addLiteral(text.substr(pos, start - pos));
+    const size_t end = text.find('}', start);
+    if (end == absl::string_view::npos) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Unterminated placeholder: ",
+                                 text.substr(start)));
+    }
+    const Status s = t.addPlaceholder(text.substr(start + 2, end - start - 2));
+    if (!s.ok()) {
+      return s;
+    }
+    pos = end + 1;
+  }
+  return t;
+}
+
+void RequestTemplate::addLiteral(absl::string_view s) {
+  if (s.empty()) {
+    return;
+  }
+  if (!segments_.empty() && (segments_.back().kind == kLiteral)) {
+    // Literals are appended in order, so just make the last one longer
+    segments_.back().b += s.size();
+  } else {
+    segments_.push_back(
+        {kLiteral, static_cast<int64_t>(literals_.size()),
+         static_cast<int64_t>(s.size())});
+  }
+  literals_.append(s.data(), s.size());
+}
+
+Status RequestTemplate::addPlaceholder(absl::string_view p) {
+  const std::vector<absl::string_view> parts = absl::StrSplit(p, ':');
+  const absl::string_view name = parts[0];
+  const size_t args = parts.size() - 1;
+  int64_t a = 0;
+  int64_t b = 0;
+  Kind kind;
+
+  if ((name == "counter") && (args == 0)) {
+    kind = kCounter;
+  } else if ((name == "uuid") && (args == 0)) {
+    kind = kUuid;
+  } else if ((name == "conn") && (args == 0)) {
+    kind = kConnection;
+  } else if ((name == "thread") && (args == 0)) {
+    kind = kThread;
+  } else if ((name == "rand") && (args == 2)) {
+    int32_t min, max;
+    if (!absl::SimpleAtoi(parts[1], &min) ||
+        !absl::SimpleAtoi(parts[2], &max) || (min > max)) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid range in ${", p, "}"));
+    }
+    kind = kRandInt;
+    a = min;
+    b = max;
+  } else if ((name == "randstr") && (args == 1)) {
+    if (!absl::SimpleAtoi(parts[1], &a) || (a < 1) || (a > 65536)) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid length in ${", p, "}"));
+    }
+    kind = kRandString;
+  } else if ((name == "csv") && (args == 1)) {
+    if (!absl::SimpleAtoi(parts[1], &a) || (a < 1)) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid column in ${", p, "}"));
+    }
+    kind = kCsv;
+    // Columns are numbered from one
+    a--;
+  } else {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Unknown placeholder ${", p, "}"));
+  }
+
+  segments_.push_back({kind, a, b});
+  return Status::kOk;
+}
+
+bool RequestTemplate::isLiteral() const {
+  for (auto it = segments_.cbegin(); it != segments_.cend(); it++) {
+    if (it->kind != kLiteral) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RequestTemplate::usesCsv() const {
+  for (auto it = segments_.cbegin(); it != segments_.cend(); it++) {
+    if (it->kind == kCsv) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void appendRandString(RandomGenerator* rand, int64_t len,
+                             std::string* out) {
+  // Each random number has 30 bits, which is enough for five characters
+  while (len > 0) {
+    uint32_t r = rand->bits();
+    for (int i = 0; (i < 5) && (len > 0); i++, len--) {
+      out->push_back(kRandChars[r & 0x3f]);
+      r >>= 6;
+    }
+  }
+}
+
+static void appendUuid(RandomGenerator* rand, std::string* out) {
+  uint8_t b[16];
+  for (int i = 0; i < 16; i += 3) {
+    const uint32_t r = rand->bits();
+    b[i] = r & 0xff;
+    if ((i + 1) < 16) {
+      b[i + 1] = (r >> 8) & 0xff;
+    }
+    if ((i + 2) < 16) {
+      b[i + 2] = (r >> 16) & 0xff;
+    }
+  }
+  // Version 4, variant 1, as RFC 4122 says
+  b[6] = (b[6] & 0x0f) | 0x40;
+  b[8] = (b[8] & 0x3f) | 0x80;
+
+  char buf[36];
+  char* p = buf;
+  for (int i = 0; i < 16; i++) {
+    if ((i == 4) || (i == 6) || (i == 8) || (i == 10)) {
+      *(p++) = '-';
+    }
+    *(p++) = kHexChars[b[i] >> 4];
+    *(p++) = kHexChars[b[i] & 0xf];
+  }
+  out->append(buf, sizeof(buf));
+}
+
+void RequestTemplate::fill(const TemplateContext& ctx,
+                           std::string* out) const {
+  for (auto it = segments_.cbegin(); it != segments_.cend(); it++) {
+    switch (it->kind) {
+      case kLiteral:
+        out->append(literals_, it->a, it->b);
+        break;
+      case kCounter:
+        absl::StrAppend(out, ctx.counter);
+        break;
+      case kRandInt:
+        absl::StrAppend(out, ctx.rand->get(it->a, it->b));
+        break;
+      case kRandString:
+        appendRandString(ctx.rand, it->a, out);
+        break;
+      case kUuid:
+        appendUuid(ctx.rand, out);
+        break;
+      case kCsv:
+        if ((ctx.row != nullptr) &&
+            (static_cast<size_t>(it->a) < ctx.row->size())) {
+          out->append((*ctx.row)[it->a]);
+        }
+        break;
+      case kConnection:
+        absl::StrAppend(out, ctx.connection);
+        break;
+      case kThread:
+        absl::StrAppend(out, ctx.thread);
+        break;
+    }
+  }
+}
+
+Status RequestTemplates::compile(const std::vector<std::string>& headerLines,
+                                 absl::string_view sendData) {
+  paths.clear();
+  for (size_t i = 0; i < URLInfo::Count(); i++) {
+    auto t = RequestTemplate::Compile(URLInfo::Get(i)->path());
+    if (!t.ok()) {
+      return t.status();
+    }
+    paths.push_back(t.value());
+  }
+
+  std::string allHeaders;
+  for (auto it = headerLines.cbegin(); it != headerLines.cend(); it++) {
+    absl::StrAppend(&allHeaders, *it, "\r\n");
+  }
+  auto h = RequestTemplate::Compile(allHeaders);
+  if (!h.ok()) {
+    return h.status();
+  }
+  headers = h.value();
+
+  auto b = RequestTemplate::Compile(sendData);
+  if (!b.ok()) {
+    return b.status();
+  }
+  body = b.value();
+  return Status::kOk;
+}
+
+bool RequestTemplates::pathsAreLiteral() const {
+  for (auto it = paths.cbegin(); it != paths.cend(); it++) {
+    if (!it->isLiteral()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RequestTemplates::isLiteral() const {
+  return pathsAreLiteral() && headers.isLiteral() && body.isLiteral();
+}
+
+bool RequestTemplates::usesCsv() const {
+  if (headers.usesCsv() || body.usesCsv()) {
+    return true;
+  }
+  for (auto it = paths.cbegin(); it != paths.cend(); it++) {
+    if (it->usesCsv()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace apib
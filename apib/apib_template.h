@@ -0,0 +1,134 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_TEMPLATE_H
+#define APIB_TEMPLATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "apib/apib_rand.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// The rows of a CSV file, for templates to pick values from. Fields may be
+// quoted with double quotes, and a quote inside a quoted field is doubled.
+class CsvData {
+ public:
+  Status load(absl::string_view fileName);
+  // Parse the CSV from a string rather than a file
+  void parse(absl::string_view data);
+
+  size_t size() const { return rows_.size(); }
+  bool empty() const { return rows_.empty(); }
+  const std::vector<std::string>& row(size_t i) const { return rows_[i]; }
+
+ private:
+  std::vector<std::vector<std::string>> rows_;
+};
+
+// The values that change from one request to the next. The caller fills
+// this in once per request, so that every template used by the request
+// sees the same counter and CSV row.
+struct TemplateContext {
+  RandomGenerator* rand = nullptr;
+  uint64_t counter = 0;
+  int thread = 0;
+  int connection = 0;
+  // The CSV row for this request, or null if there is no CSV file
+  const std::vector<std::string>* row = nullptr;
+};
+
+/*
+ * A piece of request text with placeholders that are replaced on every
+ * request. The text is compiled once into a list of literals and
+ * placeholders, so filling it in is just a series of appends. The
+ * placeholders are:
+ *   ${counter}         A number that counts up with each request on a thread
+ *   ${rand:MIN:MAX}    A random integer from MIN to MAX
+ *   ${randstr:LEN}     A random string of LEN letters, digits, "-" and "_"
+ *   ${uuid}            A random (version 4) UUID
+ *   ${csv:COLUMN}      A column of the CSV row, starting at 1
+ *   ${conn}            The number of the connection within the thread
+ *   ${thread}          The number of the thread
+ * and "$${" is a literal "${".
+ */
+class RequestTemplate {
+ public:
+  // Compile "text," or return an error for a malformed or unknown
+  // placeholder.
+  static StatusOr<RequestTemplate> Compile(absl::string_view text);
+
+  // Whether there are any placeholders at all
+  bool isLiteral() const;
+  // Whether any placeholder refers to the CSV row
+  bool usesCsv() const;
+
+  // Append the text to "out" with the placeholders filled in. This only
+  // allocates if "out" has to grow.
+  void fill(const TemplateContext& ctx, std::string* out) const;
+
+ private:
+  enum Kind {
+    kLiteral,
+    kCounter,
+    kRandInt,
+    kRandString,
+    kUuid,
+    kCsv,
+    kConnection,
+    kThread
+  };
+
+  struct Segment {
+    Kind kind;
+    // For literals, the place in "literals_." For everything else, the
+    // arguments, if any.
+    int64_t a;
+    int64_t b;
+  };
+
+  Status addPlaceholder(absl::string_view p);
+  void addLiteral(absl::string_view s);
+
+  std::string literals_;
+  std::vector<Segment> segments_;
+};
+
+// Every part of a request that may be templated
+struct RequestTemplates {
+  // Request paths, one for each URLInfo by its index
+  std::vector<RequestTemplate> paths;
+  // All the "-H" headers, each followed by CRLF
+  RequestTemplate headers;
+  RequestTemplate body;
+  CsvData csv;
+
+  // Compile the paths of all the URLs, plus the headers and body
+  Status compile(const std::vector<std::string>& headerLines,
+                 absl::string_view sendData);
+  // Whether any part of the request has placeholders
+  bool isLiteral() const;
+  bool pathsAreLiteral() const;
+  bool usesCsv() const;
+};
+
+}  // namespace apib
+
+#endif  // APIB_TEMPLATE_H
@@ -17,8 +17,13 @@ limitations under the License.
 #include "apib/apib_time.h"
 
 #include <cassert>
+#include <cmath>
 #include <ctime>
 
+#ifdef APIB_HAVE_TSC
+#include <cpuid.h>
+#endif
+
 #include "apib/apib_util.h"
 
 namespace apib {
@@ -27,13 +32,92 @@ static const int64_t kNanosecond = 1000000000LL;
 static const double kNanosecondF = 1000000000.0;
 static const double kMillisecondF = 1000.0;
 
-int64_t GetTime() {
+namespace time_internal {
+bool useTsc = false;
+}
+
+// Nanoseconds per tick, as a fixed-point number with 32 fractional bits
+static uint64_t tickMultiplier = 1ULL << 32;
+static double tickFrequency = kNanosecondF;
+
+static int64_t readClock(clockid_t clock) {
   struct timespec tp;
-  const int err = clock_gettime(CLOCK_REALTIME, &tp);
+  const int err = clock_gettime(clock, &tp);
   mandatoryAssert(err == 0);
   return (((int64_t)tp.tv_sec) * kNanosecond) + tp.tv_nsec;
 }
 
+int64_t GetTime() { return readClock(CLOCK_MONOTONIC); }
+
+int64_t GetWallTime() { return readClock(CLOCK_REALTIME); }
+
+int64_t TicksToNanos(int64_t ticks) {
+  if (ticks <= 0) {
+    return 0;
+  }
+  if (!time_internal::useTsc) {
+    return ticks;
+  }
+#ifdef APIB_HAVE_TSC
+  return (int64_t)(((unsigned __int128)ticks * tickMultiplier) >> 32);
+#else
+  return ticks;
+#endif
+}
+
+#ifdef APIB_HAVE_TSC
+// Count ticks across a short sleep and return the frequency
+static double measureTsc() {
+  const struct timespec pause = {0, 50000000};
+  const int64_t startTime = GetTime();
+  const uint64_t startTicks = __rdtsc();
+  nanosleep(&pause, nullptr);
+  const uint64_t endTicks = __rdtsc();
+  const int64_t endTime = GetTime();
+  return (endTicks - startTicks) * kNanosecondF / (endTime - startTime);
+}
+#endif
+
+Status EnableTsc() {
+#ifdef APIB_HAVE_TSC
+  unsigned int eax, ebx, ecx, edx;
+  // The "invariant TSC" bit says that the counter runs at a constant rate
+  // regardless of power states, and is in step across cores.
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1U << 8))) {
+    return Status(Status::INTERNAL_ERROR, "CPU does not have an invariant TSC");
+  }
+
+  // Measure twice. A TSC that is being emulated or adjusted by a
+  // hypervisor is unlikely to give the same answer both times.
+  const double f1 = measureTsc();
+  const double f2 = measureTsc();
+  if (f1 < 1.0e8 || fabs(f1 - f2) / f1 > 0.001) {
+    return Status(Status::INTERNAL_ERROR, "TSC frequency is not stable");
+  }
+  uint64_t last = __rdtsc();
+  for (int i = 0; i < 1000; i++) {
+    const uint64_t now = __rdtsc();
+    if (now < last) {
+      return Status(Status::INTERNAL_ERROR, "TSC went backwards");
+    }
+    last = now;
+  }
+
+  tickFrequency = (f1 + f2) / 2.0;
+  tickMultiplier = (uint64_t)(kNanosecondF / tickFrequency * 4294967296.0);
+  time_internal::useTsc = true;
+  return Status::kOk;
+#else
+  return Status(Status::INTERNAL_ERROR,
+                "The TSC is only supported on x86-64 processors");
+#endif
+}
+
+bool TscEnabled() { return time_internal::useTsc; }
+
+double TickFrequency() { return tickFrequency; }
+
 double Seconds(int64_t t) { return ((double)t) / kNanosecondF; }
 
 double Milliseconds(int64_t t) {
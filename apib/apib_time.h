@@ -19,14 +19,57 @@ limitations under the License.
 
 #include <cstdint>
 
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#define APIB_HAVE_TSC 1
+#endif
+
+#include "apib/status.h"
+
 namespace apib {
 
 // Time is always in 64-bit nanoseconds
 
+// Monotonic time, for measuring intervals. It does not jump when the
+// system clock is set.
 extern int64_t GetTime();
+// Time since the epoch, for timestamps that leave the process
+extern int64_t GetWallTime();
 extern double Seconds(int64_t t);
 extern double Milliseconds(int64_t t);
 
+// "Ticks" are a cheaper clock for measuring latency. They are the same as
+// GetTime unless EnableTsc succeeded, in which case they come straight
+// from the CPU's time stamp counter. Differences between ticks must be
+// converted to nanoseconds with TicksToNanos before they mean anything.
+
+namespace time_internal {
+extern bool useTsc;
+}
+
+inline int64_t GetTicks() {
+#ifdef APIB_HAVE_TSC
+  if (time_internal::useTsc) {
+    return __rdtsc();
+  }
+#endif
+  return GetTime();
+}
+
+// Convert a difference between two values of GetTicks to nanoseconds.
+// Negative differences, which may happen if the counters on two CPUs are
+// slightly out of step, become zero.
+extern int64_t TicksToNanos(int64_t ticks);
+
+// Check that the CPU has an invariant TSC that keeps time consistently,
+// measure its frequency against the monotonic clock, and start using it
+// for GetTicks. Returns an error, and leaves the monotonic clock in use,
+// if the TSC is missing or unreliable. This takes about 100 milliseconds.
+extern Status EnableTsc();
+extern bool TscEnabled();
+// Ticks per second, for information
+extern double TickFrequency();
+
 }  // namespace apib
 
 #endif  // APIB_TIME_H
\ No newline at end of file
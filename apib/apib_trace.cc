@@ -0,0 +1,208 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_trace.h"
+
+#include <algorithm>
+#include <map>
+
+#include "absl/strings/str_cat.h"
+#include "apib/apib_json.h"
+#include "apib/apib_time.h"
+
+namespace apib {
+
+static uint64_t roundUp(size_t size) {
+  uint64_t s = 1;
+  while (s < size) {
+    s <<= 1;
+  }
+  return s;
+}
+
+TraceBuffer::TraceBuffer(size_t size)
+    : mask_(roundUp(size) - 1), slots_(new Slot[mask_ + 1]) {}
+
+void TraceBuffer::snapshot(std::vector<TraceEvent>* events) const {
+  const uint64_t size = mask_ + 1;
+  const uint64_t end = pos_.load(std::memory_order_acquire);
+  const uint64_t start = (end > size) ? end - size : 0;
+  std::vector<TraceEvent> copy;
+  copy.reserve(end - start);
+  for (uint64_t p = start; p < end; p++) {
+    const Slot& s = slots_[p & mask_];
+    const uint64_t info = s.info.load(std::memory_order_relaxed);
+    TraceEvent e;
+    e.ticks = s.ticks.load(std::memory_order_relaxed);
+    e.type = static_cast<TraceType>(info >> 32);
+    e.connection = static_cast<int>(static_cast<uint32_t>(info));
+    copy.push_back(e);
+  }
+
+  // The I/O thread may have gone around the ring while we copied it. If it
+  // is now writing position "after," then every slot up to and including
+  // "after - size" may hold something newer than we expected.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = pos_.load(std::memory_order_relaxed);
+  // If it went all the way around, none of the copy is any good.
+  uint64_t firstGood = start;
+  if (after >= size) {
+    firstGood = std::min(std::max(start, after - size + 1), end);
+  }
+  if (firstGood == end) {
+    events->clear();
+    return;
+  }
+  events->assign(copy.begin() + (firstGood - start), copy.end());
+}
+
+namespace {
+
+// Turns the events for one connection into slices
+class ConnectionTrace {
+ public:
+  ConnectionTrace(JsonWriter* w, int pid, int tid, int64_t base)
+      : w_(w), pid_(pid), tid_(tid), base_(base) {}
+
+  void add(const TraceEvent& e) {
+    switch (e.type) {
+      case TRACE_CONNECT:
+        instant("connect", e.ticks);
+        break;
+      case TRACE_HANDSHAKE:
+        instant("handshake", e.ticks);
+        break;
+      case TRACE_WRITE_START:
+        requestStart_ = e.ticks;
+        phaseStart_ = e.ticks;
+        break;
+      case TRACE_WRITE_END:
+        slice("write", phaseStart_, e.ticks);
+        phaseStart_ = e.ticks;
+        break;
+      case TRACE_FIRST_BYTE:
+        slice("wait", phaseStart_, e.ticks);
+        phaseStart_ = e.ticks;
+        break;
+      case TRACE_COMPLETE:
+        slice("read", phaseStart_, e.ticks);
+        slice("request", requestStart_, e.ticks);
+        requestStart_ = phaseStart_ = -1;
+        break;
+      case TRACE_ERROR:
+        instant("error", e.ticks);
+        slice("failed request", requestStart_, e.ticks);
+        requestStart_ = phaseStart_ = -1;
+        break;
+      case TRACE_CLOSE:
+        instant("close", e.ticks);
+        break;
+    }
+  }
+
+ private:
+  double micros(int64_t ticks) const {
+    return TicksToNanos(ticks - base_) / 1000.0;
+  }
+
+  void common(const char* name, const char* phase, int64_t ticks) {
+    w_->field("name", name);
+    w_->field("ph", phase);
+    w_->field("pid", pid_);
+    w_->field("tid", tid_);
+    w_->field("ts", micros(ticks));
+  }
+
+  // Nothing is written for a phase whose start fell off the ring
+  void slice(const char* name, int64_t start, int64_t end) {
+    if (start < 0) {
+      return;
+    }
+    w_->beginObject();
+    common(name, "X", start);
+    w_->field("dur", micros(end) - micros(start));
+    w_->endObject();
+  }
+
+  void instant(const char* name, int64_t ticks) {
+    w_->beginObject();
+    common(name, "i", ticks);
+    w_->field("s", "t");
+    w_->endObject();
+  }
+
+  JsonWriter* w_;
+  const int pid_;
+  const int tid_;
+  const int64_t base_;
+  int64_t requestStart_ = -1;
+  int64_t phaseStart_ = -1;
+};
+
+void writeName(JsonWriter* w, const char* what, int pid, int tid,
+               const std::string& name) {
+  w->beginObject();
+  w->field("name", what);
+  w->field("ph", "M");
+  w->field("pid", pid);
+  w->field("tid", tid);
+  w->key("args");
+  w->beginObject();
+  w->field("name", name);
+  w->endObject();
+  w->endObject();
+}
+
+}  // namespace
+
+void WriteChromeTrace(std::ostream& out,
+                      const std::vector<std::vector<TraceEvent>>& threads) {
+  // Times start at the first event that we still have
+  int64_t base = -1;
+  for (auto it = threads.cbegin(); it != threads.cend(); it++) {
+    if (!it->empty() && ((base < 0) || (it->front().ticks < base))) {
+      base = it->front().ticks;
+    }
+  }
+
+  JsonWriter w(out);
+  w.beginObject();
+  w.field("displayTimeUnit", "ms");
+  w.key("traceEvents");
+  w.beginArray();
+  for (size_t t = 0; t < threads.size(); t++) {
+    const int pid = static_cast<int>(t);
+    writeName(&w, "process_name", pid, 0, absl::StrCat("I/O thread ", t));
+    std::map<int, ConnectionTrace> conns;
+    for (auto it = threads[t].cbegin(); it != threads[t].cend(); it++) {
+      auto c = conns.find(it->connection);
+      if (c == conns.end()) {
+        writeName(&w, "thread_name", pid, it->connection,
+                  absl::StrCat("connection ", it->connection));
+        c = conns
+                .insert(std::make_pair(
+                    it->connection,
+                    ConnectionTrace(&w, pid, it->connection, base)))
+                .first;
+      }
+      c->second.add(*it);
+    }
+  }
+  w.endArray();
+  w.endObject();
+}
+
+}  // namespace apib
@@ -0,0 +1,102 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_TRACE_H
+#define APIB_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace apib {
+
+// The things that happen to a connection that may be traced
+typedef enum {
+  TRACE_CONNECT,
+  TRACE_HANDSHAKE,
+  TRACE_WRITE_START,
+  TRACE_WRITE_END,
+  TRACE_FIRST_BYTE,
+  TRACE_COMPLETE,
+  TRACE_ERROR,
+  TRACE_CLOSE
+} TraceType;
+
+struct TraceEvent {
+  // From "GetTicks"
+  int64_t ticks;
+  TraceType type;
+  int connection;
+};
+
+/*
+ * A fixed-size ring of the most recent events on one I/O thread, kept in
+ * binary form so that recording one costs a clock read and two stores.
+ * Only the I/O thread records, and any other thread may take a snapshot at
+ * any time. Each slot is a pair of relaxed atomics so that a snapshot
+ * taken while the ring is being written is safe, and the snapshot drops
+ * any slots that were overwritten while it was copying them.
+ */
+class TraceBuffer {
+ public:
+  // "size" is rounded up to a power of two.
+  explicit TraceBuffer(size_t size);
+  TraceBuffer(const TraceBuffer&) = delete;
+  TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+  void record(int64_t ticks, TraceType type, int connection) {
+    const uint64_t pos = pos_.load(std::memory_order_relaxed);
+    // A snapshot that sees any part of this slot's new contents will also
+    // see "pos," and so know that the old contents are gone.
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& s = slots_[pos & mask_];
+    s.ticks.store(ticks, std::memory_order_relaxed);
+    s.info.store((static_cast<uint64_t>(type) << 32) |
+                     static_cast<uint32_t>(connection),
+                 std::memory_order_relaxed);
+    pos_.store(pos + 1, std::memory_order_release);
+  }
+
+  // Copy the events in the ring, oldest first, to "events." Once the ring
+  // has filled, this is the last "size() - 1" events, since the oldest slot
+  // may be in the middle of being overwritten.
+  void snapshot(std::vector<TraceEvent>* events) const;
+
+  size_t size() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    std::atomic<int64_t> ticks{0};
+    std::atomic<uint64_t> info{0};
+  };
+
+  const uint64_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> pos_{0};
+};
+
+// Write the events from each thread, as taken by "snapshot," in the JSON
+// format that Chrome's "about:tracing" and Perfetto read. Each I/O thread
+// is a process and each connection is a thread, and each request is a
+// slice, divided into writing, waiting, and reading.
+void WriteChromeTrace(std::ostream& out,
+                      const std::vector<std::vector<TraceEvent>>& threads);
+
+}  // namespace apib
+
+#endif  // APIB_TRACE_H
@@ -23,10 +23,15 @@ limitations under the License.
 #include <sys/types.h>
 
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "apib/apib_lines.h"
 #include "apib/apib_util.h"
@@ -42,9 +47,18 @@ using std::endl;
 namespace apib {
 
 std::vector<URLInfoPtr> URLInfo::urls_;
+std::vector<std::unique_ptr<Host>> URLInfo::hosts_;
+Balance URLInfo::balance_;
 bool URLInfo::initialized_ = false;
+
+// For "StartRefresh"
+static std::mutex refreshLock;
+static std::condition_variable refreshWakeup;
+static bool refreshStopped = false;
+static std::thread* refreshThread = nullptr;
 const std::string URLInfo::kHttp = "http";
 const std::string URLInfo::kHttps = "https";
+const std::string URLInfo::kUnix = "unix";
 
 static absl::string_view urlPart(const struct http_parser_url* pu,
                                  const absl::string_view urlstr, int part) {
@@ -52,6 +66,60 @@ static absl::string_view urlPart(const struct http_parser_url* pu,
 }
 
 Status URLInfo::init(absl::string_view urlstr) {
+  const std::string unixPrefix = absl::StrCat(kUnix, "://");
+  if (!absl::StartsWith(urlstr, unixPrefix)) {
+    const Status s = parseHttp(urlstr);
+    if (!s.ok()) {
+      return s;
+    }
+    if (!shareHost()) {
+      // If the lookup fails, the host has no addresses
+      hosts_.push_back(std::unique_ptr<Host>(new Host(hostName_)));
+      host_ = hosts_.back().get();
+      lookupStatus_ = host_->lookup(balance_);
+    }
+    return Status::kOk;
+  }
+
+  // "unix://SOCKET:PATH" sends requests for PATH over the Unix socket at
+  // SOCKET. The rest is parsed like an ordinary URL on "localhost."
+  const absl::string_view rest = urlstr.substr(unixPrefix.size());
+  const size_t colon = rest.find(':');
+  const absl::string_view socketPath = rest.substr(0, colon);
+  const absl::string_view requestPath =
+      (colon == absl::string_view::npos) ? "/" : rest.substr(colon + 1);
+  const auto as = Address::unixSocket(socketPath);
+  if (!as.ok() || !absl::StartsWith(requestPath, "/")) {
+    return Status(Status::INVALID_URL, urlstr);
+  }
+  const Status s = parseHttp(absl::StrCat(kHttp, "://localhost", requestPath));
+  if (!s.ok()) {
+    return Status(Status::INVALID_URL, urlstr);
+  }
+  str_ = std::string(urlstr);
+  hostName_ = std::string(socketPath);
+  if (!shareHost()) {
+    hosts_.push_back(
+        std::unique_ptr<Host>(new Host(hostName_, as.valueref())));
+    host_ = hosts_.back().get();
+  }
+  return Status::kOk;
+}
+
+// URLs on the same host share its addresses, and it's only looked up once.
+// Returns false if this is the first URL for the host.
+bool URLInfo::shareHost() {
+  for (auto it = urls_.cbegin(); it != urls_.cend(); it++) {
+    if ((*it)->hostName_ == hostName_) {
+      host_ = (*it)->host_;
+      lookupStatus_ = (*it)->lookupStatus_;
+      return true;
+    }
+  }
+  return false;
+}
+
+Status URLInfo::parseHttp(absl::string_view urlstr) {
   struct http_parser_url pu;
 
   http_parser_url_init(&pu);
@@ -72,6 +140,7 @@ Status URLInfo::init(absl::string_view urlstr) {
     return Status(Status::INVALID_URL, "Invalid scheme");
   }
 
+  str_ = std::string(urlstr);
   hostName_ = std::string(urlPart(&pu, urlstr, UF_HOST));
 
   if (pu.field_set & (1 << UF_PORT)) {
@@ -106,15 +175,6 @@ Status URLInfo::init(absl::string_view urlstr) {
     hostHeader_ = absl::StrCat(hostName_, ":", port_);
   }
 
-  auto ls = Addresses::lookup(hostName_);
-  lookupStatus_ = ls.status();
-  if (ls.ok()) {
-    ls.valueptr()->swap(addresses_);
-  } else {
-    // Insert an empty vector of addresses.
-    addresses_.reset(new Addresses());
-  }
-
   return Status::kOk;
 }
 
@@ -123,16 +183,22 @@ Status URLInfo::InitOne(absl::string_view urlStr) {
   URLInfoPtr url(new URLInfo());
   const auto s = url->init(urlStr);
   if (s.ok()) {
+    url->index_ = urls_.size();
     urls_.push_back(std::move(url));
     initialized_ = true;
   }
   return s;
 }
 
-bool URLInfo::IsSameServer(const URLInfo& u1, const URLInfo& u2, int sequence) {
-  const Address a1 = u1.address(sequence);
-  const Address a2 = u2.address(sequence);
-  return a1 == a2;
+Address URLInfo::address(int sequence) const {
+  const HostAddress* a = host_->get(sequence);
+  if (a == nullptr) {
+    // Empty address, with "AF_UNSPEC" family.
+    return Address();
+  }
+  Address ret = a->address;
+  ret.setPort(port_);
+  return ret;
 }
 
 Status URLInfo::InitFile(absl::string_view fileName) {
@@ -158,6 +224,7 @@ Status URLInfo::InitFile(absl::string_view fileName) {
       if (!s.ok()) {
         return s;
       }
+      u->index_ = urls_.size();
       urls_.push_back(std::move(u));
     }
     line.consume();
@@ -184,8 +251,50 @@ URLInfo* const URLInfo::GetNext(RandomGenerator* rand) {
 }
 
 void URLInfo::Reset() {
+  StopRefresh();
   urls_.clear();
+  hosts_.clear();
   initialized_ = false;
 }
 
+void URLInfo::StartRefresh(int seconds) {
+  std::lock_guard<std::mutex> lock(refreshLock);
+  if (refreshThread != nullptr) {
+    return;
+  }
+  refreshStopped = false;
+  refreshThread = new std::thread([seconds]() {
+    std::unique_lock<std::mutex> lock(refreshLock);
+    while (!refreshWakeup.wait_for(lock, std::chrono::seconds(seconds),
+                                   []() { return refreshStopped; })) {
+      // Don't hold up "StopRefresh" while waiting for DNS. The list of hosts
+      // does not change while the thread runs.
+      lock.unlock();
+      for (auto it = hosts_.cbegin(); it != hosts_.cend(); it++) {
+        const auto s = (*it)->lookup(balance_);
+        if (!s.ok()) {
+          cerr << "Can't look up " << (*it)->name() << " again: " << s
+               << endl;
+        }
+      }
+      lock.lock();
+    }
+  });
+}
+
+void URLInfo::StopRefresh() {
+  std::thread* t;
+  {
+    std::lock_guard<std::mutex> lock(refreshLock);
+    refreshStopped = true;
+    t = refreshThread;
+    refreshThread = nullptr;
+  }
+  if (t != nullptr) {
+    refreshWakeup.notify_all();
+    t->join();
+    delete t;
+  }
+}
+
 }  // namespace apib
\ No newline at end of file
@@ -25,6 +25,7 @@ limitations under the License.
 
 #include "absl/strings/string_view.h"
 #include "apib/addresses.h"
+#include "apib/apib_host.h"
 #include "apib/apib_rand.h"
 #include "apib/status.h"
 
@@ -44,6 +45,7 @@ class URLInfo {
  public:
   static const std::string kHttp;
   static const std::string kHttps;
+  static const std::string kUnix;
 
   URLInfo() {}
   URLInfo(const URLInfo&) = delete;
@@ -74,33 +76,72 @@ class URLInfo {
   static URLInfo* const GetNext(RandomGenerator* rand);
 
   /*
-   * Return whether the two URLs refer to the same host and port for the given
-   * connection -- we use this to optimize socket management.
+   * Return how many URLs there are, and each one by its index.
    */
-  static bool IsSameServer(const URLInfo& u1, const URLInfo& u2, int sequence);
+  static size_t Count() { return urls_.size(); }
+  static const URLInfo* Get(size_t index) { return urls_[index].get(); }
 
   /*
-   * Get the network address for the next request based on which connection is
-   * making it. Using the sequence number for each connection means that for a
-   * host with multiple IPs, we evenly distribute requests across them without
-   * opening a new connection for each request.
+   * Return whether the two URLs refer to the same host, port, and scheme,
+   * so that a connection made for one may be used for the other -- we use
+   * this to optimize socket management.
    */
-  Address address(int sequence) const {
-    return addresses_->get(port_, sequence);
+  static bool IsSameServer(const URLInfo& u1, const URLInfo& u2) {
+    return (u1.host_ == u2.host_) && (u1.port_ == u2.port_) &&
+           (u1.isSsl_ == u2.isSsl_);
   }
 
+  /*
+   * Set how new connections choose among the addresses of a host. This
+   * must be called before either of the Init functions.
+   */
+  static void SetBalance(const Balance& b) { balance_ = b; }
+
+  /*
+   * Look up every host again every "seconds" seconds on a background
+   * thread until "StopRefresh" is called, so that connections follow
+   * changes in DNS.
+   */
+  static void StartRefresh(int seconds);
+  static void StopRefresh();
+
+  /*
+   * Return every distinct host name in the list of URLs.
+   */
+  static const std::vector<std::unique_ptr<Host>>& Hosts() { return hosts_; }
+
+  /*
+   * Choose the address for a new connection made by thread "sequence."
+   * Returns null if there are no addresses.
+   */
+  HostAddress* pickAddress(int sequence, RandomGenerator* rand) const {
+    return host_->pick(balance_, sequence, rand);
+  }
+
+  /*
+   * Get the network address at position "sequence" in the host's current
+   * list, with the port set, or an invalid address if there are none.
+   */
+  Address address(int sequence) const;
+
   uint16_t port() const { return port_; }
   bool isSsl() const { return isSsl_; }
-  std::string path() const { return path_; }
-  std::string pathOnly() const { return pathOnly_; }
-  std::string query() const { return query_; }
-  std::string hostName() const { return hostName_; }
-  std::string hostHeader() const { return hostHeader_; }
-  size_t addressCount() const { return addresses_->size(); }
+  const std::string& path() const { return path_; }
+  const std::string& pathOnly() const { return pathOnly_; }
+  const std::string& query() const { return query_; }
+  const std::string& hostName() const { return hostName_; }
+  const std::string& hostHeader() const { return hostHeader_; }
+  size_t addressCount() const { return host_->size(); }
   Status lookupStatus() const { return lookupStatus_; }
+  // The URL as it was originally specified
+  const std::string& str() const { return str_; }
+  // The position of this URL in the list, for reporting
+  size_t index() const { return index_; }
 
  private:
   Status init(absl::string_view urlStr);
+  Status parseHttp(absl::string_view urlStr);
+  bool shareHost();
 
   uint16_t port_;
   bool isSsl_;
@@ -110,9 +151,13 @@ class URLInfo {
   std::string hostName_;
   std::string hostHeader_;
   Status lookupStatus_;
-  AddressesPtr addresses_;
+  Host* host_ = nullptr;
+  std::string str_;
+  size_t index_ = 0;
 
   static std::vector<URLInfoPtr> urls_;
+  static std::vector<std::unique_ptr<Host>> hosts_;
+  static Balance balance_;
   static bool initialized_;
 };
 
@@ -16,11 +16,32 @@ limitations under the License.
 
 #include "apib/apib_util.h"
 
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(__FreeBSD__)
+/* clang-format off */
+#include <sys/param.h>
+#include <sys/cpuset.h>
+/* clang-format on */
+#endif
+
+#include <algorithm>
 #include <cassert>
 #include <locale>
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
 namespace apib {
 
+// CPU numbers must fit in the affinity mask that "cpu_SetAffinity" builds
+#ifdef CPU_SETSIZE
+static const int kMaxCpus = CPU_SETSIZE;
+#else
+static const int kMaxCpus = 1024;
+#endif
+
 bool eqcase(const absl::string_view s1, const absl::string_view s2) {
   if (s1.size() != s2.size()) {
     return false;
@@ -36,4 +57,38 @@ bool eqcase(const absl::string_view s1, const absl::string_view s2) {
   return true;
 }
 
-}  // namespace apib
\ No newline at end of file
+bool parseCpuList(absl::string_view s, std::vector<int>* cpus) {
+  cpus->clear();
+  const absl::string_view list = absl::StripAsciiWhitespace(s);
+  if (list.empty()) {
+    return true;
+  }
+  const std::vector<absl::string_view> ranges = absl::StrSplit(list, ',');
+  for (auto it = ranges.cbegin(); it != ranges.cend(); it++) {
+    const std::vector<absl::string_view> ends = absl::StrSplit(*it, '-');
+    int first;
+    int last;
+    if ((ends.size() > 2) || !absl::SimpleAtoi(ends[0], &first) ||
+        (first < 0)) {
+      return false;
+    }
+    if (ends.size() == 2) {
+      if (!absl::SimpleAtoi(ends[1], &last) || (last < first) ||
+          (last >= kMaxCpus)) {
+        return false;
+      }
+    } else if (first >= kMaxCpus) {
+      return false;
+    } else {
+      last = first;
+    }
+    for (int c = first; c <= last; c++) {
+      cpus->push_back(c);
+    }
+  }
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return true;
+}
+
+}  // namespace apib
@@ -20,6 +20,7 @@ limitations under the License.
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "absl/strings/string_view.h"
 
@@ -34,6 +35,12 @@ namespace apib {
 
 extern bool eqcase(const absl::string_view s1, const absl::string_view s2);
 
+// Parse a list of CPU numbers in the format used by Linux in places like
+// sysfs and "taskset -c," such as "0-3,8,10-11". The result is sorted and
+// has no duplicates. Returns false if the list is invalid, or names a CPU
+// too large for an affinity mask.
+extern bool parseCpuList(absl::string_view s, std::vector<int>* cpus);
+
 }  // namespace apib
 
 #endif  // APIB_UTIL_H
@@ -19,12 +19,144 @@ limitations under the License.
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 
 namespace apib {
 
+namespace {
+
+struct OptionDefinition {
+  const char* name;
+  int level;
+  int option;
+  bool isString;
+};
+
+// Each option is only available if the platform defines it.
+const OptionDefinition kOptionDefinitions[] = {
+    {"sndbuf", SOL_SOCKET, SO_SNDBUF, false},
+    {"rcvbuf", SOL_SOCKET, SO_RCVBUF, false},
+#ifdef SO_BUSY_POLL
+    {"busy_poll", SOL_SOCKET, SO_BUSY_POLL, false},
+#endif
+#ifdef TCP_QUICKACK
+    {"quickack", IPPROTO_TCP, TCP_QUICKACK, false},
+#endif
+#ifdef TCP_CONGESTION
+    {"congestion", IPPROTO_TCP, TCP_CONGESTION, true},
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+    {"fastopen_connect", IPPROTO_TCP, TCP_FASTOPEN_CONNECT, false},
+#endif
+    {"tos", IPPROTO_IP, IP_TOS, false},
+};
+
+const OptionDefinition* findOption(absl::string_view name) {
+  for (const auto& d : kOptionDefinitions) {
+    if (name == d.name) {
+      return &d;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+Status SocketOptions::add(absl::string_view arg) {
+  const auto eq = arg.find('=');
+  if ((eq == absl::string_view::npos) || (eq == 0) ||
+      (eq == arg.size() - 1)) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Expected name=value: ", arg));
+  }
+  const absl::string_view name = arg.substr(0, eq);
+  const std::string value(arg.substr(eq + 1));
+
+  const OptionDefinition* def = findOption(name);
+  if (def == nullptr) {
+    return Status(Status::INVALID_ARGUMENT,
+                  absl::StrCat("Unsupported socket option: ", name));
+  }
+
+  Option opt;
+  opt.name = def->name;
+  opt.level = def->level;
+  opt.option = def->option;
+  opt.intValue = 0;
+  if (def->isString) {
+    opt.strValue = value;
+  } else {
+    // Accept hex, such as "tos=0x10", as well as decimal
+    char* end;
+    const long v = strtol(value.c_str(), &end, 0);
+    if ((*end != 0) || (v < 0) || (v > INT32_MAX)) {
+      return Status(Status::INVALID_ARGUMENT,
+                    absl::StrCat("Invalid value for ", name, ": ", value));
+    }
+    opt.intValue = v;
+  }
+#ifdef TCP_QUICKACK
+  if ((def->level == IPPROTO_TCP) && (def->option == TCP_QUICKACK)) {
+    quickAck_ = (opt.intValue != 0);
+  }
+#endif
+  options_.push_back(opt);
+  return Status::kOk;
+}
+
+Status SocketOptions::apply(int fd, int family) const {
+  for (const auto& o : options_) {
+    int level = o.level;
+    int option = o.option;
+    if ((family == AF_UNIX) &&
+        ((level == IPPROTO_TCP) || (level == IPPROTO_IP))) {
+      continue;
+    }
+    if ((family == AF_INET6) && (level == IPPROTO_IP) && (option == IP_TOS)) {
+      // The same value goes in the "traffic class" field for IPv6
+      level = IPPROTO_IPV6;
+      option = IPV6_TCLASS;
+    }
+    int err;
+    if (o.strValue.empty()) {
+      err = setsockopt(fd, level, option, &o.intValue, sizeof(int));
+    } else {
+      err = setsockopt(fd, level, option, o.strValue.data(),
+                       o.strValue.size());
+    }
+    if (err != 0) {
+      return Status(Status::SOCKET_ERROR, errno);
+    }
+  }
+  return Status::kOk;
+}
+
+std::string SocketOptions::str() const {
+  return absl::StrJoin(options_, ",", [](std::string* out, const Option& o) {
+    if (o.strValue.empty()) {
+      absl::StrAppend(out, o.name, "=", o.intValue);
+    } else {
+      absl::StrAppend(out, o.name, "=", o.strValue);
+    }
+  });
+}
+
+std::string SocketOptions::names() {
+  return absl::StrJoin(kOptionDefinitions, ", ",
+                       [](std::string* out, const OptionDefinition& d) {
+                         out->append(d.name);
+                       });
+}
+
 Socket::~Socket() {
   if (fd_ != 0) {
     ::close(fd_);
@@ -39,11 +171,17 @@ Status Socket::connect(const Address& addr) {
 
   socklen_t addrlen = 0;
   int yes = 1;
-  // Set NODELAY to minimize latency and because we are not processing
-  // keystrokes
-  int err = setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
-  if (err != 0) {
-    goto fail;
+  int err;
+  // Unix sockets have no TCP options and no local address to bind to
+  const bool tcp = !addr.isUnix();
+  tcp_ = tcp;
+  if (tcp) {
+    // Set NODELAY to minimize latency and because we are not processing
+    // keystrokes
+    err = setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+    if (err != 0) {
+      goto fail;
+    }
   }
   // Set REUSEADDR for convenience when running lots of tests
   err = setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
@@ -61,6 +199,49 @@ Status Socket::connect(const Address& addr) {
     goto fail;
   }
 
+  if (options_ != nullptr) {
+    // Options such as the buffer sizes must be set before connecting, or
+    // they will not affect the window negotiated with the server.
+    const Status os = options_->apply(fd_, addr.family());
+    if (!os.ok()) {
+      ::close(fd_);
+      fd_ = 0;
+      return os;
+    }
+  }
+
+#ifdef TCP_FASTOPEN_CONNECT
+  if (fastOpen_ && tcp) {
+    // With this option, "connect" returns right away, and the SYN is not
+    // sent until the first write, so that it can carry the data.
+    err = setsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &yes,
+                     sizeof(int));
+    if (err != 0) {
+      goto fail;
+    }
+  }
+#endif
+
+  if (source_.valid() && tcp) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    if (source_.port() == 0) {
+      // Don't pick a local port until "connect," so that the same port may
+      // be used for connections to different servers.
+      err = setsockopt(fd_, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &yes,
+                       sizeof(int));
+      if (err != 0) {
+        goto fail;
+      }
+    }
+#endif
+    struct sockaddr_storage srcaddr;
+    const socklen_t srclen = source_.get(&srcaddr);
+    err = bind(fd_, (struct sockaddr*)&srcaddr, srclen);
+    if (err != 0) {
+      goto fail;
+    }
+  }
+
   // The socket must be non-blocking or the rest of the logic doesn't work.
   err = fcntl(fd_, F_SETFL, O_NONBLOCK);
   if (err != 0) {
@@ -78,6 +259,7 @@ Status Socket::connect(const Address& addr) {
 fail:
   const Status failStat = Status(Status::SOCKET_ERROR, errno);
   ::close(fd_);
+  fd_ = 0;
   return failStat;
 }
 
@@ -105,9 +287,42 @@ StatusOr<IOStatus> Socket::read(void* buf, size_t count, size_t* readed) {
     return Status(Status::SOCKET_ERROR, errno);
   }
   *readed = rs;
+  afterRead();
+  if ((rs == 0) && (count > 0)) {
+    return IOStatus::FEOF;
+  }
   return IOStatus::OK;
 }
 
+bool Socket::fastOpenSupported() {
+#ifdef TCP_FASTOPEN_CONNECT
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool Socket::fastOpened() const {
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+  }
+#endif
+  return false;
+}
+
+void Socket::afterRead() {
+#ifdef TCP_QUICKACK
+  if (tcp_ && (options_ != nullptr) && options_->quickAck()) {
+    // Failure here is not worth failing the connection over
+    int yes = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(int));
+  }
+#endif
+}
+
 StatusOr<IOStatus> Socket::close() {
   const auto cs = ::close(fd_);
   fd_ = 0;
@@ -117,4 +332,10 @@ StatusOr<IOStatus> Socket::close() {
   return IOStatus::OK;
 }
 
+bool Socket::stillOpen() const {
+  char c;
+  const ssize_t rc = recv(fd_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return (rc < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+}
+
 }  // namespace apib
\ No newline at end of file
@@ -17,6 +17,10 @@ limitations under the License.
 #ifndef APIB_SOCKET_H
 #define APIB_SOCKET_H
 
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
 #include "apib/addresses.h"
 #include "apib/status.h"
 
@@ -24,6 +28,40 @@ namespace apib {
 
 typedef enum { OK, NEED_READ, NEED_WRITE, FEOF } IOStatus;
 
+/*
+ * A set of additional socket options, such as buffer sizes or the
+ * congestion control algorithm, to set on every new socket. Options are
+ * specified in "name=value" format. Options that the platform does not
+ * support are rejected when they are added.
+ */
+class SocketOptions {
+ public:
+  // Parse an option in "name=value" format and add it to the set.
+  Status add(absl::string_view arg);
+  bool empty() const { return options_.empty(); }
+  // Whether TCP_QUICKACK was requested. The kernel may turn it off again
+  // at any time, so it must be re-applied after each read.
+  bool quickAck() const { return quickAck_; }
+  // Set all the options on a new socket before it connects. TCP and IP
+  // options are skipped for Unix sockets.
+  Status apply(int fd, int family) const;
+  // The options as a comma-separated list of "name=value" pairs.
+  std::string str() const;
+  // The names of all the options supported on this platform.
+  static std::string names();
+
+ private:
+  struct Option {
+    std::string name;
+    int level;
+    int option;
+    int intValue;
+    std::string strValue;
+  };
+  std::vector<Option> options_;
+  bool quickAck_ = false;
+};
+
 /*
  * This is an abstraction for a socket. A subclass supports TLS.
  * Although the destructor will free storage (used by SSL), the
@@ -40,14 +78,41 @@ class Socket {
 
   int fd() const { return fd_; }
 
+  // Bind to this local address when connecting. If its port is zero, the
+  // kernel picks the local port.
+  void setSource(const Address& source) { source_ = source; }
+  // Set these options on the socket when it connects. The options must
+  // remain valid as long as the socket does.
+  void setOptions(const SocketOptions* options) { options_ = options; }
+  // Use TCP Fast Open, so that the first write goes out with the SYN
+  // if the client has a cookie from an earlier connection to the server.
+  void setFastOpen(bool fastOpen) { fastOpen_ = fastOpen; }
+  // Whether this platform supports "setFastOpen."
+  static bool fastOpenSupported();
+  // After the server has responded, whether it accepted the data sent
+  // with the SYN.
+  bool fastOpened() const;
+
   Status connect(const Address& addr);
   virtual StatusOr<IOStatus> write(const void* buf, size_t count,
                                    size_t* written);
   virtual StatusOr<IOStatus> read(void* buf, size_t count, size_t* readed);
   virtual StatusOr<IOStatus> close();
+  // Whether a connected socket that has been idle can still be used for
+  // another request: the peer has not closed it, and there is nothing
+  // waiting to be read from it.
+  virtual bool stillOpen() const;
 
  protected:
+  // Re-apply any options that the kernel resets after each read.
+  void afterRead();
+
   int fd_;
+  Address source_;
+  const SocketOptions* options_ = nullptr;
+  bool fastOpen_ = false;
+  // False for Unix sockets, which have no TCP options
+  bool tcp_ = true;
 };
 
 }  // namespace apib
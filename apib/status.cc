@@ -25,7 +25,7 @@ static const Status kOkStatus(Status::Code::OK);
 const Status& Status::kOk = kOkStatus;
 static const int kMaxStatusLen = 64;
 
-Status::Status(Code c, int errnum) : code_(c) {
+Status::Status(Code c, int errnum) : code_(c), errnum_(errnum) {
   char msgbuf[kMaxStatusLen];
   strerror_r(errnum, msgbuf, kMaxStatusLen);
   msg_ = msgbuf;
@@ -43,8 +43,12 @@ std::string Status::codeString() const {
       return "DNS error";
     case INVALID_URL:
       return "Invalid URL";
+    case INVALID_ARGUMENT:
+      return "Invalid argument";
     case IO_ERROR:
       return "I/O error";
+    case PARSE_ERROR:
+      return "HTTP parsing error";
     case INTERNAL_ERROR:
       return "Internal error";
     default:
@@ -32,7 +32,9 @@ class Status {
     TLS_ERROR,
     DNS_ERROR,
     INVALID_URL,
+    INVALID_ARGUMENT,
     IO_ERROR,
+    PARSE_ERROR,
     INTERNAL_ERROR
   };
 
@@ -49,6 +51,8 @@ class Status {
 
   Code code() const { return code_; }
   std::string message() const { return msg_; }
+  // The "errno" value used to construct this status, or zero
+  int errnum() const { return errnum_; }
   bool ok() const { return code_ == OK; }
 
   std::string codeString() const;
@@ -57,6 +61,7 @@ class Status {
 
  private:
   Code code_;
+  int errnum_ = 0;
   std::string msg_;
 };
 
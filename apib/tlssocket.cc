@@ -17,6 +17,7 @@ limitations under the License.
 #include "apib/tlssocket.h"
 
 #include <cassert>
+#include <cerrno>
 
 #include "openssl/err.h"
 
@@ -30,6 +31,16 @@ static Status makeTLSError(int err) {
   return Status(Status::TLS_ERROR, buf);
 }
 
+// SSL_ERROR_SYSCALL usually means that the underlying socket failed, as
+// when the connection is refused, so report the errno so that we can tell
+// those errors apart from TLS failures.
+static Status makeSyscallError(int err) {
+  if (errno != 0) {
+    return Status(Status::SOCKET_ERROR, errno);
+  }
+  return makeTLSError(err);
+}
+
 TLSSocket::~TLSSocket() {
   if (ssl_ != nullptr) {
     SSL_free(ssl_);
@@ -59,40 +70,207 @@ Status TLSSocket::connectTLS(const Address& addr, absl::string_view hostName,
     return makeTLSError(sslErr);
   }
 
+  if (session_ != nullptr) {
+    SSL_set_session(ssl_, session_);
+    if (earlyData_) {
+#ifdef OPENSSL_IS_BORINGSSL
+      if (SSL_SESSION_early_data_capable(session_)) {
+        SSL_set_early_data_enabled(ssl_, 1);
+        earlyState_ = kEarlyWriting;
+      }
+#else
+      if (SSL_SESSION_get_max_early_data(session_) > 0) {
+        earlyState_ = kEarlyWriting;
+      }
+#endif
+    }
+  }
+
   SSL_set_connect_state(ssl_);
   return Status::kOk;
 }
 
-StatusOr<IOStatus> TLSSocket::write(const void* buf, size_t count,
-                                    size_t* written) {
-  assert(written != nullptr);
-  const int s = SSL_write(ssl_, buf, count);
-  if (s > 0) {
-    *written = s;
-    return OK;
+SSL_SESSION* TLSSocket::getSession() const {
+  if (ssl_ == nullptr) {
+    return nullptr;
   }
+  SSL_SESSION* s = SSL_get1_session(ssl_);
+  if ((s != nullptr) && !SSL_SESSION_is_resumable(s)) {
+    SSL_SESSION_free(s);
+    return nullptr;
+  }
+  return s;
+}
 
-  // Man page says that "0" means "failure".
-  *written = 0;
-  const int sslErr = SSL_get_error(ssl_, s);
+bool TLSSocket::sessionReused() const {
+  return (ssl_ != nullptr) && SSL_session_reused(ssl_);
+}
+
+// Translate the result of a failed SSL_write or SSL_do_handshake.
+StatusOr<IOStatus> TLSSocket::writeError(int ret) {
+  const int sslErr = SSL_get_error(ssl_, ret);
   switch (sslErr) {
     case SSL_ERROR_WANT_READ:
       return NEED_READ;
     case SSL_ERROR_WANT_WRITE:
       return NEED_WRITE;
+    case SSL_ERROR_SYSCALL:
+      return makeSyscallError(sslErr);
+#ifdef OPENSSL_IS_BORINGSSL
+    case SSL_ERROR_EARLY_DATA_REJECTED:
+      return rejectEarlyData();
+#endif
     default:
       return makeTLSError(sslErr);
   }
 }
 
+#ifdef OPENSSL_IS_BORINGSSL
+// BoringSSL reports a rejection as an error from SSL_read or SSL_write.
+// The connection may be used again once the early data is sent again.
+StatusOr<IOStatus> TLSSocket::rejectEarlyData() {
+  SSL_reset_early_data_reject(ssl_);
+  earlyResult_ = kEarlyRejected;
+  earlyState_ = kEarlyResending;
+  resendPos_ = 0;
+  return NEED_WRITE;
+}
+
+void TLSSocket::checkEarlyData() {
+  if ((earlyState_ == kEarlyWriting) && !SSL_in_early_data(ssl_) &&
+      !SSL_in_init(ssl_)) {
+    if (SSL_early_data_accepted(ssl_)) {
+      earlyResult_ = kEarlyAccepted;
+    }
+    earlyState_ = kEarlyNone;
+    earlySent_.clear();
+  }
+}
+#endif
+
+// Once we're done sending early data, complete the handshake, and send
+// the data again if the server rejected it. Return OK when the socket
+// may be used normally.
+StatusOr<IOStatus> TLSSocket::finishEarlyData() {
+#ifndef OPENSSL_IS_BORINGSSL
+  if (earlyState_ == kEarlyWriting) {
+    const int s = SSL_do_handshake(ssl_);
+    if (s != 1) {
+      return writeError(s);
+    }
+    switch (SSL_get_early_data_status(ssl_)) {
+      case SSL_EARLY_DATA_ACCEPTED:
+        earlyResult_ = kEarlyAccepted;
+        break;
+      case SSL_EARLY_DATA_REJECTED:
+        earlyResult_ = kEarlyRejected;
+        earlyState_ = kEarlyResending;
+        resendPos_ = 0;
+        break;
+      default:
+        break;
+    }
+    if (earlyState_ != kEarlyResending) {
+      earlyState_ = kEarlyNone;
+      earlySent_.clear();
+      return OK;
+    }
+  }
+#endif
+
+  while (resendPos_ < earlySent_.size()) {
+    const int s = SSL_write(ssl_, earlySent_.data() + resendPos_,
+                            earlySent_.size() - resendPos_);
+    if (s <= 0) {
+      return writeError(s);
+    }
+    resendPos_ += s;
+  }
+  earlyState_ = kEarlyNone;
+  earlySent_.clear();
+  return OK;
+}
+
+StatusOr<IOStatus> TLSSocket::write(const void* buf, size_t count,
+                                    size_t* written) {
+  assert(written != nullptr);
+  // Man page says that "0" means "failure".
+  *written = 0;
+  errno = 0;
+
+  if (earlyState_ != kEarlyNone) {
+#ifdef OPENSSL_IS_BORINGSSL
+    // BoringSSL sends early data from SSL_write, and only needs help
+    // after a rejection.
+    const bool mustFinish = (earlyState_ == kEarlyResending);
+#else
+    if ((earlyState_ == kEarlyWriting) &&
+        ((earlySent_.size() + count) <=
+         SSL_SESSION_get_max_early_data(session_))) {
+      size_t earlyWritten = 0;
+      const int s = SSL_write_early_data(ssl_, buf, count, &earlyWritten);
+      if (s <= 0) {
+        return writeError(s);
+      }
+      earlySent_.append(static_cast<const char*>(buf), earlyWritten);
+      *written = earlyWritten;
+      return OK;
+    }
+    // There is too much to send as early data, so send the rest normally.
+    const bool mustFinish = true;
+#endif
+    if (mustFinish) {
+      const auto fs = finishEarlyData();
+      if (!fs.ok() || (fs.value() != OK)) {
+        return fs;
+      }
+    }
+  }
+
+  const int s = SSL_write(ssl_, buf, count);
+  if (s <= 0) {
+    return writeError(s);
+  }
+#ifdef OPENSSL_IS_BORINGSSL
+  if ((earlyState_ == kEarlyWriting) && SSL_in_early_data(ssl_)) {
+    earlySent_.append(static_cast<const char*>(buf), s);
+  } else {
+    checkEarlyData();
+  }
+#endif
+  *written = s;
+  return OK;
+}
+
 StatusOr<IOStatus> TLSSocket::read(void* buf, size_t count, size_t* readed) {
+  *readed = 0;
+  errno = 0;
+
+  if (earlyState_ != kEarlyNone) {
+#ifdef OPENSSL_IS_BORINGSSL
+    // BoringSSL completes the handshake from SSL_read.
+    const bool mustFinish = (earlyState_ == kEarlyResending);
+#else
+    const bool mustFinish = true;
+#endif
+    if (mustFinish) {
+      const auto fs = finishEarlyData();
+      if (!fs.ok() || (fs.value() != OK)) {
+        return fs;
+      }
+    }
+  }
+
   const int s = SSL_read(ssl_, buf, count);
   if (s > 0) {
     *readed = s;
+#ifdef OPENSSL_IS_BORINGSSL
+    checkEarlyData();
+#endif
+    afterRead();
     return OK;
   }
 
-  *readed = 0;
   int sentShutdown = (SSL_get_shutdown(ssl_) & SSL_SENT_SHUTDOWN);
 
   const int sslErr = SSL_get_error(ssl_, s);
@@ -108,7 +286,11 @@ StatusOr<IOStatus> TLSSocket::read(void* buf, size_t count, size_t* readed) {
       if (sentShutdown) {
         return FEOF;
       }
-      return makeTLSError(sslErr);
+      return makeSyscallError(sslErr);
+#ifdef OPENSSL_IS_BORINGSSL
+    case SSL_ERROR_EARLY_DATA_REJECTED:
+      return rejectEarlyData();
+#endif
     default:
       return makeTLSError(sslErr);
   }
@@ -137,4 +319,10 @@ StatusOr<IOStatus> TLSSocket::close() {
   }
 }
 
+bool TLSSocket::stillOpen() const {
+  // Anything buffered by TLS but not read yet is left over from the
+  // last response, so the connection is not safe to use either
+  return (SSL_pending(ssl_) == 0) && Socket::stillOpen();
+}
+
 }  // namespace apib
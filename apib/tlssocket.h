@@ -17,6 +17,8 @@ limitations under the License.
 #ifndef APIB_TLS_SOCKET_H
 #define APIB_TLS_SOCKET_H
 
+#include <string>
+
 #include "absl/strings/string_view.h"
 #include "apib/socket.h"
 #include "openssl/ssl.h"
@@ -30,15 +32,53 @@ class TLSSocket : public Socket {
   TLSSocket& operator=(const Socket&) = delete;
   virtual ~TLSSocket();
 
+  // Try to resume this session when connecting. If "earlyData" is set and
+  // the session allows it, send the first data as TLS 1.3 early data,
+  // before the handshake completes. The caller keeps ownership of the session.
+  void setSession(SSL_SESSION* session, bool earlyData) {
+    session_ = session;
+    earlyData_ = earlyData;
+  }
+
   Status connectTLS(const Address& addr, absl::string_view hostName,
                     SSL_CTX* ctx);
   StatusOr<IOStatus> write(const void* buf, size_t count,
                            size_t* written) override;
   StatusOr<IOStatus> read(void* buf, size_t count, size_t* readed) override;
   StatusOr<IOStatus> close() override;
+  bool stillOpen() const override;
+
+  // Return a new reference to the session, if it may be resumed, or null.
+  SSL_SESSION* getSession() const;
+  // Whether the handshake resumed the session passed to "setSession."
+  bool sessionReused() const;
+  // Whether the handshake is complete, so that the connection is secure
+  bool handshakeDone() const {
+    return (ssl_ != nullptr) && SSL_is_init_finished(ssl_);
+  }
+  bool earlyDataAccepted() const { return earlyResult_ == kEarlyAccepted; }
+  bool earlyDataRejected() const { return earlyResult_ == kEarlyRejected; }
 
  private:
+  typedef enum { kEarlyNone, kEarlyWriting, kEarlyResending } EarlyState;
+  typedef enum { kEarlyUnknown, kEarlyAccepted, kEarlyRejected } EarlyResult;
+
+  StatusOr<IOStatus> finishEarlyData();
+  StatusOr<IOStatus> writeError(int ret);
+#ifdef OPENSSL_IS_BORINGSSL
+  StatusOr<IOStatus> rejectEarlyData();
+  void checkEarlyData();
+#endif
+
   SSL* ssl_ = nullptr;
+  SSL_SESSION* session_ = nullptr;
+  bool earlyData_ = false;
+  EarlyState earlyState_ = kEarlyNone;
+  EarlyResult earlyResult_ = kEarlyUnknown;
+  // Early data is kept until the server accepts it, because it must be
+  // sent again if the server rejects it.
+  std::string earlySent_;
+  size_t resendPos_ = 0;
 };
 
 }  // namespace apib
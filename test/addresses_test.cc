@@ -0,0 +1,108 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/addresses.h"
+#include "gtest/gtest.h"
+
+using apib::Address;
+using apib::SourceAddress;
+
+namespace {
+
+TEST(Address, UnixSocket) {
+  auto a = Address::unixSocket("/tmp/apib.sock");
+  ASSERT_TRUE(a.ok());
+  EXPECT_TRUE(a.valueref().isUnix());
+  EXPECT_EQ("/tmp/apib.sock", a.valueref().str());
+  EXPECT_EQ(0, a.valueref().port());
+  Address b = a.value();
+  b.setPort(80);
+  EXPECT_TRUE(a.valueref() == b);
+
+  auto c = Address::unixSocket("/tmp/apib.sock2");
+  ASSERT_TRUE(c.ok());
+  EXPECT_FALSE(a.valueref() == c.valueref());
+
+  EXPECT_FALSE(Address::unixSocket("").ok());
+  EXPECT_FALSE(Address::unixSocket(std::string(200, 'x')).ok());
+}
+
+#ifdef __linux__
+TEST(Address, AbstractSocket) {
+  auto a = Address::unixSocket("@apib");
+  ASSERT_TRUE(a.ok());
+  EXPECT_TRUE(a.valueref().isUnix());
+  EXPECT_EQ("@apib", a.valueref().str());
+  // No terminating null on an abstract name
+  auto b = Address::unixSocket("@apib2");
+  ASSERT_TRUE(b.ok());
+  EXPECT_EQ(a.valueref().length() + 1, b.valueref().length());
+  EXPECT_FALSE(a.valueref() == b.valueref());
+}
+#endif
+
+TEST(SourceAddress, AddressOnly) {
+  auto s = SourceAddress::parse("127.0.0.1");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(AF_INET, s.valueref().address().family());
+  EXPECT_EQ("127.0.0.1", s.valueref().address().str());
+  EXPECT_FALSE(s.valueref().hasPorts());
+  EXPECT_EQ(0, s.valueref().get(123).port());
+}
+
+TEST(SourceAddress, PortRange) {
+  auto s = SourceAddress::parse("127.0.0.1:20000-20009");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ("127.0.0.1", s.valueref().address().str());
+  EXPECT_TRUE(s.valueref().hasPorts());
+  EXPECT_EQ(20000, s.valueref().firstPort());
+  EXPECT_EQ(20009, s.valueref().lastPort());
+  EXPECT_EQ(20000, s.valueref().get(0).port());
+  EXPECT_EQ(20009, s.valueref().get(9).port());
+  EXPECT_EQ(20001, s.valueref().get(11).port());
+}
+
+TEST(SourceAddress, OnePort) {
+  auto s = SourceAddress::parse("127.0.0.1:20000");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(20000, s.valueref().get(0).port());
+  EXPECT_EQ(20000, s.valueref().get(1).port());
+}
+
+TEST(SourceAddress, IP6) {
+  auto s = SourceAddress::parse("::1");
+  if (!s.ok()) {
+    GTEST_SKIP() << "No IPv6 support";
+  }
+  EXPECT_EQ(AF_INET6, s.valueref().address().family());
+  EXPECT_FALSE(s.valueref().hasPorts());
+
+  s = SourceAddress::parse("[::1]:30000-30001");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(AF_INET6, s.valueref().address().family());
+  EXPECT_EQ(30001, s.valueref().get(1).port());
+}
+
+TEST(SourceAddress, Invalid) {
+  EXPECT_FALSE(SourceAddress::parse("127.0.0.1:").ok());
+  EXPECT_FALSE(SourceAddress::parse("127.0.0.1:foo").ok());
+  EXPECT_FALSE(SourceAddress::parse("127.0.0.1:100000").ok());
+  EXPECT_FALSE(SourceAddress::parse("127.0.0.1:2000-1000").ok());
+  EXPECT_FALSE(SourceAddress::parse("[::1").ok());
+  EXPECT_FALSE(SourceAddress::parse("[::1]2000").ok());
+}
+
+}  // namespace
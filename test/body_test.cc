@@ -0,0 +1,133 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_body.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using apib::BodySource;
+using apib::BodyStream;
+
+namespace {
+
+// Send the whole body, "n" bytes at a time, and count the pauses
+static std::string sendAll(const BodySource* src, size_t n,
+                           int* pauses = nullptr) {
+  BodyStream s;
+  s.start(src);
+  std::string out;
+  int p = 0;
+  while (!s.done()) {
+    const auto piece = s.peek().substr(0, n);
+    EXPECT_FALSE(piece.empty());
+    out.append(piece.data(), piece.size());
+    if (s.advance(piece.size())) {
+      p++;
+    }
+  }
+  if (pauses != nullptr) {
+    *pauses = p;
+  }
+  return out;
+}
+
+TEST(Body, FileChunked) {
+  std::unique_ptr<BodySource> src;
+  ASSERT_TRUE(BodySource::Parse("chunked,chunk=4", "abcdefghij", &src).ok());
+  EXPECT_TRUE(src->chunked());
+  EXPECT_EQ(10, src->size());
+  EXPECT_EQ(3, src->unitCount());
+  EXPECT_EQ("4\r\nabcd\r\n", src->unit(0));
+  EXPECT_EQ("4\r\nefgh\r\n", src->unit(1));
+  EXPECT_EQ("2\r\nij\r\n0\r\n\r\n", src->unit(2));
+
+  int pauses;
+  EXPECT_EQ("4\r\nabcd\r\n4\r\nefgh\r\n2\r\nij\r\n0\r\n\r\n",
+            sendAll(src.get(), 3, &pauses));
+  EXPECT_EQ(2, pauses);
+}
+
+TEST(Body, FileExactChunks) {
+  std::unique_ptr<BodySource> src;
+  ASSERT_TRUE(BodySource::Parse("chunked,chunk=5", "abcdefghij", &src).ok());
+  EXPECT_EQ(2, src->unitCount());
+  EXPECT_EQ("5\r\nabcde\r\n5\r\nfghij\r\n0\r\n\r\n", sendAll(src.get(), 100));
+
+  ASSERT_TRUE(BodySource::Parse("chunk=4,delay=10", "abcdefghij", &src).ok());
+  EXPECT_FALSE(src->chunked());
+  EXPECT_EQ(10, src->delay());
+  EXPECT_EQ("abcdefghij", sendAll(src.get(), 1));
+}
+
+TEST(Body, Generated) {
+  std::unique_ptr<BodySource> src;
+  ASSERT_TRUE(
+      BodySource::Parse("size=10,data=text:abc,chunk=4", "", &src).ok());
+  EXPECT_EQ(3, src->unitCount());
+  EXPECT_EQ("abcaabcaab", sendAll(src.get(), 3));
+
+  ASSERT_TRUE(BodySource::Parse("size=8,data=zeros,chunk=4,chunked", "", &src)
+                  .ok());
+  EXPECT_EQ(2, src->unitCount());
+  EXPECT_EQ(std::string("4\r\n\0\0\0\0\r\n4\r\n\0\0\0\0\r\n0\r\n\r\n", 23),
+            sendAll(src.get(), 5));
+
+  ASSERT_TRUE(BodySource::Parse("size=0,chunked", "", &src).ok());
+  EXPECT_EQ("0\r\n\r\n", sendAll(src.get(), 5));
+  ASSERT_TRUE(BodySource::Parse("size=0", "", &src).ok());
+  EXPECT_EQ(0, src->unitCount());
+}
+
+TEST(Body, Large) {
+  // Much bigger than what's kept in memory
+  std::unique_ptr<BodySource> src;
+  ASSERT_TRUE(BodySource::Parse("size=4G,chunked", "", &src).ok());
+  EXPECT_EQ(4ULL * 1024 * 1024 * 1024, src->size());
+  EXPECT_EQ(65536, src->unitCount());
+  EXPECT_EQ(65536 + 9, src->unit(0).size());
+  EXPECT_EQ("10000\r\n", src->unit(0).substr(0, 7));
+  EXPECT_EQ(65536 + 14, src->unit(65535).size());
+  EXPECT_EQ(src->unit(0).data(), src->unit(1000).data());
+
+  ASSERT_TRUE(BodySource::Parse("size=3M,chunk=1m", "", &src).ok());
+  EXPECT_EQ(3, src->unitCount());
+  EXPECT_EQ(1024 * 1024, src->unit(2).size());
+}
+
+TEST(Body, Errors) {
+  std::unique_ptr<BodySource> src;
+  EXPECT_FALSE(BodySource::Parse("", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("chunked", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=foo", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10X", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=9223372036854775808", "", &src).ok());
+  EXPECT_EQ(apib::Status::INVALID_ARGUMENT,
+            BodySource::Parse("size=17179869184G", "", &src).code());
+  EXPECT_FALSE(BodySource::Parse("size=8589934592G", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10,chunk=0", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10,delay=x", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10,data=foo", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10,data=text:", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10,foo=bar", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("chunked=1,size=10", "", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("size=10", "file", &src).ok());
+  EXPECT_FALSE(BodySource::Parse("data=zeros", "file", &src).ok());
+  EXPECT_FALSE(src);
+}
+
+}  // namespace
@@ -0,0 +1,205 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_compare.h"
+
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "apib/apib_histogram.h"
+#include "apib/apib_json.h"
+#include "gtest/gtest.h"
+
+using apib::CompareOptions;
+using apib::Comparison;
+using apib::Histogram;
+using apib::JsonWriter;
+using apib::RunResults;
+
+namespace {
+
+// Write a minimal result file like "apib --json" does, with the given
+// interval throughputs and "count" requests each at "latencies"
+// nanoseconds
+static std::string makeRun(const std::vector<double>& intervals,
+                           const std::vector<int64_t>& latencies,
+                           int64_t count) {
+  double total = 0.0;
+  for (auto it = intervals.cbegin(); it != intervals.cend(); it++) {
+    total += *it;
+  }
+  Histogram h;
+  for (auto it = latencies.cbegin(); it != latencies.cend(); it++) {
+    for (int64_t i = 0; i < count; i++) {
+      h.record(*it);
+    }
+  }
+
+  std::ostringstream out;
+  JsonWriter w(out);
+  w.beginObject();
+  w.field("name", "test");
+  w.key("results");
+  w.beginObject();
+  w.field("throughput", total / intervals.size());
+  w.field("completedRequests", h.count());
+  w.endObject();
+  w.key("histogram");
+  w.beginObject();
+  w.key("buckets");
+  w.beginArray();
+  for (int i = 0; i < Histogram::kNumBuckets; i++) {
+    if (h.bucketCount(i) > 0) {
+      w.beginObject();
+      w.field("min", Histogram::bucketLowerBound(i));
+      w.field("max", Histogram::bucketUpperBound(i));
+      w.field("count", h.bucketCount(i));
+      w.endObject();
+    }
+  }
+  w.endArray();
+  w.endObject();
+  w.key("intervals");
+  w.beginArray();
+  for (auto it = intervals.cbegin(); it != intervals.cend(); it++) {
+    w.beginObject();
+    w.field("throughput", *it);
+    w.endObject();
+  }
+  w.endArray();
+  w.endObject();
+  return out.str();
+}
+
+static RunResults parseRun(const std::string& json) {
+  const auto r = RunResults::Parse(json);
+  EXPECT_TRUE(r.ok()) << r.status();
+  return r.value();
+}
+
+TEST(Compare, Welch) {
+  // Example 1 from the Wikipedia article on Welch's t-test
+  const std::vector<double> a = {19.8, 20.4, 19.6, 17.8, 18.5,
+                                 18.9, 18.3, 18.9, 19.5, 22.0};
+  const std::vector<double> b = {28.2, 26.6, 20.1, 23.3, 25.2, 22.1, 17.7,
+                                 27.6, 20.6, 13.7, 23.2, 17.5, 20.6, 18.0,
+                                 23.9, 21.6, 24.3, 20.4, 23.9, 13.3};
+  EXPECT_NEAR(0.0355, apib::WelchTTest(a, b), 0.0005);
+  EXPECT_NEAR(0.0355, apib::WelchTTest(b, a), 0.0005);
+  EXPECT_DOUBLE_EQ(1.0, apib::WelchTTest(a, a));
+  EXPECT_TRUE(std::isnan(apib::WelchTTest(a, {1.0})));
+}
+
+TEST(Compare, MannWhitney) {
+  std::vector<int64_t> a(Histogram::kNumBuckets);
+  std::vector<int64_t> b(Histogram::kNumBuckets);
+  double prob;
+  EXPECT_TRUE(std::isnan(apib::MannWhitney(a, b, &prob)));
+
+  a[100] = 50;
+  a[101] = 50;
+  b[100] = 50;
+  b[101] = 50;
+  EXPECT_DOUBLE_EQ(1.0, apib::MannWhitney(a, b, &prob));
+  EXPECT_DOUBLE_EQ(0.5, prob);
+
+  // Everything in "b" is slower
+  b[100] = 0;
+  b[102] = 50;
+  EXPECT_GT(0.001, apib::MannWhitney(a, b, &prob));
+  EXPECT_DOUBLE_EQ(0.875, prob);
+}
+
+TEST(Compare, Percentile) {
+  std::vector<int64_t> b(Histogram::kNumBuckets);
+  EXPECT_TRUE(std::isnan(apib::HistogramPercentile(b, 50.0)));
+  // 16 through 31 each have their own bucket
+  b[16] = 10;
+  b[17] = 10;
+  EXPECT_DOUBLE_EQ(16.5, apib::HistogramPercentile(b, 25.0));
+  EXPECT_DOUBLE_EQ(17.0, apib::HistogramPercentile(b, 50.0));
+  EXPECT_DOUBLE_EQ(18.0, apib::HistogramPercentile(b, 100.0));
+}
+
+TEST(Compare, Parse) {
+  const RunResults r = parseRun(makeRun({100.0, 200.0}, {1000000}, 10));
+  EXPECT_EQ("test", r.name);
+  EXPECT_EQ(150.0, r.throughput);
+  EXPECT_EQ(10, r.completedRequests);
+  ASSERT_EQ(2U, r.intervals.size());
+  EXPECT_EQ(200.0, r.intervals[1]);
+  EXPECT_EQ(10, r.buckets[Histogram::bucketFor(1000000)]);
+
+  EXPECT_FALSE(RunResults::Parse("{\"name\": \"x\"}").ok());
+  EXPECT_FALSE(RunResults::Parse("[").ok());
+}
+
+TEST(Compare, Same) {
+  const RunResults a =
+      parseRun(makeRun({1000.0, 1010.0, 990.0, 1005.0, 995.0},
+                       {1000000, 1100000, 1200000, 5000000}, 250));
+  const Comparison c = apib::CompareRuns(a, a, CompareOptions());
+  EXPECT_FALSE(c.regression);
+  for (auto it = c.metrics.cbegin(); it != c.metrics.cend(); it++) {
+    EXPECT_EQ(0.0, it->change) << it->name;
+    EXPECT_FALSE(it->significant) << it->name;
+    EXPECT_LE(it->changeLow, 0.0) << it->name;
+    EXPECT_GE(it->changeHigh, 0.0) << it->name;
+  }
+  EXPECT_DOUBLE_EQ(0.5, c.slowerProbability);
+}
+
+TEST(Compare, Regression) {
+  const RunResults a =
+      parseRun(makeRun({1000.0, 1010.0, 990.0, 1005.0, 995.0},
+                       {1000000, 1100000, 1200000, 5000000}, 250));
+  const RunResults b =
+      parseRun(makeRun({800.0, 810.0, 790.0, 805.0, 795.0},
+                       {1300000, 1400000, 1500000, 7000000}, 250));
+
+  const Comparison c = apib::CompareRuns(a, b, CompareOptions());
+  EXPECT_TRUE(c.regression);
+  ASSERT_LE(2U, c.metrics.size());
+  EXPECT_EQ("Throughput", c.metrics[0].name);
+  EXPECT_NEAR(-20.0, c.metrics[0].change, 0.01);
+  EXPECT_TRUE(c.metrics[0].regression);
+  EXPECT_GT(0.001, c.metrics[0].pValue);
+  EXPECT_LT(c.metrics[0].changeLow, -15.0);
+  EXPECT_GT(c.metrics[0].changeHigh, -25.0);
+  EXPECT_EQ("Average latency", c.metrics[1].name);
+  EXPECT_TRUE(c.metrics[1].regression);
+  EXPECT_LT(0.75, c.slowerProbability);
+
+  // The reverse is an improvement, not a regression
+  const Comparison r = apib::CompareRuns(b, a, CompareOptions());
+  EXPECT_FALSE(r.regression);
+  EXPECT_TRUE(r.metrics[0].significant);
+
+  // A large enough threshold hides it
+  CompareOptions lenient;
+  lenient.threshold = 50.0;
+  EXPECT_FALSE(apib::CompareRuns(a, b, lenient).regression);
+
+  std::ostringstream out;
+  apib::PrintComparison(out, a, b, c);
+  EXPECT_TRUE(absl::StrContains(out.str(), "95% interval"));
+  EXPECT_TRUE(absl::StrContains(out.str(), "REGRESSION"));
+}
+
+}  // namespace
@@ -14,6 +14,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <sched.h>
+
 #include "apib/apib_cpu.h"
 #include "gtest/gtest.h"
 
@@ -55,6 +57,35 @@ TEST(CPU, MultiUsage) {
   }
 }
 
+TEST(CPU, Nodes) {
+  const auto nodes = apib::cpu_GetNodes();
+  ASSERT_FALSE(nodes.empty());
+  for (auto it = nodes.cbegin(); it != nodes.cend(); it++) {
+    EXPECT_FALSE(it->empty());
+  }
+}
+
+#ifdef __linux__
+TEST(CPU, Affinity) {
+  const auto nodes = apib::cpu_GetNodes();
+  std::vector<int> all;
+  for (auto it = nodes.cbegin(); it != nodes.cend(); it++) {
+    all.insert(all.end(), it->cbegin(), it->cend());
+  }
+  const int last = all.back();
+
+  ASSERT_EQ(0, apib::cpu_SetAffinity(std::vector<int>(1, last)));
+  EXPECT_EQ(last, sched_getcpu());
+  ASSERT_EQ(0, apib::cpu_SetAffinity(all));
+}
+
+TEST(CPU, Interface) {
+  // Loopback doesn't have any interrupts
+  EXPECT_TRUE(apib::cpu_GetInterfaceCpus("lo").empty());
+  EXPECT_TRUE(apib::cpu_GetInterfaceCpus("nosuchinterface").empty());
+}
+#endif
+
 }  // namespace
 
 int main(int argc, char** argv) {
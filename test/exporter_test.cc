@@ -0,0 +1,178 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_exporter.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "absl/strings/match.h"
+#include "apib/apib_histogram.h"
+#include "apib/apib_metrics.h"
+#include "apib/apib_reporting.h"
+#include "gtest/gtest.h"
+
+using apib::Histogram;
+using apib::MetricsFile;
+using apib::MetricsPage;
+using apib::MetricsServer;
+
+namespace {
+
+static std::string httpGet(int port, const std::string& path) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_LT(0, fd);
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  int err = connect(fd, (const sockaddr*)&addr, sizeof(struct sockaddr_in));
+  EXPECT_EQ(0, err);
+
+  const std::string req = "GET " + path + " HTTP/1.1\r\nHost: test\r\n\r\n";
+  EXPECT_EQ((ssize_t)req.size(), write(fd, req.data(), req.size()));
+
+  std::string resp;
+  char buf[1024];
+  ssize_t rc;
+  while ((rc = read(fd, buf, sizeof(buf))) > 0) {
+    resp.append(buf, rc);
+  }
+  close(fd);
+  return resp;
+}
+
+class Exporter : public ::testing::Test {
+ protected:
+  Exporter() {
+    EXPECT_TRUE(metrics.open("").ok());
+    MetricsPage* p = metrics.beginUpdate();
+    p->state = apib::METRICS_RUNNING;
+    p->successfulRequests = 100;
+    p->unsuccessfulRequests = 3;
+    p->errorCounts[apib::CONNECTION_REFUSED] = 2;
+    p->connectionsOpened = 10;
+    p->bytesSent = 1000;
+    p->bytesReceived = 2000;
+    // 100 requests of 2 milliseconds and 1 of 5 seconds
+    p->buckets[Histogram::bucketFor(2000000)] = 100;
+    p->buckets[Histogram::bucketFor(5000000000LL)] = 1;
+    p->latencyCount = 101;
+    p->latencySum = 5200000000LL;
+    metrics.endUpdate();
+  }
+
+  MetricsFile metrics;
+};
+
+TEST_F(Exporter, Format) {
+  const std::string out =
+      MetricsServer::format(*metrics.page(), 0.25, 0.5);
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_requests_total{result=\"success\"} 100\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_requests_total{result=\"failure\"} 3\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_socket_errors_total{class=\"refused\"} 2\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_socket_errors_total{class=\"tls\"} 0\n"));
+  EXPECT_TRUE(
+      absl::StrContains(out, "apib_connections_opened_total 10\n"));
+  EXPECT_TRUE(absl::StrContains(out, "apib_sent_bytes_total 1000\n"));
+  EXPECT_TRUE(absl::StrContains(out, "apib_received_bytes_total 2000\n"));
+  // The bucket that ends just below 2^21 nanoseconds holds the 2 ms
+  // requests, and the 5 second one is only in the larger buckets.
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_request_duration_seconds_bucket{le=\"0.001048575\"} 0\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_request_duration_seconds_bucket{le=\"0.002097151\"} 100\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_request_duration_seconds_bucket{le=\"+Inf\"} 101\n"));
+  EXPECT_TRUE(
+      absl::StrContains(out, "apib_request_duration_seconds_count 101\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "apib_request_duration_seconds_sum 5.200000000\n"));
+  EXPECT_TRUE(absl::StrContains(out, "apib_client_cpu_ratio 0.2500\n"));
+  EXPECT_TRUE(absl::StrContains(out, "apib_running 1\n"));
+  EXPECT_TRUE(absl::EndsWith(out, "# EOF\n"));
+
+  const std::string noCpu =
+      MetricsServer::format(*metrics.page(), -1.0, -1.0);
+  EXPECT_FALSE(absl::StrContains(noCpu, "apib_client_cpu_ratio"));
+  EXPECT_FALSE(absl::StrContains(noCpu, "apib_client_memory_ratio"));
+}
+
+TEST_F(Exporter, Scrape) {
+  MetricsServer svr;
+  ASSERT_TRUE(svr.start("127.0.0.1", 0, metrics.page(), false).ok());
+  const int port = svr.port();
+  ASSERT_LT(0, port);
+
+  std::string resp = httpGet(port, "/metrics");
+  EXPECT_TRUE(absl::StartsWith(resp, "HTTP/1.1 200 OK\r\n"));
+  EXPECT_TRUE(absl::StrContains(
+      resp, "Content-Type: application/openmetrics-text"));
+  EXPECT_TRUE(absl::StrContains(
+      resp, "apib_requests_total{result=\"success\"} 100\n"));
+  EXPECT_TRUE(absl::EndsWith(resp, "# EOF\n"));
+
+  // Updates show up in the next scrape
+  metrics.beginUpdate()->successfulRequests = 200;
+  metrics.endUpdate();
+  resp = httpGet(port, "/metrics?x=y");
+  EXPECT_TRUE(absl::StrContains(
+      resp, "apib_requests_total{result=\"success\"} 200\n"));
+
+  resp = httpGet(port, "/other");
+  EXPECT_TRUE(absl::StartsWith(resp, "HTTP/1.1 404 Not Found\r\n"));
+
+  svr.stop();
+}
+
+// Stopping closes the connections of scrapes that never finished
+TEST_F(Exporter, StopWithOpenScrape) {
+  MetricsServer svr;
+  ASSERT_TRUE(svr.start("127.0.0.1", 0, metrics.page(), false).ok());
+  const int port = svr.port();
+
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_LT(0, fd);
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  ASSERT_EQ(0,
+            connect(fd, (const sockaddr*)&addr, sizeof(struct sockaddr_in)));
+  const std::string partial = "GET /metrics HTTP/1.1\r\n";
+  EXPECT_EQ((ssize_t)partial.size(),
+            write(fd, partial.data(), partial.size()));
+
+  // By the time this one is answered, the first has been accepted
+  const std::string resp = httpGet(port, "/metrics");
+  EXPECT_TRUE(absl::StartsWith(resp, "HTTP/1.1 200 OK\r\n"));
+
+  svr.stop();
+  char buf[16];
+  EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+  close(fd);
+}
+
+}  // namespace
@@ -0,0 +1,127 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "test/test_faults.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using apib::FaultOptions;
+using apib::LatencyDistribution;
+using apib::SplitResponse;
+
+namespace {
+
+static const int kSamples = 100000;
+
+static std::vector<int64_t> sample(const std::string& spec) {
+  const auto d = LatencyDistribution::Parse(spec);
+  EXPECT_TRUE(d.ok()) << d.status();
+  std::mt19937_64 rand(1);
+  std::vector<int64_t> s;
+  for (int i = 0; i < kSamples; i++) {
+    s.push_back(d.value().sample(&rand));
+  }
+  std::sort(s.begin(), s.end());
+  return s;
+}
+
+TEST(Faults, Fixed) {
+  const auto s = sample("fixed:1500");
+  EXPECT_EQ(1500, s.front());
+  EXPECT_EQ(1500, s.back());
+}
+
+TEST(Faults, Uniform) {
+  const auto s = sample("uniform:100:200");
+  EXPECT_LE(100, s.front());
+  EXPECT_GE(200, s.back());
+  EXPECT_NEAR(150, s[kSamples / 2], 2);
+}
+
+TEST(Faults, LogNormal) {
+  const auto s = sample("lognormal:1000:0.5");
+  EXPECT_NEAR(1000, s[kSamples / 2], 20);
+  // exp(0.5 * 2.326) for the 99th percentile
+  EXPECT_NEAR(3200, s[kSamples * 99 / 100], 100);
+}
+
+TEST(Faults, Bimodal) {
+  const auto s = sample("bimodal:100:10000:0.01");
+  EXPECT_EQ(100, s[kSamples * 98 / 100]);
+  EXPECT_EQ(10000, s.back());
+  const auto slow = std::count(s.cbegin(), s.cend(), 10000);
+  EXPECT_NEAR(kSamples / 100, slow, kSamples / 500);
+}
+
+TEST(Faults, ParseErrors) {
+  EXPECT_FALSE(LatencyDistribution::Parse("fixed").ok());
+  EXPECT_FALSE(LatencyDistribution::Parse("uniform:200:100").ok());
+  EXPECT_FALSE(LatencyDistribution::Parse("lognormal:0:1").ok());
+  EXPECT_FALSE(LatencyDistribution::Parse("bimodal:1:2:3").ok());
+  EXPECT_FALSE(LatencyDistribution::Parse("gaussian:1:2").ok());
+  EXPECT_FALSE(FaultOptions::Parse("errors=2").ok());
+  EXPECT_FALSE(FaultOptions::Parse("slow=0.5:0:10").ok());
+  EXPECT_FALSE(FaultOptions::Parse("bogus=1").ok());
+}
+
+TEST(Faults, Options) {
+  EXPECT_TRUE(FaultOptions::Parse("").value().empty());
+  const auto f = FaultOptions::Parse(
+      "latency=fixed:10, errors=0.1,reset=0.01,slow=0.5:10:100,"
+      "trickle=1:20:200");
+  ASSERT_TRUE(f.ok()) << f.status();
+  EXPECT_FALSE(f.value().empty());
+  EXPECT_EQ(LatencyDistribution::FIXED, f.value().latency.type());
+  EXPECT_DOUBLE_EQ(0.1, f.value().errorRate);
+  EXPECT_DOUBLE_EQ(0.01, f.value().resetRate);
+  EXPECT_DOUBLE_EQ(0.5, f.value().slow.probability);
+  EXPECT_EQ(10U, f.value().slow.bytes);
+  EXPECT_EQ(100, f.value().slow.intervalMicros);
+  EXPECT_DOUBLE_EQ(1.0, f.value().chunked.probability);
+  EXPECT_EQ(20U, f.value().chunked.bytes);
+  EXPECT_EQ(200, f.value().chunked.intervalMicros);
+}
+
+static const std::string kResponse =
+    "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nServer: x\r\n\r\nHello";
+
+TEST(Faults, SplitSlow) {
+  const auto p = SplitResponse(kResponse, 10, false);
+  std::string joined;
+  for (auto it = p.cbegin(); it != p.cend(); it++) {
+    EXPECT_GE(10U, it->size());
+    joined += *it;
+  }
+  EXPECT_EQ(kResponse, joined);
+}
+
+TEST(Faults, SplitChunked) {
+  const auto p = SplitResponse(kResponse, 2, true);
+  ASSERT_EQ(4U, p.size());
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nServer: x\r\nTransfer-Encoding: chunked\r\n\r\n",
+      p[0]);
+  EXPECT_EQ("2\r\nHe\r\n", p[1]);
+  EXPECT_EQ("2\r\nll\r\n", p[2]);
+  EXPECT_EQ("1\r\no\r\n0\r\n\r\n", p[3]);
+}
+
+}  // namespace
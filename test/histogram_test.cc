@@ -0,0 +1,97 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_histogram.h"
+
+#include "gtest/gtest.h"
+
+using apib::Histogram;
+
+namespace {
+
+TEST(Histogram, Buckets) {
+  EXPECT_EQ(0, Histogram::bucketFor(0));
+  EXPECT_EQ(15, Histogram::bucketFor(15));
+  EXPECT_EQ(16, Histogram::bucketFor(16));
+  EXPECT_EQ(31, Histogram::bucketFor(31));
+  EXPECT_EQ(32, Histogram::bucketFor(32));
+  EXPECT_EQ(32, Histogram::bucketFor(33));
+  EXPECT_EQ(Histogram::kNumBuckets - 1,
+            Histogram::bucketFor(Histogram::kMaxValue));
+  EXPECT_EQ(Histogram::kNumBuckets - 1,
+            Histogram::bucketFor(Histogram::kMaxValue + 1000));
+
+  // Every bucket starts right after the previous one ends, and every
+  // value in it maps back to it.
+  for (int i = 1; i < Histogram::kNumBuckets; i++) {
+    const int64_t lower = Histogram::bucketLowerBound(i);
+    const int64_t upper = Histogram::bucketUpperBound(i);
+    EXPECT_EQ(Histogram::bucketUpperBound(i - 1) + 1, lower);
+    EXPECT_EQ(i, Histogram::bucketFor(lower));
+    EXPECT_EQ(i, Histogram::bucketFor(upper));
+    EXPECT_LE(upper - lower, lower / Histogram::kSubBuckets);
+  }
+  EXPECT_EQ(Histogram::kMaxValue,
+            Histogram::bucketUpperBound(Histogram::kNumBuckets - 1));
+}
+
+TEST(Histogram, Empty) {
+  Histogram h;
+  EXPECT_EQ(0, h.count());
+  EXPECT_EQ(0, h.min());
+  EXPECT_EQ(0, h.max());
+  EXPECT_EQ(0, h.percentile(50.0));
+}
+
+TEST(Histogram, Percentiles) {
+  Histogram h;
+  // One to 1000 microseconds
+  for (int64_t i = 1; i <= 1000; i++) {
+    h.record(i * 1000);
+  }
+  EXPECT_EQ(1000, h.count());
+  EXPECT_EQ(1000, h.min());
+  EXPECT_EQ(1000000, h.max());
+  EXPECT_EQ(1000000, h.percentile(100.0));
+
+  const int64_t p50 = h.percentile(50.0);
+  EXPECT_GE(p50, 500000);
+  EXPECT_LE(p50, 500000 + (500000 / Histogram::kSubBuckets));
+  const int64_t p99 = h.percentile(99.0);
+  EXPECT_GE(p99, 990000);
+  EXPECT_LE(p99, 1000000);
+}
+
+TEST(Histogram, Add) {
+  Histogram h1;
+  Histogram h2;
+  h1.record(100);
+  h1.record(200);
+  h2.record(50);
+  h2.record(5000);
+  h1.add(h2);
+  EXPECT_EQ(4, h1.count());
+  EXPECT_EQ(5350, h1.sum());
+  EXPECT_EQ(50, h1.min());
+  EXPECT_EQ(5000, h1.max());
+  EXPECT_EQ(1, h1.bucketCount(Histogram::bucketFor(5000)));
+
+  h1.clear();
+  EXPECT_EQ(0, h1.count());
+  EXPECT_EQ(0, h1.bucketCount(Histogram::bucketFor(5000)));
+}
+
+}  // namespace
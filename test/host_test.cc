@@ -0,0 +1,164 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_host.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using apib::Address;
+using apib::Balance;
+using apib::Host;
+using apib::HostAddress;
+using apib::RandomGenerator;
+
+namespace {
+
+static Address makeAddress(const char* ip) {
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  inet_pton(AF_INET, ip, &sa.sin_addr);
+  return Address((struct sockaddr*)&sa, sizeof(sa));
+}
+
+static std::vector<Address> makeAddresses(
+    std::initializer_list<const char*> ips) {
+  std::vector<Address> ret;
+  for (auto it = ips.begin(); it != ips.end(); it++) {
+    ret.push_back(makeAddress(*it));
+  }
+  return ret;
+}
+
+TEST(Balance, Parse) {
+  Balance b;
+  EXPECT_EQ(Balance::BY_THREAD, b.mode());
+  ASSERT_TRUE(Balance::Parse("round-robin", &b).ok());
+  EXPECT_EQ(Balance::ROUND_ROBIN, b.mode());
+  ASSERT_TRUE(Balance::Parse("least-conn", &b).ok());
+  EXPECT_EQ(Balance::LEAST_CONNECTIONS, b.mode());
+  ASSERT_TRUE(Balance::Parse("thread", &b).ok());
+  EXPECT_EQ(Balance::BY_THREAD, b.mode());
+
+  ASSERT_TRUE(Balance::Parse("weighted:10.0.0.1=3,fd00:0::1=0", &b).ok());
+  EXPECT_EQ(Balance::WEIGHTED, b.mode());
+  EXPECT_EQ(3, b.weight(makeAddress("10.0.0.1")));
+  EXPECT_EQ(1, b.weight(makeAddress("10.0.0.2")));
+
+  EXPECT_FALSE(Balance::Parse("", &b).ok());
+  EXPECT_FALSE(Balance::Parse("random", &b).ok());
+  EXPECT_FALSE(Balance::Parse("weighted:10.0.0.1", &b).ok());
+  EXPECT_FALSE(Balance::Parse("weighted:10.0.0.1=x", &b).ok());
+  EXPECT_FALSE(Balance::Parse("weighted:host=1", &b).ok());
+}
+
+TEST(Host, Lookup) {
+  Host h("127.0.0.1");
+  EXPECT_EQ(0, h.size());
+  EXPECT_EQ(nullptr, h.get(0));
+  ASSERT_TRUE(h.lookup(Balance()).ok());
+  ASSERT_EQ(1, h.size());
+  EXPECT_EQ("127.0.0.1", h.get(0)->address.str());
+
+  Host bad("notfound.notfound");
+  EXPECT_FALSE(bad.lookup(Balance()).ok());
+  EXPECT_EQ(nullptr, bad.pick(Balance(), 0, nullptr));
+}
+
+TEST(Host, Update) {
+  const Balance b;
+  Host h("test");
+  h.update(makeAddresses({"10.0.0.1", "10.0.0.2"}), b);
+  ASSERT_EQ(2, h.size());
+  HostAddress* a1 = h.pick(b, 0, nullptr);
+  HostAddress* a2 = h.pick(b, 1, nullptr);
+  EXPECT_EQ("10.0.0.1", a1->address.str());
+  EXPECT_EQ("10.0.0.2", a2->address.str());
+
+  // Same addresses in a different order change nothing
+  h.update(makeAddresses({"10.0.0.2", "10.0.0.1"}), b);
+  EXPECT_EQ(a1, h.get(0));
+  EXPECT_EQ(a2, h.get(1));
+
+  h.update(makeAddresses({"10.0.0.3", "10.0.0.2"}), b);
+  ASSERT_EQ(2, h.size());
+  EXPECT_FALSE(a1->current);
+  EXPECT_TRUE(a2->current);
+  EXPECT_EQ(a2, h.get(0));
+  EXPECT_EQ("10.0.0.3", h.get(1)->address.str());
+  EXPECT_EQ(3, h.all().size());
+
+  // An address that comes back is the same one as before
+  h.update(makeAddresses({"10.0.0.1"}), b);
+  EXPECT_TRUE(a1->current);
+  EXPECT_FALSE(a2->current);
+  EXPECT_EQ(a1, h.pick(b, 5, nullptr));
+  EXPECT_EQ(3, h.all().size());
+}
+
+TEST(Host, RoundRobin) {
+  Balance b;
+  ASSERT_TRUE(Balance::Parse("round-robin", &b).ok());
+  Host h("test");
+  h.update(makeAddresses({"10.0.0.1", "10.0.0.2", "10.0.0.3"}), b);
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(h.get(i), h.pick(b, 0, nullptr));
+  }
+}
+
+TEST(Host, LeastConnections) {
+  Balance b;
+  ASSERT_TRUE(Balance::Parse("least-conn", &b).ok());
+  Host h("test");
+  h.update(makeAddresses({"10.0.0.1", "10.0.0.2", "10.0.0.3"}), b);
+  HostAddress* a0 = h.pick(b, 0, nullptr);
+  EXPECT_EQ(h.get(0), a0);
+  a0->active = 2;
+  HostAddress* a1 = h.pick(b, 0, nullptr);
+  EXPECT_EQ(h.get(1), a1);
+  a1->active = 1;
+  EXPECT_EQ(h.get(2), h.pick(b, 0, nullptr));
+  EXPECT_EQ(h.get(2), h.pick(b, 1, nullptr));
+}
+
+TEST(Host, Weighted) {
+  Balance b;
+  ASSERT_TRUE(Balance::Parse("weighted:10.0.0.1=3,10.0.0.3=0", &b).ok());
+  Host h("test");
+  h.update(makeAddresses({"10.0.0.1", "10.0.0.2", "10.0.0.3"}), b);
+  RandomGenerator rand;
+  int counts[3] = {0, 0, 0};
+  for (int i = 0; i < 4000; i++) {
+    const HostAddress* a = h.pick(b, 0, &rand);
+    for (int j = 0; j < 3; j++) {
+      if (a == h.get(j)) {
+        counts[j]++;
+      }
+    }
+  }
+  EXPECT_EQ(0, counts[2]);
+  EXPECT_EQ(4000, counts[0] + counts[1]);
+  EXPECT_LT(2700, counts[0]);
+  EXPECT_GT(3300, counts[0]);
+}
+
+}  // namespace
@@ -0,0 +1,444 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Benchmarks for the code that runs for every request that apib sends,
+// from formatting the request to recording the result, and for a whole
+// client and server on the loopback interface. Run with
+// "--benchmark_repetitions" and "--benchmark_out" to save numbers that
+// can be compared between releases.
+
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "apib/apib_histogram.h"
+#include "apib/apib_iothread.h"
+#include "apib/apib_oauth.h"
+#include "apib/apib_rand.h"
+#include "apib/apib_reporting.h"
+#include "apib/apib_template.h"
+#include "apib/apib_url.h"
+#include "benchmark/benchmark.h"
+#include "test/test_keygen.h"
+#include "test/test_server.h"
+
+namespace apib {
+
+// A friend of ConnectionState, so that we can run parts of the request
+// cycle without a socket or an event loop.
+class ConnectionBenchmark {
+ public:
+  explicit ConnectionBenchmark(IOThread* t) : c_(0, t) {
+    c_.url_ = URLInfo::GetNext(t->rand());
+  }
+
+  const std::string& writeRequest(bool dirty) {
+    c_.writeDirty_ = dirty;
+    c_.writeRequest();
+    return c_.fullWrite_;
+  }
+
+  // Feed "response" to the parser the way that "singleRead" does, a read
+  // buffer at a time, and return the status code.
+  int parseResponse(const std::string& response) {
+    c_.readDone_ = false;
+    http_parser_init(&c_.parser_, HTTP_RESPONSE);
+    c_.parser_.data = &c_;
+    size_t pos = 0;
+    while (!c_.readDone_ && (pos < response.size())) {
+      const size_t len =
+          std::min(ConnectionState::kReadBufSize - c_.readBufPos_,
+                   response.size() - pos);
+      memcpy(c_.readBuf_ + c_.readBufPos_, response.data() + pos, len);
+      pos += len;
+      if (!c_.parseResponse(len)) {
+        return -1;
+      }
+    }
+    return c_.parser_.status_code;
+  }
+
+ private:
+  ConnectionState c_;
+};
+
+}  // namespace apib
+
+using apib::ConnectionBenchmark;
+using apib::IOThread;
+using apib::URLInfo;
+
+static const char kUrl[] = "http://127.0.0.1:8080/hello/world?foo=bar";
+
+static std::string makeResponse(int bodySize) {
+  return absl::StrCat(
+      "HTTP/1.1 200 OK\r\n"
+      "Server: apib-benchmark\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: ",
+      bodySize, "\r\n\r\n", std::string(bodySize, 'x'));
+}
+
+static apib::OAuthInfo makeOAuth() {
+  apib::OAuthInfo oauth;
+  oauth.consumerKey = "dpf43f3p2l4k3l03";
+  oauth.consumerSecret = "kd94hf93k423kf44";
+  oauth.accessToken = "nnch734d00sl2jdk";
+  oauth.tokenSecret = "pfkkdhi9sl3r4s00";
+  return oauth;
+}
+
+static void BM_WriteRequest(benchmark::State& state) {
+  URLInfo::InitOne(kUrl);
+  IOThread t;
+  t.httpVerb = "POST";
+  t.sendData = "Hello, World!";
+  std::vector<std::string> headers;
+  for (int i = 0; i < state.range(0); i++) {
+    headers.push_back(absl::StrCat("X-Benchmark-Header-", i, ": value"));
+  }
+  t.headers = &headers;
+  ConnectionBenchmark c(&t);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(c.writeRequest(true).data());
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_WriteRequest)->Arg(0)->Arg(8);
+
+// The same request again on the same connection, which reuses the buffer
+static void BM_WriteRequestReused(benchmark::State& state) {
+  URLInfo::InitOne(kUrl);
+  IOThread t;
+  t.httpVerb = "GET";
+  ConnectionBenchmark c(&t);
+  c.writeRequest(true);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(c.writeRequest(false).data());
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_WriteRequestReused);
+
+// With --oauth, every request is formatted and signed again
+static void BM_WriteRequestSigned(benchmark::State& state) {
+  URLInfo::InitOne(kUrl);
+  apib::OAuthSigner signer(makeOAuth());
+  IOThread t;
+  t.httpVerb = "GET";
+  t.signer = &signer;
+  ConnectionBenchmark c(&t);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(c.writeRequest(false).data());
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_WriteRequestSigned);
+
+// With --template, every request is filled in again
+static void BM_WriteRequestTemplated(benchmark::State& state) {
+  URLInfo::InitOne("http://127.0.0.1:8080/hello/${counter}?r=${randstr:16}");
+  IOThread t;
+  t.httpVerb = "POST";
+  apib::RequestTemplates templates;
+  const std::vector<std::string> headers = {"X-Request-Id: ${uuid}"};
+  templates.compile(headers, "{\"id\": ${rand:1:1000000}}");
+  t.templates = &templates;
+  ConnectionBenchmark c(&t);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(c.writeRequest(false).data());
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_WriteRequestTemplated);
+
+static void BM_ParseResponse(benchmark::State& state) {
+  URLInfo::InitOne(kUrl);
+  IOThread t;
+  ConnectionBenchmark c(&t);
+  const std::string response = makeResponse(state.range(0));
+
+  for (auto _ : state) {
+    if (c.parseResponse(response) != 200) {
+      state.SkipWithError("Invalid response");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * response.size());
+  URLInfo::Reset();
+}
+BENCHMARK(BM_ParseResponse)->Arg(2)->Arg(1024)->Arg(65536);
+
+static void BM_URLGetNext(benchmark::State& state) {
+  const int numUrls = state.range(0);
+  if (numUrls == 1) {
+    URLInfo::InitOne(kUrl);
+  } else {
+    char fileName[] = "/tmp/apib_benchmark_urls.XXXXXX";
+    const int fd = mkstemp(fileName);
+    std::string urls;
+    for (int i = 0; i < numUrls; i++) {
+      urls += absl::StrCat("http://127.0.0.1:", 8000 + i, "/path/", i, "\n");
+    }
+    write(fd, urls.data(), urls.size());
+    close(fd);
+    URLInfo::InitFile(fileName);
+    unlink(fileName);
+  }
+  apib::RandomGenerator rand;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(URLInfo::GetNext(&rand));
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_URLGetNext)->Arg(1)->Arg(100);
+
+static void BM_RecordResult(benchmark::State& state) {
+  IOThread t;
+  int64_t latency = 0;
+
+  for (auto _ : state) {
+    t.recordResult(200, latency);
+    // Keep the list of latencies from growing without bound, as
+    // the reporting thread would
+    if ((++latency % 100000) == 0) {
+      state.PauseTiming();
+      delete t.exchangeCounters();
+      state.ResumeTiming();
+    }
+  }
+  delete t.exchangeCounters();
+}
+BENCHMARK(BM_RecordResult);
+
+static void BM_HistogramRecord(benchmark::State& state) {
+  apib::RandomGenerator rand;
+  std::vector<int64_t> latencies;
+  for (int i = 0; i < 4096; i++) {
+    // Between one microsecond and about a second
+    latencies.push_back(1000LL << rand.get(0, 20));
+  }
+  apib::Histogram h;
+  size_t i = 0;
+
+  for (auto _ : state) {
+    h.record(latencies[i++ & 4095]);
+  }
+  benchmark::DoNotOptimize(h.count());
+}
+BENCHMARK(BM_HistogramRecord);
+
+// The way that each I/O thread signs requests
+static void BM_OAuthHeader(benchmark::State& state) {
+  URLInfo::InitOne(kUrl);
+  apib::RandomGenerator rand;
+  apib::OAuthSigner signer(makeOAuth());
+  const URLInfo* url = URLInfo::GetNext(&rand);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(signer.header(&rand, *url, "", "GET", "").data());
+  }
+  URLInfo::Reset();
+}
+BENCHMARK(BM_OAuthHeader);
+
+static std::string keyFile;
+static std::string certFile;
+
+static void makeKeys() {
+  if (!keyFile.empty()) {
+    return;
+  }
+  const char* dir = getenv("TEST_TMPDIR");
+  if (dir == nullptr) {
+    dir = "/tmp";
+  }
+  keyFile = absl::StrCat(dir, "/apib_benchmark_key.pem");
+  certFile = absl::StrCat(dir, "/apib_benchmark_cert.pem");
+
+  RSA* key = apib::keygen_MakeRSAPrivateKey(2048);
+  assert(key != nullptr);
+  X509* cert = apib::keygen_MakeServerCertificate(key, 1, 1);
+  assert(cert != nullptr);
+  int err = apib::keygen_SignCertificate(key, cert);
+  assert(err == 0);
+  err = apib::keygen_WriteRSAPrivateKey(key, keyFile.c_str());
+  assert(err == 0);
+  err = apib::keygen_WriteX509Certificate(cert, certFile.c_str());
+  assert(err == 0);
+  // Hand the key to an EVP_PKEY to free it, since RSA_free is deprecated
+  EVP_PKEY* pkey = EVP_PKEY_new();
+  EVP_PKEY_assign_RSA(pkey, key);
+  EVP_PKEY_free(pkey);
+  X509_free(cert);
+}
+
+// Complete the handshake between two non-blocking TLS connections
+// in the same thread.
+static bool handshake(SSL* client, SSL* server) {
+  for (int i = 0; i < 1000; i++) {
+    const int c = SSL_do_handshake(client);
+    const int s = SSL_do_handshake(server);
+    if ((c == 1) && (s == 1)) {
+      return true;
+    }
+    if (((c != 1) && (SSL_get_error(client, c) != SSL_ERROR_WANT_READ)) ||
+        ((s != 1) && (SSL_get_error(server, s) != SSL_ERROR_WANT_READ))) {
+      return false;
+    }
+  }
+  return false;
+}
+
+static bool exchange(SSL* from, SSL* to, const std::string& msg,
+                     std::vector<char>* buf) {
+  if (SSL_write(from, msg.data(), msg.size()) != (int)msg.size()) {
+    return false;
+  }
+  for (size_t got = 0; got < msg.size();) {
+    const int rc = SSL_read(to, buf->data(), buf->size());
+    if (rc <= 0) {
+      return false;
+    }
+    got += rc;
+  }
+  return true;
+}
+
+// Send a request-sized message one way and a response-sized message the
+// other over a socket pair, so that both encryption and decryption count.
+static void BM_TLSReadWrite(benchmark::State& state) {
+  makeKeys();
+  SSL_CTX* serverCtx = SSL_CTX_new(TLS_server_method());
+  SSL_CTX_use_certificate_chain_file(serverCtx, certFile.c_str());
+  SSL_CTX_use_PrivateKey_file(serverCtx, keyFile.c_str(), SSL_FILETYPE_PEM);
+  SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  SSL* client = SSL_new(clientCtx);
+  SSL_set_fd(client, fds[0]);
+  SSL_set_connect_state(client);
+  SSL* server = SSL_new(serverCtx);
+  SSL_set_fd(server, fds[1]);
+  SSL_set_accept_state(server);
+
+  const size_t size = state.range(0);
+  const std::string request(256, 'q');
+  const std::string response(size, 'r');
+  std::vector<char> buf(std::max(size, request.size()));
+
+  // Both ends are in this thread, so the handshake must not block, but
+  // after that, blocking makes the loop below simpler.
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  if (!handshake(client, server)) {
+    ERR_print_errors_fp(stderr);
+    state.SkipWithError("TLS handshake failed");
+  }
+  fcntl(fds[0], F_SETFL, 0);
+  fcntl(fds[1], F_SETFL, 0);
+
+  for (auto _ : state) {
+    if (!exchange(client, server, request, &buf) ||
+        !exchange(server, client, response, &buf)) {
+      state.SkipWithError("TLS read or write failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * (request.size() + size));
+
+  SSL_free(client);
+  SSL_free(server);
+  close(fds[0]);
+  close(fds[1]);
+  SSL_CTX_free(clientCtx);
+  SSL_CTX_free(serverCtx);
+}
+BENCHMARK(BM_TLSReadWrite)->Arg(64)->Arg(1024)->Arg(16384);
+
+// Run apib against the test server on the loopback interface for one
+// second per iteration, with one thread each and "range(0)" connections.
+// The "requests" counter is the rate that it achieved.
+static void BM_Loopback(benchmark::State& state) {
+  apib::TestServer server;
+  if (server.start("127.0.0.1", 0, "", "", 1) != 0) {
+    state.SkipWithError("Can't start test server");
+    return;
+  }
+  apib::RecordInit("", "");
+  URLInfo::InitOne(absl::StrCat("http://127.0.0.1:", server.port(), "/hello"));
+
+  int64_t requests = 0;
+  for (auto _ : state) {
+    apib::ThreadList threads;
+    IOThread* t = new IOThread();
+    threads.push_back(std::unique_ptr<IOThread>(t));
+    t->numConnections = state.range(0);
+    t->httpVerb = "GET";
+    t->Start();
+    apib::RecordStart(true, threads);
+    sleep(1);
+    apib::RecordStop(threads);
+    t->Stop();
+    const apib::BenchmarkResults results = apib::ReportResults();
+    if (results.unsuccessfulRequests > 0 || results.socketErrors > 0) {
+      state.SkipWithError("Requests failed");
+      break;
+    }
+    requests += results.successfulRequests;
+  }
+  state.counters["requests"] =
+      benchmark::Counter(requests, benchmark::Counter::kIsRate);
+
+  URLInfo::Reset();
+  apib::EndReporting();
+  server.stop();
+}
+BENCHMARK(BM_Loopback)
+    ->Arg(1)
+    ->Arg(16)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+  SSL_library_init();
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  if (!keyFile.empty()) {
+    unlink(keyFile.c_str());
+    unlink(certFile.c_str());
+  }
+  return 0;
+}
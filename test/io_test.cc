@@ -14,10 +14,21 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
+#include "absl/strings/string_view.h"
+#include "apib/apib_body.h"
 #include "apib/apib_iothread.h"
 #include "apib/apib_reporting.h"
+#include "apib/apib_time.h"
 #include "apib/apib_url.h"
 #include "gtest/gtest.h"
 #include "test/test_server.h"
@@ -128,6 +139,47 @@ TEST_F(IOTest, OneThreadNoKeepAlive) {
   EXPECT_EQ(results.completedRequests, results.connectionsOpened);
 }
 
+// Every request on a new connection is traced in order
+TEST_F(IOTest, Trace) {
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->httpVerb = "GET";
+  t->noKeepAlive = 1;
+  t->traceEvents = 1024;
+
+  RecordStart(true, threads);
+  t->Start();
+  usleep(200000);
+  t->Stop();
+  RecordStop(threads);
+  compareReporting();
+
+  std::vector<apib::TraceEvent> events;
+  t->traceSnapshot(&events);
+  ASSERT_LE(6, events.size());
+  // Find the start of a connection, then check a whole cycle
+  size_t i = 0;
+  while (events[i].type != apib::TRACE_CONNECT) {
+    i++;
+  }
+  const apib::TraceType expected[] = {
+      apib::TRACE_CONNECT,    apib::TRACE_WRITE_START, apib::TRACE_WRITE_END,
+      apib::TRACE_FIRST_BYTE, apib::TRACE_COMPLETE,    apib::TRACE_CLOSE};
+  ASSERT_LE(i + 6, events.size());
+  for (int j = 0; j < 6; j++) {
+    EXPECT_EQ(expected[j], events[i + j].type);
+    EXPECT_EQ(0, events[i + j].connection);
+    if (j > 0) {
+      EXPECT_LE(events[i + j - 1].ticks, events[i + j].ticks);
+    }
+  }
+}
+
 TEST_F(IOTest, OneThreadThinkTime) {
   char url[128];
   sprintf(url, "http://127.0.0.1:%i/hello", testServerPort);
@@ -284,6 +336,62 @@ TEST_F(IOTest, OneThreadBigPost) {
   compareReporting();
 }
 
+static void runStream(ThreadList* threads, const char* path,
+                      const char* spec, absl::string_view fileData,
+                      int connections, bool once) {
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i%s", testServerPort, path);
+  URLInfo::InitOne(url);
+
+  std::unique_ptr<apib::BodySource> stream;
+  ASSERT_TRUE(apib::BodySource::Parse(spec, fileData, &stream).ok());
+  IOThread* t = new IOThread();
+  threads->push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = connections;
+  t->httpVerb = "POST";
+  t->stream = stream.get();
+  t->keepRunning = (once ? -1 : 1);
+
+  RecordStart(true, *threads);
+  t->Start();
+  if (once) {
+    t->Join();
+  } else {
+    sleep(1);
+    t->Stop();
+  }
+  RecordStop(*threads);
+}
+
+TEST_F(IOTest, StreamUpload) {
+  runStream(&threads, "/upload", "size=1M,chunk=16K", "", 2, false);
+  compareReporting();
+  EXPECT_EQ(testServer.stats().successCount,
+            testServer.stats().successes[OP_UPLOAD]);
+}
+
+TEST_F(IOTest, StreamChunked) {
+  std::string data;
+  for (int p = 0; p < POST_LEN; p += 10) {
+    data.append("abcdefghij");
+  }
+  runStream(&threads, "/echo", "chunked,chunk=1000", data, 2, false);
+  compareReporting();
+  EXPECT_EQ(testServer.stats().successCount,
+            testServer.stats().successes[OP_ECHO]);
+}
+
+TEST_F(IOTest, StreamPaced) {
+  const int64_t start = apib::GetTime();
+  runStream(&threads, "/upload", "size=5K,chunk=1K,delay=20,chunked", "", 1,
+            true);
+  // Four pauses between five chunks
+  EXPECT_LE(0.08, apib::Seconds(apib::GetTime() - start));
+  BenchmarkResults results = ReportResults();
+  EXPECT_EQ(1, results.successfulRequests);
+  EXPECT_EQ(0, results.socketErrors);
+}
+
 TEST_F(IOTest, OneThreadHeaders) {
   char url[128];
   sprintf(url, "http://127.0.0.1:%i/hello", testServerPort);
@@ -307,6 +415,166 @@ TEST_F(IOTest, OneThreadHeaders) {
   delete t->headers;
 }
 
+TEST_F(IOTest, ConnectionRefused) {
+  // Find a port that nobody is listening on
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(fd, (struct sockaddr*)&addr, sizeof(addr)));
+  socklen_t addrLen = sizeof(addr);
+  getsockname(fd, (struct sockaddr*)&addr, &addrLen);
+  close(fd);
+
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i/hello", ntohs(addr.sin_port));
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->httpVerb = "GET";
+  t->backoffMin = 50;
+  t->backoffMax = 200;
+
+  RecordStart(true, threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(threads);
+  BenchmarkResults results = ReportResults();
+
+  EXPECT_EQ(0, results.completedRequests);
+  EXPECT_LT(0, results.socketErrors);
+  EXPECT_EQ(results.socketErrors,
+            results.errorCounts[apib::CONNECTION_REFUSED]);
+  // Without backing off there would be thousands of attempts
+  EXPECT_GT(20, results.socketErrors);
+}
+
+TEST_F(IOTest, SourcePortRange) {
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  std::vector<apib::SourceAddress> sources;
+  auto s = apib::SourceAddress::parse("127.0.0.1:42000-42999");
+  ASSERT_TRUE(s.ok());
+  sources.push_back(s.value());
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 2;
+  t->httpVerb = "GET";
+  t->noKeepAlive = 1;
+  t->sourceAddresses = &sources;
+
+  RecordStart(true, threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(threads);
+
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LT(1, results.connectionsOpened);
+}
+
+TEST_F(IOTest, FastOpen) {
+  if (!apib::Socket::fastOpenSupported()) {
+    return;
+  }
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->httpVerb = "GET";
+  t->noKeepAlive = 1;
+  t->fastOpen = true;
+
+  RecordStart(true, threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(threads);
+
+  // The test server doesn't enable Fast Open, so this only checks that
+  // connections fall back to a regular handshake.
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LT(1, results.connectionsOpened);
+  EXPECT_EQ(results.completedRequests, results.connectionsOpened);
+}
+
+// Run one connection for a second with an "X-Fault" header
+static void runWithFault(ThreadList* threads, const char* path,
+                         const char* fault) {
+  char url[128];
+  sprintf(url, "http://127.0.0.1:%i%s", testServerPort, path);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads->push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->httpVerb = "GET";
+  t->headers = new std::vector<std::string>();
+  t->headers->push_back(std::string("X-Fault: ") + fault);
+
+  RecordStart(true, *threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(*threads);
+  delete t->headers;
+}
+
+TEST_F(IOTest, FaultLatency) {
+  runWithFault(&threads, "/hello", "latency=fixed:5000");
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  // Each request should take at least 5 milliseconds, and not much more
+  EXPECT_LE(5.0, results.latencies[0]);
+  EXPECT_GT(50.0, results.latencies[50]);
+  EXPECT_GE(200, results.successfulRequests);
+}
+
+TEST_F(IOTest, FaultErrors) {
+  runWithFault(&threads, "/hello", "errors=1");
+  apib::TestServerStats stats = testServer.stats();
+  BenchmarkResults results = ReportResults();
+  EXPECT_EQ(0, results.successfulRequests);
+  EXPECT_LT(0, results.unsuccessfulRequests);
+  EXPECT_EQ(0, results.socketErrors);
+  EXPECT_EQ(results.unsuccessfulRequests, stats.errorCount);
+}
+
+TEST_F(IOTest, FaultTrickle) {
+  // Ten chunks a millisecond apart
+  runWithFault(&threads, "/data?size=1000", "trickle=1:100:1000");
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LE(10.0, results.latencies[0]);
+}
+
+TEST_F(IOTest, FaultSlow) {
+  runWithFault(&threads, "/data?size=1000", "slow=1:500:2000");
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LE(4.0, results.latencies[0]);
+}
+
+TEST_F(IOTest, FaultReset) {
+  runWithFault(&threads, "/hello", "reset=1");
+  BenchmarkResults results = ReportResults();
+  EXPECT_EQ(0, results.successfulRequests);
+  EXPECT_LT(0, results.socketErrors);
+  EXPECT_LT(0, testServer.stats().resetCount);
+}
+
 TEST_F(IOTest, IP6Address) {
   // Start and stop a separate server here on a different address and port
   apib::TestServer testServer6;
@@ -338,12 +606,129 @@ TEST_F(IOTest, IP6Address) {
   testServer6.stop();
 }
 
+// Run against a separate server listening on the Unix socket "path"
+static void runUnix(ThreadList* threads, const std::string& path,
+                    bool keepAlive,
+                    const apib::SocketOptions* options = nullptr) {
+  apib::TestServer unixServer;
+  ASSERT_EQ(0, unixServer.start("unix:" + path, 0, "", ""));
+  ASSERT_TRUE(URLInfo::InitOne("unix://" + path + ":/hello").ok());
+
+  IOThread* t = new IOThread();
+  threads->push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 2;
+  t->httpVerb = "GET";
+  t->noKeepAlive = !keepAlive;
+  t->socketOptions = options;
+
+  RecordStart(true, *threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(*threads);
+
+  const apib::TestServerStats stats = unixServer.stats();
+  unixServer.stop();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LT(0, results.successfulRequests);
+  EXPECT_EQ(0, results.unsuccessfulRequests);
+  EXPECT_EQ(0, results.socketErrors);
+  EXPECT_EQ(results.successfulRequests, stats.successCount);
+  if (keepAlive) {
+    EXPECT_EQ(2, results.connectionsOpened);
+  } else {
+    EXPECT_EQ(results.completedRequests, results.connectionsOpened);
+  }
+}
+
+TEST_F(IOTest, UnixSocket) {
+  char path[64];
+  sprintf(path, "/tmp/apib-io-test-%i.sock", getpid());
+  runUnix(&threads, path, true);
+  unlink(path);
+}
+
+TEST_F(IOTest, UnixSocketNoKeepAlive) {
+  char path[64];
+  sprintf(path, "/tmp/apib-io-test-%i.sock", getpid());
+  runUnix(&threads, path, false);
+  unlink(path);
+}
+
+#ifdef __linux__
+TEST_F(IOTest, AbstractSocket) {
+  char path[64];
+  sprintf(path, "@apib-io-test-%i", getpid());
+  runUnix(&threads, path, true);
+}
+
+// TCP and IP options are ignored for Unix sockets, and the rest still apply
+TEST_F(IOTest, UnixSocketOptions) {
+  apib::SocketOptions options;
+  ASSERT_TRUE(options.add("quickack=1").ok());
+  ASSERT_TRUE(options.add("tos=0x10").ok());
+  ASSERT_TRUE(options.add("sndbuf=65536").ok());
+  char path[64];
+  sprintf(path, "/tmp/apib-io-test-%i.sock", getpid());
+  runUnix(&threads, path, false, &options);
+  unlink(path);
+}
+#endif
+
+// Send requests at random to the test server and to a second one on a
+// different port, and return how many connections were opened.
+static int64_t runTwoServers(ThreadList* threads, int hostPoolSize) {
+  apib::TestServer testServer2;
+  EXPECT_EQ(0, testServer2.start("127.0.0.1", 0, "", ""));
+
+  char fileName[] = "/tmp/apib-io-test-XXXXXX";
+  const int fd = mkstemp(fileName);
+  EXPECT_LE(0, fd);
+  char urls[256];
+  const int len =
+      sprintf(urls, "http://127.0.0.1:%i/hello\nhttp://127.0.0.1:%i/hello\n",
+              testServerPort, testServer2.port());
+  EXPECT_EQ(len, write(fd, urls, len));
+  close(fd);
+  EXPECT_TRUE(URLInfo::InitFile(fileName).ok());
+  unlink(fileName);
+
+  IOThread* t = new IOThread();
+  threads->push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 2;
+  t->httpVerb = "GET";
+  t->hostPoolSize = hostPoolSize;
+
+  RecordStart(true, *threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(*threads);
+  testServer2.stop();
+
+  BenchmarkResults results = ReportResults();
+  EXPECT_LT(10, results.successfulRequests);
+  EXPECT_EQ(0, results.unsuccessfulRequests);
+  EXPECT_EQ(0, results.socketErrors);
+  return results.connectionsOpened;
+}
+
+TEST_F(IOTest, TwoServersPooled) {
+  // Each connection needs at most one socket to each server
+  EXPECT_GE(4, runTwoServers(&threads, IOThread::kDefaultHostPoolSize));
+}
+
+TEST_F(IOTest, TwoServersNotPooled) {
+  // Reconnect about every other request
+  EXPECT_LT(10, runTwoServers(&threads, 0));
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
-  int err = testServer.start("127.0.0.1", 0, "", "");
+  int err = testServer.start("127.0.0.1", 0, "", "", 2);
   if (err != 0) {
     fprintf(stderr, "Can't start test server: %i\n", err);
     return 2;
@@ -0,0 +1,145 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_json.h"
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using apib::JsonValue;
+using apib::JsonWriter;
+
+namespace {
+
+TEST(JsonWriter, Quote) {
+  EXPECT_EQ("\"\"", JsonWriter::quote(""));
+  EXPECT_EQ("\"hello\"", JsonWriter::quote("hello"));
+  EXPECT_EQ("\"a\\\"b\\\\c\"", JsonWriter::quote("a\"b\\c"));
+  EXPECT_EQ("\"1\\n2\\t3\\r\"", JsonWriter::quote("1\n2\t3\r"));
+  EXPECT_EQ("\"\\u0001\"", JsonWriter::quote("\x01"));
+}
+
+TEST(JsonWriter, Empty) {
+  std::ostringstream out;
+  JsonWriter w(out);
+  w.beginObject();
+  w.key("list");
+  w.beginArray();
+  w.endArray();
+  w.key("object");
+  w.beginObject();
+  w.endObject();
+  w.endObject();
+  EXPECT_EQ("{\n  \"list\": [],\n  \"object\": {}\n}\n", out.str());
+}
+
+TEST(JsonWriter, Values) {
+  std::ostringstream out;
+  JsonWriter w(out);
+  w.beginObject();
+  w.field("string", "foo");
+  w.field("int", 123);
+  w.field("negative", (int64_t)-9000000000LL);
+  w.field("true", true);
+  w.field("false", false);
+  w.field("double", 0.25);
+  w.field("tenth", 0.1);
+  w.field("nan", std::nan(""));
+  w.key("list");
+  w.beginArray();
+  w.value(1);
+  w.value(2);
+  w.endArray();
+  w.endObject();
+  EXPECT_EQ(
+      "{\n"
+      "  \"string\": \"foo\",\n"
+      "  \"int\": 123,\n"
+      "  \"negative\": -9000000000,\n"
+      "  \"true\": true,\n"
+      "  \"false\": false,\n"
+      "  \"double\": 0.25,\n"
+      "  \"tenth\": 0.1,\n"
+      "  \"nan\": null,\n"
+      "  \"list\": [\n"
+      "    1,\n"
+      "    2\n"
+      "  ]\n"
+      "}\n",
+      out.str());
+}
+
+TEST(JsonValue, Parse) {
+  const auto r = JsonValue::Parse(
+      " {\"name\": \"a\\\"b\\u00e9\", \"n\": -1.5e2, \"ok\": true,\n"
+      "  \"none\": null, \"list\": [1, [], {}]} ");
+  ASSERT_TRUE(r.ok()) << r.status();
+  const JsonValue& v = r.valueref();
+  EXPECT_EQ(JsonValue::OBJECT, v.type());
+  EXPECT_EQ(5U, v.size());
+  EXPECT_EQ("a\"b\xc3\xa9", v.getString("name", ""));
+  EXPECT_EQ(-150.0, v.getNumber("n", 0.0));
+  ASSERT_NE(nullptr, v.get("ok"));
+  EXPECT_TRUE(v.get("ok")->boolValue());
+  ASSERT_NE(nullptr, v.get("none"));
+  EXPECT_TRUE(v.get("none")->isNull());
+  EXPECT_EQ(nullptr, v.get("missing"));
+  EXPECT_EQ(7.0, v.getNumber("missing", 7.0));
+  EXPECT_EQ(7.0, v.getNumber("name", 7.0));
+
+  const JsonValue* list = v.get("list");
+  ASSERT_NE(nullptr, list);
+  EXPECT_EQ(JsonValue::ARRAY, list->type());
+  ASSERT_EQ(3U, list->size());
+  EXPECT_EQ(1.0, list->at(0).number());
+  EXPECT_EQ(JsonValue::ARRAY, list->at(1).type());
+  EXPECT_EQ(0U, list->at(1).size());
+  EXPECT_EQ(JsonValue::OBJECT, list->at(2).type());
+}
+
+TEST(JsonValue, Invalid) {
+  EXPECT_FALSE(JsonValue::Parse("").ok());
+  EXPECT_FALSE(JsonValue::Parse("{").ok());
+  EXPECT_FALSE(JsonValue::Parse("{\"a\" 1}").ok());
+  EXPECT_FALSE(JsonValue::Parse("[1,]").ok());
+  EXPECT_FALSE(JsonValue::Parse("[1] 2").ok());
+  EXPECT_FALSE(JsonValue::Parse("\"abc").ok());
+  EXPECT_FALSE(JsonValue::Parse("nope").ok());
+  EXPECT_FALSE(JsonValue::Parse("1x").ok());
+  EXPECT_FALSE(JsonValue::Parse(std::string(100, '[')).ok());
+}
+
+TEST(JsonValue, RoundTrip) {
+  std::ostringstream out;
+  JsonWriter w(out);
+  w.beginObject();
+  w.field("text", "line\n\"quoted\"\x01");
+  w.field("tenth", 0.1);
+  w.field("big", (int64_t)1234567890123LL);
+  w.endObject();
+
+  const auto r = JsonValue::Parse(out.str());
+  ASSERT_TRUE(r.ok()) << r.status();
+  EXPECT_EQ("line\n\"quoted\"\x01", r.valueref().getString("text", ""));
+  EXPECT_EQ(0.1, r.valueref().getNumber("tenth", 0.0));
+  EXPECT_EQ(1234567890123.0, r.valueref().getNumber("big", 0.0));
+}
+
+}  // namespace
@@ -14,14 +14,19 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <openssl/hmac.h>
+#include <unistd.h>
+
 #include <regex>
 
 #include "apib/apib_oauth.h"
+#include "third_party/base64/base64.h"
 #include "gtest/gtest.h"
 
 namespace {
 
 using apib::OAuthInfo;
+using apib::OAuthSigner;
 using apib::URLInfo;
 
 static apib::RandomGenerator randgen;
@@ -112,4 +117,67 @@ TEST_F(OAuthTest, AuthHeader) {
   EXPECT_TRUE(std::regex_match(hdr.begin(), hdr.end(), re));
 }
 
+
+// Compare with a one-shot HMAC, including a key longer than the SHA-1 block
+TEST_F(OAuthTest, Hmac) {
+  const std::string base = "GET&http%3A%2F%2Fexample.com%2F&a%3Db";
+  for (int i = 0; i < 2; i++) {
+    if (i == 1) {
+      oauth.tokenSecret = std::string(100, 'x');
+    }
+    const std::string key = oauth.consumerSecret + '&' + oauth.tokenSecret;
+    unsigned char hmac[EVP_MAX_MD_SIZE];
+    unsigned int hmacLen;
+    HMAC(EVP_sha1(), key.data(), key.size(), (const unsigned char*)base.data(),
+         base.size(), hmac, &hmacLen);
+    char expected[64];
+    Base64encode(expected, (const char*)hmac, hmacLen);
+
+    EXPECT_EQ(expected, apib::oauth_generateHmac(base, oauth));
+    // Signing twice with the same signer must give the same result
+    OAuthSigner signer(oauth);
+    std::string sig;
+    signer.sign(base, &sig);
+    EXPECT_EQ(expected, sig);
+    signer.sign(base, &sig);
+    EXPECT_EQ(expected, sig);
+  }
+}
+
+// A signer caches each URL's base string, so make sure that switching
+// between URLs and bodies gives the same results as a new signer.
+TEST_F(OAuthTest, ReuseSigner) {
+  char fileName[] = "/tmp/oauth_test_urls.XXXXXX";
+  const int fd = mkstemp(fileName);
+  ASSERT_LE(0, fd);
+  const std::string urls =
+      "http://example.com/one\nhttp://example.com/two?a=%C3%A9&b=c\n";
+  ASSERT_EQ((ssize_t)urls.size(), write(fd, urls.data(), urls.size()));
+  close(fd);
+  ASSERT_TRUE(URLInfo::InitFile(fileName).ok());
+  unlink(fileName);
+  ASSERT_EQ(2, URLInfo::Count());
+  const URLInfo& u1 = *(URLInfo::Get(0));
+  const URLInfo& u2 = *(URLInfo::Get(1));
+
+  OAuthSigner signer(oauth);
+  std::string base;
+  for (int i = 0; i < 2; i++) {
+    signer.buildBaseString(u1, "GET", "", 1, "abc", &base);
+    EXPECT_EQ(
+        "GET&http%3A%2F%2Fexample.com%2Fone&oauth_consumer_key%3D9djdj82h48djs9"
+        "d2%26oauth_nonce%3Dabc%26oauth_signature_method%3DHMAC-SHA1%26oauth_t"
+        "imestamp%3D1%26oauth_token%3Dkkk9d7dh3k39sjv7",
+        base);
+    signer.buildBaseString(u2, "POST", "z=1", 2, "def", &base);
+    EXPECT_EQ(apib::oauth_buildBaseString(&randgen, u2, "POST", 2, "def", "z=1",
+                                          3, oauth),
+              base);
+    EXPECT_NE(std::string::npos, base.find("%26z%3D1"));
+    EXPECT_NE(std::string::npos, base.find("&a%3D%25C3%25A9%26b%3Dc%26"));
+    signer.buildBaseString(u2, "POST", "", 2, "def", &base);
+    EXPECT_EQ(std::string::npos, base.find("z%3D1"));
+  }
+}
+
 }  // namespace
@@ -14,21 +14,40 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <sstream>
+#include <string>
 
+#include "absl/strings/match.h"
 #include "apib/apib_iothread.h"
+#include "apib/apib_metrics.h"
 #include "apib/apib_reporting.h"
 #include "gtest/gtest.h"
 
 using apib::BenchmarkIntervalResults;
 using apib::BenchmarkResults;
+using apib::ClassifyError;
 using apib::IOThread;
+using apib::MergeResults;
+using apib::MetricsFile;
+using apib::MetricsPage;
 using apib::RecordConnectionOpen;
 using apib::RecordSocketError;
 using apib::RecordStart;
 using apib::RecordStop;
 using apib::ReportIntervalResults;
 using apib::ReportResults;
+using apib::RunInfo;
+using apib::SerializeResults;
+using apib::Status;
 using apib::ThreadList;
 
 namespace {
@@ -118,4 +137,197 @@ TEST_F(Reporting, ReportingInterval) {
   EXPECT_EQ(0, r.totalBytesReceived);
 }
 
+TEST_F(Reporting, ErrorTypes) {
+  EXPECT_EQ(apib::CONNECTION_REFUSED,
+            ClassifyError(Status(Status::SOCKET_ERROR, ECONNREFUSED)));
+  EXPECT_EQ(apib::CONNECTION_TIMEOUT,
+            ClassifyError(Status(Status::SOCKET_ERROR, ETIMEDOUT)));
+  EXPECT_EQ(apib::ADDRESS_UNAVAILABLE,
+            ClassifyError(Status(Status::SOCKET_ERROR, EADDRNOTAVAIL)));
+  EXPECT_EQ(apib::OTHER_ERROR,
+            ClassifyError(Status(Status::SOCKET_ERROR, EPIPE)));
+  EXPECT_EQ(apib::TLS_FAILURE, ClassifyError(Status(Status::TLS_ERROR)));
+  EXPECT_EQ(apib::PARSE_FAILURE, ClassifyError(Status(Status::PARSE_ERROR)));
+
+  RecordStart(true, threads);
+  RecordSocketError(apib::CONNECTION_REFUSED);
+  RecordSocketError(apib::CONNECTION_REFUSED);
+  RecordSocketError(apib::TLS_FAILURE);
+  RecordSocketError();
+  RecordStop(threads);
+
+  BenchmarkResults r = ReportResults();
+  EXPECT_EQ(4, r.socketErrors);
+  EXPECT_EQ(2, r.errorCounts[apib::CONNECTION_REFUSED]);
+  EXPECT_EQ(1, r.errorCounts[apib::TLS_FAILURE]);
+  EXPECT_EQ(1, r.errorCounts[apib::OTHER_ERROR]);
+  EXPECT_EQ(0, r.errorCounts[apib::ADDRESS_UNAVAILABLE]);
+}
+
+TEST_F(Reporting, MergeWorkers) {
+  threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
+  RecordStart(true, threads);
+  RecordConnectionOpen();
+  threads[0]->recordResult(200, 100000000);
+  threads[0]->recordResult(500, 120000000);
+  threads[0]->recordWrite(100);
+  threads[0]->recordRead(200);
+  RecordSocketError(apib::CONNECTION_REFUSED);
+  RecordStop(threads);
+  const std::string worker = SerializeResults();
+
+  // Merge two copies of the worker's results into an otherwise empty run,
+  // as the parent process does.
+  ThreadList noThreads;
+  RecordStart(true, noThreads);
+  RecordStop(noThreads);
+  ASSERT_TRUE(MergeResults(worker).ok());
+  ASSERT_TRUE(MergeResults(worker).ok());
+  EXPECT_FALSE(MergeResults(worker.substr(0, worker.size() - 1)).ok());
+
+  BenchmarkResults r = ReportResults();
+  EXPECT_EQ(4, r.completedRequests);
+  EXPECT_EQ(2, r.successfulRequests);
+  EXPECT_EQ(2, r.unsuccessfulRequests);
+  EXPECT_EQ(2, r.socketErrors);
+  EXPECT_EQ(2, r.errorCounts[apib::CONNECTION_REFUSED]);
+  EXPECT_EQ(2, r.connectionsOpened);
+  EXPECT_EQ(200, r.totalBytesSent);
+  EXPECT_EQ(400, r.totalBytesReceived);
+  EXPECT_EQ(100.0, r.latencies[0]);
+  EXPECT_EQ(120.0, r.latencies[100]);
+}
+
+TEST_F(Reporting, JsonResults) {
+  threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
+  RecordStart(true, threads);
+  RecordConnectionOpen();
+  threads[0]->recordResult(200, 1000000, 0);
+  threads[0]->recordResult(200, 3000000, 0);
+  threads[0]->recordResult(500, 5000000, 1);
+  RecordSocketError(apib::CONNECTION_REFUSED);
+  apib::RecordInterval(threads);
+  RecordStop(threads);
+
+  RunInfo info;
+  info.name = "test \"run\"";
+  info.url = "@urls.txt";
+  info.method = "GET";
+  info.threads = 1;
+  info.connections = 1;
+  std::ostringstream out;
+  apib::PrintJsonResults(out, info);
+  const std::string json = out.str();
+
+  EXPECT_TRUE(absl::StartsWith(json, "{\n"));
+  EXPECT_TRUE(absl::EndsWith(json, "}\n"));
+  EXPECT_TRUE(absl::StrContains(json, "\"name\": \"test \\\"run\\\"\""));
+  EXPECT_TRUE(absl::StrContains(json, "\"url\": \"@urls.txt\""));
+  EXPECT_TRUE(absl::StrContains(json, "\"completedRequests\": 3,"));
+  EXPECT_TRUE(absl::StrContains(json, "\"refused\": 1,"));
+  EXPECT_TRUE(absl::StrContains(json, "\"count\": 3,"));
+  EXPECT_TRUE(absl::StrContains(json, "\"intervals\": [\n"));
+  // One entry for each URL, in order
+  const size_t url0 = json.find("\"averageLatency\": 2,");
+  const size_t url1 = json.find("\"averageLatency\": 5,");
+  EXPECT_NE(std::string::npos, url0);
+  EXPECT_NE(std::string::npos, url1);
+  EXPECT_LT(url0, url1);
+}
+
+TEST_F(Reporting, MetricsFile) {
+  const char* tmpDir = getenv("TEST_TMPDIR");
+  const std::string path =
+      std::string(tmpDir == nullptr ? "/tmp" : tmpDir) + "/apib_metrics_test";
+  ASSERT_TRUE(apib::RecordMetricsFile(path).ok());
+
+  const int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  void* m = mmap(nullptr, sizeof(MetricsPage), PROT_READ, MAP_SHARED, fd, 0);
+  ASSERT_NE(MAP_FAILED, m);
+  close(fd);
+  const MetricsPage* page = static_cast<const MetricsPage*>(m);
+  MetricsPage copy;
+
+  ASSERT_TRUE(MetricsFile::read(page, &copy));
+  EXPECT_EQ(0, memcmp(apib::kMetricsMagic, copy.magic, 8));
+  EXPECT_EQ(apib::kMetricsVersion, copy.version);
+  EXPECT_EQ(sizeof(MetricsPage), copy.size);
+  EXPECT_EQ(getpid(), copy.pid);
+  EXPECT_EQ(apib::METRICS_STARTING, copy.state);
+
+  threads.push_back(std::unique_ptr<IOThread>(new IOThread()));
+  RecordStart(true, threads);
+  RecordConnectionOpen();
+  threads[0]->recordResult(200, 1000000);
+  threads[0]->recordResult(200, 2000000);
+  threads[0]->recordResult(500, 3000000);
+  RecordSocketError(apib::CONNECTION_REFUSED);
+  apib::PublishMetrics(threads, false);
+
+  ASSERT_TRUE(MetricsFile::read(page, &copy));
+  EXPECT_EQ(2U, copy.sequence);
+  EXPECT_EQ(apib::METRICS_RUNNING, copy.state);
+  EXPECT_EQ(2, copy.successfulRequests);
+  EXPECT_EQ(1, copy.unsuccessfulRequests);
+  EXPECT_EQ(1, copy.socketErrors);
+  EXPECT_EQ(1, copy.errorCounts[apib::CONNECTION_REFUSED]);
+  EXPECT_EQ(1, copy.connectionsOpened);
+  EXPECT_EQ(2, copy.intervalSuccesses);
+  EXPECT_EQ(1, copy.intervalFailures);
+  EXPECT_EQ(3, copy.latencyCount);
+  EXPECT_EQ(1000000, copy.latencyMin);
+  EXPECT_EQ(3000000, copy.latency[apib::kMetricsNumPercentiles - 1]);
+  EXPECT_EQ(1, copy.buckets[apib::Histogram::bucketFor(2000000)]);
+
+  // Nothing new in this interval
+  apib::PublishMetrics(threads, false);
+  ASSERT_TRUE(MetricsFile::read(page, &copy));
+  EXPECT_EQ(2, copy.successfulRequests);
+  EXPECT_EQ(0, copy.intervalSuccesses);
+  EXPECT_EQ(3, copy.latencyCount);
+
+  threads[0]->recordResult(200, 4000000);
+  RecordStop(threads);
+  apib::PublishFinalMetrics();
+  ASSERT_TRUE(MetricsFile::read(page, &copy));
+  EXPECT_EQ(apib::METRICS_DONE, copy.state);
+  EXPECT_EQ(3, copy.successfulRequests);
+  EXPECT_EQ(4, copy.latencyCount);
+
+  munmap(m, sizeof(MetricsPage));
+  unlink(path.c_str());
+}
+
+TEST(Backoff, Delays) {
+  IOThread t;
+  t.backoffMin = 100;
+  t.backoffMax = 1000;
+  for (int i = 0; i < 100; i++) {
+    const double first = t.backoffDelay(1);
+    EXPECT_LE(0.05, first);
+    EXPECT_GE(0.1, first);
+    const double third = t.backoffDelay(3);
+    EXPECT_LE(0.2, third);
+    EXPECT_GE(0.4, third);
+    const double capped = t.backoffDelay(20);
+    EXPECT_LE(0.5, capped);
+    EXPECT_GE(1.0, capped);
+  }
+}
+
+// Doubling a large delay must not wrap around
+TEST(Backoff, Large) {
+  IOThread t;
+  t.backoffMin = 1000;
+  t.backoffMax = 3000000000U;
+  for (int i = 1; i < 40; i++) {
+    const double d = t.backoffDelay(i);
+    EXPECT_LE(0.5, d);
+    EXPECT_GE(INT32_MAX / 1000.0, d);
+  }
+  t.backoffMin = 3000000000U;
+  EXPECT_LE(INT32_MAX / 2000.0, t.backoffDelay(1));
+}
+
 }  // namespace
\ No newline at end of file
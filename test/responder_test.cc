@@ -0,0 +1,135 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_responder.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "apib/apib_iothread.h"
+#include "apib/apib_reporting.h"
+#include "apib/apib_url.h"
+#include "gtest/gtest.h"
+
+using apib::BenchmarkResults;
+using apib::IOThread;
+using apib::Responder;
+using apib::URLInfo;
+
+namespace {
+
+static const char kResponse[] =
+    "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+
+static int connectTo(int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_LE(0, fd);
+  EXPECT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                       sizeof(addr)));
+  return fd;
+}
+
+static void writeString(int fd, const std::string& s) {
+  ASSERT_EQ((ssize_t)s.size(), write(fd, s.data(), s.size()));
+}
+
+// Read exactly "len" bytes
+static std::string readString(int fd, size_t len) {
+  std::string s;
+  char buf[1024];
+  while (s.size() < len) {
+    const ssize_t rc = read(fd, buf, std::min(sizeof(buf), len - s.size()));
+    if (rc <= 0) {
+      break;
+    }
+    s.append(buf, rc);
+  }
+  return s;
+}
+
+TEST(Responder, Pipelined) {
+  Responder r;
+  ASSERT_TRUE(r.start(2).ok());
+  ASSERT_LT(0, r.port());
+
+  const int fd = connectTo(r.port());
+  // Two requests in one write, and a third split in the middle of the
+  // blank line
+  writeString(fd,
+              "GET / HTTP/1.1\r\nHost: x\r\n\r\n"
+              "GET / HTTP/1.1\r\nHost: x\r\n\r\n"
+              "GET / HTTP/1.1\r\nHost: x\r\n\r");
+  const std::string one(kResponse);
+  EXPECT_EQ(one + one, readString(fd, one.size() * 2));
+  writeString(fd, "\n");
+  EXPECT_EQ(one, readString(fd, one.size()));
+
+  // Closing the connection must not disturb the others
+  close(fd);
+  const int fd2 = connectTo(r.port());
+  writeString(fd2, "GET / HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(one, readString(fd2, one.size()));
+  close(fd2);
+  r.stop();
+}
+
+TEST(Responder, Benchmark) {
+  Responder r;
+  ASSERT_TRUE(r.start(1).ok());
+  apib::RecordInit("", "");
+  ASSERT_TRUE(
+      URLInfo::InitOne(absl::StrCat("http://127.0.0.1:", r.port(), "/")).ok());
+
+  apib::ThreadList threads;
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 2;
+  t->httpVerb = "GET";
+  t->Start();
+
+  // Measure CPU while the thread runs, the way the "apib" command does
+  apib::RecordStart(true, threads);
+  sleep(1);
+  apib::RecordStop(threads);
+  t->Stop();
+
+  const BenchmarkResults results = apib::ReportResults();
+  EXPECT_LT(0, results.successfulRequests);
+  EXPECT_EQ(0, results.unsuccessfulRequests);
+  EXPECT_EQ(0, results.socketErrors);
+#ifdef __linux__
+  EXPECT_LT(0.0, results.threadCpuTime);
+  EXPECT_LT(0.0, results.maxThreadBusy);
+  EXPECT_GE(1.5, results.maxThreadBusy);
+#endif
+
+  URLInfo::Reset();
+  apib::EndReporting();
+}
+
+}  // namespace
@@ -0,0 +1,341 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_signer.h"
+
+#include <openssl/bn.h>
+#include <openssl/ecdsa.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <unistd.h>
+
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "apib/apib_json.h"
+#include "apib/apib_url.h"
+#include "gtest/gtest.h"
+#include "third_party/base64/base64.h"
+
+using apib::HmacKey;
+using apib::JsonValue;
+using apib::RandomGenerator;
+using apib::RequestSigner;
+using apib::Status;
+using apib::URLInfo;
+
+namespace {
+
+// 2015-08-30T12:36:00Z, from the AWS Signature Version 4 test suite
+static const int64_t kAwsTestTime = 1440938160;
+
+class SignerTest : public ::testing::Test {
+ public:
+  ~SignerTest() { URLInfo::Reset(); }
+
+  std::string sign(RequestSigner* s, const std::string& method,
+                   const std::string& body, int64_t now) {
+    std::string headers;
+    s->sign(&rand, *(URLInfo::GetNext(&rand)), method, body, now, &headers);
+    return headers;
+  }
+
+  RandomGenerator rand;
+};
+
+static std::string hmacSha256Base64(const std::string& key,
+                                    const std::string& data) {
+  unsigned char mac[EVP_MAX_MD_SIZE];
+  unsigned int macLen;
+  HMAC(EVP_sha256(), key.data(), key.size(),
+       (const unsigned char*)data.data(), data.size(), mac, &macLen);
+  char encoded[128];
+  Base64encode(encoded, (const char*)mac, macLen);
+  return encoded;
+}
+
+static std::string base64UrlDecode(absl::string_view s) {
+  std::string b64(s);
+  for (auto it = b64.begin(); it != b64.end(); it++) {
+    if (*it == '-') {
+      *it = '+';
+    } else if (*it == '_') {
+      *it = '/';
+    }
+  }
+  while ((b64.size() % 4) != 0) {
+    b64.push_back('=');
+  }
+  std::vector<char> buf(Base64decode_len(b64.c_str()));
+  const int len = Base64decode(buf.data(), b64.c_str());
+  return std::string(buf.data(), len);
+}
+
+static std::string writeKey(EVP_PKEY* key) {
+  char fileName[] = "/tmp/signer_test_key.XXXXXX";
+  const int fd = mkstemp(fileName);
+  EXPECT_LE(0, fd);
+  FILE* f = fdopen(fd, "w");
+  EXPECT_EQ(1, PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr,
+                                    nullptr));
+  fclose(f);
+  return fileName;
+}
+
+static EVP_PKEY* makeKey(bool ecdsa) {
+  EVP_PKEY_CTX* ctx =
+      EVP_PKEY_CTX_new_id(ecdsa ? EVP_PKEY_EC : EVP_PKEY_RSA, nullptr);
+  EXPECT_EQ(1, EVP_PKEY_keygen_init(ctx));
+  if (ecdsa) {
+    EXPECT_EQ(1, EVP_PKEY_CTX_set_ec_paramgen_curve_nid(
+                     ctx, NID_X9_62_prime256v1));
+  } else {
+    EXPECT_EQ(1, EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048));
+  }
+  EVP_PKEY* key = nullptr;
+  EXPECT_EQ(1, EVP_PKEY_keygen(ctx, &key));
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+// Check the signature on a JWT and return its claims
+static JsonValue verifyJwt(const std::string& header, EVP_PKEY* key,
+                           bool ecdsa) {
+  const std::string prefix = "Authorization: Bearer ";
+  EXPECT_EQ(0, header.find(prefix));
+  EXPECT_EQ("\r\n", header.substr(header.size() - 2));
+  const std::string token =
+      header.substr(prefix.size(), header.size() - prefix.size() - 2);
+  const std::vector<absl::string_view> parts = absl::StrSplit(token, '.');
+  EXPECT_EQ(3, parts.size());
+
+  const auto jose = JsonValue::Parse(base64UrlDecode(parts[0]));
+  EXPECT_TRUE(jose.ok());
+  EXPECT_EQ(ecdsa ? "ES256" : "RS256", jose.valueref().getString("alg", ""));
+  EXPECT_EQ("JWT", jose.valueref().getString("typ", ""));
+
+  std::string sig = base64UrlDecode(parts[2]);
+  if (ecdsa) {
+    // Back to DER from the JWS form
+    EXPECT_EQ(64, sig.size());
+    ECDSA_SIG* es = ECDSA_SIG_new();
+    ECDSA_SIG_set0(es, BN_bin2bn((const unsigned char*)sig.data(), 32, nullptr),
+                   BN_bin2bn((const unsigned char*)sig.data() + 32, 32,
+                             nullptr));
+    unsigned char* der = nullptr;
+    const int derLen = i2d_ECDSA_SIG(es, &der);
+    sig.assign((const char*)der, derLen);
+    OPENSSL_free(der);
+    ECDSA_SIG_free(es);
+  }
+
+  const size_t signedLen = parts[0].size() + 1 + parts[1].size();
+  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+  EXPECT_EQ(1, EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, key));
+  EXPECT_EQ(1, EVP_DigestVerifyUpdate(ctx, token.data(), signedLen));
+  EXPECT_EQ(1, EVP_DigestVerifyFinal(ctx, (const unsigned char*)sig.data(),
+                                     sig.size()));
+  EVP_MD_CTX_free(ctx);
+
+  const auto claims = JsonValue::Parse(base64UrlDecode(parts[1]));
+  EXPECT_TRUE(claims.ok());
+  return claims.valueref();
+}
+
+TEST(HmacKey, MatchesHmac) {
+  const std::string data = "The quick brown fox jumps over the lazy dog";
+  const std::string keys[] = {"key", std::string(100, 'k')};
+  for (const auto& key : keys) {
+    unsigned char expected[EVP_MAX_MD_SIZE];
+    unsigned int expectedLen;
+    HMAC(EVP_sha256(), key.data(), key.size(),
+         (const unsigned char*)data.data(), data.size(), expected,
+         &expectedLen);
+
+    HmacKey k(EVP_sha256(), key);
+    for (int i = 0; i < 2; i++) {
+      unsigned char mac[EVP_MAX_MD_SIZE];
+      ASSERT_EQ(expectedLen, k.sign(data, mac));
+      EXPECT_EQ(0, memcmp(expected, mac, expectedLen));
+    }
+  }
+}
+
+TEST_F(SignerTest, ParseErrors) {
+  std::unique_ptr<RequestSigner> s;
+  EXPECT_FALSE(RequestSigner::Parse("", &s).ok());
+  EXPECT_FALSE(RequestSigner::Parse("foo", &s).ok());
+  EXPECT_FALSE(RequestSigner::Parse("hmac-sha256,key=foo", &s).ok());
+  EXPECT_FALSE(
+      RequestSigner::Parse("hmac-sha256,key=foo,secret=bar,baz=1", &s).ok());
+  EXPECT_FALSE(RequestSigner::Parse("hmac-sha256,key", &s).ok());
+  EXPECT_FALSE(RequestSigner::Parse("jwt,alg=HS256,key=x", &s).ok());
+  EXPECT_FALSE(
+      RequestSigner::Parse("jwt,alg=RS256,key=/no/such/file", &s).ok());
+  EXPECT_FALSE(RequestSigner::Parse("sigv4,access=a,secret=b,region=c", &s)
+                   .ok());
+  EXPECT_FALSE(s);
+}
+
+TEST_F(SignerTest, HmacSha256) {
+  ASSERT_TRUE(URLInfo::InitOne("http://localhost:8080/foo?bar=baz").ok());
+  std::unique_ptr<RequestSigner> s;
+  ASSERT_TRUE(
+      RequestSigner::Parse("hmac-sha256,key=client1,secret=sekrit", &s).ok());
+
+  // A new nonce on every request, even for the same body and time
+  std::string lastNonce;
+  for (int i = 0; i < 3; i++) {
+    const std::string body = (i == 2 ? "Something else" : "Hello!");
+    const std::string hdr = sign(s.get(), "POST", body, 1000 + i);
+
+    const std::regex re(
+        "Authorization: HMAC-SHA256 keyId=\"client1\", timestamp=\"(\\d+)\", "
+        "nonce=\"([0-9A-F]+)\", signature=\"([^\"]+)\"\r\n");
+    std::smatch m;
+    ASSERT_TRUE(std::regex_match(hdr, m, re)) << hdr;
+    EXPECT_EQ(std::to_string(1000 + i), m[1].str());
+    EXPECT_NE(lastNonce, m[2].str());
+    lastNonce = m[2].str();
+
+    unsigned char bodyHash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen;
+    EVP_Digest(body.data(), body.size(), bodyHash, &hashLen, EVP_sha256(),
+               nullptr);
+    std::string hexHash;
+    for (unsigned int j = 0; j < hashLen; j++) {
+      absl::StrAppend(&hexHash, absl::Hex(bodyHash[j], absl::kZeroPad2));
+    }
+    const std::string toSign =
+        absl::StrCat("POST\n/foo?bar=baz\nlocalhost:8080\n", m[1].str(), "\n",
+                     m[2].str(), "\n", hexHash);
+    EXPECT_EQ(hmacSha256Base64("sekrit", toSign), m[3].str());
+  }
+}
+
+TEST_F(SignerTest, SigV4GetVanilla) {
+  ASSERT_TRUE(URLInfo::InitOne("http://example.amazonaws.com/").ok());
+  std::unique_ptr<RequestSigner> s;
+  ASSERT_TRUE(RequestSigner::Parse(
+                  "sigv4,access=AKIDEXAMPLE,secret=wJalrXUtnFEMI/K7MDENG+"
+                  "bPxRfiCYEXAMPLEKEY,region=us-east-1,service=service",
+                  &s)
+                  .ok());
+  const std::string expected =
+      "X-Amz-Date: 20150830T123600Z\r\n"
+      "Authorization: AWS4-HMAC-SHA256 "
+      "Credential=AKIDEXAMPLE/20150830/us-east-1/service/aws4_request, "
+      "SignedHeaders=host;x-amz-date, "
+      "Signature="
+      "5fa00fa31553b73ebf1942676e86291e8372ff2a2260956d9b8aae1d763fbf31\r\n";
+  EXPECT_EQ(expected, sign(s.get(), "GET", "", kAwsTestTime));
+
+  // The cached parts must not leak from one second, or one day, to the next
+  const std::string later = sign(s.get(), "GET", "", kAwsTestTime + 86401);
+  EXPECT_NE(std::string::npos, later.find("X-Amz-Date: 20150831T123601Z"));
+  EXPECT_NE(std::string::npos, later.find("AKIDEXAMPLE/20150831/"));
+  EXPECT_EQ(expected, sign(s.get(), "GET", "", kAwsTestTime));
+
+  // A copy for another thread signs the same way
+  auto copy = s->clone();
+  EXPECT_EQ(expected, sign(copy.get(), "GET", "", kAwsTestTime));
+}
+
+TEST_F(SignerTest, SigV4Headers) {
+  ASSERT_TRUE(
+      URLInfo::InitOne("https://bucket.s3.amazonaws.com/a%20b/c?z=1&a=x%2Fy")
+          .ok());
+  std::unique_ptr<RequestSigner> s;
+  ASSERT_TRUE(RequestSigner::Parse(
+                  "sigv4,access=AK,secret=SK,region=us-west-2,service=s3,"
+                  "token=TOKEN",
+                  &s)
+                  .ok());
+  const std::string hdr = sign(s.get(), "PUT", "", kAwsTestTime);
+  EXPECT_NE(std::string::npos,
+            hdr.find("X-Amz-Content-Sha256: "
+                     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b"
+                     "7852b855\r\n"));
+  EXPECT_NE(std::string::npos, hdr.find("X-Amz-Security-Token: TOKEN\r\n"));
+  EXPECT_NE(std::string::npos,
+            hdr.find("SignedHeaders=host;x-amz-content-sha256;x-amz-date;"
+                     "x-amz-security-token, "));
+}
+
+static void testJwt(SignerTest* t, bool ecdsa) {
+  ASSERT_TRUE(URLInfo::InitOne("http://localhost:8080/").ok());
+  EVP_PKEY* key = makeKey(ecdsa);
+  const std::string keyFile = writeKey(key);
+  std::unique_ptr<RequestSigner> s;
+  const Status st = RequestSigner::Parse(
+      absl::StrCat("jwt,alg=", ecdsa ? "ES256" : "RS256", ",key=", keyFile,
+                   ",iss=apib,aud=test,ttl=60,reuse=30"),
+      &s);
+  // The other algorithm must not accept this key
+  std::unique_ptr<RequestSigner> wrong;
+  EXPECT_FALSE(RequestSigner::Parse(
+                   absl::StrCat("jwt,alg=", ecdsa ? "RS256" : "ES256",
+                                ",key=", keyFile),
+                   &wrong)
+                   .ok());
+  unlink(keyFile.c_str());
+  ASSERT_TRUE(st.ok()) << st;
+
+  const std::string first = t->sign(s.get(), "GET", "", 1000);
+  const JsonValue claims = verifyJwt(first, key, ecdsa);
+  EXPECT_EQ("apib", claims.getString("iss", ""));
+  EXPECT_EQ("test", claims.getString("aud", ""));
+  EXPECT_EQ(1000, claims.getNumber("iat", 0));
+  EXPECT_EQ(1060, claims.getNumber("exp", 0));
+  EXPECT_NE("", claims.getString("jti", ""));
+
+  // Reused within the window, and replaced after it
+  EXPECT_EQ(first, t->sign(s.get(), "GET", "", 1029));
+  const std::string second = t->sign(s.get(), "GET", "", 1030);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(1030, verifyJwt(second, key, ecdsa).getNumber("iat", 0));
+  EVP_PKEY_free(key);
+}
+
+TEST_F(SignerTest, JwtRS256) { testJwt(this, false); }
+
+TEST_F(SignerTest, JwtES256) { testJwt(this, true); }
+
+TEST_F(SignerTest, JwtNoReuse) {
+  ASSERT_TRUE(URLInfo::InitOne("http://localhost:8080/").ok());
+  EVP_PKEY* key = makeKey(true);
+  const std::string keyFile = writeKey(key);
+  std::unique_ptr<RequestSigner> s;
+  const Status st = RequestSigner::Parse(
+      absl::StrCat("jwt,alg=ES256,key=", keyFile, ",reuse=0"), &s);
+  unlink(keyFile.c_str());
+  ASSERT_TRUE(st.ok()) << st;
+  EXPECT_NE(sign(s.get(), "GET", "", 1000), sign(s.get(), "GET", "", 1000));
+  EVP_PKEY_free(key);
+
+  std::unique_ptr<RequestSigner> bad;
+  EXPECT_FALSE(RequestSigner::Parse(
+                   absl::StrCat("jwt,alg=ES256,key=", keyFile,
+                                ",ttl=10,reuse=20"),
+                   &bad)
+                   .ok());
+}
+
+}  // namespace
@@ -0,0 +1,132 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "apib/socket.h"
+#include "gtest/gtest.h"
+
+using apib::Address;
+using apib::Socket;
+using apib::SocketOptions;
+
+namespace {
+
+TEST(SocketOptions, Parse) {
+  SocketOptions o;
+  EXPECT_TRUE(o.empty());
+  EXPECT_TRUE(o.add("sndbuf=65536").ok());
+  EXPECT_TRUE(o.add("tos=0x10").ok());
+  EXPECT_FALSE(o.empty());
+  EXPECT_FALSE(o.quickAck());
+  EXPECT_EQ("sndbuf=65536,tos=16", o.str());
+}
+
+TEST(SocketOptions, Invalid) {
+  SocketOptions o;
+  EXPECT_FALSE(o.add("").ok());
+  EXPECT_FALSE(o.add("sndbuf").ok());
+  EXPECT_FALSE(o.add("sndbuf=").ok());
+  EXPECT_FALSE(o.add("=123").ok());
+  EXPECT_FALSE(o.add("sndbuf=lots").ok());
+  EXPECT_FALSE(o.add("sndbuf=-1").ok());
+  EXPECT_FALSE(o.add("nosuchoption=1").ok());
+  EXPECT_TRUE(o.empty());
+}
+
+#ifdef __linux__
+TEST(SocketOptions, Linux) {
+  SocketOptions o;
+  EXPECT_TRUE(o.add("quickack=1").ok());
+  EXPECT_TRUE(o.add("congestion=cubic").ok());
+  EXPECT_TRUE(o.quickAck());
+  EXPECT_EQ("quickack=1,congestion=cubic", o.str());
+}
+#endif
+
+TEST(SocketOptions, Apply) {
+  SocketOptions o;
+  ASSERT_TRUE(o.add("rcvbuf=32768").ok());
+  ASSERT_TRUE(o.add("tos=0x10").ok());
+
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GT(fd, 0);
+  ASSERT_TRUE(o.apply(fd, AF_INET).ok());
+
+  int val = 0;
+  socklen_t len = sizeof(int);
+  ASSERT_EQ(0, getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, &len));
+  // Linux doubles the value
+  EXPECT_GE(val, 32768);
+  len = sizeof(int);
+  ASSERT_EQ(0, getsockopt(fd, IPPROTO_IP, IP_TOS, &val, &len));
+  EXPECT_EQ(0x10, val);
+  close(fd);
+}
+
+// Wait until there is something to read on "fd"
+static void waitReadable(int fd) {
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  ASSERT_EQ(1, poll(&p, 1, 5000));
+}
+
+TEST(Socket, StillOpen) {
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GT(listener, 0);
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sa);
+  ASSERT_EQ(0, bind(listener, (struct sockaddr*)&sa, len));
+  ASSERT_EQ(0, listen(listener, 2));
+  ASSERT_EQ(0, getsockname(listener, (struct sockaddr*)&sa, &len));
+  const Address addr((struct sockaddr*)&sa, len);
+
+  // Idle, then with unexpected data from the server
+  Socket s1;
+  ASSERT_TRUE(s1.connect(addr).ok());
+  const int a1 = accept(listener, nullptr, nullptr);
+  ASSERT_GT(a1, 0);
+  EXPECT_TRUE(s1.stillOpen());
+  ASSERT_EQ(1, write(a1, "x", 1));
+  waitReadable(s1.fd());
+  EXPECT_FALSE(s1.stillOpen());
+
+  // Closed by the server
+  Socket s2;
+  ASSERT_TRUE(s2.connect(addr).ok());
+  const int a2 = accept(listener, nullptr, nullptr);
+  ASSERT_GT(a2, 0);
+  EXPECT_TRUE(s2.stillOpen());
+  close(a2);
+  waitReadable(s2.fd());
+  EXPECT_FALSE(s2.stillOpen());
+
+  close(a1);
+  close(listener);
+}
+
+}  // namespace
@@ -0,0 +1,180 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_template.h"
+
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "apib/apib_rand.h"
+#include "apib/apib_url.h"
+#include "gtest/gtest.h"
+
+using apib::CsvData;
+using apib::RandomGenerator;
+using apib::RequestTemplate;
+using apib::RequestTemplates;
+using apib::TemplateContext;
+using apib::URLInfo;
+
+namespace {
+
+class TemplateTest : public ::testing::Test {
+ protected:
+  TemplateTest() {
+    ctx.rand = &rand;
+    ctx.counter = 123;
+    ctx.thread = 4;
+    ctx.connection = 5;
+  }
+
+  std::string fill(const std::string& text) {
+    const auto t = RequestTemplate::Compile(text);
+    EXPECT_TRUE(t.ok()) << t.status();
+    std::string out;
+    t.valueref().fill(ctx, &out);
+    return out;
+  }
+
+  RandomGenerator rand;
+  TemplateContext ctx;
+};
+
+TEST_F(TemplateTest, Literal) {
+  const auto t = RequestTemplate::Compile("/foo/bar?baz=1");
+  ASSERT_TRUE(t.ok());
+  EXPECT_TRUE(t.valueref().isLiteral());
+  EXPECT_FALSE(t.valueref().usesCsv());
+  EXPECT_EQ("/foo/bar?baz=1", fill("/foo/bar?baz=1"));
+  EXPECT_EQ("", fill(""));
+  EXPECT_EQ("$5 ${counter} $}", fill("$5 $${counter} $}"));
+}
+
+TEST_F(TemplateTest, Simple) {
+  const auto t = RequestTemplate::Compile("/${counter}");
+  ASSERT_TRUE(t.ok());
+  EXPECT_FALSE(t.valueref().isLiteral());
+  EXPECT_EQ("/123/4/5", fill("/${counter}/${thread}/${conn}"));
+  EXPECT_EQ("1235", fill("${counter}${conn}"));
+}
+
+TEST_F(TemplateTest, Appends) {
+  const auto t = RequestTemplate::Compile("b${counter}");
+  ASSERT_TRUE(t.ok());
+  std::string out = "a";
+  t.valueref().fill(ctx, &out);
+  EXPECT_EQ("ab123", out);
+}
+
+TEST_F(TemplateTest, Random) {
+  std::set<std::string> seen;
+  for (int i = 0; i < 100; i++) {
+    const int r = std::stoi(fill("${rand:-5:5}"));
+    EXPECT_LE(-5, r);
+    EXPECT_GE(5, r);
+    EXPECT_EQ("7", fill("${rand:7:7}"));
+
+    const std::string s = fill("${randstr:13}");
+    EXPECT_TRUE(std::regex_match(s, std::regex("[A-Za-z0-9_-]{13}"))) << s;
+    seen.insert(s);
+  }
+  // Not the same every time
+  EXPECT_LT(90, seen.size());
+}
+
+TEST_F(TemplateTest, Uuid) {
+  const std::regex re(
+      "[0-9a-f]{8}-[0-9a-f]{4}-4[0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}");
+  const std::string u1 = fill("${uuid}");
+  EXPECT_TRUE(std::regex_match(u1, re)) << u1;
+  EXPECT_NE(u1, fill("${uuid}"));
+}
+
+TEST_F(TemplateTest, Csv) {
+  CsvData csv;
+  csv.parse(
+      "one,two,three\n"
+      "\"quoted, comma\",\"a \"\"quote\"\"\",\n"
+      "\r\n"
+      "last");
+  ASSERT_EQ(3, csv.size());
+  EXPECT_EQ(3, csv.row(0).size());
+  EXPECT_EQ("quoted, comma", csv.row(1)[0]);
+  EXPECT_EQ("a \"quote\"", csv.row(1)[1]);
+  EXPECT_EQ("", csv.row(1)[2]);
+  EXPECT_EQ(1, csv.row(2).size());
+
+  const auto t = RequestTemplate::Compile("${csv:1}");
+  ASSERT_TRUE(t.ok());
+  EXPECT_TRUE(t.valueref().usesCsv());
+
+  ctx.row = &(csv.row(0));
+  EXPECT_EQ("three-one", fill("${csv:3}-${csv:1}"));
+  ctx.row = &(csv.row(2));
+  // Columns past the end of the row are empty
+  EXPECT_EQ("last-", fill("${csv:1}-${csv:2}"));
+  ctx.row = nullptr;
+  EXPECT_EQ("", fill("${csv:1}"));
+}
+
+TEST_F(TemplateTest, Errors) {
+  EXPECT_FALSE(RequestTemplate::Compile("${").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("/${counter").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${foo}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${counter:1}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${rand:1}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${rand:5:1}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${rand:a:b}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${randstr:0}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${csv:0}").ok());
+  EXPECT_FALSE(RequestTemplate::Compile("${csv}").ok());
+}
+
+TEST_F(TemplateTest, Request) {
+  ASSERT_TRUE(URLInfo::InitOne("http://localhost:8080/item/${counter}").ok());
+  RequestTemplates t;
+  ASSERT_TRUE(t.compile({"X-Id: ${uuid}", "X-Thread: ${thread}"},
+                        "{\"c\": ${conn}}")
+                  .ok());
+  EXPECT_FALSE(t.isLiteral());
+  EXPECT_FALSE(t.pathsAreLiteral());
+  EXPECT_FALSE(t.usesCsv());
+  ASSERT_EQ(1, t.paths.size());
+
+  std::string out;
+  t.paths[0].fill(ctx, &out);
+  EXPECT_EQ("/item/123", out);
+  out.clear();
+  t.headers.fill(ctx, &out);
+  EXPECT_TRUE(std::regex_match(
+      out, std::regex("X-Id: [0-9a-f-]{36}\r\nX-Thread: 4\r\n")))
+      << out;
+  out.clear();
+  t.body.fill(ctx, &out);
+  EXPECT_EQ("{\"c\": 5}", out);
+  URLInfo::Reset();
+
+  ASSERT_TRUE(URLInfo::InitOne("http://localhost:8080/item").ok());
+  ASSERT_TRUE(t.compile({}, "").ok());
+  EXPECT_TRUE(t.isLiteral());
+  EXPECT_FALSE(t.compile({"X-Bad: ${bad}"}, "").ok());
+  URLInfo::Reset();
+}
+
+}  // namespace
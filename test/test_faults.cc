@@ -0,0 +1,185 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "test/test_faults.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+
+namespace apib {
+
+static bool parseProbability(absl::string_view s, double* p) {
+  return absl::SimpleAtod(s, p) && (*p >= 0.0) && (*p <= 1.0);
+}
+
+static bool parseMicros(absl::string_view s, double* us) {
+  return absl::SimpleAtod(s, us) && (*us >= 0.0);
+}
+
+StatusOr<LatencyDistribution> LatencyDistribution::Parse(absl::string_view s) {
+  const Status invalid(Status::INVALID_ARGUMENT,
+                       absl::StrFormat("Invalid latency \"%s\"", s));
+  const std::vector<absl::string_view> parts = absl::StrSplit(s, ':');
+  LatencyDistribution d;
+
+  if ((parts[0] == "fixed") && (parts.size() == 2)) {
+    d.type_ = FIXED;
+    if (!parseMicros(parts[1], &d.a_)) {
+      return invalid;
+    }
+  } else if ((parts[0] == "uniform") && (parts.size() == 3)) {
+    d.type_ = UNIFORM;
+    if (!parseMicros(parts[1], &d.a_) || !parseMicros(parts[2], &d.b_) ||
+        (d.b_ < d.a_)) {
+      return invalid;
+    }
+  } else if ((parts[0] == "lognormal") && (parts.size() == 3)) {
+    d.type_ = LOGNORMAL;
+    // Stored as the parameters of the underlying normal distribution
+    double median;
+    if (!parseMicros(parts[1], &median) || (median <= 0.0) ||
+        !absl::SimpleAtod(parts[2], &d.b_) || (d.b_ < 0.0)) {
+      return invalid;
+    }
+    d.a_ = log(median);
+  } else if ((parts[0] == "bimodal") && (parts.size() == 4)) {
+    d.type_ = BIMODAL;
+    if (!parseMicros(parts[1], &d.a_) || !parseMicros(parts[2], &d.b_) ||
+        !parseProbability(parts[3], &d.p_)) {
+      return invalid;
+    }
+  } else {
+    return invalid;
+  }
+  return d;
+}
+
+int64_t LatencyDistribution::sample(std::mt19937_64* rand) const {
+  switch (type_) {
+    case FIXED:
+      return (int64_t)a_;
+    case UNIFORM:
+      return (int64_t)std::uniform_real_distribution<double>(a_, b_)(*rand);
+    case LOGNORMAL:
+      return (int64_t)std::lognormal_distribution<double>(a_, b_)(*rand);
+    case BIMODAL:
+      return (int64_t)(std::bernoulli_distribution(p_)(*rand) ? b_ : a_);
+    default:
+      return 0;
+  }
+}
+
+static bool parseTrickle(absl::string_view s, Trickle* t) {
+  const std::vector<absl::string_view> parts = absl::StrSplit(s, ':');
+  double interval;
+  if ((parts.size() != 3) || !parseProbability(parts[0], &t->probability) ||
+      !absl::SimpleAtoi(parts[1], &t->bytes) || (t->bytes == 0) ||
+      !parseMicros(parts[2], &interval)) {
+    return false;
+  }
+  t->intervalMicros = (int64_t)interval;
+  return true;
+}
+
+StatusOr<FaultOptions> FaultOptions::Parse(absl::string_view spec) {
+  FaultOptions f;
+  const std::vector<absl::string_view> opts =
+      absl::StrSplit(spec, ',', absl::SkipWhitespace());
+  for (auto it = opts.cbegin(); it != opts.cend(); it++) {
+    const std::pair<absl::string_view, absl::string_view> nv =
+        absl::StrSplit(absl::StripAsciiWhitespace(*it), absl::MaxSplits('=', 1));
+    const Status invalid(Status::INVALID_ARGUMENT,
+                         absl::StrFormat("Invalid fault \"%s\"", *it));
+    bool ok;
+    if (nv.first == "latency") {
+      const auto l = LatencyDistribution::Parse(nv.second);
+      if (!l.ok()) {
+        return l.status();
+      }
+      f.latency = l.value();
+      ok = true;
+    } else if (nv.first == "errors") {
+      ok = parseProbability(nv.second, &f.errorRate);
+    } else if (nv.first == "reset") {
+      ok = parseProbability(nv.second, &f.resetRate);
+    } else if (nv.first == "slow") {
+      ok = parseTrickle(nv.second, &f.slow);
+    } else if (nv.first == "trickle") {
+      ok = parseTrickle(nv.second, &f.chunked);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      return invalid;
+    }
+  }
+  return f;
+}
+
+bool FaultOptions::empty() const {
+  return (latency.type() == LatencyDistribution::NONE) &&
+         (errorRate == 0.0) && (resetRate == 0.0) &&
+         (slow.probability == 0.0) && (chunked.probability == 0.0);
+}
+
+std::vector<std::string> SplitResponse(const std::string& response,
+                                       size_t bytes, bool chunked) {
+  std::vector<std::string> pieces;
+  if (!chunked) {
+    for (size_t pos = 0; pos < response.size(); pos += bytes) {
+      pieces.push_back(response.substr(pos, bytes));
+    }
+    return pieces;
+  }
+
+  size_t bodyStart = response.find("\r\n\r\n");
+  if (bodyStart == std::string::npos) {
+    pieces.push_back(response);
+    return pieces;
+  }
+  bodyStart += 4;
+
+  // Replace the Content-Length with chunked encoding
+  std::string headers;
+  const std::vector<absl::string_view> lines = absl::StrSplit(
+      absl::string_view(response.data(), bodyStart - 4), "\r\n");
+  for (auto it = lines.cbegin(); it != lines.cend(); it++) {
+    if (!absl::StartsWithIgnoreCase(*it, "Content-Length:")) {
+      headers.append(it->data(), it->size());
+      headers += "\r\n";
+    }
+  }
+  headers += "Transfer-Encoding: chunked\r\n\r\n";
+  pieces.push_back(headers);
+
+  for (size_t pos = bodyStart; pos < response.size(); pos += bytes) {
+    const size_t len = std::min(bytes, response.size() - pos);
+    pieces.push_back(absl::StrFormat("%x\r\n", len) +
+                     response.substr(pos, len) + "\r\n");
+  }
+  // The last chunk carries the terminator, so that it doesn't cost
+  // another interval
+  pieces.back() += "0\r\n\r\n";
+  return pieces;
+}
+
+}  // namespace apib
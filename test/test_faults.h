@@ -0,0 +1,94 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APIB_TEST_FAULTS_H
+#define APIB_TEST_FAULTS_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "apib/status.h"
+
+namespace apib {
+
+// A distribution of latency to add to responses, in microseconds
+class LatencyDistribution {
+ public:
+  enum Type { NONE, FIXED, UNIFORM, LOGNORMAL, BIMODAL };
+
+  // Parse one of:
+  //   fixed:US
+  //   uniform:MIN:MAX
+  //   lognormal:MEDIAN:SIGMA
+  //   bimodal:FAST:SLOW:P, which is SLOW with probability P, or else FAST
+  static StatusOr<LatencyDistribution> Parse(absl::string_view s);
+
+  Type type() const { return type_; }
+  int64_t sample(std::mt19937_64* rand) const;
+
+ private:
+  Type type_ = NONE;
+  double a_ = 0.0;
+  double b_ = 0.0;
+  double p_ = 0.0;
+};
+
+// Send a response "bytes" at a time, waiting "intervalMicros" in between,
+// for the given fraction of requests
+class Trickle {
+ public:
+  double probability = 0.0;
+  size_t bytes = 0;
+  int64_t intervalMicros = 0;
+};
+
+// Ways for the test server to misbehave, so that the client can be tested
+// against a known distribution of latency and failures. The command line
+// and the "X-Fault" request header use the same comma-separated syntax:
+//
+//   latency=DIST     Wait before responding, as in LatencyDistribution
+//   errors=P         Respond with a 500 error
+//   reset=P          Reset the connection instead of responding
+//   slow=P:BYTES:US  Write the response BYTES at a time, US apart
+//   trickle=P:BYTES:US
+//                    Send the body with chunked encoding, one chunk
+//                    of BYTES every US
+//
+// where each P is a probability from 0 to 1.
+class FaultOptions {
+ public:
+  static StatusOr<FaultOptions> Parse(absl::string_view spec);
+  bool empty() const;
+
+  LatencyDistribution latency;
+  double errorRate = 0.0;
+  double resetRate = 0.0;
+  Trickle slow;
+  Trickle chunked;
+};
+
+// Split a complete response with a Content-Length into the pieces that a
+// Trickle sends. If "chunked," then change it to chunked encoding with
+// one chunk of the body per piece.
+extern std::vector<std::string> SplitResponse(const std::string& response,
+                                              size_t bytes, bool chunked);
+
+}  // namespace apib
+
+#endif  // APIB_TEST_FAULTS_H
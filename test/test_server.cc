@@ -19,24 +19,43 @@ limitations under the License.
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
-#include <regex.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <queue>
+#include <random>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
 #include "apib/addresses.h"
-#include "apib/apib_lines.h"
+#include "apib/apib_time.h"
 #include "apib/apib_util.h"
+#include "ev.h"
+#include "third_party/http_parser/http_parser.h"
 
 using std::cerr;
 using std::cout;
@@ -44,15 +63,179 @@ using std::endl;
 
 namespace apib {
 
-#define BACKLOG 32
-#define READ_BUF 1024
+#define BACKLOG 1024
+#define READ_BUF 16384
+// Each thread keeps ready-made "/data" responses up to this size
+#define MAX_CACHED_DATA (1024 * 1024)
+#define MAX_CACHED_SIZES 64
+#define DEFAULT_DATA_SIZE 1024
 
 static http_parser_settings ParserSettings;
 
-static regex_t sizeParameter;
-#define SIZE_PARAMETER_REGEX "^size=([0-9]+)"
+// Responses that never change are built once, at startup
+static std::string HelloResponse;
+static std::string BadMethodResponse;
+static std::string NotFoundResponse;
+static std::string NotAuthorizedResponse;
+static std::string ServerErrorResponse;
+
+class TestConnection;
+
+// One event loop, on its own thread, and the connections that it accepted
+class TestThread {
+ public:
+  explicit TestThread(TestServer* s) : server_(s) {}
+  ~TestThread();
+  int listen(const Address& addr, bool reusePort);
+  // Accept connections from another thread's socket, when the platform
+  // can't give each thread its own
+  void shareListener(int fd);
+  int listenFd() const { return listenfd_; }
+  void start();
+  void stop();
+  void join();
+
+  SSL_CTX* ssl() const { return server_->ssl(); }
+  const FaultOptions& faults() const { return server_->faults(); }
+  std::mt19937_64* rand() { return &rand_; }
+  struct ev_loop* loop() const {
+    return loop_;
+  }
+  TestServerStats* stats() { return &stats_; }
+  const std::string& dataResponse(int size);
+  void acceptReady();
+  void removeConnection(TestConnection* c) { connections_.erase(c); }
+  // Call "c->wake()" after "micros" microseconds, without blocking the
+  // thread. Return an ID for "cancelWake."
+  uint64_t scheduleWake(TestConnection* c, int64_t micros);
+  void cancelWake(uint64_t id) { sleepers_.erase(id); }
+  void wakeReady();
+
+  void success(int op);
+  void failure() { stats_.errorCount++; }
+  void socketError() { stats_.socketErrorCount++; }
+  void newConnection() { stats_.connectionCount++; }
+  void connectionReset() { stats_.resetCount++; }
+
+ private:
+  void run();
+  void armWakeTimer();
+
+  TestServer* server_;
+  int listenfd_ = -1;
+  bool ownsListener_ = true;
+  struct ev_loop* loop_ = nullptr;
+  ev_io listenev_;
+  ev_async shutdownev_;
+  std::unique_ptr<std::thread> thread_;
+  // Only this thread counts here, so the atomics are never contended
+  TestServerStats stats_;
+  std::unordered_set<TestConnection*> connections_;
+  std::unordered_map<int, std::string> dataResponses_;
+  std::mt19937_64 rand_;
+
+  // Connections waiting to be woken up, ordered by when, in nanoseconds.
+  // A connection that closes removes itself from "sleepers_" and leaves
+  // its entry in the queue to be skipped.
+  typedef std::pair<int64_t, uint64_t> Wake;
+  std::priority_queue<Wake, std::vector<Wake>, std::greater<Wake>>
+      wakeQueue_;
+  std::unordered_map<uint64_t, TestConnection*> sleepers_;
+  uint64_t nextWakeId_ = 1;
+  // A timerfd has nanosecond resolution, where libev's timers only
+  // have the resolution of the poll timeout
+  int timerFd_ = -1;
+  ev_io timerev_;
+  ev_timer wakeTimer_;
+};
+
+// One connection. It reads requests as they arrive, without blocking,
+// and answers them in order.
+class TestConnection {
+ public:
+  TestConnection(TestThread* t, int fd);
+  ~TestConnection();
+  bool start();
+  void ioReady();
+  void wake();
+
+  // Called by http_parser
+  void messageBegin();
+  void setBody(const absl::string_view bs) {
+    // Uploads may be too big to keep, so just count them
+    if (path_ != "/upload") {
+      body_.append(bs.data(), bs.size());
+    }
+    bodyLen_ += bs.size();
+  }
+  void setQuery(const absl::string_view qs);
+  void setNextHeaderName(const absl::string_view n) {
+    nextHeader_ = std::string(n);
+  }
+  void setHeaderValue(const absl::string_view v);
 
-TestConnection::TestConnection(TestServer* s, int fd) : server_(s), fd_(fd) {}
+ private:
+  bool run();
+  bool chance(double p) {
+    return (p > 0.0) && std::bernoulli_distribution(p)(*thread_->rand());
+  }
+  void respond();
+  bool readEarlyData();
+  bool readInput();
+  bool processInput();
+  void requestComplete();
+  void handleRequest();
+  void send(const absl::string_view r) { output_.append(r.data(), r.size()); }
+  bool flush();
+  void updateEvents();
+  bool writePending() const { return written_ < output_.size(); }
+  int method() const { return parser_.method; }
+
+  TestThread* thread_;
+  int fd_;
+  SSL* ssl_ = nullptr;
+  ev_io io_;
+  http_parser parser_;
+
+  char buf_[READ_BUF];
+  size_t bufLen_ = 0;
+  std::string output_;
+  size_t written_ = 0;
+
+  // The TLS handshake is still reading early data
+  bool handshaking_ = false;
+  int handshakeEvents_ = EV_READ;
+  // OpenSSL needs a write retried with the same length
+  int tlsWriteLen_ = 0;
+  bool readWantsWrite_ = false;
+  bool writeWantsRead_ = false;
+  // Waiting for "wake" before answering the current request, or sending
+  // the next piece of it
+  bool sleeping_ = false;
+  uint64_t wakeId_ = 0;
+  bool closeAfterWrite_ = false;
+  // Close with a reset instead of a FIN
+  bool reset_ = false;
+  // The rest of a response that is being trickled out
+  std::deque<std::string> trickle_;
+  int64_t trickleInterval_ = 0;
+
+  // The current request
+  std::string path_;
+  std::unordered_map<std::string, std::string> query_;
+  std::string body_;
+  size_t bodyLen_ = 0;
+  std::string nextHeader_;
+  bool shouldClose_ = false;
+  bool notAuthorized_ = false;
+  int sleepTime_ = 0;
+  std::string faultSpec_;
+  // What FaultOptions decided for it
+  bool respondError_ = false;
+  const Trickle* trickleMode_ = nullptr;
+  bool trickleChunked_ = false;
+  FaultOptions requestFaults_;
+};
 
 static std::string makeData(const int len) {
   std::string b(len, '\0');
@@ -62,69 +245,74 @@ static std::string makeData(const int len) {
   return b;
 }
 
+static std::string makeResponse(int code, const absl::string_view codestr,
+                                const absl::string_view msg) {
+  std::ostringstream out;
+  out << "HTTP/1.1 " << code << ' ' << codestr << "\r\n"
+      << "Server: apib test server\r\n"
+      << "Content-Type: text/plain\r\n"
+      << "Content-Length: " << msg.size() << "\r\n"
+      << "\r\n"
+      << msg;
+  return out.str();
+}
+
 static void printSslError(const absl::string_view msg) {
   char buf[256];
   ERR_error_string_n(ERR_get_error(), buf, 256);
   cerr << msg << ": " << buf << endl;
 }
 
-void TestServer::success(int op) {
+static bool wouldBlock() {
+  return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+}
+
+void TestThread::success(int op) {
   assert(op < NUM_OPS);
   stats_.successes[op]++;
   stats_.successCount++;
 }
 
-void TestServer::failure() { stats_.errorCount++; }
-
-void TestServer::socketError() { stats_.socketErrorCount++; }
-
-void TestServer::newConnection() { stats_.connectionCount++; }
-
-int TestConnection::write(const absl::string_view s) {
-  if (ssl_ == NULL) {
-    return ::write(fd_, s.data(), s.size());
+const std::string& TestThread::dataResponse(int size) {
+  auto it = dataResponses_.find(size);
+  if (it != dataResponses_.end()) {
+    return it->second;
   }
-  return SSL_write(ssl_, s.data(), s.size());
+  if (dataResponses_.size() >= MAX_CACHED_SIZES) {
+    dataResponses_.clear();
+  }
+  return dataResponses_[size] = makeResponse(200, "OK", makeData(size));
 }
 
-void TestConnection::sendText(int code, const absl::string_view codestr,
-                              const absl::string_view msg) {
-  std::ostringstream out;
-  out << "HTTP/1.1 " << code << ' ' << codestr << "\r\n"
-      << "Server: apib test server\r\n"
-      << "Content-Type: text/plain\r\n"
-      << "Content-Length: " << msg.size() << "\r\n"
-      << "\r\n"
-      << msg;
-  write(out.str());
+// Called by http_parser at the start of each request
+static int messageBegin(http_parser* p) {
+  auto c = static_cast<TestConnection*>(p->data);
+  c->messageBegin();
+  return 0;
 }
 
-void TestConnection::sendData(const absl::string_view msg) {
-  std::ostringstream out;
-  out << "HTTP/1.1 200 OK\r\n"
-      << "Server: apib test server\r\n"
-      << "Content-Type: text/plain\r\n"
-      << "Content-Length: " << msg.size() << "\r\n"
-      << "\r\n"
-      << msg;
-  write(out.str());
+void TestConnection::messageBegin() {
+  path_.clear();
+  query_.clear();
+  body_.clear();
+  bodyLen_ = 0;
+  shouldClose_ = false;
+  notAuthorized_ = false;
+  sleepTime_ = 0;
+  faultSpec_.clear();
 }
 
 // Called by http_parser to collect the request body
 static int parsedBody(http_parser* p, const char* buf, size_t len) {
-  auto c = reinterpret_cast<TestConnection*>(p->data);
-  c->setBody(std::string(buf, len));
+  auto c = static_cast<TestConnection*>(p->data);
+  c->setBody(absl::string_view(buf, len));
   return 0;
 }
 
-void TestConnection::setBody(const absl::string_view bs) {
-  body_ = std::string(bs);
-}
-
 // Called by http_parser when we get the URL.
 static int parsedUrl(http_parser* p, const char* buf, size_t len) {
-  auto c = reinterpret_cast<TestConnection*>(p->data);
-  c->setQuery(std::string(buf, len));
+  auto c = static_cast<TestConnection*>(p->data);
+  c->setQuery(absl::string_view(buf, len));
   return 0;
 }
 
@@ -155,9 +343,10 @@ void TestConnection::setQuery(const absl::string_view qs) {
   }
 }
 
+// Stop parsing at the end of each request, so that it can be answered
+// before the next one, which may already be in the buffer, is parsed.
 static int parseComplete(http_parser* p) {
-  auto c = static_cast<TestConnection*>(p->data);
-  c->setParseComplete();
+  http_parser_pause(p, 1);
   return 0;
 }
 
@@ -185,301 +374,798 @@ void TestConnection::setHeaderValue(const absl::string_view v) {
     if (absl::SimpleAtoi(v, &tmpSleep)) {
       sleepTime_ = tmpSleep;
     }
+  } else if (eqcase("X-Fault", nextHeader_)) {
+    faultSpec_ = std::string(v);
   }
 }
 
 void TestConnection::handleRequest() {
+  if (shouldClose_) {
+    closeAfterWrite_ = true;
+  }
   if (notAuthorized_) {
-    sendText(401, "Not authorized", "Wrong password!\n");
+    send(NotAuthorizedResponse);
     return;
   }
 
-  if (sleepTime_ > 0) {
-    sleep(sleepTime_);
-  }
-
+  // Count each result before sending it, so that the stats are up to date
+  // by the time the client sees the response.
   if ("/hello" == path_) {
-    if (parser_.method == HTTP_GET) {
-      sendText(200, "OK", "Hello, World!\n");
-      server_->success(OP_HELLO);
+    if (method() == HTTP_GET) {
+      thread_->success(OP_HELLO);
+      send(HelloResponse);
     } else {
-      sendText(405, "BAD METHOD", "Wrong method");
-      server_->failure();
+      thread_->failure();
+      send(BadMethodResponse);
     }
 
   } else if ("/data" == path_) {
-    if (parser_.method == HTTP_GET) {
-      int size = 1024;
-      if (!query_["size"].empty()) {
-        size = stoi(query_["size"]);
+    if (method() == HTTP_GET) {
+      int size = DEFAULT_DATA_SIZE;
+      const auto sizeParam = query_.find("size");
+      if ((sizeParam != query_.end()) &&
+          !absl::SimpleAtoi(sizeParam->second, &size)) {
+        size = DEFAULT_DATA_SIZE;
+      }
+      thread_->success(OP_DATA);
+      if ((size >= 0) && (size <= MAX_CACHED_DATA)) {
+        send(thread_->dataResponse(size));
+      } else {
+        send(makeResponse(200, "OK", makeData(std::max(size, 0))));
       }
-      sendData(makeData(size));
-      server_->success(OP_DATA);
     } else {
-      sendText(405, "BAD METHOD", "Wrong method");
-      server_->failure();
+      thread_->failure();
+      send(BadMethodResponse);
     }
 
   } else if ("/echo" == path_) {
-    if (parser_.method == HTTP_POST) {
-      sendData(body());
-      server_->success(OP_ECHO);
+    if (method() == HTTP_POST) {
+      thread_->success(OP_ECHO);
+      send(makeResponse(200, "OK", body_));
     } else {
-      sendText(405, "BAD METHOD", "Wrong method");
-      server_->failure();
+      thread_->failure();
+      send(BadMethodResponse);
+    }
+  } else if ("/upload" == path_) {
+    if ((method() == HTTP_POST) || (method() == HTTP_PUT)) {
+      thread_->success(OP_UPLOAD);
+      send(makeResponse(200, "OK", absl::StrCat(bodyLen_, "\n")));
+    } else {
+      thread_->failure();
+      send(BadMethodResponse);
     }
   } else {
-    sendText(404, "NOT FOUND", "Not found");
-    server_->failure();
+    thread_->failure();
+    send(NotFoundResponse);
   }
 }
 
-ssize_t TestConnection::httpTransaction(char* buf, ssize_t bufPos) {
-  done_ = false;
+static void handleConnectionIo(struct ev_loop* loop, ev_io* io, int e) {
+  static_cast<TestConnection*>(io->data)->ioReady();
+}
+
+TestConnection::TestConnection(TestThread* t, int fd) : thread_(t), fd_(fd) {
   http_parser_init(&parser_, HTTP_REQUEST);
   parser_.data = this;
+  ev_io_init(&io_, handleConnectionIo, fd_, EV_READ);
+  io_.data = this;
+}
 
-  do {
-    int readCount;
-    if (ssl_ == nullptr) {
-      readCount = ::read(fd_, buf + bufPos, READ_BUF - bufPos);
-    } else {
-      readCount = SSL_read(ssl_, buf + bufPos, READ_BUF - bufPos);
+TestConnection::~TestConnection() {
+  ev_io_stop(thread_->loop(), &io_);
+  if (wakeId_ != 0) {
+    thread_->cancelWake(wakeId_);
+  }
+  if (reset_) {
+    // Send a RST instead of a FIN
+    struct linger l;
+    l.l_onoff = 1;
+    l.l_linger = 0;
+    setsockopt(fd_, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  } else if (ssl_ != nullptr) {
+    // Without a clean shutdown, OpenSSL won't let the session be resumed.
+    SSL_shutdown(ssl_);
+  }
+  if (ssl_ != nullptr) {
+    SSL_free(ssl_);
+  }
+  close(fd_);
+}
+
+bool TestConnection::start() {
+  if (thread_->ssl() != nullptr) {
+    ssl_ = SSL_new(thread_->ssl());
+    const int err = SSL_set_fd(ssl_, fd_);
+    if (err != 1) {
+      printSslError("Can't connect to SSL FD");
+      return false;
     }
+    SSL_set_accept_state(ssl_);
+    handshaking_ = true;
+  } else {
+    thread_->newConnection();
+  }
+  ev_io_start(thread_->loop(), &io_);
+  return true;
+}
 
-    if (readCount < 0) {
-      if (ssl_ == NULL) {
-        perror("Error on read from socket");
-      } else {
-        printSslError("Error on socket read");
-      }
-      server_->socketError();
-      return -1;
-    } else if (readCount == 0) {
-      return -2;
+void TestConnection::ioReady() {
+  if (!run()) {
+    thread_->removeConnection(this);
+    delete this;
+  }
+}
+
+void TestConnection::wake() {
+  wakeId_ = 0;
+  sleeping_ = false;
+  if (trickle_.empty()) {
+    respond();
+  } else {
+    send(trickle_.front());
+    trickle_.pop_front();
+    if (!trickle_.empty()) {
+      sleeping_ = true;
+      wakeId_ = thread_->scheduleWake(this, trickleInterval_);
     }
+  }
+  ioReady();
+}
 
-    const size_t available = bufPos + readCount;
-    const size_t parseCount =
-        http_parser_execute(&parser_, &ParserSettings, buf, available);
+// Do whatever can be done without blocking. Return false when the
+// connection should be closed.
+bool TestConnection::run() {
+  if (handshaking_) {
+    if (!readEarlyData()) {
+      return false;
+    }
+    if (handshaking_) {
+      updateEvents();
+      return true;
+    }
+  }
+  if (!flush()) {
+    return false;
+  }
+  if (!sleeping_ && !closeAfterWrite_) {
+    // There may be requests left over from early data or from before
+    // a sleep
+    if (!processInput() || !readInput()) {
+      return false;
+    }
+  }
+  if (!flush()) {
+    return false;
+  }
+  if (closeAfterWrite_ && !sleeping_ && !writePending()) {
+    return false;
+  }
+  updateEvents();
+  return true;
+}
 
-    if (parser_.http_errno != 0) {
-      fprintf(stderr, "Error parsing HTTP request: %i: %s\n",
-              parser_.http_errno,
-              http_errno_description((http_errno)parser_.http_errno));
-      return -1;
+bool TestConnection::readEarlyData() {
+#ifndef OPENSSL_IS_BORINGSSL
+  // Accept TLS 1.3 early data, if the client sent any.
+  for (;;) {
+    size_t readed = 0;
+    const int er = SSL_read_early_data(ssl_, buf_ + bufLen_,
+                                       READ_BUF - bufLen_, &readed);
+    bufLen_ += readed;
+    if (er == SSL_READ_EARLY_DATA_FINISH) {
+      break;
+    }
+    if (er == SSL_READ_EARLY_DATA_ERROR) {
+      switch (SSL_get_error(ssl_, er)) {
+        case SSL_ERROR_WANT_READ:
+          handshakeEvents_ = EV_READ;
+          return true;
+        case SSL_ERROR_WANT_WRITE:
+          handshakeEvents_ = EV_WRITE;
+          return true;
+        default:
+          printSslError("Error reading early data");
+          return false;
+      }
     }
+  }
+#endif
+  handshaking_ = false;
+  thread_->newConnection();
+  return true;
+}
 
-    if (parseCount < available) {
-      const size_t leftover = available - parseCount;
-      memmove(buf, buf + parseCount, leftover);
-      bufPos = leftover;
+// Read until the socket would block, answering requests as they arrive
+bool TestConnection::readInput() {
+  readWantsWrite_ = false;
+  for (;;) {
+    int readCount;
+    if (ssl_ == nullptr) {
+      readCount = ::read(fd_, buf_ + bufLen_, READ_BUF - bufLen_);
+      if (readCount < 0) {
+        if (wouldBlock()) {
+          return true;
+        }
+        perror("Error on read from socket");
+        thread_->socketError();
+        return false;
+      }
+      if (readCount == 0) {
+        return false;
+      }
     } else {
-      bufPos = 0;
+      readCount = SSL_read(ssl_, buf_ + bufLen_, READ_BUF - bufLen_);
+      if (readCount <= 0) {
+        switch (SSL_get_error(ssl_, readCount)) {
+          case SSL_ERROR_WANT_READ:
+            return true;
+          case SSL_ERROR_WANT_WRITE:
+            readWantsWrite_ = true;
+            return true;
+          case SSL_ERROR_ZERO_RETURN:
+            return false;
+          case SSL_ERROR_SYSCALL:
+            if ((readCount == 0) || (errno == ECONNRESET)) {
+              // The client went away without a close_notify
+              return false;
+            }
+            // Fall through
+          default:
+            printSslError("Error on socket read");
+            thread_->socketError();
+            return false;
+        }
+      }
     }
-  } while (!done_);
 
-  handleRequest();
-  if (shouldClose_) {
-    return -1;
+    bufLen_ += readCount;
+    if (!processInput()) {
+      return false;
+    }
+    if (sleeping_ || closeAfterWrite_) {
+      // Leave the rest in the socket until this request is done
+      return true;
+    }
   }
-  return bufPos;
 }
 
-void TestConnection::socketLoop() {
-  ssize_t bufPos = 0;
-  char* buf = (char*)malloc(READ_BUF);
+// Parse and answer every complete request in the buffer
+bool TestConnection::processInput() {
+  while (bufLen_ > 0) {
+    const size_t parseCount =
+        http_parser_execute(&parser_, &ParserSettings, buf_, bufLen_);
+    const http_errno err = HTTP_PARSER_ERRNO(&parser_);
+    if (parseCount < bufLen_) {
+      memmove(buf_, buf_ + parseCount, bufLen_ - parseCount);
+    }
+    bufLen_ -= parseCount;
 
-  if (server_->ssl() != nullptr) {
-    ssl_ = SSL_new(server_->ssl());
-    int err = SSL_set_fd(ssl_, fd_);
-    if (err != 1) {
-      printSslError("Can't connect to SSL FD");
-      goto finish;
+    if (err == HPE_PAUSED) {
+      http_parser_pause(&parser_, 0);
+      requestComplete();
+      if (sleeping_ || closeAfterWrite_) {
+        return true;
+      }
+    } else if (err != HPE_OK) {
+      fprintf(stderr, "Error parsing HTTP request: %i: %s\n", err,
+              http_errno_description(err));
+      return false;
     }
-    SSL_set_accept_state(ssl_);
   }
+  return true;
+}
 
-  server_->newConnection();
+// Decide how to misbehave, if at all, and then respond now or later
+void TestConnection::requestComplete() {
+  const FaultOptions* f = &thread_->faults();
+  if (!faultSpec_.empty()) {
+    auto rf = FaultOptions::Parse(faultSpec_);
+    if (!rf.ok()) {
+      thread_->failure();
+      send(makeResponse(400, "BAD REQUEST", rf.status().str() + '\n'));
+      return;
+    }
+    requestFaults_ = rf.value();
+    f = &requestFaults_;
+  }
 
-  do {
-    bufPos = httpTransaction(buf, bufPos);
-    path_.clear();
-    query_.clear();
-    body_.clear();
-    shouldClose_ = false;
-    notAuthorized_ = false;
-    sleepTime_ = 0;
-  } while (bufPos >= 0);
+  if (chance(f->resetRate)) {
+    thread_->connectionReset();
+    reset_ = true;
+    closeAfterWrite_ = true;
+    return;
+  }
+  respondError_ = chance(f->errorRate);
+  trickleMode_ = nullptr;
+  if (chance(f->chunked.probability)) {
+    trickleMode_ = &f->chunked;
+    trickleChunked_ = true;
+  } else if (chance(f->slow.probability)) {
+    trickleMode_ = &f->slow;
+    trickleChunked_ = false;
+  }
 
-finish:
-  close(fd_);
-  free(buf);
-  if (ssl_ != nullptr) {
-    SSL_free(ssl_);
+  const int64_t delay =
+      f->latency.sample(thread_->rand()) + (sleepTime_ * 1000000LL);
+  if (delay > 0) {
+    // Answer later, without holding up the other connections
+    sleeping_ = true;
+    wakeId_ = thread_->scheduleWake(this, delay);
+    return;
   }
-  delete this;
+  respond();
 }
 
-void TestServer::acceptLoop() { ev_run(loop_, 0); }
-
-void TestServer::acceptOne() {
-  const int fd = accept(listenfd_, nullptr, nullptr);
-  if (fd < 0) {
-    // This could be because the socket was closed.
-    perror("Error accepting socket");
+void TestConnection::respond() {
+  if (respondError_) {
+    if (shouldClose_) {
+      closeAfterWrite_ = true;
+    }
+    thread_->failure();
+    send(ServerErrorResponse);
+    return;
+  }
+  if (trickleMode_ == nullptr) {
+    handleRequest();
     return;
   }
 
-  // Explicitly clear the blocking flag, because it might be inherited from
-  // the accept FD.
-  int flags = fcntl(fd, F_GETFL);
-  flags &= ~O_NONBLOCK;
-  int err = fcntl(fd, F_SETFL, flags);
-  mandatoryAssert(err == 0);
+  // Send the first piece now and the rest as "wake" is called
+  const size_t start = output_.size();
+  handleRequest();
+  const std::vector<std::string> pieces = SplitResponse(
+      output_.substr(start), trickleMode_->bytes, trickleChunked_);
+  output_.resize(start);
+  trickle_.assign(pieces.begin(), pieces.end());
+  trickleInterval_ = trickleMode_->intervalMicros;
+  trickleMode_ = nullptr;
+  if (!trickle_.empty()) {
+    send(trickle_.front());
+    trickle_.pop_front();
+  }
+  if (!trickle_.empty()) {
+    sleeping_ = true;
+    wakeId_ = thread_->scheduleWake(this, trickleInterval_);
+  }
+}
 
-  TestConnection* c = new TestConnection(this, fd);
-  std::thread ct(std::bind(&TestConnection::socketLoop, c));
-  ct.detach();
+// Write as much as possible without blocking
+bool TestConnection::flush() {
+  while (writePending()) {
+    int writeCount;
+    if (ssl_ == nullptr) {
+      writeCount =
+          ::write(fd_, output_.data() + written_, output_.size() - written_);
+      if (writeCount < 0) {
+        if (wouldBlock()) {
+          return true;
+        }
+        return false;
+      }
+    } else {
+      const int len =
+          (tlsWriteLen_ > 0)
+              ? tlsWriteLen_
+              : (int)std::min(output_.size() - written_, (size_t)INT_MAX);
+      writeCount = SSL_write(ssl_, output_.data() + written_, len);
+      if (writeCount <= 0) {
+        tlsWriteLen_ = len;
+        switch (SSL_get_error(ssl_, writeCount)) {
+          case SSL_ERROR_WANT_READ:
+            writeWantsRead_ = true;
+            return true;
+          case SSL_ERROR_WANT_WRITE:
+            return true;
+          default:
+            printSslError("Error on socket write");
+            return false;
+        }
+      }
+      tlsWriteLen_ = 0;
+      writeWantsRead_ = false;
+    }
+    written_ += writeCount;
+  }
+  output_.clear();
+  written_ = 0;
+  return true;
 }
 
-int TestServer::initializeSsl(const std::string& keyFile,
-                              const std::string& certFile) {
-  sslCtx_ = SSL_CTX_new(TLS_server_method());
+void TestConnection::updateEvents() {
+  int events = 0;
+  if (handshaking_) {
+    events = handshakeEvents_;
+  } else {
+    if (!sleeping_ && !closeAfterWrite_) {
+      events |= EV_READ;
+    }
+    if (writePending() || readWantsWrite_) {
+      events |= EV_WRITE;
+    }
+    if (writeWantsRead_) {
+      events |= EV_READ;
+    }
+  }
+  if (events == (io_.events & (EV_READ | EV_WRITE))) {
+    return;
+  }
+  ev_io_stop(thread_->loop(), &io_);
+  ev_io_set(&io_, fd_, events);
+  if (events != 0) {
+    ev_io_start(thread_->loop(), &io_);
+  }
+}
 
-  int err = SSL_CTX_use_certificate_chain_file(sslCtx_, certFile.c_str());
-  if (err != 1) {
-    printSslError("Can't load certificate file");
-    return -1;
+uint64_t TestThread::scheduleWake(TestConnection* c, int64_t micros) {
+  const uint64_t id = nextWakeId_++;
+  sleepers_[id] = c;
+  const int64_t when = GetTime() + (micros * 1000LL);
+  const bool soonest = wakeQueue_.empty() || (when < wakeQueue_.top().first);
+  wakeQueue_.push(Wake(when, id));
+  if (soonest) {
+    armWakeTimer();
   }
+  return id;
+}
 
-  err = SSL_CTX_use_PrivateKey_file(sslCtx_, keyFile.c_str(), SSL_FILETYPE_PEM);
-  if (err != 1) {
-    printSslError("Can't load key file");
-    return -2;
+void TestThread::armWakeTimer() {
+  // Skip connections that went away
+  while (!wakeQueue_.empty() &&
+         (sleepers_.find(wakeQueue_.top().second) == sleepers_.end())) {
+    wakeQueue_.pop();
+  }
+  if (wakeQueue_.empty()) {
+    return;
   }
+  const int64_t when = wakeQueue_.top().first;
+#ifdef __linux__
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  // A zero time would disarm the timer
+  its.it_value.tv_sec = when / 1000000000LL;
+  its.it_value.tv_nsec = std::max<int64_t>(when % 1000000000LL, 1);
+  timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &its, nullptr);
+#else
+  ev_timer_stop(loop_, &wakeTimer_);
+  ev_timer_set(&wakeTimer_,
+               std::max<int64_t>(when - GetTime(), 0) / 1000000000.0, 0.0);
+  ev_timer_start(loop_, &wakeTimer_);
+#endif
+}
 
-  return 0;
+void TestThread::wakeReady() {
+#ifdef __linux__
+  uint64_t expirations;
+  if (read(timerFd_, &expirations, sizeof(expirations)) < 0) {
+    // Nothing to do, or a spurious wakeup
+  }
+#endif
+  const int64_t now = GetTime();
+  while (!wakeQueue_.empty() && (wakeQueue_.top().first <= now)) {
+    const uint64_t id = wakeQueue_.top().second;
+    wakeQueue_.pop();
+    auto it = sleepers_.find(id);
+    if (it != sleepers_.end()) {
+      TestConnection* c = it->second;
+      sleepers_.erase(it);
+      c->wake();
+    }
+  }
+  armWakeTimer();
+}
+
+static void handleWakeFd(struct ev_loop* loop, ev_io* io, int e) {
+  static_cast<TestThread*>(io->data)->wakeReady();
+}
+
+static void handleWakeTimer(struct ev_loop* loop, ev_timer* t, int e) {
+  static_cast<TestThread*>(t->data)->wakeReady();
 }
 
 static void handleAccept(struct ev_loop* loop, ev_io* io, int e) {
-  auto s = reinterpret_cast<TestServer*>(io->data);
-  s->acceptOne();
+  static_cast<TestThread*>(io->data)->acceptReady();
 }
 
 static void handleShutdown(struct ev_loop* loop, ev_async* a, int e) {
-  // Unreference the listener fd and this handler and then the loop will exit!
-  ev_unref(loop);
-  ev_unref(loop);
+  ev_break(loop, EVBREAK_ALL);
 }
 
-int TestServer::start(const std::string& address, int port,
-                      const std::string& keyFile, const std::string& certFile) {
-  int err = regcomp(&sizeParameter, SIZE_PARAMETER_REGEX, REG_EXTENDED);
-  assert(err == 0);
+void TestThread::acceptReady() {
+  for (;;) {
+    const int fd = accept(listenfd_, nullptr, nullptr);
+    if (fd < 0) {
+      // Another thread may have accepted it first
+      if (!wouldBlock() && (errno != ECONNABORTED)) {
+        perror("Error accepting socket");
+      }
+      return;
+    }
 
-  http_parser_settings_init(&ParserSettings);
-  ParserSettings.on_url = parsedUrl;
-  ParserSettings.on_header_field = parsedHeaderField;
-  ParserSettings.on_header_value = parsedHeaderValue;
-  ParserSettings.on_body = parsedBody;
-  ParserSettings.on_message_complete = parseComplete;
+    int err = fcntl(fd, F_SETFL, O_NONBLOCK);
+    mandatoryAssert(err == 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-  if (!keyFile.empty() && !certFile.empty()) {
-    if (initializeSsl(keyFile, certFile) != 0) {
-      return -1;
+    TestConnection* c = new TestConnection(this, fd);
+    if (c->start()) {
+      connections_.insert(c);
+    } else {
+      delete c;
     }
   }
+}
 
-  auto as = Addresses::lookup(address);
-  if (!as.ok()) {
-    cerr << "Invalid listen address: " << as << '\n';
-    return -1;
-  }
-
-  const Address listenAddr = as.valueref()->get(port);
-
-  loop_ = ev_loop_new(EVFLAG_AUTO);
-
-  listenfd_ = socket(listenAddr.family(), SOCK_STREAM, 0);
+int TestThread::listen(const Address& addr, bool reusePort) {
+  listenfd_ = socket(addr.family(), SOCK_STREAM, 0);
   if (listenfd_ < 0) {
     perror("Cant' create socket");
     return -1;
   }
 
-  err = fcntl(listenfd_, F_SETFL, O_NONBLOCK);
+#ifdef SO_REUSEPORT
+  if (reusePort) {
+    int one = 1;
+    setsockopt(listenfd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  }
+#endif
+
+  int err = fcntl(listenfd_, F_SETFL, O_NONBLOCK);
   if (err != 0) {
     perror("Can't set socket mode");
     return -2;
   }
 
-  struct sockaddr_storage addr;
-  const socklen_t addrlen = listenAddr.get(&addr);
-  err = bind(listenfd_, (const struct sockaddr*)&addr, addrlen);
+  struct sockaddr_storage sa;
+  const socklen_t addrlen = addr.get(&sa);
+  err = bind(listenfd_, (const struct sockaddr*)&sa, addrlen);
   if (err != 0) {
     perror("Can't bind to port");
     return -2;
   }
 
-  err = listen(listenfd_, BACKLOG);
+  err = ::listen(listenfd_, BACKLOG);
   if (err != 0) {
     perror("Can't listen on socket");
     return -3;
   }
+  return 0;
+}
+
+void TestThread::shareListener(int fd) {
+  listenfd_ = fd;
+  ownsListener_ = false;
+}
 
+void TestThread::start() {
+  loop_ = ev_loop_new(EVFLAG_AUTO);
   ev_async_init(&shutdownev_, handleShutdown);
   ev_async_start(loop_, &shutdownev_);
-
   ev_io_init(&listenev_, handleAccept, listenfd_, EV_READ);
   listenev_.data = this;
   ev_io_start(loop_, &listenev_);
 
-  acceptThread_.reset(
-      new std::thread(std::bind(&TestServer::acceptLoop, this)));
-  return 0;
+  std::random_device seed;
+  rand_.seed(seed());
+#ifdef __linux__
+  timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  mandatoryAssert(timerFd_ >= 0);
+  ev_io_init(&timerev_, handleWakeFd, timerFd_, EV_READ);
+  timerev_.data = this;
+  ev_io_start(loop_, &timerev_);
+#endif
+  ev_init(&wakeTimer_, handleWakeTimer);
+  wakeTimer_.data = this;
+
+  thread_.reset(new std::thread(std::bind(&TestThread::run, this)));
 }
 
-TestServer::~TestServer() {
+void TestThread::run() {
+  ev_run(loop_, 0);
+  // Close whatever is still open
+  for (auto it = connections_.begin(); it != connections_.end(); it++) {
+    delete *it;
+  }
+  connections_.clear();
+}
+
+void TestThread::stop() {
+  if (thread_) {
+    ev_async_send(loop_, &shutdownev_);
+    thread_->join();
+    thread_.reset();
+  }
+}
+
+void TestThread::join() {
+  if (thread_) {
+    thread_->join();
+    thread_.reset();
+  }
+}
+
+TestThread::~TestThread() {
+  stop();
   if (loop_ != nullptr) {
     ev_loop_destroy(loop_);
   }
-  if (sslCtx_ != nullptr) {
-    SSL_CTX_free(sslCtx_);
+  if (ownsListener_ && (listenfd_ >= 0)) {
+    close(listenfd_);
+  }
+  if (timerFd_ >= 0) {
+    close(timerFd_);
   }
 }
 
-int TestServer::port() const {
+int TestServer::initializeSsl(const std::string& keyFile,
+                              const std::string& certFile) {
+  sslCtx_ = SSL_CTX_new(TLS_server_method());
+
+  int err = SSL_CTX_use_certificate_chain_file(sslCtx_, certFile.c_str());
+  if (err != 1) {
+    printSslError("Can't load certificate file");
+    return -1;
+  }
+
+  err = SSL_CTX_use_PrivateKey_file(sslCtx_, keyFile.c_str(), SSL_FILETYPE_PEM);
+  if (err != 1) {
+    printSslError("Can't load key file");
+    return -2;
+  }
+
+  // Responses are written from a buffer that may grow between attempts
+  SSL_CTX_set_mode(sslCtx_, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#ifndef OPENSSL_IS_BORINGSSL
+  SSL_CTX_set_max_early_data(sslCtx_, READ_BUF);
+#endif
+
+  return 0;
+}
+
+static int socketPort(int fd) {
   struct sockaddr_storage addr;
   socklen_t addrlen = sizeof(struct sockaddr_storage);
 
-  getsockname(listenfd_, (struct sockaddr*)&addr, &addrlen);
+  getsockname(fd, (struct sockaddr*)&addr, &addrlen);
   const Address a((struct sockaddr*)&addr, addrlen);
   return a.port();
 }
 
-void TestServer::resetStats() { stats_.reset(); }
+int TestServer::start(const std::string& address, int port,
+                      const std::string& keyFile, const std::string& certFile,
+                      int threads) {
+  // Writing to a socket that the client already closed, as when sending a
+  // TLS close_notify, must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  http_parser_settings_init(&ParserSettings);
+  ParserSettings.on_message_begin = messageBegin;
+  ParserSettings.on_url = parsedUrl;
+  ParserSettings.on_header_field = parsedHeaderField;
+  ParserSettings.on_header_value = parsedHeaderValue;
+  ParserSettings.on_body = parsedBody;
+  ParserSettings.on_message_complete = parseComplete;
+
+  HelloResponse = makeResponse(200, "OK", "Hello, World!\n");
+  BadMethodResponse = makeResponse(405, "BAD METHOD", "Wrong method");
+  NotFoundResponse = makeResponse(404, "NOT FOUND", "Not found");
+  NotAuthorizedResponse =
+      makeResponse(401, "Not authorized", "Wrong password!\n");
+  ServerErrorResponse =
+      makeResponse(500, "INTERNAL SERVER ERROR", "Injected failure\n");
 
-TestServerStats TestServer::stats() const { return stats_; }
+  if (!keyFile.empty() && !certFile.empty()) {
+    if (initializeSsl(keyFile, certFile) != 0) {
+      return -1;
+    }
+  }
 
-void TestServer::stop() {
-  ev_async_send(loop_, &shutdownev_);
-  acceptThread_->join();
-  close(listenfd_);
+  // "unix:PATH" listens on a Unix socket instead of a TCP port
+  const bool unixSocket = absl::StartsWith(address, "unix:");
+  Address listenAddr;
+  if (unixSocket) {
+    const auto us = Address::unixSocket(address.substr(5));
+    if (!us.ok()) {
+      cerr << "Invalid listen address: " << us.status() << '\n';
+      return -1;
+    }
+    listenAddr = us.value();
+    if (address[5] != '@') {
+      // Replace the socket file left over from the last run
+      unlink(address.c_str() + 5);
+    }
+  } else {
+    auto as = Addresses::lookup(address);
+    if (!as.ok()) {
+      cerr << "Invalid listen address: " << as << '\n';
+      return -1;
+    }
+    listenAddr = as.valueref()->get(port);
+  }
+
+  if (threads < 1) {
+    threads = 1;
+  }
+#ifdef SO_REUSEPORT
+  const bool reusePort = (threads > 1) && !unixSocket;
+#else
+  const bool reusePort = false;
+#endif
+
+  for (int i = 0; i < threads; i++) {
+    std::unique_ptr<TestThread> t(new TestThread(this));
+    if ((i == 0) || reusePort) {
+      const int err = t->listen(listenAddr, reusePort);
+      if (err != 0) {
+        threads_.clear();
+        return err;
+      }
+      // The rest listen on the port that the first one got
+      listenAddr.setPort(socketPort(t->listenFd()));
+    } else {
+      t->shareListener(threads_[0]->listenFd());
+    }
+    threads_.push_back(std::move(t));
+  }
+
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->start();
+  }
+  return 0;
 }
 
-void TestServer::join() { acceptThread_->join(); }
+TestServer::TestServer() {}
 
-TestServerStats::TestServerStats() {
-  for (int i = 0; i < NUM_OPS; i++) {
-    successes[i] = 0;
+TestServer::~TestServer() {
+  threads_.clear();
+  if (sslCtx_ != nullptr) {
+    SSL_CTX_free(sslCtx_);
+  }
+}
+
+int TestServer::port() const {
+  if (threads_.empty()) {
+    return 0;
   }
+  return socketPort(threads_[0]->listenFd());
 }
 
+void TestServer::resetStats() {
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->stats()->reset();
+  }
+}
+
+TestServerStats TestServer::stats() const {
+  TestServerStats s;
+  for (auto it = threads_.cbegin(); it != threads_.cend(); it++) {
+    s.add(*(*it)->stats());
+  }
+  return s;
+}
+
+void TestServer::stop() {
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->stop();
+  }
+  threads_.clear();
+}
+
+void TestServer::join() {
+  for (auto it = threads_.begin(); it != threads_.end(); it++) {
+    (*it)->join();
+  }
+}
+
+TestServerStats::TestServerStats() { reset(); }
+
 TestServerStats::TestServerStats(const TestServerStats& s) {
   connectionCount.store(s.connectionCount);
   socketErrorCount.store(s.socketErrorCount);
   errorCount.store(s.errorCount);
   successCount.store(s.successCount);
+  resetCount.store(s.resetCount);
   for (int i = 0; i < NUM_OPS; i++) {
     successes[i].store(s.successes[i]);
   }
@@ -490,9 +1176,21 @@ void TestServerStats::reset() {
   socketErrorCount = 0;
   errorCount = 0;
   successCount = 0;
+  resetCount = 0;
   for (int i = 0; i < NUM_OPS; i++) {
     successes[i] = 0;
   }
 }
 
-}  // namespace apib
\ No newline at end of file
+void TestServerStats::add(const TestServerStats& s) {
+  connectionCount += s.connectionCount;
+  socketErrorCount += s.socketErrorCount;
+  errorCount += s.errorCount;
+  successCount += s.successCount;
+  resetCount += s.resetCount;
+  for (int i = 0; i < NUM_OPS; i++) {
+    successes[i] += s.successes[i];
+  }
+}
+
+}  // namespace apib
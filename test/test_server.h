@@ -22,101 +22,68 @@ limitations under the License.
 #include <atomic>
 #include <cstdint>
 #include <memory>
-#include <mutex>
 #include <string>
-#include <thread>
-#include <unordered_map>
 #include <vector>
 
-#include "absl/strings/string_view.h"
-#include "ev.h"
-#include "third_party/http_parser/http_parser.h"
+#include "test/test_faults.h"
 
 namespace apib {
 
 #define OP_HELLO 0
 #define OP_ECHO 1
 #define OP_DATA 2
-#define NUM_OPS 3
+#define OP_UPLOAD 3
+#define NUM_OPS 4
 
 class TestServerStats {
  public:
   TestServerStats();
   TestServerStats(const TestServerStats& s);
   void reset();
+  // Add the counts from "s" to these
+  void add(const TestServerStats& s);
 
   std::atomic_int32_t connectionCount;
   std::atomic_int32_t socketErrorCount;
   std::atomic_int32_t errorCount;
   std::atomic_int32_t successCount;
   std::atomic_int32_t successes[NUM_OPS];
+  // Connections reset on purpose by FaultOptions
+  std::atomic_int32_t resetCount;
 };
 
+class TestThread;
+
 class TestServer {
  public:
+  TestServer();
   ~TestServer();
-  /* Start a simple and dumb thread-per-socket HTTP server on a thread. */
+  // Start an HTTP server on "threads" threads, each with its own event
+  // loop. Every connection stays on the thread that accepted it. Where
+  // SO_REUSEPORT is available, each thread also has its own listening
+  // socket on the same port, so that the kernel spreads new connections
+  // across them. An address of "unix:PATH" listens on a Unix socket, where
+  // "port" is ignored.
   int start(const std::string& address, int port, const std::string& keyFile,
-            const std::string& certFile);
+            const std::string& certFile, int threads = 1);
   int port() const;
+  // Misbehave as described, except for requests with an "X-Fault" header,
+  // which replaces these options for that request. Call before start.
+  void setFaults(const FaultOptions& f) { faults_ = f; }
+  const FaultOptions& faults() const { return faults_; }
+  // The sum of the counts from every thread
   TestServerStats stats() const;
   void resetStats();
   void stop();
   void join();
-  void success(int op);
-  void failure();
-  void socketError();
-  void newConnection();
   SSL_CTX* ssl() const { return sslCtx_; }
-  void acceptOne();
 
  private:
   int initializeSsl(const std::string& keyFile, const std::string& certFile);
-  void acceptLoop();
 
-  int listenfd_;
-  TestServerStats stats_;
-  std::mutex statsLock_;
-  std::unique_ptr<std::thread> acceptThread_;
+  std::vector<std::unique_ptr<TestThread>> threads_;
   SSL_CTX* sslCtx_ = nullptr;
-  struct ev_loop* loop_ = nullptr;
-  ev_io listenev_;
-  ev_async shutdownev_;
-};
-
-class TestConnection {
- public:
-  TestConnection(TestServer* s, int fd);
-  void socketLoop();
-  void setBody(const absl::string_view bs);
-  void setQuery(const absl::string_view qs);
-  void setParseComplete() { done_ = true; }
-  void setNextHeaderName(const absl::string_view n) {
-    nextHeader_ = std::string(n);
-  }
-  void setHeaderValue(const absl::string_view v);
-  std::string body() { return body_; }
-
- private:
-  int write(const absl::string_view s);
-  void sendText(int code, const absl::string_view codestr,
-                const absl::string_view msg);
-  void sendData(const absl::string_view msg);
-  ssize_t httpTransaction(char* buf, ssize_t bufPos);
-  void handleRequest();
-
-  TestServer* server_;
-  int fd_;
-  bool done_ = false;
-  std::string path_;
-  std::unordered_map<std::string, std::string> query_;
-  std::string body_;
-  std::string nextHeader_;
-  bool shouldClose_ = false;
-  bool notAuthorized_ = false;
-  int sleepTime_ = 0;
-  http_parser parser_;
-  SSL* ssl_ = nullptr;
+  FaultOptions faults_;
 };
 
 }  // namespace apib
@@ -14,38 +14,91 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <getopt.h>
+
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 
+#include "apib/apib_cpu.h"
 #include "test/test_server.h"
 
+static void printUsage() {
+  std::cerr << "Usage: testserver [-t threads] [-f faults] <port> [<key file> "
+               "<cert file>]"
+            << std::endl;
+  std::cerr << "  The port may be \"unix:PATH\" to listen on a Unix socket"
+            << std::endl;
+  std::cerr << "  -t  Number of threads (default one per CPU)" << std::endl;
+  std::cerr << "  -f  Comma-separated faults to inject:" << std::endl;
+  std::cerr << "        latency=fixed:US, latency=uniform:MIN:MAX,\n"
+               "        latency=lognormal:MEDIAN:SIGMA,\n"
+               "        latency=bimodal:FAST:SLOW:P, errors=P, reset=P,\n"
+               "        slow=P:BYTES:US, trickle=P:BYTES:US\n"
+               "      where times are in microseconds and each P is a\n"
+               "      probability. The X-Fault header does the same for one\n"
+               "      request."
+            << std::endl;
+}
+
 int main(int argc, char** argv) {
-  if ((argc < 2) || (argc > 4)) {
-    std::cerr << "Usage: testserver <port> [<key file> <cert file>]"
-              << std::endl;
+  int threads = apib::cpu_Count();
+  apib::FaultOptions faults;
+  int arg;
+  while ((arg = getopt(argc, argv, "f:t:")) >= 0) {
+    switch (arg) {
+      case 'f': {
+        const auto f = apib::FaultOptions::Parse(optarg);
+        if (!f.ok()) {
+          std::cerr << f.status() << std::endl;
+          return 1;
+        }
+        faults = f.value();
+        break;
+      }
+      case 't':
+        threads = atoi(optarg);
+        break;
+      default:
+        printUsage();
+        return 1;
+    }
+  }
+
+  const int numArgs = argc - optind;
+  if ((numArgs < 1) || (numArgs > 3)) {
+    printUsage();
     return 1;
   }
 
-  int port = atoi(argv[1]);
+  std::string address = "0.0.0.0";
+  int port = 0;
+  if (strncmp(argv[optind], "unix:", 5) == 0) {
+    address = argv[optind];
+  } else {
+    port = atoi(argv[optind]);
+  }
   std::string keyFile;
   std::string certFile;
 
-  if (argc > 2) {
-    keyFile = argv[2];
+  if (numArgs > 1) {
+    keyFile = argv[optind + 1];
   }
-  if (argc > 3) {
-    certFile = argv[3];
+  if (numArgs > 2) {
+    certFile = argv[optind + 2];
   }
 
   apib::TestServer svr;
-  int err = svr.start("0.0.0.0", port, keyFile, certFile);
+  svr.setFaults(faults);
+  int err = svr.start(address, port, keyFile, certFile, threads);
   if (err != 0) {
     return 2;
   }
 
-  std::cout << "Listening on port " << svr.port() << std::endl;
+  std::cout << "Listening on port " << svr.port() << " with " << threads
+            << " threads" << std::endl;
 
   svr.join();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,84 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Measure what it costs to time each request with the different clocks,
+// and how much "--loop-time" saves by reading the clock once per pass
+// through the event loop instead of twice per request.
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "apib/apib_time.h"
+
+static const int kIterations = 10000000;
+
+// Keep the compiler from optimizing the clock reads away
+static volatile int64_t sink;
+
+template <typename F>
+static double nanosPerCall(F f) {
+  const int64_t start = apib::GetTime();
+  for (int i = 0; i < kIterations; i++) {
+    sink = f();
+  }
+  return (double)(apib::GetTime() - start) / kIterations;
+}
+
+static int64_t readSyscall() {
+  struct timespec tp;
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &tp);
+  return tp.tv_nsec;
+}
+
+static int64_t readRealtime() {
+  struct timespec tp;
+  clock_gettime(CLOCK_REALTIME, &tp);
+  return tp.tv_nsec;
+}
+
+static void printRow(const char* name, double perRead) {
+  // Twice per request without --loop-time, and once per pass with it,
+  // shared by all of the requests that completed in that pass
+  printf("%-28s %10.1f %10.1f %10.2f %10.2f\n", name, perRead, perRead * 2.0,
+         perRead / 10.0, perRead / 100.0);
+}
+
+int main(int argc, char** argv) {
+  printf("Nanoseconds per clock read and per request\n\n");
+  printf("%-28s %10s %10s %10s %10s\n", "", "read", "request",
+         "loop/10", "loop/100");
+
+  printRow("clock_gettime system call", nanosPerCall(readSyscall));
+  printRow("CLOCK_REALTIME (vDSO)", nanosPerCall(readRealtime));
+  printRow("GetTime (CLOCK_MONOTONIC)", nanosPerCall(apib::GetTime));
+
+  const auto s = apib::EnableTsc();
+  if (s.ok()) {
+    printRow("GetTicks (TSC)", nanosPerCall(apib::GetTicks));
+  } else {
+    printf("%-28s %s\n", "GetTicks (TSC)", s.str().c_str());
+  }
+
+  printf(
+      "\n\"request\" is the cost of timing each request by reading the clock\n"
+      "before and after it. \"loop/N\" is the cost per request with\n"
+      "--loop-time when N requests complete in each pass through the loop.\n");
+  return 0;
+}
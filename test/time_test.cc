@@ -0,0 +1,62 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_time.h"
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(Time, Monotonic) {
+  int64_t last = apib::GetTime();
+  for (int i = 0; i < 1000; i++) {
+    const int64_t now = apib::GetTime();
+    EXPECT_LE(last, now);
+    last = now;
+  }
+  // The wall clock is somewhere after 2020
+  EXPECT_LT(1577836800LL * 1000000000LL, apib::GetWallTime());
+}
+
+TEST(Time, Ticks) {
+  // Before EnableTsc, ticks are nanoseconds
+  EXPECT_FALSE(apib::TscEnabled());
+  EXPECT_EQ(12345, apib::TicksToNanos(12345));
+  EXPECT_EQ(0, apib::TicksToNanos(-1));
+
+  const auto s = apib::EnableTsc();
+  if (!s.ok()) {
+    // Not every machine has a usable TSC. Nothing should have changed.
+    EXPECT_FALSE(apib::TscEnabled());
+    EXPECT_EQ(12345, apib::TicksToNanos(12345));
+    return;
+  }
+  EXPECT_TRUE(apib::TscEnabled());
+  EXPECT_LT(1.0e8, apib::TickFrequency());
+  EXPECT_EQ(0, apib::TicksToNanos(-1));
+
+  // Ticks across a sleep agree with the monotonic clock
+  const int64_t startTime = apib::GetTime();
+  const int64_t startTicks = apib::GetTicks();
+  usleep(20000);
+  const int64_t ticks = apib::GetTicks() - startTicks;
+  const int64_t elapsed = apib::GetTime() - startTime;
+  EXPECT_NEAR(elapsed, apib::TicksToNanos(ticks), elapsed / 100);
+}
+
+}  // namespace
@@ -17,6 +17,9 @@ limitations under the License.
 #include <assert.h>
 #include <openssl/ssl.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "apib/apib_iothread.h"
 #include "apib/apib_reporting.h"
 #include "apib/apib_url.h"
@@ -115,6 +118,98 @@ TEST_F(TLSTest, NoKeepAlive) {
   compareReporting();
 }
 
+TEST_F(TLSTest, TraceHandshake) {
+  char url[128];
+  sprintf(url, "https://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->httpVerb = "GET";
+  t->sslCtx = setUpTLS();
+  t->keepRunning = -1;
+  t->traceEvents = 64;
+
+  RecordStart(true, threads);
+  t->Start();
+  t->Join();
+  RecordStop(threads);
+
+  std::vector<apib::TraceEvent> events;
+  t->traceSnapshot(&events);
+  std::vector<apib::TraceType> types;
+  for (auto it = events.cbegin(); it != events.cend(); it++) {
+    types.push_back(it->type);
+  }
+  // The handshake finishes during the write or the first read
+  ASSERT_EQ(7, types.size());
+  EXPECT_EQ(apib::TRACE_CONNECT, types[0]);
+  EXPECT_EQ(apib::TRACE_WRITE_START, types[1]);
+  EXPECT_EQ(1, std::count(types.begin(), types.end(), apib::TRACE_HANDSHAKE));
+  types.erase(std::remove(types.begin(), types.end(), apib::TRACE_HANDSHAKE),
+              types.end());
+  const std::vector<apib::TraceType> expected = {
+      apib::TRACE_CONNECT,    apib::TRACE_WRITE_START, apib::TRACE_WRITE_END,
+      apib::TRACE_FIRST_BYTE, apib::TRACE_COMPLETE,    apib::TRACE_CLOSE};
+  EXPECT_EQ(expected, types);
+}
+
+TEST_F(TLSTest, Resume) {
+  char url[128];
+  sprintf(url, "https://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->noKeepAlive = 1;
+  t->tlsResume = true;
+  t->httpVerb = "GET";
+  t->sslCtx = setUpTLS();
+
+  RecordStart(true, threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(threads);
+
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  // Every connection but the first should resume
+  EXPECT_LT(0, results.featureCounts[apib::TLS_RESUMED]);
+  EXPECT_EQ(0, results.featureCounts[apib::TLS_EARLY_DATA_ACCEPTED]);
+}
+
+TEST_F(TLSTest, EarlyData) {
+  char url[128];
+  sprintf(url, "https://127.0.0.1:%i/hello", testServerPort);
+  URLInfo::InitOne(url);
+
+  IOThread* t = new IOThread();
+  threads.push_back(std::unique_ptr<IOThread>(t));
+  t->numConnections = 1;
+  t->noKeepAlive = 1;
+  t->tlsResume = true;
+  t->tlsEarlyData = true;
+  t->httpVerb = "GET";
+  t->sslCtx = setUpTLS();
+
+  RecordStart(true, threads);
+  t->Start();
+  sleep(1);
+  t->Stop();
+  RecordStop(threads);
+
+  compareReporting();
+  BenchmarkResults results = ReportResults();
+  EXPECT_LT(0, results.featureCounts[apib::TLS_RESUMED]);
+#ifndef OPENSSL_IS_BORINGSSL
+  // Only the OpenSSL version of the test server accepts early data
+  EXPECT_LT(0, results.featureCounts[apib::TLS_EARLY_DATA_ACCEPTED]);
+#endif
+}
+
 TEST_F(TLSTest, Larger) {
   char url[128];
   sprintf(url, "https://127.0.0.1:%i/data?size=8000", testServerPort);
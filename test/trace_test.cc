@@ -0,0 +1,153 @@
+/*
+Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apib/apib_trace.h"
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "apib/apib_json.h"
+#include "gtest/gtest.h"
+
+using apib::JsonValue;
+using apib::TraceBuffer;
+using apib::TraceEvent;
+
+namespace {
+
+TEST(TraceBuffer, Empty) {
+  TraceBuffer b(10);
+  EXPECT_EQ(16, b.size());
+  std::vector<TraceEvent> events;
+  b.snapshot(&events);
+  EXPECT_TRUE(events.empty());
+}
+
+TEST(TraceBuffer, Record) {
+  TraceBuffer b(8);
+  b.record(100, apib::TRACE_CONNECT, 3);
+  b.record(200, apib::TRACE_CLOSE, 1000000);
+  std::vector<TraceEvent> events;
+  b.snapshot(&events);
+  ASSERT_EQ(2, events.size());
+  EXPECT_EQ(100, events[0].ticks);
+  EXPECT_EQ(apib::TRACE_CONNECT, events[0].type);
+  EXPECT_EQ(3, events[0].connection);
+  EXPECT_EQ(200, events[1].ticks);
+  EXPECT_EQ(apib::TRACE_CLOSE, events[1].type);
+  EXPECT_EQ(1000000, events[1].connection);
+}
+
+TEST(TraceBuffer, Wrap) {
+  TraceBuffer b(8);
+  for (int i = 0; i < 21; i++) {
+    b.record(i, apib::TRACE_WRITE_START, i);
+  }
+  std::vector<TraceEvent> events;
+  b.snapshot(&events);
+  ASSERT_EQ(7, events.size());
+  for (int i = 0; i < 7; i++) {
+    EXPECT_EQ(14 + i, events[i].ticks);
+    EXPECT_EQ(14 + i, events[i].connection);
+  }
+}
+
+// Whatever a snapshot gets while the ring is being written must be a run
+// of consecutive events. A small ring makes the writer lap it often.
+TEST(TraceBuffer, Concurrent) {
+  TraceBuffer b(4);
+  std::thread writer([&b]() {
+    for (int i = 0; i < 1000000; i++) {
+      b.record(i, apib::TRACE_WRITE_START, i);
+    }
+  });
+  // Don't return before the writer is joined
+  bool ok = true;
+  std::vector<TraceEvent> events;
+  for (int n = 0; ok && (n < 1000); n++) {
+    b.snapshot(&events);
+    EXPECT_GE(4, events.size());
+    ok = (events.size() <= 4);
+    for (size_t i = 0; ok && (i < events.size()); i++) {
+      EXPECT_EQ(events[i].ticks, events[i].connection);
+      ok = (events[i].ticks == events[i].connection);
+      if (ok && (i > 0)) {
+        EXPECT_EQ(events[i - 1].ticks + 1, events[i].ticks);
+        ok = (events[i - 1].ticks + 1 == events[i].ticks);
+      }
+    }
+  }
+  writer.join();
+}
+
+static TraceEvent makeEvent(int64_t ticks, apib::TraceType type, int conn) {
+  TraceEvent e;
+  e.ticks = ticks;
+  e.type = type;
+  e.connection = conn;
+  return e;
+}
+
+TEST(ChromeTrace, Slices) {
+  std::vector<std::vector<TraceEvent>> threads(2);
+  // The start of this request fell off the ring
+  threads[0].push_back(makeEvent(1000000, apib::TRACE_COMPLETE, 0));
+  threads[0].push_back(makeEvent(2000000, apib::TRACE_WRITE_START, 0));
+  threads[0].push_back(makeEvent(3000000, apib::TRACE_WRITE_END, 0));
+  threads[0].push_back(makeEvent(5000000, apib::TRACE_FIRST_BYTE, 0));
+  threads[0].push_back(makeEvent(6000000, apib::TRACE_COMPLETE, 0));
+  threads[1].push_back(makeEvent(500000, apib::TRACE_CONNECT, 7));
+  threads[1].push_back(makeEvent(2500000, apib::TRACE_WRITE_START, 7));
+  threads[1].push_back(makeEvent(2600000, apib::TRACE_ERROR, 7));
+  threads[1].push_back(makeEvent(2700000, apib::TRACE_CLOSE, 7));
+
+  std::ostringstream out;
+  apib::WriteChromeTrace(out, threads);
+  const auto parsed = JsonValue::Parse(out.str());
+  ASSERT_TRUE(parsed.ok());
+  const JsonValue* events = parsed.valueref().get("traceEvents");
+  ASSERT_NE(nullptr, events);
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < events->size(); i++) {
+    const JsonValue& e = events->at(i);
+    const std::string name = e.getString("name", "");
+    names.push_back(name);
+    if (name == "request") {
+      EXPECT_EQ("X", e.getString("ph", ""));
+      EXPECT_EQ(0, e.getNumber("pid", -1));
+      EXPECT_EQ(0, e.getNumber("tid", -1));
+      EXPECT_DOUBLE_EQ(1500.0, e.getNumber("ts", -1));
+      EXPECT_DOUBLE_EQ(4000.0, e.getNumber("dur", -1));
+    } else if (name == "wait") {
+      EXPECT_DOUBLE_EQ(2500.0, e.getNumber("ts", -1));
+      EXPECT_DOUBLE_EQ(2000.0, e.getNumber("dur", -1));
+    } else if (name == "connect") {
+      EXPECT_EQ("i", e.getString("ph", ""));
+      EXPECT_EQ(1, e.getNumber("pid", -1));
+      EXPECT_EQ(7, e.getNumber("tid", -1));
+      EXPECT_DOUBLE_EQ(0.0, e.getNumber("ts", -1));
+    }
+  }
+  const std::vector<std::string> expected = {
+      "process_name", "thread_name",    "write", "wait",  "read",
+      "request",      "process_name",   "thread_name",    "connect",
+      "error",        "failed request", "close"};
+  EXPECT_EQ(expected, names);
+}
+
+}  // namespace
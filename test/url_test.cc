@@ -168,6 +168,35 @@ TEST(URL, ParseLocalhost) {
   URLInfo::Reset();
 }
 
+TEST(URL, ParseUnix) {
+  ASSERT_TRUE(URLInfo::InitOne("unix:///tmp/apib.sock:/foo?bar=baz").ok());
+  const URLInfo* u = URLInfo::GetNext(nullptr);
+  ASSERT_NE(nullptr, u);
+  EXPECT_FALSE(u->isSsl());
+  EXPECT_EQ("/tmp/apib.sock", u->hostName());
+  EXPECT_EQ("localhost", u->hostHeader());
+  EXPECT_EQ("/foo?bar=baz", u->path());
+  EXPECT_EQ("/foo", u->pathOnly());
+  EXPECT_EQ("bar=baz", u->query());
+  EXPECT_EQ(1, u->addressCount());
+  EXPECT_TRUE(u->address(0).isUnix());
+  EXPECT_EQ("/tmp/apib.sock", u->address(0).str());
+  EXPECT_EQ("unix:///tmp/apib.sock:/foo?bar=baz", u->str());
+  URLInfo::Reset();
+
+  ASSERT_TRUE(URLInfo::InitOne("unix://@apib").ok());
+  u = URLInfo::GetNext(nullptr);
+  EXPECT_EQ("/", u->path());
+  EXPECT_EQ("@apib", u->address(0).str());
+  URLInfo::Reset();
+}
+
+TEST(URL, ParseUnixBad) {
+  EXPECT_FALSE(URLInfo::InitOne("unix://").ok());
+  EXPECT_FALSE(URLInfo::InitOne("unix:///tmp/apib.sock:foo").ok());
+  URLInfo::Reset();
+}
+
 TEST(URL, ParseFile) {
   apib::RandomGenerator rand;
   if (!URLInfo::InitFile("test/data/urls.txt").ok()) {
@@ -18,6 +18,7 @@ limitations under the License.
 #include "gtest/gtest.h"
 
 using apib::eqcase;
+using apib::parseCpuList;
 
 namespace {
 
@@ -34,4 +35,27 @@ TEST(Eqcase, Failure) {
   EXPECT_EQ(false, eqcase(" ", ""));
 }
 
+TEST(CpuList, Valid) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(parseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_TRUE(parseCpuList("3", &cpus));
+  EXPECT_EQ(std::vector<int>({3}), cpus);
+  EXPECT_TRUE(parseCpuList("0-3,8,10-11\n", &cpus));
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+  EXPECT_TRUE(parseCpuList("4,0-2,1", &cpus));
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 4}), cpus);
+}
+
+TEST(CpuList, Invalid) {
+  std::vector<int> cpus;
+  EXPECT_FALSE(parseCpuList("x", &cpus));
+  EXPECT_FALSE(parseCpuList("1,", &cpus));
+  EXPECT_FALSE(parseCpuList("3-1", &cpus));
+  EXPECT_FALSE(parseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(parseCpuList("-1", &cpus));
+  EXPECT_FALSE(parseCpuList("100000", &cpus));
+  EXPECT_FALSE(parseCpuList("0-2000000000", &cpus));
+}
+
 }  // namespace